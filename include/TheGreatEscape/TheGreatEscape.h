@@ -42,6 +42,8 @@ extern "C"
 #endif
 
 
+#include <stddef.h>
+
 #include "ZXSpectrum/Spectrum.h"
 
 
@@ -52,8 +54,22 @@ extern "C"
  */
 typedef struct tgestate tgestate_t;
 
+/**
+ * Status returned by tge_main() describing what the slice it ran was doing.
+ */
+typedef enum tgestatus
+{
+  tgestatus_FRAME_DONE,  /**< An iteration of the main loop completed. */
+  tgestatus_WAITING,     /**< The game is waiting for the user to press a key. */
+  tgestatus_TRANSITION   /**< A zoombox transition is in progress. */
+}
+tgestatus_t;
+
 /**
  * Create a game instance.
+ *
+ * All game state lives in the instance so separate instances, each driving
+ * its own zxspectrum_t, may run concurrently from separate threads.
  */
 TGE_API tgestate_t *tge_create(zxspectrum_t *speccy);
 
@@ -62,6 +78,25 @@ TGE_API tgestate_t *tge_create(zxspectrum_t *speccy);
  */
 TGE_API void tge_destroy(tgestate_t *state);
 
+/**
+ * Copy the complete state of game instance 'src' into 'dst'.
+ *
+ * Internal pointers are relocated to refer to 'dst' and its buffers. 'dst'
+ * keeps its own virtual ZX Spectrum but the screen contents are copied into
+ * it then redrawn. 'dst' keeps its rewind settings but its history is
+ * discarded.
+ *
+ * \return 0 on success, non-zero if the instances are incompatible.
+ */
+TGE_API int tge_clone(tgestate_t *dst, const tgestate_t *src);
+
+/**
+ * Create a new game instance driving 'speccy' which is a copy of 'src'.
+ *
+ * \return New game instance, or NULL on failure.
+ */
+TGE_API tgestate_t *tge_fork(const tgestate_t *src, zxspectrum_t *speccy);
+
 /**
  * Prepare the game screen.
  */
@@ -84,9 +119,179 @@ TGE_API void tge_setup2(tgestate_t *state);
 /**
  * Invoke the game instance.
  *
- * Call this repeatedly.
+ * Call this repeatedly. Each call runs one slice of the game - a single main
+ * loop iteration, a single step of a zoombox or a single poll of the keyboard
+ * while waiting for input - then returns. Each call invokes the sleep callback
+ * exactly once. No call blocks waiting for user input.
+ *
+ * \return Status indicating what the slice was doing.
+ */
+TGE_API tgestatus_t tge_main(tgestate_t *state);
+
+/**
+ * Return the number of Z80 T-states the game instance has slept for.
+ *
+ * Each main loop iteration sleeps for an estimate of how long the original
+ * game would have taken to run it, so this measures the work the game has
+ * done independently of the speed of the host.
+ */
+TGE_API uint64_t tge_tstates(const tgestate_t *state);
+
+/**
+ * Save the game state to 'filename' as a binary snapshot.
+ *
+ * Snapshots are fast to save and load but are specific to the build which
+ * wrote them: a snapshot will only load into a build with the same structure
+ * layout and byte order. Use the text format to move games between builds.
+ *
+ * \return 0 on success, non-zero on error.
  */
-TGE_API void tge_main(tgestate_t *state);
+TGE_API int tge_snapshot_save(tgestate_t *state, const char *filename);
+
+/**
+ * Load the game state from the binary snapshot 'filename'.
+ *
+ * The snapshot is validated before the state is modified. If it is rejected
+ * the state is left untouched.
+ *
+ * \return 0 on success, non-zero on error.
+ */
+TGE_API int tge_snapshot_load(tgestate_t *state, const char *filename);
+
+/**
+ * Test whether 'filename' is a binary snapshot.
+ *
+ * \return Non-zero if it is.
+ */
+TGE_API int tge_snapshot_detect(const char *filename);
+
+/**
+ * Hash the complete game state.
+ *
+ * The hash covers everything a snapshot would save, with pointers reduced to
+ * indices, so instances which are in the same state hash the same.
+ *
+ * \return Hash, or zero if out of memory.
+ */
+TGE_API uint32_t tge_hash(const tgestate_t *state);
+
+/**
+ * Statistics describing a game instance's rewind history.
+ */
+typedef struct tgerewindstats
+{
+  int    frames;       /**< Number of frames held. */
+  int    keyframes;    /**< Number of those which are keyframes. */
+  size_t bytes;        /**< Memory used by the history, in bytes. */
+  size_t uncompressed; /**< Memory the frames would need uncompressed. */
+}
+tgerewindstats_t;
+
+/**
+ * Enable the rewind history, keeping up to 'frames' frames of it.
+ *
+ * Once enabled, each call to tge_main() records a frame. Any existing
+ * history is discarded. Pass zero frames to disable the history and release
+ * its memory.
+ *
+ * \return 0 on success, non-zero if out of memory.
+ */
+TGE_API int tge_rewind_enable(tgestate_t *state, int frames);
+
+/**
+ * Rewind the game by 'frames' calls to tge_main().
+ *
+ * The frames rewound over are discarded from the history.
+ *
+ * \return Number of frames actually rewound. This is limited by the length
+ * of the history.
+ */
+TGE_API int tge_rewind(tgestate_t *state, int frames);
+
+/**
+ * Report on the rewind history.
+ */
+TGE_API void tge_rewind_stats(const tgestate_t *state,
+                              tgerewindstats_t *stats);
+
+#ifdef TGE_PROFILE
+
+/**
+ * Number of buckets in a profile histogram. Bucket 'n' counts durations of
+ * [2^n, 2^(n+1)) nanoseconds, except bucket zero which also counts zero.
+ */
+#define TGE_PROFILE_BUCKETS (32)
+
+/**
+ * Timings of one phase of the game's main loop.
+ */
+typedef struct tgeprofilephase
+{
+  const char *name;      /**< Name of the phase. */
+  uint64_t    count;     /**< Number of times the phase was run. */
+  uint64_t    total_ns;  /**< Total time spent in the phase. */
+  uint64_t    min_ns;    /**< Shortest run. */
+  uint64_t    max_ns;    /**< Longest run. */
+  uint32_t    histogram[TGE_PROFILE_BUCKETS]; /**< Log2 histogram of runs. */
+}
+tgeprofilephase_t;
+
+/**
+ * Return the number of phases timed by the profiler.
+ */
+TGE_API int tge_profile_phases(void);
+
+/**
+ * Fetch the timings of phase 'index'.
+ *
+ * \return 0 on success, non-zero if 'index' is out of range.
+ */
+TGE_API int tge_profile_get(const tgestate_t *state,
+                            int               index,
+                            tgeprofilephase_t *phase);
+
+/**
+ * Discard all timings.
+ */
+TGE_API void tge_profile_reset(tgestate_t *state);
+
+/**
+ * Write all timings to 'filename' as JSON.
+ *
+ * \return 0 on success, non-zero on error.
+ */
+TGE_API int tge_profile_dump_json(const tgestate_t *state,
+                                  const char       *filename);
+
+#endif /* TGE_PROFILE */
+
+#ifdef TGE_MAP_CACHE
+
+/**
+ * Return the memory used by the exterior map cache, in bytes.
+ *
+ * The cache is rendered by the first call to tge_create() then shared,
+ * read-only, by every game instance in the process.
+ *
+ * \return Size of the cache, or zero if it hasn't been created.
+ */
+TGE_API size_t tge_mapcache_size(void);
+
+#endif /* TGE_MAP_CACHE */
+
+#ifdef TGE_SPRITE_CACHE
+
+/**
+ * Return the memory used by the sprite cache, in bytes.
+ *
+ * The cache is built by the first call to tge_create() then shared,
+ * read-only, by every game instance in the process.
+ *
+ * \return Size of the cache, or zero if it hasn't been created.
+ */
+TGE_API size_t tge_spritecache_size(void);
+
+#endif /* TGE_SPRITE_CACHE */
 
 #ifdef TGE_SAVES
 
@@ -110,6 +315,19 @@ TGE_API int tge_load(tgestate_t *state,
  */
 TGE_API void tge_disposeoferror(char *error);
 
+/**
+ * Convert the saved game 'input' between the text and binary snapshot
+ * formats, writing the result to 'output'. The direction is determined by the
+ * format of 'input'.
+ *
+ * 'error' is populated as for tge_load().
+ *
+ * \return 0 on success, non-zero on error.
+ */
+TGE_API int tge_convert_save(const char *input,
+                             const char *output,
+                             char      **error);
+
 #endif /* TGE_SAVES */
 
 #ifdef __cplusplus
@@ -0,0 +1,104 @@
+/* Beeper.h
+ *
+ * ZX Spectrum beeper synthesis.
+ *
+ * Copyright (c) David Thomas, 2020. <dave@davespace.co.uk>
+ */
+
+#ifndef ZXSPECTRUM_BEEPER_H
+#define ZXSPECTRUM_BEEPER_H
+
+#include "C99/Types.h"
+
+#include "ZXSpectrum/Spectrum.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Rate of the Spectrum's clock, in T-states per second.
+ */
+#define ZXBEEPER_TSTATES_PER_SEC (3500000)
+
+/**
+ * A beeper synthesiser: turns speaker events into band-limited 16-bit mono
+ * PCM at any sample rate.
+ *
+ * Each edge is rendered as a band-limited step, so the output is free of the
+ * aliasing which makes a naively sampled square wave sound clicky. A high
+ * pass filter then removes the speaker's DC offset.
+ *
+ * A front end passes the events it receives through its speaker_batch
+ * callback to zxbeeper_add() then, in its sleep callback, calls
+ * zxbeeper_render() to produce the samples for the period slept. Both are
+ * called on the game thread so need no locking.
+ *
+ * The output depends only on the events and durations given, and not on the
+ * CPU or build, so it may be compared between runs.
+ */
+typedef struct zxbeeper zxbeeper_t;
+
+/**
+ * Create a beeper synthesiser.
+ *
+ * \param[in] sample_rate Output sample rate, in Hz (8000..192000).
+ *
+ * \return New beeper, or NULL on failure.
+ */
+zxbeeper_t *zxbeeper_create(int sample_rate);
+
+/**
+ * Destroy a beeper synthesiser.
+ *
+ * \param[in] doomed Doomed beeper.
+ */
+void zxbeeper_destroy(zxbeeper_t *doomed);
+
+/**
+ * Add a block of speaker events.
+ *
+ * Events are timed relative to the end of the last period rendered. Those
+ * which are late are sounded immediately. Events may be added up to a second
+ * ahead of time, as happens when a sound outlasts the frame which made it.
+ * Events further ahead than that are taken to mean that the game's clock was
+ * reset so the beeper resynchronises with them.
+ *
+ * \param[in] beeper  Beeper.
+ * \param[in] events  Speaker events.
+ * \param[in] nevents Number of events.
+ */
+void zxbeeper_add(zxbeeper_t             *beeper,
+                  const zxspeakerevent_t *events,
+                  int                     nevents);
+
+/**
+ * Return the most samples which zxbeeper_render() can produce for a period
+ * of 'duration' T-states.
+ *
+ * \param[in] beeper   Beeper.
+ * \param[in] duration Period, in T-states.
+ *
+ * \return Number of samples.
+ */
+int zxbeeper_max_samples(const zxbeeper_t *beeper, int duration);
+
+/**
+ * Render the samples for the next 'duration' T-states.
+ *
+ * \param[in]  beeper   Beeper.
+ * \param[in]  duration Period, in T-states.
+ * \param[out] samples  Buffer for at least zxbeeper_max_samples() samples.
+ *
+ * \return Number of samples written.
+ */
+int zxbeeper_render(zxbeeper_t *beeper, int duration, int16_t *samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZXSPECTRUM_BEEPER_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,107 @@
+/* InputLog.h
+ *
+ * Recording and replay of ZX Spectrum input.
+ *
+ * Copyright (c) David Thomas, 2020. <dave@davespace.co.uk>
+ */
+
+#ifndef ZXSPECTRUM_INPUTLOG_H
+#define ZXSPECTRUM_INPUTLOG_H
+
+#include "C99/Types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * An input log: a per-frame record of the values read from the input ports,
+ * interleaved with periodic hashes of the machine state.
+ *
+ * A front end routes its key handler through zxinputlog_key() and calls
+ * zxinputlog_end_frame() after every slice of the game (each call to
+ * tge_menu() or tge_main(), say). When recording, the first value read from
+ * a port in a frame is latched and returned for every later read of that
+ * port in the same frame, so the log holds exactly what the game saw. When
+ * replaying, the live values are ignored and the logged ones returned.
+ */
+typedef struct zxinputlog zxinputlog_t;
+
+/**
+ * Result of zxinputlog_end_frame() and zxinputlog_close().
+ */
+typedef enum zxinputlogresult
+{
+  zxinputlog_OK,     /**< Carry on. */
+  zxinputlog_END,    /**< Replay has used up all of the logged frames. */
+  zxinputlog_DESYNC, /**< Replay has diverged from the recording. */
+  zxinputlog_ERROR   /**< File I/O failed or the log is malformed. */
+}
+zxinputlogresult_t;
+
+/**
+ * A callback which hashes the state of the game.
+ */
+typedef uint32_t (zxinputlog_hasher_t)(void *opaque);
+
+/**
+ * Start recording to 'filename', hashing the state every 'hash_interval'
+ * frames. Zero disables hashing.
+ *
+ * \return New input log, or NULL on failure.
+ */
+zxinputlog_t *zxinputlog_record(const char *filename, int hash_interval);
+
+/**
+ * Start replaying 'filename'.
+ *
+ * \return New input log, or NULL on failure.
+ */
+zxinputlog_t *zxinputlog_replay(const char *filename);
+
+/**
+ * Filter a read of an input port.
+ *
+ * \param[in] log   Input log.
+ * \param[in] port  Port number.
+ * \param[in] value Live value of the port. Ignored when replaying.
+ *
+ * \return Value to give to the game.
+ */
+int zxinputlog_key(zxinputlog_t *log, uint16_t port, int value);
+
+/**
+ * End the current frame.
+ *
+ * \param[in] log    Input log.
+ * \param[in] hasher Callback to hash the game state, called only when a
+ *                   hash is due. May be NULL.
+ * \param[in] opaque Argument passed to 'hasher'.
+ *
+ * \return zxinputlog_OK to carry on, or a reason to stop.
+ */
+zxinputlogresult_t zxinputlog_end_frame(zxinputlog_t        *log,
+                                        zxinputlog_hasher_t *hasher,
+                                        void                *opaque);
+
+/**
+ * Return the number of frames recorded or replayed so far.
+ */
+unsigned long zxinputlog_frames(const zxinputlog_t *log);
+
+/**
+ * Finish recording or replaying and destroy the log.
+ *
+ * \return zxinputlog_ERROR if the recording couldn't be completed,
+ * zxinputlog_OK otherwise.
+ */
+zxinputlogresult_t zxinputlog_close(zxinputlog_t *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZXSPECTRUM_INPUTLOG_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -16,21 +16,136 @@ extern "C"
 #endif
 
 /**
- * Convert the given ZX Spectrum format screen into 0x00BBGGRR pixel format
- * (or 0x00RRGGBB on Windows).
+ * Implementations of the inner loop of zxscreen_converter_convert().
  *
- * \param[in] screen ZX Spectrum screen data.
- * \param[in] output Output screen pixels.
- * \param[in] dirty  Dirty rectangle in cartesian space - (0,0) is bottom left.
+ * All of them produce identical output. The scalar kernel is the reference.
  */
-void zxscreen_convert(const void    *screen,
-                      unsigned int  *output,
-                      const zxbox_t *dirty);
+typedef enum zxscreen_kernel
+{
+  zxscreen_kernel_AUTO,   /**< Choose the fastest one the CPU supports. */
+  zxscreen_kernel_SCALAR, /**< Portable C. */
+  zxscreen_kernel_SSE2,   /**< x86-64 SSE2. */
+  zxscreen_kernel_AVX2,   /**< x86-64 AVX2. */
+  zxscreen_kernel_NEON    /**< AArch64 NEON. */
+}
+zxscreen_kernel_t;
+
+/**
+ * Select the kernel used by zxscreen_converter_convert().
+ *
+ * By default the kernel is chosen automatically on first use. This is
+ * intended for testing and benchmarking. It may be called from any thread:
+ * conversions already in progress finish with the kernel they started with.
+ *
+ * \param[in] kernel Kernel to use.
+ *
+ * \return 0 on success, non-zero if the kernel isn't supported by this build
+ * or CPU.
+ */
+int zxscreen_set_kernel(zxscreen_kernel_t kernel);
+
+/**
+ * Return the kernel used by zxscreen_converter_convert().
+ */
+zxscreen_kernel_t zxscreen_get_kernel(void);
+
+/**
+ * Copy screen pixels held in this build's layout into the Spectrum's
+ * interleaved layout.
+ *
+ * This is a plain copy unless ZXSCREEN_LINEAR is defined.
+ *
+ * \param[in]  pixels      SCREEN_BITMAP_LENGTH bytes of zxscreen_t pixels.
+ * \param[out] interleaved SCREEN_BITMAP_LENGTH bytes of interleaved pixels.
+ */
+void zxscreen_to_interleaved(const uint8_t *pixels, uint8_t *interleaved);
+
+/**
+ * Copy screen pixels held in the Spectrum's interleaved layout into this
+ * build's layout.
+ *
+ * \param[in]  interleaved SCREEN_BITMAP_LENGTH bytes of interleaved pixels.
+ * \param[out] pixels      SCREEN_BITMAP_LENGTH bytes of zxscreen_t pixels.
+ */
+void zxscreen_from_interleaved(const uint8_t *interleaved, uint8_t *pixels);
+
+/**
+ * A screen converter for a given output format and palette.
+ */
+typedef struct zxscreen_converter zxscreen_converter_t;
 
-// 4bpp variant
-void zxscreen_convert16(const void    *vscr,
-                        unsigned int  *poutput,
-                        const zxbox_t *dirty);
+/**
+ * Return the Spectrum's own colours as 16 0x00RRGGBB words, indexed as for
+ * the indexed formats.
+ */
+const uint32_t *zxscreen_get_default_palette(void);
+
+/**
+ * Return the minimum stride, in bytes, of a screen converted to 'format'.
+ */
+int zxscreen_format_stride(zxscreen_format_t format);
+
+/**
+ * Create a converter for the given format.
+ *
+ * \param[in] format  Output pixel format.
+ * \param[in] palette 16 0xAARRGGBB colours, or NULL for the default palette.
+ *                    Copied. Ignored by the indexed formats.
+ *
+ * \return New converter, or NULL if out of memory or 'format' is unknown.
+ */
+zxscreen_converter_t *zxscreen_converter_create(zxscreen_format_t format,
+                                                const uint32_t   *palette);
+
+/**
+ * Destroy a converter.
+ *
+ * \param[in] doomed Doomed converter.
+ */
+void zxscreen_converter_destroy(zxscreen_converter_t *doomed);
+
+/**
+ * Convert the given ZX Spectrum format screen into the converter's format.
+ *
+ * This works in 32-pixel chunks so may convert pixels either side of the
+ * dirty rectangle.
+ *
+ * \param[in] converter Converter.
+ * \param[in] screen    ZX Spectrum screen data.
+ * \param[in] output    Output screen pixels.
+ * \param[in] stride    Bytes from one output row to the next. A multiple of
+ *                      four.
+ * \param[in] dirty     Dirty rectangle in cartesian space - (0,0) is bottom
+ *                      left.
+ */
+void zxscreen_converter_convert(const zxscreen_converter_t *converter,
+                                const void                 *screen,
+                                void                       *output,
+                                int                         stride,
+                                const zxbox_t              *dirty);
+
+/**
+ * Recolour a cell of a screen converted by zxscreen_converter_convert() from
+ * one attribute to another without reference to its pixels.
+ *
+ * \param[in] converter Converter.
+ * \param[in] output    Output screen pixels.
+ * \param[in] stride    Bytes from one output row to the next.
+ * \param[in] column    Cell column (0..31).
+ * \param[in] row       Cell row (0..23), from the top.
+ * \param[in] from      Attribute the cell was converted with.
+ * \param[in] to        Attribute to recolour the cell to.
+ *
+ * \return 0 on success, non-zero if the cell can't be recoloured (because
+ * its ink and paper were the same colour) and must be converted instead.
+ */
+int zxscreen_converter_recolour(const zxscreen_converter_t *converter,
+                                void                       *output,
+                                int                         stride,
+                                int                         column,
+                                int                         row,
+                                int                         from,
+                                int                         to);
 
 #ifdef __cplusplus
 }
@@ -89,6 +89,55 @@ enum
 #define SCREEN_ATTRIBUTES_START_ADDRESS ((uint16_t) 0x5800)
 #define SCREEN_ATTRIBUTES_END_ADDRESS   ((uint16_t) 0x5AFF)
 
+/* Screen pixel layout
+ *
+ * The Spectrum interleaves its screen: an offset into the pixels is laid out
+ * as 0b000BBLLLRRRCCCCC where BB is the third of the screen, RRR the
+ * character row within that third, LLL the scanline within the character row
+ * and CCCCC the byte column. zxscreen_t holds its pixels in that layout
+ * unless ZXSCREEN_LINEAR is defined, in which case they're held linearly:
+ * 32 bytes per scanline, top to bottom.
+ *
+ * In the macros below 'x' is a byte column (0..31) and 'y' a scanline
+ * (0..191) counting down from the top.
+ */
+
+/** Offset of (x,y) in the Spectrum's interleaved layout. */
+#define ZXSCREEN_INTERLEAVED_OFFSET(x, y) \
+  ((((y) & 0xC0) << 5) | (((y) & 0x07) << 8) | (((y) & 0x38) << 2) | (x))
+
+/** Scanline of an offset in the Spectrum's interleaved layout. */
+#define ZXSCREEN_INTERLEAVED_Y(offset) \
+  ((((offset) & 0x1800) >> 5) | (((offset) & 0x0700) >> 8) | (((offset) & 0x00E0) >> 2))
+
+#ifdef ZXSCREEN_LINEAR
+/** Offset of (x,y) in zxscreen_t pixels. */
+#define ZXSCREEN_OFFSET(x, y)             ((y) * (SCREEN_WIDTH / 8) + (x))
+/** Scanline of an offset into zxscreen_t pixels. */
+#define ZXSCREEN_Y(offset)                ((offset) / (SCREEN_WIDTH / 8))
+/** Distance between successive scanlines of a character row. */
+#define ZXSCREEN_SCANLINE_STRIDE          (SCREEN_WIDTH / 8)
+/** Convert an interleaved offset into an offset into zxscreen_t pixels. */
+#define ZXSCREEN_FROM_INTERLEAVED(offset) \
+  ZXSCREEN_OFFSET(ZXSCREEN_X(offset), ZXSCREEN_INTERLEAVED_Y(offset))
+/** Convert an offset into zxscreen_t pixels into an interleaved offset. */
+#define ZXSCREEN_TO_INTERLEAVED(offset) \
+  ZXSCREEN_INTERLEAVED_OFFSET(ZXSCREEN_X(offset), ZXSCREEN_Y(offset))
+#else
+#define ZXSCREEN_OFFSET(x, y)             ZXSCREEN_INTERLEAVED_OFFSET(x, y)
+#define ZXSCREEN_Y(offset)                ZXSCREEN_INTERLEAVED_Y(offset)
+#define ZXSCREEN_SCANLINE_STRIDE          (256)
+#define ZXSCREEN_FROM_INTERLEAVED(offset) (offset)
+#define ZXSCREEN_TO_INTERLEAVED(offset)   (offset)
+#endif
+
+/** Byte column of an offset into zxscreen_t pixels in either layout. */
+#define ZXSCREEN_X(offset)                ((offset) & 0x1F)
+
+/** Offset of the attribute covering an offset into zxscreen_t pixels. */
+#define ZXSCREEN_ATTRIBUTE_OFFSET(offset) \
+  (ZXSCREEN_Y(offset) / 8 * (SCREEN_WIDTH / 8) + ZXSCREEN_X(offset))
+
 /**
  * The current state of the machine.
  */
@@ -103,6 +152,18 @@ typedef struct zxbox
 }
 zxbox_t;
 
+/**
+ * Map of the dirty areas of the screen.
+ *
+ * Each scanline has a row of 32 bits, one per 8-pixel column. Bit 0 is the
+ * leftmost column and row 0 is the top scanline.
+ */
+typedef struct zxdirtymap
+{
+  uint32_t rows[SCREEN_HEIGHT];
+}
+zxdirtymap_t;
+
 /**
  * Screen pixels and attributes.
  */
@@ -114,6 +175,36 @@ typedef struct zxscreen
 }
 zxscreen_t;
 
+/**
+ * Number of speaker events buffered before they're passed to the host.
+ */
+#define ZXSPEAKER_EVENTS                (1024)
+
+/**
+ * Backwards jumps in the speaker event times of more than this many
+ * T-states (one second) are taken to mean that the game's clock was reset,
+ * e.g. by loading a game, rather than that sounds overlap.
+ */
+#define ZXSPEAKER_REBASE                (3500000)
+
+/**
+ * Speaker events are turned into a bitstream for the speaker callback at
+ * one bit per this many T-states, holding a level for at most
+ * ZXSPEAKER_MAX_HOLD bits (about 150ms) so that silences don't flood it.
+ */
+#define ZXSPEAKER_TSTATES_PER_BIT       (16)
+#define ZXSPEAKER_MAX_HOLD              (32768)
+
+/**
+ * A change of the speaker's level.
+ */
+typedef struct zxspeakerevent
+{
+  uint32_t tstate; /* virtual T-state at which the level changed */
+  uint32_t level;  /* 0 or 1 */
+}
+zxspeakerevent_t;
+
 /**
  * The current state of the machine.
  *
@@ -139,6 +230,13 @@ struct zxspectrum
    */
   void (*draw)(zxspectrum_t *state, const zxbox_t *dirty);
 
+  /**
+   * The game calls this when only screen attributes have changed.
+   *
+   * \param[in] dirty Dirty region. Rounded out to whole attribute cells.
+   */
+  void (*draw_attrs)(zxspectrum_t *state, const zxbox_t *dirty);
+
   /**
    * The game calls this at the start of a timed segment.
    */
@@ -153,9 +251,60 @@ struct zxspectrum
    */
   int (*sleep)(zxspectrum_t *state, int duration);
 
+  /**
+   * Passes the buffered speaker events to the host. This happens
+   * automatically when the buffer fills and when the game sleeps.
+   */
+  void (*flush_speaker)(zxspectrum_t *state);
+
+  /**
+   * Speaker events buffered for the host. The game appends to these with
+   * ZXSPECTRUM_SPEAKER() rather than OUTing to the EAR port.
+   */
+  int              nspeakerevents;
+  uint32_t         speakertime; /* time of the most recent event */
+  zxspeakerevent_t speakerevents[ZXSPEAKER_EVENTS];
+
   zxscreen_t screen;
 };
 
+/**
+ * Set the speaker's level to LEVEL at virtual T-state TSTATE.
+ *
+ * Times should increase but may wrap around.
+ */
+#define ZXSPECTRUM_SPEAKER(SPECCY, TSTATE, LEVEL)                     \
+do {                                                                  \
+  zxspectrum_t     *zx_ = (SPECCY);                                   \
+  zxspeakerevent_t *ev_;                                              \
+                                                                      \
+  if (zx_->nspeakerevents == ZXSPEAKER_EVENTS)                        \
+    zx_->flush_speaker(zx_);                                          \
+  ev_ = &zx_->speakerevents[zx_->nspeakerevents++];                   \
+  ev_->tstate = zx_->speakertime = (TSTATE);                          \
+  ev_->level  = (LEVEL) != 0;                                         \
+} while (0)
+
+/**
+ * Pixel formats of the converted screen.
+ *
+ * The indexed formats hold BRIGHT * 8 + colour, where colour is the
+ * Spectrum's 0 (black) to 7 (white), for the host to look up in its own
+ * palette.
+ */
+typedef enum zxscreen_format
+{
+  zxscreen_format_NATIVE,   /**< The build's default: ABGR8888, or ARGB8888 on
+                                 Windows and SDL, or PACKED4 on RISC OS. */
+  zxscreen_format_ARGB8888, /**< 32-bit 0xAARRGGBB words. */
+  zxscreen_format_ABGR8888, /**< 32-bit 0xAABBGGRR words. */
+  zxscreen_format_RGB565,   /**< 16-bit 0bRRRRRGGGGGGBBBBB words. */
+  zxscreen_format_INDEXED8, /**< 8-bit indices. */
+  zxscreen_format_PACKED4   /**< 4-bit indices, two per byte, with the
+                                 leftmost pixel in the low nibble. */
+}
+zxscreen_format_t;
+
 /**
  * A configuration and handler specifier for app (host environment) code.
  */
@@ -182,14 +331,40 @@ typedef struct zxconfig
   /** App callback called to set the border colour. */
   void (*border)(int colour, void *opaque);
 
-  /** App callback called to sound the speaker. */
+  /** App callback called to sound the speaker. Called with a bit per
+   * ZXSPEAKER_TSTATES_PER_BIT T-states, and only when speaker_batch is NULL.
+   */
   void (*speaker)(int on_off, void *opaque);
+
+  /* The following may be left zero for the defaults. */
+
+  /** Pixel format of the converted screen. */
+  zxscreen_format_t format;
+
+  /** Bytes from one row of the converted screen to the next. A multiple of
+   * four. Zero packs the rows together. */
+  int stride;
+
+  /** 16 0xAARRGGBB colours, indexed as for the indexed formats, to convert
+   * to. NULL selects the Spectrum's own colours. The indexed formats ignore
+   * it. */
+  const uint32_t *palette;
+
+  /** App callback called with blocks of speaker events, usually once per
+   * frame. Event times never decrease. NULL
+   * selects the speaker callback instead. */
+  void (*speaker_batch)(const zxspeakerevent_t *events,
+                        int                     nevents,
+                        void                   *opaque);
 }
 zxconfig_t;
 
 /**
  * Create a logical ZX Spectrum.
  *
+ * Instances share no mutable state so separate instances may be driven
+ * concurrently from separate threads.
+ *
  * \return New ZXSpectrum.
  */
 zxspectrum_t *zxspectrum_create(const zxconfig_t *config);
@@ -202,10 +377,21 @@ zxspectrum_t *zxspectrum_create(const zxconfig_t *config);
 void zxspectrum_destroy(zxspectrum_t *doomed);
 
 /**
- * Lock the screen then return a converted screen buffer.
+ * Return a converted screen buffer holding the newest complete frame.
  *
  * Call this at the last moment when you're ready to use the screen pixels.
  *
+ * Frames are handed over from the game without locking so this never blocks
+ * the game and the game never waits for it. If the game has published
+ * several frames since the last call then all but the newest are dropped. If
+ * it has published none then the previous frame is returned again.
+ *
+ * Only one thread at a time may claim the screen. The pixels remain valid
+ * until the next call.
+ *
+ * The pixels are in the format and stride given by the zxconfig_t. Cast the
+ * result accordingly for formats other than the 32-bit ones.
+ *
  * \param[in] state ZXSpectrum state.
  *
  * \return Pixels.
@@ -213,12 +399,62 @@ void zxspectrum_destroy(zxspectrum_t *doomed);
 uint32_t *zxspectrum_claim_screen(zxspectrum_t *state);
 
 /**
- * Unlock the screen.
+ * Finish with the screen returned by zxspectrum_claim_screen().
  *
  * \param[in] state ZXSpectrum state.
  */
 void zxspectrum_release_screen(zxspectrum_t *state);
 
+/**
+ * Return a map of the areas of the converted screen which changed during the
+ * last call to zxspectrum_claim_screen().
+ *
+ * Front ends can use this to upload only the changed regions of a texture.
+ * The map remains valid until the next claim.
+ *
+ * \param[in] state ZXSpectrum state.
+ *
+ * \return Dirty map.
+ */
+const zxdirtymap_t *zxspectrum_get_dirty_map(zxspectrum_t *state);
+
+/**
+ * Iterate over the dirty areas in 'map' as boxes.
+ *
+ * Runs of dirty columns are extended over identical scanlines, so a typical
+ * map yields a handful of boxes. Boxes are in the same cartesian space as the
+ * draw callback's dirty rectangle - (0,0) is bottom left.
+ *
+ * \param[in]     map    Dirty map.
+ * \param[in,out] cursor Iteration state. Set to zero before the first call.
+ * \param[out]    box    Next dirty box.
+ *
+ * \return Non-zero if a box was returned, zero once the map is exhausted.
+ */
+int zxdirtymap_next_box(const zxdirtymap_t *map, int *cursor, zxbox_t *box);
+
+/**
+ * Counts of frames handed from the game to the presenter.
+ */
+typedef struct zxframestats
+{
+  unsigned long published;  /**< Frames completed by the game. */
+  unsigned long presented;  /**< Frames claimed by the presenter. */
+  unsigned long dropped;    /**< Frames replaced before they were claimed. */
+  unsigned long duplicated; /**< Claims which found no new frame. */
+}
+zxframestats_t;
+
+/**
+ * Return the frame handoff counters.
+ *
+ * This may be called from any thread.
+ *
+ * \param[in]  state ZXSpectrum state.
+ * \param[out] stats Counters.
+ */
+void zxspectrum_get_frame_stats(zxspectrum_t *state, zxframestats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
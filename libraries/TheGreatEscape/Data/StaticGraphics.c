@@ -200,7 +200,7 @@ void plot_statics_and_menu_text(tgestate_t *state)
   iters  = NELEMS(static_graphic_defs);
   do
   {
-    screenptr = &state->speccy->screen.pixels[stline->screenloc]; /* Fetch screen address offset. */
+    screenptr = &state->speccy->screen.pixels[ZXSCREEN_FROM_INTERLEAVED(stline->screenloc)]; /* Fetch screen address offset. */
     ASSERT_SCREEN_PTR_VALID(screenptr);
 
     if (stline->flags_and_length & statictileline_VERTICAL)
@@ -292,21 +292,25 @@ static void plot_static_tiles(tgestate_t             *state,
     do
     {
       *out = *tile_data++;
-      out += 256; /* move to next screen row */
+      out += ZXSCREEN_SCANLINE_STRIDE; /* move to next screen row */
     }
     while (--iters);
-    out -= 256;
+    out -= ZXSCREEN_SCANLINE_STRIDE;
 
     /* Calculate screen attribute address of tile. */
-    // ((out - screen_base) / 0x800) * 0x100 + attr_base
     soffset = out - &state->speccy->screen.pixels[0];
+#ifdef ZXSCREEN_LINEAR
+    aoffset = ZXSCREEN_ATTRIBUTE_OFFSET(soffset);
+#else
+    // ((out - screen_base) / 0x800) * 0x100 + attr_base
     aoffset = soffset & 0xFF;
     if (soffset >= 0x0800) aoffset += 256;
     if (soffset >= 0x1000) aoffset += 256;
+#endif
     state->speccy->screen.attributes[aoffset] = static_tile->attr; /* Copy attribute byte. */
 
     if (orientation == 0) /* Horizontal */
-      out = out - 7 * 256 + 1;
+      out = out - 7 * ZXSCREEN_SCANLINE_STRIDE + 1;
     else /* Vertical */
       out = (uint8_t *) get_next_scanline(state, out); // must cast away constness
 
@@ -25,8 +25,14 @@
 
 #include "TheGreatEscape/Types.h"
 #include "TheGreatEscape/InteriorObjectDefs.h"
+#include "TheGreatEscape/MapCache.h"
+#include "TheGreatEscape/MaskIndex.h"
 #include "TheGreatEscape/Messages.h"
+#include "TheGreatEscape/Profile.h"
+#include "TheGreatEscape/Rewind.h"
 #include "TheGreatEscape/Rooms.h"
+#include "TheGreatEscape/Screen.h"
+#include "TheGreatEscape/SpriteCache.h"
 #include "TheGreatEscape/State.h"
 
 /* ----------------------------------------------------------------------- */
@@ -240,7 +246,7 @@ static void tge_initialise(tgestate_t *state)
 
   /* $A141 */
   state->moraleflag_screen_address =
-    &state->speccy->screen.pixels[0x5002 - SCREEN_START_ADDRESS];
+    &state->speccy->screen.pixels[ZXSCREEN_FROM_INTERLEAVED(0x5002 - SCREEN_START_ADDRESS)];
 
   /* $A263 */
   state->red_cross_parcel_current_contents = item_NONE;
@@ -263,11 +269,14 @@ static void tge_initialise(tgestate_t *state)
          locked_doors,
          sizeof(locked_doors));
 
-#ifndef NDEBUG
+  /* Fill the buffers with a recognisable pattern so that reads of parts not
+   * yet drawn stand out. This is done in every build, not only debug ones,
+   * since the buffers are part of the image hashed by tge_hash(). */
   memset(state->tile_buf,   0x55, state->tile_buf_size);
   memset(state->window_buf, 0x55, state->window_buf_size);
   memset(state->map_buf,    0x55, state->map_buf_size);
-#endif
+
+  invalidate_game_window(state);
 
   memcpy(state->roomdef_shadow_bytes,
          default_roomdef_shadow_bytes,
@@ -334,8 +343,12 @@ TGE_API tgestate_t *tge_create(zxspectrum_t *speccy)
   state->window_buf_size   = window_buf_size;
   state->map_buf_size      = map_buf_size;
 
-  tile_buf   = calloc(1, tile_buf_size);
-  window_buf = calloc(1, window_buf_size);
+  /* Conv: tile_buf and window_buf are allocated with slack either side so
+   * that the map can scroll by moving them. */
+  tile_buf   = calloc(1, tile_buf_size +
+                         2 * SCROLL_SLACK_ROWS * state->columns);
+  window_buf = calloc(1, window_buf_size +
+                         2 * SCROLL_SLACK_ROWS * window_buf_stride);
   map_buf    = calloc(1, map_buf_size);
 
   if (tile_buf   == NULL ||
@@ -343,8 +356,10 @@ TGE_API tgestate_t *tge_create(zxspectrum_t *speccy)
       map_buf    == NULL)
     goto failure;
 
-  state->tile_buf   = tile_buf;
-  state->window_buf = window_buf;
+  state->tile_buf_alloc   = tile_buf;
+  state->window_buf_alloc = window_buf;
+  state->tile_buf   = tile_buf   + SCROLL_SLACK_ROWS * state->columns;
+  state->window_buf = window_buf + SCROLL_SLACK_ROWS * window_buf_stride;
   state->map_buf    = map_buf;
 
   state->prng_index = 0;
@@ -353,6 +368,27 @@ TGE_API tgestate_t *tge_create(zxspectrum_t *speccy)
 
   state->speccy = speccy;
 
+#ifdef TGE_PROFILE
+  state->profile = profile_create();
+  if (state->profile == NULL)
+    goto failure;
+#endif
+
+#ifdef TGE_MAP_CACHE
+  /* Conv: Without the cache the map is plotted tile by tile instead. */
+  state->mapcache = mapcache_get();
+#endif
+
+#ifdef TGE_SPRITE_CACHE
+  /* Conv: Without the cache sprites are shifted and flipped as plotted. */
+  state->spritecache = spritecache_get();
+#endif
+
+#ifdef TGE_MASK_INDEX
+  /* Conv: Without the index every exterior mask is tested for every sprite. */
+  state->maskindex = maskindex_get();
+#endif
+
   /* Initialise original game variables. */
 
   tge_initialise(state);
@@ -375,13 +411,174 @@ TGE_API void tge_destroy(tgestate_t *state)
   if (state == NULL)
     return;
 
+  tge_rewind_enable(state, 0);
+#ifdef TGE_PROFILE
+  profile_destroy(state->profile);
+#endif
+
   free(state->map_buf);
-  free(state->window_buf);
-  free(state->tile_buf);
+  free(state->window_buf_alloc);
+  free(state->tile_buf_alloc);
 
   free(state);
 }
 
 /* ----------------------------------------------------------------------- */
 
+/**
+ * Relocate a pointer which points into one block of memory so that it
+ * points to the same offset in another block.
+ *
+ * Pointers outside of the block are returned unchanged.
+ *
+ * \param[in] ptr     Pointer to relocate.
+ * \param[in] oldbase Base of the block 'ptr' may point into.
+ * \param[in] length  Length of the block in bytes.
+ * \param[in] newbase Base of the block to relocate into.
+ *
+ * \return Relocated pointer, or 'ptr' if it doesn't point into the block.
+ */
+static void *relocate(const void *ptr,
+                      const void *oldbase,
+                      size_t      length,
+                      void       *newbase)
+{
+  uintptr_t p    = (uintptr_t) ptr;
+  uintptr_t base = (uintptr_t) oldbase;
+
+  /* Inclusive of the end to allow for pointers one past the end. */
+  if (p < base || p > base + length)
+    return (void *) ptr;
+
+  return (uint8_t *) newbase + (p - base);
+}
+
+/**
+ * Relocate a pointer from game instance 'src' into 'dst'.
+ *
+ * Pointers may point into the state structure, its separately allocated
+ * buffers or the screen. Anything else points to constant game data which
+ * all instances share, so is returned unchanged.
+ *
+ * \param[in] dst Destination game state.
+ * \param[in] src Source game state.
+ * \param[in] ptr Pointer to relocate.
+ *
+ * \return Relocated pointer.
+ */
+static void *relocate_state(tgestate_t       *dst,
+                            const tgestate_t *src,
+                            const void       *ptr)
+{
+  void *p;
+
+  if (ptr == NULL)
+    return NULL;
+
+  p = relocate(ptr, src, sizeof(*src), dst);
+  if (p == ptr)
+    p = relocate(ptr, src->tile_buf, src->tile_buf_size, dst->tile_buf);
+  if (p == ptr)
+    p = relocate(ptr, src->window_buf, src->window_buf_size, dst->window_buf);
+  if (p == ptr)
+    p = relocate(ptr, src->map_buf, src->map_buf_size, dst->map_buf);
+  if (p == ptr)
+    p = relocate(ptr,
+                 &src->speccy->screen, sizeof(zxscreen_t),
+                 &dst->speccy->screen);
+
+  return p;
+}
+
+TGE_API int tge_clone(tgestate_t *dst, const tgestate_t *src)
+{
+  tileindex_t      *tile_buf;
+  uint8_t          *window_buf;
+  supertileindex_t *map_buf;
+  int               i;
+
+  assert(dst != NULL);
+  assert(src != NULL);
+
+  if (dst == src)
+    return 0;
+
+  if (dst->tile_buf_size   != src->tile_buf_size   ||
+      dst->window_buf_size != src->window_buf_size ||
+      dst->map_buf_size    != src->map_buf_size    ||
+      dst->speccy->screen.width  != src->speccy->screen.width ||
+      dst->speccy->screen.height != src->speccy->screen.height)
+    return 1; /* incompatible instances */
+
+  /* Copy the game, retaining the destination's own allocations. The host
+   * resources which follow the game are left alone. */
+
+  tile_buf   = dst->tile_buf_alloc;
+  window_buf = dst->window_buf_alloc;
+  map_buf    = dst->map_buf;
+
+  memcpy(dst, src, TGESTATE_GAME_SIZE);
+
+  dst->tile_buf_alloc   = tile_buf;
+  dst->window_buf_alloc = window_buf;
+  /* Conv: Place the buffers at the same positions in their allocations. */
+  dst->tile_buf   = tile_buf   + (src->tile_buf   - src->tile_buf_alloc);
+  dst->window_buf = window_buf + (src->window_buf - src->window_buf_alloc);
+  dst->map_buf    = map_buf;
+
+  memcpy(dst->tile_buf,   src->tile_buf,   src->tile_buf_size);
+  memcpy(dst->window_buf, src->window_buf, src->window_buf_size);
+  memcpy(dst->map_buf,    src->map_buf,    src->map_buf_size);
+
+  dst->speccy->screen = src->speccy->screen;
+
+  /* The history describes the game 'dst' held before so is no use now. */
+  rewind_reset(dst);
+
+  /* Relocate internal pointers. */
+
+  dst->IY                           = relocate_state(dst, src, src->IY);
+  dst->window_buf_pointer           = relocate_state(dst, src, src->window_buf_pointer);
+  dst->bitmap_pointer               = relocate_state(dst, src, src->bitmap_pointer);
+  dst->mask_pointer                 = relocate_state(dst, src, src->mask_pointer);
+  dst->foreground_mask_pointer      = relocate_state(dst, src, src->foreground_mask_pointer);
+  dst->messages.queue_pointer       = relocate_state(dst, src, src->messages.queue_pointer);
+  dst->moraleflag_screen_address    = relocate_state(dst, src, src->moraleflag_screen_address);
+  dst->ptr_to_door_being_lockpicked = relocate_state(dst, src, src->ptr_to_door_being_lockpicked);
+  for (i = 0; i < vischars_LENGTH; i++)
+  {
+    /* These point to constant animation data so are unchanged, but route
+     * them through the same logic in case that ever changes. */
+    dst->vischars[i].animbase = relocate_state(dst, src, src->vischars[i].animbase);
+    dst->vischars[i].anim     = relocate_state(dst, src, src->vischars[i].anim);
+  }
+
+  /* The screen was replaced wholesale so redraw all of it. */
+  dst->speccy->draw(dst->speccy, NULL);
+
+  return 0;
+}
+
+TGE_API tgestate_t *tge_fork(const tgestate_t *src, zxspectrum_t *speccy)
+{
+  tgestate_t *state;
+
+  assert(src    != NULL);
+  assert(speccy != NULL);
+
+  state = tge_create(speccy);
+  if (state == NULL)
+    return NULL;
+
+  if (tge_clone(state, src))
+  {
+    tge_destroy(state);
+    return NULL;
+  }
+
+  return state;
+}
+
+/* ----------------------------------------------------------------------- */
+
 // vim: ts=8 sts=2 sw=2 et
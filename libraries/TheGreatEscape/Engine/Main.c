@@ -60,6 +60,7 @@
 #include "TheGreatEscape/TheGreatEscape.h"
 
 #include "TheGreatEscape/Asserts.h"
+#include "TheGreatEscape/Cost.h"
 #include "TheGreatEscape/Debug.h"
 #include "TheGreatEscape/Events.h"
 #include "TheGreatEscape/ExteriorTiles.h"
@@ -68,13 +69,18 @@
 #include "TheGreatEscape/InteriorTiles.h"
 #include "TheGreatEscape/ItemBitmaps.h"
 #include "TheGreatEscape/Map.h"
+#include "TheGreatEscape/MapCache.h"
+#include "TheGreatEscape/MaskIndex.h"
 #include "TheGreatEscape/Masks.h"
 #include "TheGreatEscape/Menu.h"
 #include "TheGreatEscape/Messages.h"
 #include "TheGreatEscape/Pixels.h"
+#include "TheGreatEscape/Profile.h"
+#include "TheGreatEscape/Rewind.h"
 #include "TheGreatEscape/RoomDefs.h"
 #include "TheGreatEscape/Screen.h"
 #include "TheGreatEscape/SpriteBitmaps.h"
+#include "TheGreatEscape/SpriteCache.h"
 #include "TheGreatEscape/State.h"
 #include "TheGreatEscape/StaticGraphics.h"
 #include "TheGreatEscape/Text.h"
@@ -101,7 +107,7 @@
  * \param[in] state  Pointer to game state.
  * \param[in] mappos Pointer to pos. (was HL)
  *
- * \remarks Exits using longjmp in the hero case.
+ * \remarks Squashes the stack in the hero case.
  */
 void transition(tgestate_t *state, const mappos8_t *mappos)
 {
@@ -175,9 +181,12 @@ void transition(tgestate_t *state, const mappos8_t *mappos)
  *
  * The hero enters a room.
  *
+ * Conv: The zoombox runs as a separate activity. increase_score() happens
+ * once it completes, in entered_room().
+ *
  * \param[in] state Pointer to game state.
  *
- * \remarks Exits using longjmp.
+ * \remarks Squashes the stack.
  */
 void enter_room(tgestate_t *state)
 {
@@ -193,30 +202,46 @@ void enter_room(tgestate_t *state)
   set_hero_sprite_for_room(state);
   calc_vischar_isopos_from_vischar(state, &state->vischars[0]);
   setup_movable_items(state);
-  zoombox(state);
-  increase_score(state, 1);
+  RETURN_IF_SQUASHED;
+  zoombox(state, activity_ENTERED_ROOM);
 
   squash_stack_goto_main(state); /* was fallthrough */
   NEVER_RETURNS;
 }
 
+/**
+ * The tail of enter_room(), run once its zoombox has completed.
+ *
+ * Conv: Split out of enter_room().
+ *
+ * \param[in] state Pointer to game state.
+ */
+static void entered_room(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  increase_score(state, 1);
+
+  state->activity = activity_MAIN_LOOP;
+}
+
 /**
  * $691A: Squash stack, then goto main.
  *
  * In the original code this squashed the stack then jumped to the start of
- * main_loop(). In this version it uses longjmp() to exit from tge_main() to
- * permit cooperation with the host environment.
+ * main_loop(). In this version it sets a flag which causes every routine on
+ * the call stack to return, up to tge_main(). That lets tge_main() return to
+ * the host environment.
  *
  * \param[in] state Pointer to game state.
  *
- * \remarks Exits using longjmp().
+ * \remarks Callers must return immediately (see NEVER_RETURNS).
  */
 void squash_stack_goto_main(tgestate_t *state)
 {
   assert(state != NULL);
 
-  longjmp(state->jmpbuf_main, 1);
-  NEVER_RETURNS;
+  state->squashed = 1;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -297,8 +322,10 @@ void setup_movable_items(tgestate_t *state)
   }
 
   spawn_characters(state);
+  RETURN_IF_SQUASHED;
   mark_nearby_items(state);
   animate(state);
+  RETURN_IF_SQUASHED;
   move_map(state);
   plot_sprites(state);
 }
@@ -765,6 +792,8 @@ void plot_interior_tiles(tgestate_t *state)
   window_buf = state->window_buf;
   tiles_buf  = state->tile_buf; // note: type is coerced
 
+  invalidate_game_window(state);
+
   rowcounter = rows;
   do
   {
@@ -780,6 +809,8 @@ void plot_interior_tiles(tgestate_t *state)
 
       window_buf2 = window_buf;
 
+      COST(COST_PLOT_INTERIOR_TILE);
+
       iters  = 8;
       stride = columns;
       do
@@ -1331,6 +1362,7 @@ void draw_all_items(tgestate_t *state)
  * \param[in] state  Pointer to game state.
  * \param[in] item   Item index.    (was A)
  * \param[in] dstoff Screen offset. (was HL) Assumed to be in the lower third of the display.
+ *                   Conv: This is always in the Spectrum's interleaved layout.
  */
 void draw_item(tgestate_t *state, item_t item, size_t dstoff)
 {
@@ -1341,7 +1373,7 @@ void draw_item(tgestate_t *state, item_t item, size_t dstoff)
   const spritedef_t *sprite; /* was HL */
 
   /* Wipe item. */
-  screen_wipe(state, screen + dstoff, 2, 16);
+  screen_wipe(state, screen + ZXSCREEN_FROM_INTERLEAVED(dstoff), 2, 16);
 
   if (item == item_NONE)
     return;
@@ -1361,7 +1393,7 @@ void draw_item(tgestate_t *state, item_t item, size_t dstoff)
 
   /* Plot the item bitmap. */
   sprite = &item_definitions[item];
-  plot_bitmap(state, sprite->bitmap, screen + dstoff, sprite->width, sprite->height);
+  plot_bitmap(state, sprite->bitmap, screen + ZXSCREEN_FROM_INTERLEAVED(dstoff), sprite->width, sprite->height);
 }
 
 /* ----------------------------------------------------------------------- */
@@ -1524,6 +1556,11 @@ uint8_t *get_next_scanline(tgestate_t *state, uint8_t *slp)
 
   assert(offset < 0x8000);
 
+#ifdef ZXSCREEN_LINEAR
+  /* Conv: A linear screen needs no special cases. */
+  (void) delta;
+  return screen + offset + ZXSCREEN_SCANLINE_STRIDE;
+#else
   offset += 0x0100;
   if (offset & 0x0700)
     return screen + offset; /* line count didn't rollover */
@@ -1536,54 +1573,103 @@ uint8_t *get_next_scanline(tgestate_t *state, uint8_t *slp)
   offset += delta;
 
   return screen + (int16_t) offset;
+#endif
 }
 
 /* ----------------------------------------------------------------------- */
 
 /**
  * $9D7B: Main game loop.
+ *
+ * Conv: This runs a single iteration. It returns early if the stack is
+ * squashed.
  */
 void main_loop(tgestate_t *state)
 {
   assert(state != NULL);
 
+  if (state->activity == activity_MAIN_LOOP_RESUME)
+  {
+    /* Conv: keyscan_break() reset the outdoor scene. Continue from where it
+     * left off. */
+    state->activity = activity_MAIN_LOOP;
+    PROFILE_START;
+    goto resume;
+  }
+
   state->speccy->stamp(state->speccy);
 
+  PROFILE_START;
   check_morale(state);
+  PROFILE_LAP(CHECK_MORALE);
   keyscan_break(state);
+  PROFILE_LAP(KEYSCAN_BREAK);
+  RETURN_IF_SQUASHED;
+
+resume:
   message_display(state);
+  PROFILE_LAP(MESSAGE_DISPLAY);
   process_player_input(state);
+  PROFILE_LAP(PROCESS_PLAYER_INPUT);
+  RETURN_IF_SQUASHED;
   in_permitted_area(state);
+  PROFILE_LAP(IN_PERMITTED_AREA);
+  RETURN_IF_SQUASHED;
   restore_tiles(state);
+  PROFILE_LAP(RESTORE_TILES);
   move_a_character(state);
+  PROFILE_LAP(MOVE_A_CHARACTER);
   automatics(state);
+  PROFILE_LAP(AUTOMATICS);
+  RETURN_IF_SQUASHED;
   purge_invisible_characters(state);
+  PROFILE_LAP(PURGE_INVISIBLE_CHARACTERS);
   spawn_characters(state);
+  PROFILE_LAP(SPAWN_CHARACTERS);
+  RETURN_IF_SQUASHED;
   mark_nearby_items(state);
+  PROFILE_LAP(MARK_NEARBY_ITEMS);
   ring_bell(state);
+  PROFILE_LAP(RING_BELL);
   animate(state);
+  PROFILE_LAP(ANIMATE);
+  RETURN_IF_SQUASHED;
   move_map(state);
+  PROFILE_LAP(MOVE_MAP);
   message_display(state); /* second */
+  PROFILE_LAP(MESSAGE_DISPLAY);
   ring_bell(state); /* second */
+  PROFILE_LAP(RING_BELL);
   plot_sprites(state);
+  PROFILE_LAP(PLOT_SPRITES);
   plot_game_window(state);
+  PROFILE_LAP(PLOT_GAME_WINDOW);
   ring_bell(state); /* third */
+  PROFILE_LAP(RING_BELL);
   if (state->day_or_night != 0)
+  {
     nighttime(state);
+    PROFILE_LAP(NIGHTTIME);
+  }
   /* Conv: Removed interior_delay_loop call here. */
   wave_morale_flag(state);
+  PROFILE_LAP(WAVE_MORALE_FLAG);
   if ((state->game_counter & 63) == 0)
+  {
     dispatch_timed_event(state);
+    PROFILE_LAP(DISPATCH_TIMED_EVENT);
+  }
 
-  /* Conv: Timing: To calculate the magic timing interval value here the
-   * original game was run in FUSE and its main_loop breakpointed. For both
-   * indoor and outdoor scenes the T-states and current frame number were
-   * captured, then the average T-state figure for the game was calculated.
+  /* Conv: Timing: The original game is not dependent on accurate timing: it
+   * is much slower in outdoor scenes and especially when multiple characters
+   * are on the screen simultaneously. The expensive routines charge their
+   * estimated cost to the frame (see Cost.h) and we sleep for the total.
    *
-   * The original game is not dependent on accurate timing: it is much slower
-   * in outdoor scenes and especially when multiple characters are on the
-   * screen simultaneously. */
-  (void) state->speccy->sleep(state->speccy, 367731);
+   * The fixed charge for the rest of the loop was calibrated so that the
+   * mean frame matches the figure previously used for every frame: 367731
+   * T-states, found by running the original game in FUSE with main_loop
+   * breakpointed and averaging over indoor and outdoor scenes. */
+  (void) framedelay(state, COST_MAIN_LOOP);
 }
 
 /* ----------------------------------------------------------------------- */
@@ -1618,9 +1704,12 @@ void check_morale(tgestate_t *state)
  * If pressed then clear the screen and confirm with the player that they
  * want to reset the game. Reset if requested.
  *
+ * Conv: The confirmation is handled by keyscan_break_prompt() and
+ * keyscan_break_confirm() once the screen's zoombox has completed.
+ *
  * \param[in] state Pointer to game state.
  *
- * \remarks Exits using longjmp if the game is canceled, or indoors.
+ * \remarks Squashes the stack if pressed.
  */
 void keyscan_break(tgestate_t *state)
 {
@@ -1635,22 +1724,73 @@ void keyscan_break(tgestate_t *state)
   if (!space || !shift)
     return; /* not pressed */
 
-  screen_reset(state);
-  if (user_confirm(state) == 0)
+  screen_reset(state, activity_BREAK_PROMPT);
+  squash_stack_goto_main(state);
+  NEVER_RETURNS;
+}
+
+/**
+ * Ask the player to confirm the break.
+ *
+ * Conv: Split out of keyscan_break().
+ *
+ * \param[in] state Pointer to game state.
+ */
+static void keyscan_break_prompt(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  screen_reset_complete(state);
+  user_confirm_prompt(state);
+  state->activity = activity_BREAK_CONFIRM;
+}
+
+/**
+ * Poll for the player's answer to the break prompt then act upon it.
+ *
+ * Conv: Split out of keyscan_break().
+ *
+ * \param[in] state Pointer to game state.
+ *
+ * \return Non-zero if this slept.
+ */
+static int keyscan_break_confirm(tgestate_t *state)
+{
+  int confirmed;
+
+  assert(state != NULL);
+
+  confirmed = user_confirm_keyscan(state);
+  if (confirmed < 0)
+  {
+    /* Conv: Timing: The original game keyscans as fast as it can. We can't
+     * have that so instead we introduce a short delay. */
+    gamedelay(state, 3500000 / 50); /* 50/sec */
+    return 1;
+  }
+
+  if (confirmed == 0)
   {
     reset_game(state);
-    NEVER_RETURNS;
+    NEVER_RETURNS 0;
   }
 
   if (state->room_index == room_0_OUTDOORS)
   {
     reset_outdoors(state);
+    RETURN_IF_SQUASHED 0;
+
+    /* Once the zoombox completes continue the main loop from after
+     * keyscan_break(). */
+    state->after_zoombox = activity_MAIN_LOOP_RESUME;
   }
   else
   {
-    enter_room(state); /* doesn't return (jumps to main_loop) */
-    NEVER_RETURNS;
+    enter_room(state);
+    NEVER_RETURNS 0;
   }
+
+  return 0;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -1748,6 +1888,7 @@ void process_player_input(tgestate_t *state)
     if (input >= input_FIRE)
     {
       process_player_input_fire(state, input);
+      RETURN_IF_SQUASHED;
       input = input_KICK;
     }
   }
@@ -2221,6 +2362,10 @@ uint8_t *get_prev_scanline(tgestate_t *state, uint8_t *addr)
   assert(state != NULL);
   assert(addr  != NULL);
 
+#ifdef ZXSCREEN_LINEAR
+  /* Conv: A linear screen needs no special cases. */
+  return screen + raddr - ZXSCREEN_SCANLINE_STRIDE;
+#else
   if ((raddr & 0x0700) != 0)
   {
     // NNN bits
@@ -2237,12 +2382,13 @@ uint8_t *get_prev_scanline(tgestate_t *state, uint8_t *addr)
   }
 
   return screen + raddr;
+#endif
 }
 
 /* ----------------------------------------------------------------------- */
 
 /* Offset. */
-#define screenoffset_BELL_RINGER 0x118E
+#define screenoffset_BELL_RINGER ZXSCREEN_FROM_INTERLEAVED(0x118E)
 
 /**
  * $A09E: Ring the alarm bell.
@@ -2468,6 +2614,11 @@ void plot_score(tgestate_t *state)
 
 /* ----------------------------------------------------------------------- */
 
+/* Conv: Estimated T-states taken by each iteration of play_speaker's loop
+ * and by each iteration of its delay loop. */
+#define PLAY_SPEAKER_TSTATES       (35)
+#define PLAY_SPEAKER_DELAY_TSTATES (16)
+
 /**
  * $A11D: Plays a sound.
  *
@@ -2476,10 +2627,12 @@ void plot_score(tgestate_t *state)
  */
 void play_speaker(tgestate_t *state, sound_t sound)
 {
-  uint8_t iters;      /* was B */
-  uint8_t delay;      /* was A */
-  uint8_t speakerbit; /* was A */
+  uint8_t  iters;      /* was B */
+  uint8_t  delay;      /* was A */
+  uint8_t  speakerbit; /* was A */
 //  uint8_t subcount;   /* was C */
+  uint32_t now;        /* Conv: added */
+  uint32_t queued;     /* Conv: added */
 
   assert(state != NULL);
   // assert(sound); somehow
@@ -2487,25 +2640,29 @@ void play_speaker(tgestate_t *state, sound_t sound)
   iters = sound >> 8;
   delay = sound & 0xFF;
 
+  /* Conv: Timing: The original game uses an empty delay loop here to
+   * maintain the currently output speaker bit. Instead of that we timestamp
+   * each speaker edge with the time at which the original would have made
+   * it. The delay loop isn't charged to the frame so start after any sound
+   * still playing, unless the clock has been reset. */
+  now    = VIRTUAL_TSTATES();
+  queued = state->speccy->speakertime - now;
+  if (queued < ZXSPEAKER_REBASE)
+    now += queued;
+
   speakerbit = port_MASK_EAR; /* Initial speaker bit. */
   do
   {
-    state->speccy->out(state->speccy, port_BORDER_EAR_MIC, speakerbit); /* Play. */
-
-    /* Conv: Timing: The original game uses an empty delay loop here to
-     * maintain the currently output speaker bit. Instead of that, since our
-     * sound code has no knowledge of time, we just output the speaker bit
-     * for the delay period. */
-    {
-      int i;
-
-      for (i = 0; i < delay; i++)
-        state->speccy->out(state->speccy, port_BORDER_EAR_MIC, speakerbit);;
-    }
+    ZXSPECTRUM_SPEAKER(state->speccy, now, speakerbit); /* Play. */
+    now += PLAY_SPEAKER_TSTATES + delay * PLAY_SPEAKER_DELAY_TSTATES;
 
     speakerbit ^= port_MASK_EAR; /* Toggle speaker bit. */
   }
   while (--iters);
+
+  /* Conv: Mark the end of the sound so that any following sound is queued
+   * after it. This leaves the speaker at rest. */
+  ZXSPECTRUM_SPEAKER(state->speccy, now, 0);
 }
 
 /* ----------------------------------------------------------------------- */
@@ -2552,15 +2709,32 @@ void set_game_window_attributes(tgestate_t *state, attribute_t attrs)
 /**
  * $A50B: Reset the screen.
  *
+ * Conv: This starts the zoombox then returns. The caller must squash the
+ * stack. The activity 'then' must call screen_reset_complete().
+ *
  * \param[in] state Pointer to game state.
+ * \param[in] then  Activity to continue with once the zoombox completes.
  */
-void screen_reset(tgestate_t *state)
+void screen_reset(tgestate_t *state, activity_t then)
 {
   assert(state != NULL);
 
   wipe_visible_tiles(state);
   plot_interior_tiles(state);
-  zoombox(state);
+  zoombox(state, then);
+}
+
+/**
+ * The tail of screen_reset(), run once its zoombox has completed.
+ *
+ * Conv: Split out of screen_reset().
+ *
+ * \param[in] state Pointer to game state.
+ */
+void screen_reset_complete(tgestate_t *state)
+{
+  assert(state != NULL);
+
   plot_game_window(state);
   set_game_window_attributes(state, attribute_WHITE_OVER_BLACK);
 }
@@ -2573,9 +2747,30 @@ void screen_reset(tgestate_t *state)
  * Print 'well done' message then test to see if the correct objects were
  * used in the escape attempt.
  *
+ * Conv: The messages are printed by escaped_messages() and the keypress is
+ * awaited by escaped_keyscan() once the screen's zoombox has completed.
+ *
  * \param[in] state Pointer to game state.
+ *
+ * \remarks Squashes the stack.
  */
 void escaped(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  screen_reset(state, activity_ESCAPED_MESSAGES);
+  squash_stack_goto_main(state);
+  NEVER_RETURNS;
+}
+
+/**
+ * Print the escape messages.
+ *
+ * Conv: Split out of escaped().
+ *
+ * \param[in] state Pointer to game state.
+ */
+static void escaped_messages(tgestate_t *state)
 {
   /**
    * $A5CE: Escape messages.
@@ -2597,11 +2792,10 @@ void escaped(tgestate_t *state)
 
   const screenlocstring_t *message;   /* was HL */
   escapeitem_t             itemflags; /* was C */
-  uint8_t                  keys;      /* was A */
 
   assert(state != NULL);
 
-  screen_reset(state);
+  screen_reset_complete(state);
 
   /* Print standard prefix messages. */
   message = &messages[0];
@@ -2666,16 +2860,41 @@ void escaped(tgestate_t *state)
   message = &messages[10]; /* PRESS ANY KEY */
   (void) screenlocstring_plot(state, message);
 
-  /* Debounce: First wait for any already-held key to be released. */
-  do
-    keys = keyscan_all(state);
-  while (keys != 0); /* Down press */
+  state->escape_itemflags = itemflags;
+  state->activity = activity_ESCAPED_RELEASE;
+}
+
+/**
+ * Scan the keyboard once while waiting for a keypress after escaping. When
+ * one arrives reset the game or send the hero to solitary.
+ *
+ * Conv: Split out of escaped(). The loops became activities.
+ *
+ * \param[in] state Pointer to game state.
+ */
+static void escaped_keyscan(tgestate_t *state)
+{
+  uint8_t      keys;      /* was A */
+  escapeitem_t itemflags; /* was C */
+
+  assert(state != NULL);
+
+  keys = keyscan_all(state);
+
+  if (state->activity == activity_ESCAPED_RELEASE)
+  {
+    /* Debounce: First wait for any already-held key to be released. */
+    if (keys == 0) /* Down press */
+      state->activity = activity_ESCAPED_PRESS;
+    return;
+  }
+
   /* Then wait for any key to be pressed. */
-  do
-    keys = keyscan_all(state);
-  while (keys == 0); /* Up press */
+  if (keys == 0) /* Up press */
+    return;
 
   /* Reset the game, or send the hero to solitary. */
+  itemflags = state->escape_itemflags;
   if (itemflags == 0xFF || itemflags >= escapeitem_UNIFORM)
     reset_game(state); /* was tail call */
   else
@@ -2777,7 +2996,7 @@ const screenlocstring_t *screenlocstring_plot(tgestate_t              *state,
   assert(state    != NULL);
   assert(slstring != NULL);
 
-  screen = &state->speccy->screen.pixels[slstring->screenloc];
+  screen = &state->speccy->screen.pixels[ZXSCREEN_FROM_INTERLEAVED(slstring->screenloc)];
   length = slstring->length;
   string = slstring->string;
   do
@@ -2838,6 +3057,136 @@ void get_supertiles(tgestate_t *state)
 
 /* ----------------------------------------------------------------------- */
 
+#ifdef TGE_MAP_CACHE
+
+/**
+ * Conv: Locate a rectangle of the visible tiles in the map cache.
+ *
+ * Tiles beyond the edges of the map are plotted from whatever map_buf holds
+ * so only the original code can reproduce them. Those aren't cached.
+ *
+ * \param[in]  state  Pointer to game state.
+ * \param[in]  column Left edge of the rectangle in tile_buf.
+ * \param[in]  row    Top edge of the rectangle in tile_buf.
+ * \param[in]  width  Width of the rectangle, in tiles.
+ * \param[in]  height Height of the rectangle, in tiles.
+ * \param[out] pcache Map cache.
+ * \param[out] px     Left edge of the rectangle in the cache.
+ * \param[out] py     Top edge of the rectangle in the cache.
+ *
+ * \return Zero if the cache holds the whole rectangle.
+ */
+static int locate_cached_tiles(tgestate_t        *state,
+                               int                column,
+                               int                row,
+                               int                width,
+                               int                height,
+                               const mapcache_t **pcache,
+                               int               *px,
+                               int               *py)
+{
+  int x, y;
+
+  if (state->mapcache == NULL || state->room_index != room_0_OUTDOORS)
+    return 1;
+
+  x = state->map_position.x + column;
+  y = state->map_position.y + row - MAPCACHE_TOP;
+  if (x < 0 || x + width  > MAPCACHE_WIDTH ||
+      y < 0 || y + height > MAPCACHE_HEIGHT)
+    return 1;
+
+  *pcache = state->mapcache;
+  *px     = x;
+  *py     = y;
+  return 0;
+}
+
+/**
+ * Conv: Copy a row of tiles or pixels out of the map cache.
+ *
+ * Rows are at most a few dozen bytes, too short to repay the startup cost of
+ * the block copy which compilers tend to inline for memcpy() of an unknown
+ * length, so copy a word at a time.
+ *
+ * \param[out] dst   Destination.
+ * \param[in]  src   Source.
+ * \param[in]  width Width of the row, in bytes.
+ */
+static void copy_cached_row(uint8_t *dst, const uint8_t *src, int width)
+{
+  for (; width >= 8; width -= 8)
+  {
+    memcpy(dst, src, 8);
+    dst += 8;
+    src += 8;
+  }
+  while (width--)
+    *dst++ = *src++;
+}
+
+/**
+ * Conv: Plot a rectangle of the visible tiles by copying rows of tile
+ * indices and pixels from the map cache into tile_buf and window_buf.
+ *
+ * The cost charged is that of plotting the tiles one at a time.
+ *
+ * \param[in] state  Pointer to game state.
+ * \param[in] column Left edge of the rectangle in tile_buf.
+ * \param[in] row    Top edge of the rectangle in tile_buf.
+ * \param[in] width  Width of the rectangle, in tiles.
+ * \param[in] height Height of the rectangle, in tiles.
+ *
+ * \return Zero if plotted. Non-zero if the cache can't supply the
+ * rectangle, in which case nothing is plotted.
+ */
+static int plot_cached_tiles(tgestate_t *state,
+                             int         column,
+                             int         row,
+                             int         width,
+                             int         height)
+{
+  const mapcache_t  *cache;
+  int                x, y;
+  const tileindex_t *srctiles;
+  const tilerow_t   *src;
+  tileindex_t       *tiles;
+  uint8_t           *window;
+  int                i;
+
+  if (locate_cached_tiles(state, column, row, width, height, &cache, &x, &y))
+    return 1;
+
+  COST(COST_PLOT_TILE * width * height);
+
+  srctiles = &cache->tiles[y][x];
+  tiles    = &state->tile_buf[row * state->columns + column];
+  for (i = 0; i < height; i++)
+  {
+    ASSERT_TILE_BUF_PTR_VALID(tiles + width - 1);
+    copy_cached_row(tiles, srctiles, width);
+    srctiles += MAPCACHE_WIDTH;
+    tiles    += state->columns;
+  }
+
+  src    = &cache->pixels[y * 8][x];
+  window = &state->window_buf[row * state->window_buf_stride + column];
+  invalidate_window_buf(state, window, height * 8);
+  for (i = 0; i < height * 8; i++)
+  {
+    ASSERT_WINDOW_BUF_PTR_VALID(window + width - 1, 0);
+    copy_cached_row(window, src, width);
+    src    += MAPCACHE_WIDTH;
+    window += state->columns;
+  }
+
+  return 0;
+}
+
+#endif /* TGE_MAP_CACHE */
+
+/* ----------------------------------------------------------------------- */
+
 /**
  * $A80A: Plot the complete bottommost row of tiles.
  *
@@ -2852,6 +3201,11 @@ void plot_bottommost_tiles(tgestate_t *state)
 
   assert(state != NULL);
 
+#ifdef TGE_MAP_CACHE
+  if (plot_cached_tiles(state, 0, state->rows - 1, state->columns, 1) == 0)
+    return;
+#endif
+
   vistiles = &state->tile_buf[24 * 16];       // $F278 = visible tiles array + 24 * 16
   maptiles = &state->map_buf[7 * 4];          // $FF74
   y        = state->map_position.y;           // map_position y
@@ -2874,6 +3228,11 @@ void plot_topmost_tiles(tgestate_t *state)
 
   assert(state != NULL);
 
+#ifdef TGE_MAP_CACHE
+  if (plot_cached_tiles(state, 0, 0, state->columns, 1) == 0)
+    return;
+#endif
+
   vistiles = &state->tile_buf[0];   // $F0F8 = visible tiles array + 0
   maptiles = &state->map_buf[0];    // $FF58
   y        = state->map_position.y; // map_position y
@@ -3024,6 +3383,11 @@ void plot_all_tiles(tgestate_t *state)
 
   check_map_buf(state);
 
+#ifdef TGE_MAP_CACHE
+  if (plot_cached_tiles(state, 0, 0, state->columns, state->rows) == 0)
+    return;
+#endif
+
   iters = state->columns; /* Conv: was 24 */
   do
   {
@@ -3054,6 +3418,11 @@ void plot_rightmost_tiles(tgestate_t *state)
   // 23 -> state->columns - 1
   //  6 -> state->st_columns - 1
 
+#ifdef TGE_MAP_CACHE
+  if (plot_cached_tiles(state, state->columns - 1, 0, 1, state->rows) == 0)
+    return;
+#endif
+
   vistiles = &state->tile_buf[23];   /* visible tiles array */
   maptiles = &state->map_buf[6];     /* 7x5 supertile refs */
   window   = &state->window_buf[23]; /* screen buffer start address */
@@ -3081,6 +3450,11 @@ void plot_leftmost_tiles(tgestate_t *state)
 
   assert(state != NULL);
 
+#ifdef TGE_MAP_CACHE
+  if (plot_cached_tiles(state, 0, 0, 1, state->rows) == 0)
+    return;
+#endif
+
   vistiles = &state->tile_buf[0];   /* visible tiles array */
   maptiles = &state->map_buf[0];    /* 7x5 supertile refs */
   window   = &state->window_buf[0]; /* screen buffer start address */
@@ -3260,6 +3634,9 @@ uint8_t *plot_tile(tgestate_t             *state,
   ASSERT_MAP_BUF_PTR_VALID(maptiles);
   ASSERT_WINDOW_BUF_PTR_VALID(scr, 0);
 
+  COST(COST_PLOT_TILE);
+  invalidate_window_buf(state, scr, 8);
+
   supertileindex = *maptiles; /* get supertile index */
   assert(supertileindex < supertileindex__LIMIT);
 
@@ -3299,6 +3676,70 @@ uint8_t *plot_tile(tgestate_t             *state,
 
 /* ----------------------------------------------------------------------- */
 
+/**
+ * Move a buffer 'delta' bytes within its allocation, so that its contents
+ * appear shunted towards its start by 'delta' bytes. If it would run out of
+ * slack then its contents are copied back to the centre of the allocation.
+ *
+ * Conv: Added. This replaces the original's shunting of the whole buffer.
+ *
+ * \param[in] alloc Start of the buffer's allocation.
+ * \param[in] slack Bytes of slack either side of the buffer.
+ * \param[in] buf   Current start of the buffer.
+ * \param[in] size  Size of the buffer, in bytes.
+ * \param[in] delta Distance to move, in bytes. Must be within the slack.
+ *
+ * \return New start of the buffer.
+ */
+static uint8_t *slide_buf(uint8_t   *alloc,
+                          size_t     slack,
+                          uint8_t   *buf,
+                          size_t     size,
+                          ptrdiff_t  delta)
+{
+  ptrdiff_t pos;
+
+  assert((size_t) (delta >= 0 ? delta : -delta) <= slack);
+
+  pos = (buf - alloc) + delta;
+  if (pos >= 0 && pos <= (ptrdiff_t) slack * 2)
+    return alloc + pos;
+
+  /* Out of slack: recentre. */
+  memmove(alloc + slack - delta, buf, size);
+  return alloc + slack;
+}
+
+/**
+ * Scroll tile_buf and window_buf by moving them rather than their contents.
+ *
+ * Afterwards the contents appear shunted left by 'dx' columns and up by 'dy'
+ * rows. The exposed edges are left for the caller to plot.
+ *
+ * Conv: Added. Callers still charge the cost of the original's shunt.
+ *
+ * \param[in] state Pointer to game state.
+ * \param[in] dx    Columns to shunt left (-1..1).
+ * \param[in] dy    Rows to shunt up (-1..1).
+ */
+static void scroll_map_bufs(tgestate_t *state, int dx, int dy)
+{
+  assert(state != NULL);
+  assert(dx >= -1 && dx <= 1);
+  assert(dy >= -1 && dy <= 1);
+
+  state->tile_buf = slide_buf(state->tile_buf_alloc,
+                              SCROLL_SLACK_ROWS * state->columns,
+                              state->tile_buf,
+                              state->tile_buf_size,
+                              dy * state->columns + dx);
+  state->window_buf = slide_buf(state->window_buf_alloc,
+                                SCROLL_SLACK_ROWS * state->window_buf_stride,
+                                state->window_buf,
+                                state->window_buf_size,
+                                dy * (ptrdiff_t) state->window_buf_stride + dx);
+}
+
 /**
  * $A9E4: Shunt the map left.
  *
@@ -3312,8 +3753,9 @@ void shunt_map_left(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[0], &state->tile_buf[1], TILE_BUF_LENGTH - 1);
-  memmove(&state->window_buf[0], &state->window_buf[1], WINDOW_BUF_LENGTH - 1);
+  scroll_map_bufs(state, 1, 0);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 1) + (WINDOW_BUF_LENGTH - 1)));
+  invalidate_game_window(state);
 
   plot_rightmost_tiles(state);
 }
@@ -3331,8 +3773,9 @@ void shunt_map_right(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[1], &state->tile_buf[0], TILE_BUF_LENGTH - 1);
-  memmove(&state->window_buf[1], &state->window_buf[0], WINDOW_BUF_LENGTH - 1); // orig uses window_buf_length which can't be right
+  scroll_map_bufs(state, -1, 0);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 1) + (WINDOW_BUF_LENGTH - 1)));
+  invalidate_game_window(state);
 
   plot_leftmost_tiles(state);
 }
@@ -3353,8 +3796,9 @@ void shunt_map_up_right(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[1], &state->tile_buf[24], TILE_BUF_LENGTH - 24);
-  memmove(&state->window_buf[1], &state->window_buf[24 * 8], WINDOW_BUF_LENGTH - 24 * 8);
+  scroll_map_bufs(state, -1, 1);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 24) + (WINDOW_BUF_LENGTH - 24 * 8)));
+  invalidate_game_window(state);
 
   plot_bottommost_tiles(state);
   plot_leftmost_tiles(state);
@@ -3373,8 +3817,9 @@ void shunt_map_up(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[0], &state->tile_buf[24], TILE_BUF_LENGTH - 24);
-  memmove(&state->window_buf[0], &state->window_buf[24 * 8], WINDOW_BUF_LENGTH - 24 * 8);
+  scroll_map_bufs(state, 0, 1);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 24) + (WINDOW_BUF_LENGTH - 24 * 8)));
+  invalidate_game_window(state);
 
   plot_bottommost_tiles(state);
 }
@@ -3392,9 +3837,9 @@ void shunt_map_down(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[24], &state->tile_buf[0], TILE_BUF_LENGTH - 24);
-  // Conv: Original code uses LDDR
-  memmove(&state->window_buf[24 * 8], &state->window_buf[0], WINDOW_BUF_LENGTH - 24 * 8);
+  scroll_map_bufs(state, 0, -1);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 24) + (WINDOW_BUF_LENGTH - 24 * 8)));
+  invalidate_game_window(state);
 
   plot_topmost_tiles(state);
 }
@@ -3413,8 +3858,9 @@ void shunt_map_down_left(tgestate_t *state)
 
   get_supertiles(state);
 
-  memmove(&state->tile_buf[24], &state->tile_buf[1], TILE_BUF_LENGTH - 24 - 1);
-  memmove(&state->window_buf[24 * 8], &state->window_buf[1], WINDOW_BUF_LENGTH - 24 * 8 - 1);
+  scroll_map_bufs(state, 1, -1);
+  COST(COST_SHUNT_BYTE * ((TILE_BUF_LENGTH - 24 - 1) + (WINDOW_BUF_LENGTH - 24 * 8 - 1)));
+  invalidate_game_window(state);
 
   plot_topmost_tiles(state);
   plot_rightmost_tiles(state);
@@ -3504,6 +3950,11 @@ void move_map(tgestate_t *state)
     case 3: game_window_offset.x = 0x90; game_window_offset.y = 0xFF; break;
   }
 
+  /* Conv: The whole window must be replotted if the offset changes. */
+  if (game_window_offset.x != state->game_window_offset.x ||
+      game_window_offset.y != state->game_window_offset.y)
+    invalidate_game_window(state);
+
   state->game_window_offset = game_window_offset;
 
   /* These cases check the move_map_y counter to decide when to shunt up/down,
@@ -3910,10 +4361,14 @@ void searchlight_plot(tgestate_t  *state,
 
   // Conv: clip_left code was made a parameter, code handling it is hoisted.
 
+  COST(COST_SEARCHLIGHT);
+
   shape = &searchlight_shape[0];
   iters = 16; /* height */
   do
   {
+    COST(COST_SEARCHLIGHT_ROW);
+
     x = (attrs - attrs_base) % state->width; // Conv: was '& 31'. hoisted.
 
     // Finish if we're beyond the maximum y
@@ -4016,7 +4471,7 @@ exit:
   {
     /* FUTURE: Make the dirty rectangle more accurate. */
     static const zxbox_t dirty = { 7 * 8, 2 * 8, 29 * 8, 17 * 8 };
-    state->speccy->draw(state->speccy, &dirty);
+    state->speccy->draw_attrs(state->speccy, &dirty);
   }
 }
 }
@@ -4049,7 +4504,10 @@ int touch(tgestate_t *state, vischar_t *vischar, spriteindex_t sprite_index)
 
   /* If hero is player controlled then check for door transitions. */
   if (vischar == &state->vischars[0] && state->automatic_player_counter > 0)
+  {
     door_handling(state, vischar);
+    RETURN_IF_SQUASHED 1;
+  }
 
   /* If a non-player character or hero when he's not cutting the fence. */
   if (vischar > &state->vischars[0] || ((state->vischars[0].flags & (vischar_FLAGS_PICKING_LOCK | vischar_FLAGS_CUTTING_WIRE)) != vischar_FLAGS_CUTTING_WIRE))
@@ -4159,7 +4617,7 @@ int collision(tgestate_t *state)
           /* Vischar IY is a hostile who's caught the hero! */
           /* Conv: Removed "HL = IY + 1" code which has no effect. */
           solitary(state);
-          NEVER_RETURNS 0;
+          NEVER_RETURNS 1; /* Conv: Report a collision while unwinding. */
         }
       }
     }
@@ -4440,7 +4898,7 @@ int is_door_locked(tgestate_t *state)
  * \param[in] state   Pointer to game state.
  * \param[in] vischar Pointer to visible character. (was IY)
  *
- * \remarks Exits using longjmp.
+ * \remarks Squashes the stack.
  */
 void door_handling(tgestate_t *state, vischar_t *vischar)
 {
@@ -4632,6 +5090,9 @@ next:
  * $B2FC: Reset the hero's position, redraw the scene, then zoombox it onto
  * the screen.
  *
+ * Conv: The zoombox runs as an activity after this returns. The main loop
+ * restarts from the top once it completes.
+ *
  * \param[in] state Pointer to game state.
  */
 void reset_outdoors(tgestate_t *state)
@@ -4651,7 +5112,8 @@ void reset_outdoors(tgestate_t *state)
   get_supertiles(state);
   plot_all_tiles(state);
   setup_movable_items(state);
-  zoombox(state);
+  RETURN_IF_SQUASHED;
+  zoombox(state, activity_MAIN_LOOP);
 }
 
 /* ----------------------------------------------------------------------- */
@@ -5282,7 +5744,10 @@ backwards:
       state->saved_mappos.pos16.w = vischar->mi.mappos.w - frameB->dh;
 
       if (touch(state, vischar, spriteindex2))
+      {
+        RETURN_IF_SQUASHED;
         goto pop_next; /* don't animate if collided */
+      }
 
       /* Conv: Preserve reverse flag. */
       vischar->animindex = (vischar->animindex - 1) | vischar_ANIMINDEX_REVERSE;
@@ -5308,7 +5773,10 @@ forwards:
       SWAP(uint8_t, spriteindex, spriteindex2);
 
       if (touch(state, vischar, spriteindex2))
+      {
+        RETURN_IF_SQUASHED;
         goto pop_next; /* don't animate if collided */
+      }
 
       vischar->animindex++;
     }
@@ -5659,6 +6127,7 @@ still_in_searchlight:
  */
 void plot_sprites(tgestate_t *state)
 {
+  drawables_t   drawables;  /* Conv: added */
   uint8_t       index;      /* was A */
   vischar_t    *vischar;    /* was IY */
   itemstruct_t *itemstruct; /* was IY */
@@ -5667,10 +6136,14 @@ void plot_sprites(tgestate_t *state)
 
   assert(state != NULL);
 
+  /* Conv: Gather the candidates once rather than have get_next_drawable()
+   * rescan every vischar and itemstruct for each sprite it returns. */
+  collect_drawables(state, &drawables);
+
   for (;;)
   {
     /* This can return a vischar OR an itemstruct, but not both. */
-    found = get_next_drawable(state, &index, &vischar, &itemstruct);
+    found = get_next_drawable(state, &drawables, &index, &vischar, &itemstruct);
     if (!found)
       return;
 
@@ -5709,10 +6182,46 @@ void plot_sprites(tgestate_t *state)
 
 /* ----------------------------------------------------------------------- */
 
+/**
+ * Conv: Collect the vischars and itemstructs flagged for drawing.
+ *
+ * Plotting sprites moves nothing and flags nothing new for drawing, so the
+ * candidates only leave the set, as get_next_drawable() returns them.
+ *
+ * \param[in]  state     Pointer to game state.
+ * \param[out] drawables Receives the candidates.
+ */
+void collect_drawables(tgestate_t *state, drawables_t *drawables)
+{
+  const enum itemstruct_room_and_flags FLAGS = itemstruct_ROOM_FLAG_NEARBY_6 |
+                                               itemstruct_ROOM_FLAG_NEARBY_7;
+
+  int           i;
+  vischar_t    *vischar;
+  itemstruct_t *itemstr;
+
+  assert(state     != NULL);
+  assert(drawables != NULL);
+
+  drawables->nvischars = 0;
+  for (i = 0, vischar = &state->vischars[0]; i < vischars_LENGTH; i++, vischar++)
+    if (vischar->counter_and_flags & vischar_DRAWABLE)
+      drawables->vischars[drawables->nvischars++] = vischar;
+
+  drawables->nitemstructs = 0;
+  for (i = 0, itemstr = &state->item_structs[0]; i < item__LIMIT; i++, itemstr++)
+    if ((itemstr->room_and_flags & FLAGS) == FLAGS)
+      drawables->itemstructs[drawables->nitemstructs++] = itemstr;
+}
+
 /**
  * $B89C: Find the next vischar or itemstruct to draw.
  *
+ * Conv: This scans the candidates gathered by collect_drawables() rather
+ * than every vischar, and removes the one it returns.
+ *
  * \param[in]  state       Pointer to game state.
+ * \param[in]  drawables   Candidates from collect_drawables().
  * \param[out] pindex      Returns (vischars_LENGTH - iters) if vischar,
  *                         or ((item__LIMIT - iters) | (1 << 6)) if itemstruct. (was A)
  * \param[out] pvischar    Pointer to receive vischar pointer. (was IY)
@@ -5721,6 +6230,7 @@ void plot_sprites(tgestate_t *state)
  * \return Non-zero if if a valid vischar or item was returned.
  */
 int get_next_drawable(tgestate_t    *state,
+                      drawables_t   *drawables,
                       uint8_t       *pindex,
                       vischar_t    **pvischar,
                       itemstruct_t **pitemstruct)
@@ -5728,18 +6238,21 @@ int get_next_drawable(tgestate_t    *state,
   uint16_t      prev_u;           /* was BC */
   uint16_t      prev_v;           /* was DE */
   item_t        item_and_flag;    /* was A' */
-  uint8_t       iters;            /* was B' */
+  int           i;                /* Conv: replaces iters (was B') */
+  int           found_i;          /* Conv: added */
   vischar_t    *vischar;          /* was HL' */
   vischar_t    *found_vischar;    /* was IY */
   itemstruct_t *found_itemstruct; /* was IY */
 
   assert(state       != NULL);
+  assert(drawables   != NULL);
   assert(pindex      != NULL);
   assert(pvischar    != NULL);
   assert(pitemstruct != NULL);
 
   /* Conv: Quiet MS Visual Studio warning */
   found_vischar = NULL;
+  found_i       = 0;
 
   /* Conv: Added */
   *pvischar    = NULL;
@@ -5754,28 +6267,27 @@ int get_next_drawable(tgestate_t    *state,
 
   /* Find the rearmost vischar that is flagged for drawing. */
 
-  iters   = vischars_LENGTH; /* iterations */
-  vischar = &state->vischars[0]; /* Conv: Original code points at vischar[0].counter_and_flags */
-  do
+  for (i = 0; i < drawables->nvischars; i++)
   {
+    vischar = drawables->vischars[i];
+
     /* Select a vischar if it's behind the point (prev_x - 4, prev_y - 4). */
-    if ((vischar->counter_and_flags & vischar_DRAWABLE) &&
-        (vischar->mi.mappos.u >= prev_u - 4) &&
+    if ((vischar->mi.mappos.u >= prev_u - 4) &&
         (vischar->mi.mappos.v >= prev_v - 4))
     {
-      item_and_flag = vischars_LENGTH - iters; /* Vischar index (never usefully used). */
+      item_and_flag = vischar - &state->vischars[0]; /* Vischar index (never usefully used). */
 
       /* Note: The (v,u) order here matches the original code */
       prev_v = vischar->mi.mappos.v;
       prev_u = vischar->mi.mappos.u;
       state->IY = found_vischar = vischar;
+      found_i = i;
     }
-    vischar++;
   }
-  while (--iters);
 
   /* Is there an item behind the selected vischar? */
   item_and_flag = get_next_drawable_itemstruct(state,
+                                               drawables,
                                                item_and_flag,
                                                prev_u, prev_v,
                                               &found_itemstruct);
@@ -5794,6 +6306,11 @@ int get_next_drawable(tgestate_t    *state,
 
     found_vischar->counter_and_flags &= ~vischar_DRAWABLE;
 
+    /* Conv: Remove it from the candidates, keeping them in order. */
+    drawables->nvischars--;
+    for (i = found_i; i < drawables->nvischars; i++)
+      drawables->vischars[i] = drawables->vischars[i + 1];
+
     *pvischar = found_vischar; /* Conv: Added */
 
     return 1; /* found */
@@ -5815,6 +6332,49 @@ int get_next_drawable(tgestate_t    *state,
 
 /* ----------------------------------------------------------------------- */
 
+#ifdef TGE_MASK_INDEX
+/**
+ * Count the masks in a set.
+ */
+static int maskset_count(maskset_t set)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(set);
+#else
+  int count;
+
+  for (count = 0; set != 0; count++)
+    set &= set - 1;
+
+  return count;
+#endif
+}
+
+/**
+ * Remove the lowest numbered mask from a set.
+ *
+ * \param[in,out] set Non-empty set of masks.
+ *
+ * \return The exterior_mask_data[] index of the removed mask.
+ */
+static int maskset_pop(maskset_t *set)
+{
+  int index;
+
+  assert(*set != 0);
+
+#ifdef __GNUC__
+  index = __builtin_ctzll(*set);
+#else
+  for (index = 0; ((*set >> index) & 1) == 0; index++)
+    ;
+#endif
+  *set &= *set - 1;
+
+  return index;
+}
+#endif
+
 /**
  * $B916: Render the mask buffer.
  *
@@ -5824,11 +6384,15 @@ void render_mask_buffer(tgestate_t *state)
 {
   uint8_t       iters; /* was A, B */
   const mask_t *pmask; /* was HL */
+#ifdef TGE_MASK_INDEX
+  maskset_t     masks; /* Conv: added */
+#endif
 
   assert(state != NULL);
 
   /* Clear the whole mask buffer. */
   memset(&state->mask_buffer[0], 255, sizeof(state->mask_buffer));
+  COST(COST_MASK_CLEAR);
 
   if (state->room_index > room_0_OUTDOORS)
   {
@@ -5849,6 +6413,24 @@ void render_mask_buffer(tgestate_t *state)
     pmask = &exterior_mask_data[0]; /* Conv: Original game points at pmask->bounds.x1. Fixed by propagation. */
   }
 
+  /* Conv: The cost of culling each mask is charged up front. */
+  COST(COST_MASK_CULL * iters);
+
+#ifdef TGE_MASK_INDEX
+  /* Conv: Outdoors, visit only the masks whose bounds overlap the sprite,
+   * in their original order. */
+  masks = 0;
+  if (state->maskindex != NULL && state->room_index == room_0_OUTDOORS)
+  {
+    masks = state->maskindex->columns[state->isopos.x] &
+            state->maskindex->rows[state->isopos.y];
+    if (masks == 0)
+      return;
+    iters = maskset_count(masks);
+    pmask = &exterior_mask_data[maskset_pop(&masks)];
+  }
+#endif
+
 {
   uint8_t        A;                   /* was A */
   const uint8_t *mask_pointer;        /* was DE */
@@ -6018,8 +6600,12 @@ start_drawing:
             A = *mask_pointer; /* read the next byte (a tile) */
           }
 
+          COST(COST_MASK_CELL);
           if (A != 0) /* shortcut tile 0 which is blank */
+          {
             mask_against_tile(A, maskbufptr);
+            COST(COST_MASK_TILE);
+          }
           maskbufptr++;
 
           SWAP(uint8_t, A, Adash); /* unbank the repeat count/length */
@@ -6078,6 +6664,10 @@ next_line:
 
 pop_next:
     pmask++;
+#ifdef TGE_MASK_INDEX
+    if (masks != 0)
+      pmask = &exterior_mask_data[maskset_pop(&masks)];
+#endif
   }
   while (--iters);
 }
@@ -6296,6 +6886,69 @@ not_visible:
 
 /* ----------------------------------------------------------------------- */
 
+#ifdef TGE_MAP_CACHE
+
+/**
+ * Conv: Restore a rectangle of window_buf by copying rows of pixels from
+ * the map cache.
+ *
+ * restore_tiles() plots whatever tile_buf holds, so this is only done where
+ * tile_buf holds the map's own tiles.
+ *
+ * \param[in] state  Pointer to game state.
+ * \param[in] column Left edge of the rectangle in tile_buf.
+ * \param[in] row    Top edge of the rectangle in tile_buf.
+ * \param[in] width  Width of the rectangle, in tiles.
+ * \param[in] height Height of the rectangle, in tiles.
+ *
+ * \return Zero if restored. Non-zero if the cache can't supply the
+ * rectangle, in which case nothing is restored.
+ */
+static int restore_cached_tiles(tgestate_t *state,
+                                int         column,
+                                int         row,
+                                int         width,
+                                int         height)
+{
+  const mapcache_t  *cache;
+  int                x, y;
+  const tileindex_t *srctiles;
+  const tilerow_t   *src;
+  const tileindex_t *tiles;
+  uint8_t           *window;
+  int                i;
+
+  if (column + width > state->columns || row + height > state->rows)
+    return 1; /* wraps around tile_buf */
+
+  if (locate_cached_tiles(state, column, row, width, height, &cache, &x, &y))
+    return 1;
+
+  srctiles = &cache->tiles[y][x];
+  tiles    = &state->tile_buf[row * state->columns + column];
+  for (i = 0; i < height; i++)
+  {
+    if (memcmp(tiles, srctiles, width) != 0)
+      return 1;
+    srctiles += MAPCACHE_WIDTH;
+    tiles    += state->columns;
+  }
+
+  src    = &cache->pixels[y * 8][x];
+  window = &state->window_buf[row * state->window_buf_stride + column];
+  for (i = 0; i < height * 8; i++)
+  {
+    ASSERT_WINDOW_BUF_PTR_VALID(window + width - 1, 0);
+    copy_cached_row(window, src, width);
+    src    += MAPCACHE_WIDTH;
+    window += state->columns;
+  }
+
+  return 0;
+}
+
+#endif /* TGE_MAP_CACHE */
+
 /**
  * $BB98: Paint any tiles occupied by visible characters with tiles from
  * tile_buf.
@@ -6396,6 +7049,8 @@ clamp_height:
     if (height > 5)
       height = 5;
 
+    COST(COST_RESTORE_TILES_VISCHAR + COST_RESTORE_TILE * height * clipped_width);
+
     /* Conv: Self modifying code replaced. */
 
     width          = clipped_width;
@@ -6420,12 +7075,18 @@ clamp_height:
 
     windowbuf = &state->window_buf[y * state->window_buf_stride + x];
     ASSERT_WINDOW_BUF_PTR_VALID(windowbuf, 0);
+    invalidate_window_buf(state, windowbuf, height * 8);
 
     /* Calculate the offset into the tile buffer. */
 
     tilebuf = &state->tile_buf[x + y * state->columns];
     ASSERT_TILE_BUF_PTR_VALID(tilebuf);
 
+#ifdef TGE_MAP_CACHE
+    if (restore_cached_tiles(state, x, y, width, height) == 0)
+      goto next;
+#endif
+
     height_counter = height; /* in rows */
     do
     {
@@ -6585,6 +7246,7 @@ void spawn_characters(tgestate_t *state)
         }
 
         spawn_character(state, charstr);
+        RETURN_IF_SQUASHED;
       }
     }
 
@@ -7759,6 +8421,7 @@ void automatics(tgestate_t *state)
       }
 
       character_behaviour(state, vischar);
+      RETURN_IF_SQUASHED;
     }
 
     state->IY++;
@@ -8192,6 +8855,7 @@ void target_reached(tgestate_t *state, vischar_t *vischar)
     }
 
     transition(state, mappos);
+    RETURN_IF_SQUASHED;
 
     play_speaker(state, sound_CHARACTER_ENTERS_1);
     return;
@@ -9447,7 +10111,11 @@ void mark_nearby_items(tgestate_t *state)
  *
  * Leaf.
  *
+ * Conv: This scans the candidates gathered by collect_drawables() rather
+ * than every itemstruct, and removes the one it returns.
+ *
  * \param[in]  state         Pointer to game state.
+ * \param[in]  drawables     Candidates from collect_drawables().
  * \param[in]  item_and_flag Initial item_and_flag, passed through if no itemstruct is found. (was A')
  * \param[in]  u             U pos? Compared to U. (was BC')
  * \param[in]  v             V pos? Compared to V. (was DE')
@@ -9456,31 +10124,32 @@ void mark_nearby_items(tgestate_t *state)
  * \return item+flag. (was A')
  */
 uint8_t get_next_drawable_itemstruct(tgestate_t    *state,
+                                     drawables_t   *drawables,
                                      item_t         item_and_flag,
                                      uint16_t       u,
                                      uint16_t       v,
                                      itemstruct_t **pitemstr)
 {
-  uint8_t             iters;   /* was B */
+  int                 i;       /* Conv: replaces iters (was B) */
+  int                 found_i; /* Conv: added */
   const itemstruct_t *itemstr; /* was HL */
 
-  assert(state    != NULL);
-  assert(pitemstr != NULL);
+  assert(state     != NULL);
+  assert(drawables != NULL);
+  assert(pitemstr  != NULL);
 
   *pitemstr = NULL; /* Conv: Added safety initialisation. */
+  found_i   = -1;
 
   /* Find the rearmost itemstruct that is flagged for drawing. */
 
-  iters   = item__LIMIT;
-  itemstr = &state->item_structs[0]; /* Conv: Original pointed to itemstruct->room_and_flags. */
-  do
+  for (i = 0; i < drawables->nitemstructs; i++)
   {
+    itemstr = drawables->itemstructs[i];
+
     /* Select an item if it's behind the point (u,v). */
-    const enum itemstruct_room_and_flags FLAGS = itemstruct_ROOM_FLAG_NEARBY_6 |
-                                                 itemstruct_ROOM_FLAG_NEARBY_7;
     /* Conv: Original calls out to multiply by 8, HL' is temp. */
-    if ((itemstr->room_and_flags & FLAGS) == FLAGS &&
-        (itemstr->mappos.u * 8 > u) &&
+    if ((itemstr->mappos.u * 8 > u) &&
         (itemstr->mappos.v * 8 > v))
     {
       const mappos8_t *mappos; /* was HL' */
@@ -9494,11 +10163,19 @@ uint8_t get_next_drawable_itemstruct(tgestate_t    *state,
       /* The original code has an unpaired A register exchange here. If the
        * loop continues then it's unclear which output register is used. */
       /* It seems that A' is the output register, irrespective. */
-      item_and_flag = (item__LIMIT - iters) | item_FOUND; /* item index + 'item found' flag */
+      item_and_flag = (itemstr - &state->item_structs[0]) | item_FOUND; /* item index + 'item found' flag */
+      found_i = i;
     }
-    itemstr++;
   }
-  while (--iters);
+
+  /* Conv: Remove it from the candidates, keeping them in order. Any item
+   * found here is the one get_next_drawable() returns. */
+  if (found_i >= 0)
+  {
+    drawables->nitemstructs--;
+    for (i = found_i; i < drawables->nitemstructs; i++)
+      drawables->itemstructs[i] = drawables->itemstructs[i + 1];
+  }
 
   return item_and_flag;
 }
@@ -9900,6 +10577,133 @@ const size_t masked_sprite_plotter_16_enables[2 * 3] =
 
 #define MASK(bm,mask) ((~*foremaskptr | (mask)) & *screenptr) | ((bm) & *foremaskptr)
 
+#ifdef TGE_SPRITE_CACHE
+
+/**
+ * Conv: Plot a vischar's sprite from the sprite cache.
+ *
+ * This plots and costs exactly what plot_masked_sprite_24px() and
+ * plot_masked_sprite_16px() would but takes its rows ready shifted and
+ * flipped, leaving only the masking to do.
+ *
+ * \param[in] state   Pointer to game state.
+ * \param[in] vischar Pointer to visible character.
+ *
+ * \return Zero if plotted. Non-zero if the sprite isn't cached, in which
+ * case nothing is plotted.
+ */
+static int plot_cached_sprite(tgestate_t *state, const vischar_t *vischar)
+{
+  const spritedef_t *sprite;
+  ptrdiff_t          index;
+  int                width;
+  int                shift;
+  int                flip;
+  uint8_t            iters;
+  uint8_t            enables[4];
+  int                shift_cost;
+  size_t             skip;
+  const uint8_t     *row;
+  const uint8_t     *foremaskptr;
+  uint8_t           *screenptr;
+  int                i;
+
+  if (state->spritecache == NULL)
+    return 1;
+
+  sprite = &vischar->mi.sprite[state->sprite_index & ~sprite_FLAG_FLIP];
+  index  = sprite - &sprites[0];
+  if (index < 0 || index >= sprite__LIMIT)
+    return 1;
+
+  width = sprite->width;
+  shift = vischar->isopos.x & 7;
+  flip  = (state->sprite_index & sprite_FLAG_FLIP) != 0;
+
+  /* Pick the same heights and enables as the shifting plotters. */
+  shift_cost = (shift < 4) ? shift + 1 : 8 - shift;
+  if (width == 4)
+  {
+    if (shift < 4)
+    {
+      iters = state->spriteplotter.height_24_right;
+      enables[0] = state->spriteplotter.enable_24_right_1;
+      enables[1] = state->spriteplotter.enable_24_right_2;
+      enables[2] = state->spriteplotter.enable_24_right_3;
+      enables[3] = state->spriteplotter.enable_24_right_4;
+    }
+    else
+    {
+      iters = state->spriteplotter.height_24_left;
+      enables[0] = state->spriteplotter.enable_24_left_1;
+      enables[1] = state->spriteplotter.enable_24_left_2;
+      enables[2] = state->spriteplotter.enable_24_left_3;
+      enables[3] = state->spriteplotter.enable_24_left_4;
+    }
+    COST((COST_SPRITE_24_ROW +
+          COST_SPRITE_24_SHIFT * shift_cost +
+          (flip ? COST_SPRITE_24_FLIP : 0)) * iters);
+  }
+  else
+  {
+    assert(width == 3);
+
+    if (shift < 4)
+    {
+      iters = state->spriteplotter.height_16_left;
+      enables[0] = state->spriteplotter.enable_16_left_1;
+      enables[1] = state->spriteplotter.enable_16_left_2;
+      enables[2] = state->spriteplotter.enable_16_left_3;
+    }
+    else
+    {
+      iters = state->spriteplotter.height_16_right;
+      enables[0] = state->spriteplotter.enable_16_right_1;
+      enables[1] = state->spriteplotter.enable_16_right_2;
+      enables[2] = state->spriteplotter.enable_16_right_3;
+    }
+    COST((COST_SPRITE_16_ROW +
+          COST_SPRITE_16_SHIFT * shift_cost +
+          (flip ? COST_SPRITE_16_FLIP : 0)) * iters);
+  }
+  assert(iters <= MASK_BUFFER_HEIGHT * 8);
+
+  /* setup_vischar_plotting() advanced the bitmap pointer past any rows
+   * clipped from the top. */
+  skip = (size_t) (state->bitmap_pointer - sprite->bitmap) / (width - 1);
+  assert(skip + iters <= sprite->height);
+
+  row = state->spritecache->rows[index][flip][shift] + skip * width * 2;
+
+  /* Conv: The sprite may overrun into the following scanline. */
+  invalidate_window_buf(state, state->window_buf_pointer, iters + 1);
+
+  foremaskptr = state->foreground_mask_pointer;
+  screenptr   = state->window_buf_pointer;
+  do
+  {
+    ASSERT_MASK_BUF_PTR_VALID(foremaskptr);
+    ASSERT_WINDOW_BUF_PTR_VALID(screenptr, width - 1);
+
+    for (i = 0; i < width; i++)
+      if (enables[i])
+        screenptr[i] = ((~foremaskptr[i] | row[i * 2 + 1]) & screenptr[i]) |
+                       (row[i * 2] & foremaskptr[i]);
+
+    row         += width * 2;
+    foremaskptr += 4;
+    screenptr   += state->columns;
+  }
+  while (--iters);
+
+  state->foreground_mask_pointer = foremaskptr;
+  state->window_buf_pointer      = screenptr;
+
+  return 0;
+}
+
+#endif /* TGE_SPRITE_CACHE */
+
 /**
  * $E102: Sprite plotter for 24-pixel-wide sprites. Used for characters and
  * objects.
@@ -9919,6 +10723,11 @@ void plot_masked_sprite_24px(tgestate_t *state, vischar_t *vischar)
   assert(state != NULL);
   ASSERT_VISCHAR_VALID(vischar);
 
+#ifdef TGE_SPRITE_CACHE
+  if (plot_cached_sprite(state, vischar) == 0)
+    return;
+#endif
+
   if ((x = (vischar->isopos.x & 7)) < 4)
   {
     /* Shift right */
@@ -9933,6 +10742,11 @@ void plot_masked_sprite_24px(tgestate_t *state, vischar_t *vischar)
 
     iters = state->spriteplotter.height_24_right;
     assert(iters <= MASK_BUFFER_HEIGHT * 8);
+    COST((COST_SPRITE_24_ROW +
+          COST_SPRITE_24_SHIFT * (4 - x) +
+          ((state->sprite_index & sprite_FLAG_FLIP) ? COST_SPRITE_24_FLIP : 0)) * iters);
+    /* Conv: The sprite may overrun into the following scanline. */
+    invalidate_window_buf(state, state->window_buf_pointer, iters + 1);
     do
     {
       uint8_t bm0, bm1, bm2, bm3;         /* was B, C, E, D */
@@ -10057,6 +10871,11 @@ void plot_masked_sprite_24px(tgestate_t *state, vischar_t *vischar)
 
     iters = state->spriteplotter.height_24_left;
     assert(iters <= MASK_BUFFER_HEIGHT * 8);
+    COST((COST_SPRITE_24_ROW +
+          COST_SPRITE_24_SHIFT * (4 - x) +
+          ((state->sprite_index & sprite_FLAG_FLIP) ? COST_SPRITE_24_FLIP : 0)) * iters);
+    /* Conv: The sprite may overrun into the following scanline. */
+    invalidate_window_buf(state, state->window_buf_pointer, iters + 1);
     do
     {
       /* Note the different variable order to the case above. */
@@ -10206,6 +11025,11 @@ void plot_masked_sprite_16px(tgestate_t *state, vischar_t *vischar)
 
   ASSERT_VISCHAR_VALID(vischar);
 
+#ifdef TGE_SPRITE_CACHE
+  if (plot_cached_sprite(state, vischar) == 0)
+    return;
+#endif
+
   x = vischar->isopos.x & 7;
   if (x < 4)
     plot_masked_sprite_16px_right(state, x); /* was fallthrough */
@@ -10244,6 +11068,11 @@ void plot_masked_sprite_16px_right(tgestate_t *state, uint8_t x)
 
   iters = state->spriteplotter.height_16_left; /* self modified by $E49D (setup_vischar_plotting) */
   assert(iters <= MASK_BUFFER_HEIGHT * 8);
+  COST((COST_SPRITE_16_ROW +
+        COST_SPRITE_16_SHIFT * (4 - x) +
+        ((state->sprite_index & sprite_FLAG_FLIP) ? COST_SPRITE_16_FLIP : 0)) * iters);
+  /* Conv: The sprite may overrun into the following scanline. */
+  invalidate_window_buf(state, state->window_buf_pointer, iters + 1);
 
   ASSERT_WINDOW_BUF_PTR_VALID(state->window_buf_pointer, 2);
   ASSERT_WINDOW_BUF_PTR_VALID(state->window_buf_pointer + (iters - 1) * state->columns + 2 - 1, 2);
@@ -10383,6 +11212,11 @@ void plot_masked_sprite_16px_left(tgestate_t *state, uint8_t x)
 
   iters = state->spriteplotter.height_16_right; /* self modified by $E49D (setup_vischar_plotting) */
   assert(iters <= MASK_BUFFER_HEIGHT * 8);
+  COST((COST_SPRITE_16_ROW +
+        COST_SPRITE_16_SHIFT * (4 - x) +
+        ((state->sprite_index & sprite_FLAG_FLIP) ? COST_SPRITE_16_FLIP : 0)) * iters);
+  /* Conv: The sprite may overrun into the following scanline. */
+  invalidate_window_buf(state, state->window_buf_pointer, iters + 1);
 
   ASSERT_WINDOW_BUF_PTR_VALID(state->window_buf_pointer, 2);
   ASSERT_WINDOW_BUF_PTR_VALID(state->window_buf_pointer + (iters - 1) * state->columns + 2 - 1, 2);
@@ -10847,9 +11681,32 @@ void scale_mappos_down(const mappos16_t *in, mappos8_t *out)
 
 /* ----------------------------------------------------------------------- */
 
+/**
+ * Conv: Tell the Spectrum that game window rows 'first' to 'last' inclusive
+ * have been plotted.
+ *
+ * \param[in] state Pointer to game state.
+ * \param[in] first First row plotted.
+ * \param[in] last  Last row plotted.
+ */
+static void draw_game_window_rows(tgestate_t *state, int first, int last)
+{
+  zxbox_t dirty;
+
+  dirty.x0 = 7 * 8;
+  dirty.y0 = 22 * 8 - (last + 1);
+  dirty.x1 = 30 * 8;
+  dirty.y1 = 22 * 8 - first;
+  state->speccy->draw(state->speccy, &dirty);
+}
+
 /**
  * $EED3: Plot the game screen.
  *
+ * Conv: Only the rows of window_buf which have been written since the last
+ * call are copied to the screen. The cost charged is that of the original's
+ * full copy.
+ *
  * \param[in] state Pointer to game state.
  */
 void plot_game_window(tgestate_t *state)
@@ -10859,91 +11716,83 @@ void plot_game_window(tgestate_t *state)
   uint8_t         y;         /* was A */
   const uint8_t  *src;       /* was HL */
   const uint16_t *offsets;   /* was SP */
-  uint8_t         y_iters_A; /* was A */
-  uint8_t        *dst;       /* was DE */
-  uint8_t         prev;      /* was A */
-  uint8_t         y_iters_B; /* was B' */
-  uint8_t         iters;     /* was B */
-  uint8_t         tmp;       /* Conv: added for RRD macro */
+  uint8_t         y_iters;   /* was A or B' */
+  int             scanline;  /* Conv: window_buf scanline of the current row */
+  int             row;       /* Conv: index of the current row */
+  int             run;       /* Conv: first row of the current run of plotted rows, or -1 */
 
   assert(state->game_window_offset.x == 0 * 24 ||
          state->game_window_offset.x == 2 * 24 ||
          state->game_window_offset.x == 4 * 24 ||
          state->game_window_offset.x == 6 * 24);
 
+#define WINDOW_BUF_DIRTY(scanline) \
+  ((state->window_buf_dirty[(scanline) >> 5] >> ((scanline) & 31)) & 1)
+
+  scanline = state->game_window_offset.x / 24;
+  row      = 0;
+  run      = -1;
+
   y = state->game_window_offset.y; // might not be a Y value. seems to only ever be 0 or 255.
   assert(y == 0 || y == 255);
+
+  /* Conv: The original has separate loops for the two cases: an unrolled
+   * run of 23 copies, skipping the first byte of the row, or a loop which
+   * rotates each byte's nibbles into its neighbour. Here they share a loop
+   * and call out to a row blitter for each. */
+  offsets = &game_window_start_offsets[0];
   if (y == 0)
   {
     src = &state->window_buf[1] + state->game_window_offset.x;
-    ASSERT_WINDOW_BUF_PTR_VALID(src, 0);
-    offsets = &game_window_start_offsets[0];
-    y_iters_A = 128; /* iterations */
-    do
-    {
-      dst = screen + *offsets++;
-      ASSERT_SCREEN_PTR_VALID(dst);
-
-      *dst++ = *src++; /* unrolled: 23 copies */
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      *dst++ = *src++;
-      src++; // skip 24th
-    }
-    while (--y_iters_A);
+    COST(COST_GAME_WINDOW_ROW * 128);
   }
   else
   {
     src = &state->window_buf[0] + state->game_window_offset.x;
-    ASSERT_WINDOW_BUF_PTR_VALID(src, 0);
-    prev = *src++;
-    offsets = &game_window_start_offsets[0];
-    y_iters_B = 128; /* iterations */
-    do
-    {
-      dst = screen + *offsets++;
-      ASSERT_SCREEN_PTR_VALID(dst);
+    COST(COST_GAME_WINDOW_SHIFTED_ROW * 128);
+  }
+  ASSERT_WINDOW_BUF_PTR_VALID(src, 0);
 
-      /* Conv: Unrolling removed compared to original code which did 4 groups of 5 ops, then a final 3. */
-      iters = 4 * 5 + 3; /* 23 iterations */
-      do
+  y_iters = 128; /* iterations */
+  do
+  {
+    if (!WINDOW_BUF_DIRTY(scanline))
+    {
+      /* Conv: Unchanged since last time so skip it. */
+      if (run >= 0)
       {
-        /* Conv: Original code banks and shuffles registers to preserve stuff. This is simplified. */
-
-        tmp = prev & 0x0F;
-        prev = *src; // save pixel so we can use the bottom nibble next time around
-        *dst++ = (*src++ >> 4) | (tmp << 4);
+        draw_game_window_rows(state, run, row - 1);
+        run = -1;
       }
-      while (--iters);
+    }
+    else
+    {
+      uint8_t *dst; /* was DE */
 
-      prev = *src++;
+      if (run < 0)
+        run = row;
+
+      dst = screen + *offsets;
+      ASSERT_SCREEN_PTR_VALID(dst);
+
+      if (y == 0)
+        plot_game_window_row(dst, src);
+      else
+        plot_game_window_row_shifted(dst, src);
     }
-    while (--y_iters_B);
+    offsets++;
+    src += 24;
+    scanline++;
+    row++;
   }
+  while (--y_iters);
 
-  {
-    static const zxbox_t dirty = { 7*8, 6*8, 30*8, 22*8 };
-    state->speccy->draw(state->speccy, &dirty);
-  }
+#undef WINDOW_BUF_DIRTY
+
+  if (run >= 0)
+    draw_game_window_rows(state, run, row - 1);
+
+  memset(state->window_buf_dirty, 0, sizeof(state->window_buf_dirty));
 }
 
 /* ----------------------------------------------------------------------- */
@@ -11003,7 +11852,7 @@ not_at_roll_call:
  *
  * \param[in] state Pointer to game state.
  *
- * \remarks Exits using longjmp if the action takes place.
+ * \remarks Squashes the stack if the action takes place.
  */
 void action_papers(tgestate_t *state)
 {
@@ -11051,54 +11900,85 @@ void action_papers(tgestate_t *state)
 
 /* ----------------------------------------------------------------------- */
 
+/** $F014 */
+static const screenlocstring_t screenlocstring_confirm_y_or_n =
+{
+  0x100B, 15, "CONFIRM. Y OR N"
+};
+
 /**
  * $EFFC: Waits for the user to press Y or N.
  *
+ * Conv: This blocking form is used by the menu only. The game proper calls
+ * user_confirm_prompt() then polls user_confirm_keyscan() once per slice.
+ *
  * \param[in] state Pointer to game state.
  *
- * \return 0 if 'Y' pressed, 1 if 'N' pressed.
+ * \return 0 if 'Y' pressed, 1 if 'N' pressed, or -1 if the game thread is
+ * to terminate.
  */
 int user_confirm(tgestate_t *state)
 {
-  /** $F014 */
-  static const screenlocstring_t screenlocstring_confirm_y_or_n =
-  {
-    0x100B, 15, "CONFIRM. Y OR N"
-  };
-
-  uint8_t keymask; /* was A */
-  int     flags;   /* Conv: added */
+  int flags; /* Conv: added */
 
   assert(state != NULL);
 
-  screenlocstring_plot(state, &screenlocstring_confirm_y_or_n);
+  user_confirm_prompt(state);
 
   /* Keyscan. */
   for (;;)
   {
-    keymask = state->speccy->in(state->speccy, port_KEYBOARD_POIUY);
-    if ((keymask & (1 << 4)) == 0)
-    {
-      flags = 0; /* is 'Y' pressed? return Z */
-      goto exit;
-    }
-
-    keymask = state->speccy->in(state->speccy, port_KEYBOARD_SPACESYMSHFTMNB);
-    keymask = ~keymask;
-    if ((keymask & (1 << 3)) != 0)
-    {
-      flags = 1; /* is 'N' pressed? return NZ */
-      goto exit;
-    }
+    flags = user_confirm_keyscan(state);
+    if (flags >= 0)
+      return flags;
 
     /* Conv: Timing: The original game keyscans as fast as it can. We can't
      * have that so instead we introduce a short delay and handle game thread
      * termination. */
-    gamedelay(state, 3500000 / 50); /* 50/sec */
+    if (menudelay(state, 3500000 / 50)) /* 50/sec */
+      return -1;
   }
+}
 
-exit:
-  return flags;
+/**
+ * Prints the "CONFIRM. Y OR N" prompt.
+ *
+ * Conv: Split out of user_confirm().
+ *
+ * \param[in] state Pointer to game state.
+ */
+void user_confirm_prompt(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  screenlocstring_plot(state, &screenlocstring_confirm_y_or_n);
+}
+
+/**
+ * Scans the keyboard once for Y or N.
+ *
+ * Conv: Split out of user_confirm().
+ *
+ * \param[in] state Pointer to game state.
+ *
+ * \return 0 if 'Y' pressed, 1 if 'N' pressed, or -1 if neither.
+ */
+int user_confirm_keyscan(tgestate_t *state)
+{
+  uint8_t keymask; /* was A */
+
+  assert(state != NULL);
+
+  keymask = state->speccy->in(state->speccy, port_KEYBOARD_POIUY);
+  if ((keymask & (1 << 4)) == 0)
+    return 0; /* is 'Y' pressed? return Z */
+
+  keymask = state->speccy->in(state->speccy, port_KEYBOARD_SPACESYMSHFTMNB);
+  keymask = ~keymask;
+  if ((keymask & (1 << 3)) != 0)
+    return 1; /* is 'N' pressed? return NZ */
+
+  return -1;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -11137,6 +12017,58 @@ TGE_API int tge_menu(tgestate_t *state)
   return menu_screen(state);
 }
 
+/**
+ * Advance the current activity by one step (in addition to original game
+ * code).
+ *
+ * \param[in] state Pointer to game state.
+ *
+ * \return Non-zero if the step slept, i.e. the slice is complete.
+ */
+static int run_activity(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  state->squashed = 0;
+
+  switch (state->activity)
+  {
+  case activity_MAIN_LOOP:
+  case activity_MAIN_LOOP_RESUME:
+    main_loop(state);
+    return !state->squashed; /* main_loop only sleeps if it completes */
+
+  case activity_ZOOMBOX:
+    zoombox_step(state);
+    return 1;
+
+  case activity_ENTERED_ROOM:
+    entered_room(state);
+    return 0;
+
+  case activity_BREAK_PROMPT:
+    keyscan_break_prompt(state);
+    return 0;
+
+  case activity_BREAK_CONFIRM:
+    return keyscan_break_confirm(state);
+
+  case activity_ESCAPED_MESSAGES:
+    escaped_messages(state);
+    return 0;
+
+  case activity_ESCAPED_RELEASE:
+  case activity_ESCAPED_PRESS:
+    escaped_keyscan(state);
+    return 1; /* keyscan_all always sleeps */
+
+  default:
+    assert("Unknown activity" == NULL);
+    state->activity = activity_MAIN_LOOP;
+    return 0;
+  }
+}
+
 /**
  * $F17D: Setup the game proper.
  *
@@ -11229,45 +12161,66 @@ TGE_API void tge_setup2(tgestate_t *state)
   }
   while (--iters);
 
-  // Conv: Set up a jmpbuf so the game will return here.
-  if (setjmp(state->jmpbuf_main) == 0)
-  {
-    /* In the original code this wiped all state from $8100 up until the
-     * start of tiles ($8218). We'll assume for now that tgestate_t is
-     * calloc'd and so zeroed by default. */
-
-    reset_game(state);
+  /* In the original code this wiped all state from $8100 up until the
+   * start of tiles ($8218). We'll assume for now that tgestate_t is
+   * calloc'd and so zeroed by default. */
 
-    // reset_game, which in turn calls enter_room which exits via longjmp to after this if statement block
+  reset_game(state);
+  // reset_game calls enter_room which squashes the stack having started the zoombox
 
-    // i reckon this never gets this far, as reset_game jumps to enter_room itself
-    //enter_room(state); // returns by goto main_loop
-    NEVER_RETURNS;
-  }
-  // we arrive here once the game is initialised and the initial bedroom scene is drawn and zoomboxed onto the screen
+  /* Conv: Run the zoombox here so that we return once the initial bedroom
+   * scene is drawn and zoomboxed onto the screen, as the original did. */
+  while (state->activity != activity_MAIN_LOOP)
+    (void) run_activity(state);
 }
 
 /**
  * Entry point for the main game loop (in addition to original game code).
  *
- * This sets up a jump buffer so that various point in the game code can long
- * jump to the exit.
+ * Conv: The original game never returns from its main loop and blocks in
+ * nested loops while zoomboxing or waiting for keypresses. This instead runs
+ * activities until one sleeps, then returns. Routines which would have
+ * squashed the stack set a flag and unwind back to here.
  *
  * \param[in] state Pointer to game state.
+ *
+ * \return Status indicating what the slice was doing.
  */
-TGE_API void tge_main(tgestate_t *state)
+TGE_API tgestatus_t tge_main(tgestate_t *state)
 {
-  if (setjmp(state->jmpbuf_main) == 0)
-  {
-    /* On entry we run the main loop. */
-    main_loop(state);
-  }
-  else
+  activity_t activity;
+
+  assert(state != NULL);
+
+  do
+    activity = state->activity;
+  while (!run_activity(state));
+
+  if (state->rewind)
+    rewind_record(state);
+
+  switch (activity)
   {
-    /* If something wanted to exit quickly we arrive here. */
+  case activity_ZOOMBOX:
+    return tgestatus_TRANSITION;
+
+  case activity_BREAK_CONFIRM:
+  case activity_ESCAPED_RELEASE:
+  case activity_ESCAPED_PRESS:
+    return tgestatus_WAITING;
+
+  default:
+    return tgestatus_FRAME_DONE;
   }
 }
 
+TGE_API uint64_t tge_tstates(const tgestate_t *state)
+{
+  assert(state != NULL);
+
+  return state->total_tstates;
+}
+
 /* ----------------------------------------------------------------------- */
 
 /**
@@ -11290,6 +12243,9 @@ void wipe_full_screen_and_attributes(tgestate_t *state)
   /* Set the screen border to black. */
   state->speccy->out(state->speccy, port_BORDER_EAR_MIC, 0);
 
+  /* Conv: The game window must be replotted in full. */
+  invalidate_game_window(state);
+
   /* Redraw the whole screen. */
   state->speccy->draw(state->speccy, NULL); // Conv: Added
 }
@@ -26,6 +26,7 @@
 #include "TheGreatEscape/TheGreatEscape.h"
 
 #include "TheGreatEscape/Asserts.h"
+#include "TheGreatEscape/Cost.h"
 #include "TheGreatEscape/Main.h"
 #include "TheGreatEscape/Music.h"
 #include "TheGreatEscape/Screen.h"
@@ -141,6 +142,9 @@ static void wipe_game_window(tgestate_t *state)
   }
   while (--iters);
 
+  /* Conv: The game window must be replotted in full. */
+  invalidate_game_window(state);
+
   /* Conv: Invalidation added over the original game. */
   invalidate_bitmap(state,
                     screen + game_window_start_offsets[0],
@@ -215,14 +219,15 @@ static int choose_keys(tgestate_t *state)
    */
   static const uint16_t key_name_screen_offsets[5] =
   {
-    0x00D5,
-    0x0815,
-    0x0855,
-    0x0895,
-    0x08D5,
+    ZXSCREEN_FROM_INTERLEAVED(0x00D5),
+    ZXSCREEN_FROM_INTERLEAVED(0x0815),
+    ZXSCREEN_FROM_INTERLEAVED(0x0855),
+    ZXSCREEN_FROM_INTERLEAVED(0x0895),
+    ZXSCREEN_FROM_INTERLEAVED(0x08D5),
   };
 
   uint8_t *const screen = &state->speccy->screen.pixels[0]; /* Conv: Added */
+  int            confirmed;                                 /* Conv: Added */
 
   /* Loop while the user does not confirm. */
   for (;;)
@@ -243,7 +248,7 @@ static int choose_keys(tgestate_t *state)
       uint8_t     iters;     /* was B */
       const char *string;    /* was HL */
 
-      screenptr = &state->speccy->screen.pixels[prompt->screenloc];
+      screenptr = &state->speccy->screen.pixels[ZXSCREEN_FROM_INTERLEAVED(prompt->screenloc)];
       iters  = prompt->length;
       string = prompt->string;
       do
@@ -405,7 +410,10 @@ assign_keydef:
         return -1; /* Terminate the game thread */
 
     /* Wait for user's input */
-    if (user_confirm(state) == 0) /* Confirmed - return */
+    confirmed = user_confirm(state);
+    if (confirmed < 0)
+      return -1; /* Terminate the game thread */
+    if (confirmed == 0) /* Confirmed - return */
       return 1; /* Start the game */
   }
 }
@@ -521,7 +529,6 @@ int menu_screen(tgestate_t *state)
   uint8_t  C;               /* was C */
   uint8_t  Bdash;           /* was B' */
   uint8_t  Cdash;           /* was C' */
-  uint8_t  bit = 0; // most recently emitted bit
 
   assert(state != NULL);
 
@@ -569,19 +576,21 @@ int menu_screen(tgestate_t *state)
     minor_delay = 255;
     do
     {
-      int to_emit = 3; // Conv: Whatever we do always emit this many bits
+      COST(COST_MENU_MUSIC_ITER);
 
       // B,C are a pair of counters? half pulse length?
       // B = lo, C = hi  (in this routine)
 
+      /* Conv: Speaker edges are timestamped and buffered rather than OUT
+       * immediately. The original's loop timing holds the EAR port's level
+       * between them. */
+
       B = counter_0 >> 8;
       C = counter_0 & 0xFF;
       if (--B == 0 && --C == 0)
       {
         speaker0 ^= port_MASK_EAR;
-        bit = speaker0 & port_MASK_EAR;
-        state->speccy->out(state->speccy, port_BORDER_EAR_MIC, speaker0);
-        to_emit--;
+        ZXSPECTRUM_SPEAKER(state->speccy, VIRTUAL_TSTATES(), speaker0 & port_MASK_EAR);
         counter_0 = frequency_0;
       }
       else
@@ -594,29 +603,20 @@ int menu_screen(tgestate_t *state)
       if (--Bdash == 0 && --Cdash == 0)
       {
         speaker1 ^= port_MASK_EAR;
-        bit = speaker1 & port_MASK_EAR;
-        state->speccy->out(state->speccy, port_BORDER_EAR_MIC, speaker1);
-        to_emit--;
+        ZXSPECTRUM_SPEAKER(state->speccy, VIRTUAL_TSTATES(), speaker1 & port_MASK_EAR);
         counter_1 = frequency_1;
       }
       else
       {
         counter_1 = (Bdash << 8) | Cdash;
       }
-
-      /* Conv: We simulate the EAR port holding its level by adding extra
-       * OUTs here. */
-      // FIXME: The timing needs working out here: 3 OUTs per loop works,
-      // but why?
-      while (to_emit-- > 0)
-        state->speccy->out(state->speccy, port_BORDER_EAR_MIC, bit);
     }
     while (--minor_delay);
   }
   while (--major_delay);
 
   /* Conv: Timing: Calibrated to original game. */
-  if (state->speccy->sleep(state->speccy, 300365))
+  if (framedelay(state, COST_MENU))
     return -1; /* Terminate the game thread */
 
   return 0; /* Don't start the game */
@@ -18,6 +18,7 @@
 /* ----------------------------------------------------------------------- */
 
 #include <stddef.h>
+#include <string.h>
 
 #include "C99/Types.h"
 
@@ -25,13 +26,39 @@
 
 #include "TheGreatEscape/Screen.h"
 
+/* Vector versions of the game window row blits. SSE2 and NEON are always
+ * present on the 64-bit targets so no runtime detection is needed. */
+#if defined(__x86_64__) || defined(_M_X64)
+#define WINDOW_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define WINDOW_NEON
+#include <arm_neon.h>
+#endif
+
 /* ----------------------------------------------------------------------- */
 
 /**
  * $EDD3: Game screen start addresses.
  *
  * Absolute addresses in the original code. These are now offsets.
+ *
+ * Conv: When the screen is linear these are generated instead.
  */
+#ifdef ZXSCREEN_LINEAR
+#define ROW(y)  ZXSCREEN_OFFSET(7, 2 * 8 + (y))
+#define ROWS(y) ROW(y + 0), ROW(y + 1), ROW(y + 2), ROW(y + 3), \
+                ROW(y + 4), ROW(y + 5), ROW(y + 6), ROW(y + 7)
+const uint16_t game_window_start_offsets[128] =
+{
+  ROWS(  0), ROWS(  8), ROWS( 16), ROWS( 24),
+  ROWS( 32), ROWS( 40), ROWS( 48), ROWS( 56),
+  ROWS( 64), ROWS( 72), ROWS( 80), ROWS( 88),
+  ROWS( 96), ROWS(104), ROWS(112), ROWS(120)
+};
+#undef ROWS
+#undef ROW
+#else
 const uint16_t game_window_start_offsets[128] =
 {
   0x0047,
@@ -163,6 +190,7 @@ const uint16_t game_window_start_offsets[128] =
   0x1627,
   0x1727,
 };
+#endif
 
 /* ----------------------------------------------------------------------- */
 
@@ -181,10 +209,8 @@ void invalidate_bitmap(tgestate_t *state,
   offset = start - base;
 
   /* Convert screen offset to cartesian for the interface. */
-  x = (offset & 31) * 8;
-  y = ((offset & 0x0700) >> 8) |
-      ((offset & 0x00E0) >> 2) |
-      ((offset & 0x1800) >> 5);
+  x = ZXSCREEN_X(offset) * 8;
+  y = ZXSCREEN_Y(offset);
   y = 191 - y;    /* flip */
   y = y + 1;      /* inclusive lower bound becomes exclusive upper */
   y = y - height; /* get min-y */
@@ -220,7 +246,92 @@ void invalidate_attrs(tgestate_t *state,
   dirty.y0 = y;
   dirty.x1 = x + width;
   dirty.y1 = y + height;
-  state->speccy->draw(state->speccy, &dirty);
+  state->speccy->draw_attrs(state->speccy, &dirty);
+}
+
+void invalidate_window_buf(tgestate_t    *state,
+                           const uint8_t *addr,
+                           int            height)
+{
+  ptrdiff_t offset;
+  int       y0, y1;
+
+  /* Sprite plotters may be positioned before the start of the buffer so
+   * round down rather than towards zero. */
+  offset = addr - state->window_buf;
+  y0 = (int) ((offset >= 0 ? offset : offset - (state->columns - 1)) / state->columns);
+  y1 = y0 + height;
+
+  if (y0 < 0)
+    y0 = 0;
+  if (y1 > state->rows * 8)
+    y1 = state->rows * 8;
+
+  for (; y0 < y1; y0++)
+    state->window_buf_dirty[y0 >> 5] |= 1u << (y0 & 31);
+}
+
+void invalidate_game_window(tgestate_t *state)
+{
+  memset(state->window_buf_dirty, 0xFF, sizeof(state->window_buf_dirty));
+}
+
+/* ----------------------------------------------------------------------- */
+
+/* A game window row is 23 bytes wide. The vector versions handle it as two
+ * overlapping 16-byte halves: bytes 0..15 then bytes 7..22. */
+
+void plot_game_window_row(uint8_t *dst, const uint8_t *src)
+{
+#if defined(WINDOW_SSE2)
+  __m128i lo, hi;
+
+  lo = _mm_loadu_si128((const __m128i *) (src + 0));
+  hi = _mm_loadu_si128((const __m128i *) (src + 7));
+  _mm_storeu_si128((__m128i *) (dst + 0), lo);
+  _mm_storeu_si128((__m128i *) (dst + 7), hi);
+#elif defined(WINDOW_NEON)
+  uint8x16_t lo, hi;
+
+  lo = vld1q_u8(src + 0);
+  hi = vld1q_u8(src + 7);
+  vst1q_u8(dst + 0, lo);
+  vst1q_u8(dst + 7, hi);
+#else
+  memcpy(dst, src, 23);
+#endif
+}
+
+void plot_game_window_row_shifted(uint8_t *dst, const uint8_t *src)
+{
+#if defined(WINDOW_SSE2)
+  /* SSE2 has no byte shifts so shift words and mask off the nibbles which
+   * crossed into the neighbouring byte. */
+  const __m128i hi_nibbles = _mm_set1_epi8((char) 0xF0);
+  const __m128i lo_nibbles = _mm_set1_epi8(0x0F);
+  __m128i       left, right;
+
+  left  = _mm_loadu_si128((const __m128i *) (src + 0));
+  right = _mm_loadu_si128((const __m128i *) (src + 1));
+  _mm_storeu_si128((__m128i *) (dst + 0),
+                   _mm_or_si128(_mm_and_si128(_mm_slli_epi16(left,  4), hi_nibbles),
+                                _mm_and_si128(_mm_srli_epi16(right, 4), lo_nibbles)));
+
+  left  = _mm_loadu_si128((const __m128i *) (src + 7));
+  right = _mm_loadu_si128((const __m128i *) (src + 8));
+  _mm_storeu_si128((__m128i *) (dst + 7),
+                   _mm_or_si128(_mm_and_si128(_mm_slli_epi16(left,  4), hi_nibbles),
+                                _mm_and_si128(_mm_srli_epi16(right, 4), lo_nibbles)));
+#elif defined(WINDOW_NEON)
+  /* Shift right then insert the left neighbour's low nibble on top. */
+  vst1q_u8(dst + 0, vsliq_n_u8(vshrq_n_u8(vld1q_u8(src + 1), 4), vld1q_u8(src + 0), 4));
+  vst1q_u8(dst + 7, vsliq_n_u8(vshrq_n_u8(vld1q_u8(src + 8), 4), vld1q_u8(src + 7), 4));
+#else
+  int i;
+
+  for (i = 0; i < 23; i++)
+    dst[i] = (uint8_t) ((src[i] << 4) | (src[i + 1] >> 4));
+#endif
 }
 
 /* ----------------------------------------------------------------------- */
@@ -78,7 +78,7 @@ uint8_t *plot_single_glyph(tgestate_t *state, int character, uint8_t *output)
   do
   {
     *output = *row++;
-    output += 256; /* Advance to next row. */
+    output += ZXSCREEN_SCANLINE_STRIDE; /* Advance to next row. */
   }
   while (--iters);
 
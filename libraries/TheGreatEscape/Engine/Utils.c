@@ -26,20 +26,32 @@
 
 /* ----------------------------------------------------------------------- */
 
+static int sleep_tstates(tgestate_t *state, int duration)
+{
+  state->total_tstates += duration;
+  return state->speccy->sleep(state->speccy, duration);
+}
+
 int menudelay(tgestate_t *state, int duration)
 {
   state->speccy->stamp(state->speccy);
-  return state->speccy->sleep(state->speccy, duration);
+  return sleep_tstates(state, duration);
 }
 
 void gamedelay(tgestate_t *state, int duration)
 {
-  int terminate;
-
   state->speccy->stamp(state->speccy);
-  terminate = state->speccy->sleep(state->speccy, duration);
-  if (terminate)
-    squash_stack_goto_main(state); /* exits from tge_main */
+  (void) sleep_tstates(state, duration);
+}
+
+int framedelay(tgestate_t *state, int overhead)
+{
+  int duration;
+
+  duration = state->tstates + overhead;
+  state->tstates = 0;
+
+  return sleep_tstates(state, duration);
 }
 
 /* ----------------------------------------------------------------------- */
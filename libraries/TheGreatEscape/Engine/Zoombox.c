@@ -26,6 +26,7 @@
 #include "TheGreatEscape/TheGreatEscape.h"
 
 #include "TheGreatEscape/Asserts.h"
+#include "TheGreatEscape/Cost.h"
 #include "TheGreatEscape/Main.h"
 #include "TheGreatEscape/Screen.h"
 #include "TheGreatEscape/State.h"
@@ -66,13 +67,16 @@ static void zoombox_draw_tile(tgestate_t     *state,
 /**
  * $ABA0: Zoombox.
  *
+ * Conv: This sets up the zoombox then returns. Each following call to
+ * zoombox_step() draws one frame of it. Once it completes the engine
+ * continues with activity 'then'.
+ *
  * \param[in] state Pointer to game state.
+ * \param[in] then  Activity to continue with once the zoombox completes.
  */
-void zoombox(tgestate_t *state)
+void zoombox(tgestate_t *state, activity_t then)
 {
   attribute_t attrs; /* was A */
-  uint8_t    *pvar;  /* was HL */
-  uint8_t     var;   /* was A */
 
   assert(state != NULL);
 
@@ -89,59 +93,78 @@ void zoombox(tgestate_t *state)
   state->zoombox.width  = 0;
   state->zoombox.height = 0;
 
-  do
-  {
-    state->speccy->stamp(state->speccy);
+  /* Conv: The zoombox draws over the game window so it must be replotted
+   * in full afterwards. */
+  invalidate_game_window(state);
 
-    /* Shrink X and grow width until X is 1 */
-    pvar = &state->zoombox.x;
-    var = *pvar;
-    if (var != 1)
-    {
-      (*pvar)--;
-      var--;
-      pvar[1]++;
-    }
+  state->activity      = activity_ZOOMBOX;
+  state->after_zoombox = then;
+}
 
-    /* Grow width until it's 22 */
-    pvar++; /* -> &state->width */
-    var += *pvar;
-    if (var < 22)
-      (*pvar)++;
+/**
+ * Draw one frame of the zoombox.
+ *
+ * Conv: This was the body of the loop in zoombox().
+ *
+ * \param[in] state Pointer to game state.
+ */
+void zoombox_step(tgestate_t *state)
+{
+  uint8_t *pvar; /* was HL */
+  uint8_t  var;  /* was A */
 
-    /* Shrink Y and grow height until Y is 1 */
-    pvar++; /* -> &state->zoombox.y */
-    var = *pvar;
-    if (var != 1)
-    {
-      (*pvar)--;
-      var--;
-      pvar[1]++;
-    }
+  assert(state != NULL);
+  assert(state->activity == activity_ZOOMBOX);
 
-    /* Grow height until it's 15 */
-    pvar++; /* -> &state->height */
-    var += *pvar;
-    if (var < 15)
-      (*pvar)++;
+  state->speccy->stamp(state->speccy);
 
-    zoombox_fill(state);
-    zoombox_draw_border(state);
+  /* Shrink X and grow width until X is 1 */
+  pvar = &state->zoombox.x;
+  var = *pvar;
+  if (var != 1)
+  {
+    (*pvar)--;
+    var--;
+    pvar[1]++;
+  }
 
-    /* Conv: Invalidation added over the original game. */
-    invalidate_bitmap(state,
-                      &state->speccy->screen.pixels[0] + game_window_start_offsets[(state->zoombox.y - 1) * 8] + state->zoombox.x - 1,
-                      (state->zoombox.width + 2) * 8,
-                      (state->zoombox.height + 2) * 8);
+  /* Grow width until it's 22 */
+  pvar++; /* -> &state->width */
+  var += *pvar;
+  if (var < 22)
+    (*pvar)++;
 
-    {
-      /* Conv: Timing: The original game slows in proportion to the size of
-       * the area being zoomboxed. We simulate that here. */
-      int delay = (state->zoombox.height + state->zoombox.width) * 110951 / 35;
-      state->speccy->sleep(state->speccy, delay);
-    }
+  /* Shrink Y and grow height until Y is 1 */
+  pvar++; /* -> &state->zoombox.y */
+  var = *pvar;
+  if (var != 1)
+  {
+    (*pvar)--;
+    var--;
+    pvar[1]++;
   }
-  while (state->zoombox.height + state->zoombox.width < 35);
+
+  /* Grow height until it's 15 */
+  pvar++; /* -> &state->height */
+  var += *pvar;
+  if (var < 15)
+    (*pvar)++;
+
+  zoombox_fill(state);
+  zoombox_draw_border(state);
+
+  /* Conv: Invalidation added over the original game. */
+  invalidate_bitmap(state,
+                    &state->speccy->screen.pixels[0] + game_window_start_offsets[(state->zoombox.y - 1) * 8] + state->zoombox.x - 1,
+                    (state->zoombox.width + 2) * 8,
+                    (state->zoombox.height + 2) * 8);
+
+  /* Conv: Timing: The original game slows in proportion to the size of
+   * the area being zoomboxed. The fill and border charge for that. */
+  (void) framedelay(state, 0);
+
+  if (state->zoombox.height + state->zoombox.width >= 35)
+    state->activity = state->after_zoombox;
 }
 
 /**
@@ -186,12 +209,13 @@ static void zoombox_fill(tgestate_t *state)
     {
       hz_count2 = state->zoombox.width; /* TODO: This duplicates the read above. */
       memcpy(dst, src, hz_count2);
+      COST(COST_ZOOMBOX_BYTE * hz_count2);
 
       // these computations might take the values out of range on the final iteration (but will never be used)
       dst += hz_count2; // this is LDIR post-increment. it can be removed along with the line below.
       src += hz_count2 + src_skip; // move to next source line
       dst -= hz_count1; // was E -= self_AC55; // undo LDIR postinc
-      dst += state->width * 8; // was D++; // move to next scanline
+      dst += ZXSCREEN_SCANLINE_STRIDE; // was D++; // move to next scanline
 
       if (iters2 > 1 || iters > 1)
         ASSERT_SCREEN_PTR_VALID(dst);
@@ -201,8 +225,12 @@ static void zoombox_fill(tgestate_t *state)
     dst = prev_dst;
 
     dst_stride = state->width; // scanline-to-scanline stride (32)
+#ifdef ZXSCREEN_LINEAR
+    dst_stride *= 8; // Conv: skip the seven scanlines already done
+#else
     if (((dst - screen_base) & 0xFF) >= 224) // 224+32 == 256, so do skip to next band // TODO: 224 should be (256 - state->width)
       dst_stride += 7 << 8; // was B = 7
+#endif
 
     dst += dst_stride;
   }
@@ -222,6 +250,20 @@ static void zoombox_draw_border(tgestate_t *state)
   uint8_t  iters; /* was B */
   int      delta; /* was DE */
 
+  /* Conv: Distance to the same position on the next or previous character
+   * row. On a linear screen that's always eight scanlines. */
+#ifdef ZXSCREEN_LINEAR
+#define NEXT_CHAR_ROW(addr) (state->width * 8)
+#define PREV_CHAR_ROW(addr) (-state->width * 8)
+#else
+#define NEXT_CHAR_ROW(addr) \
+  (state->width + /* move to next character row */ \
+   ((((addr) - screen_base) & 0xFF) >= 224 ? 0x0700 : 0)) /* was: if (L >= 224) // if adding 32 would overflow */
+#define PREV_CHAR_ROW(addr) \
+  (-state->width - /* move to previous character row */ \
+   ((((addr) - screen_base) & 0xFF) < 32 ? 0x0700 : 0)) /* was: if (L < 32) // if subtracting 32 would underflow */
+#endif
+
   addr = screen_base + game_window_start_offsets[(state->zoombox.y - 1) * 8]; // Conv: Screen base hoisted from table.
   ASSERT_SCREEN_PTR_VALID(addr);
 
@@ -237,9 +279,7 @@ static void zoombox_draw_border(tgestate_t *state)
 
   /* Top right */
   zoombox_draw_tile(state, zoombox_tile_TR, addr);
-  delta = state->width; // move to next character row
-  if (((addr - screen_base) & 0xFF) >= 224) // was: if (L >= 224) // if adding 32 would overflow
-    delta += 0x0700; // was D=7
+  delta = NEXT_CHAR_ROW(addr);
   addr += delta;
 
   /* Vertical, moving down */
@@ -247,9 +287,7 @@ static void zoombox_draw_border(tgestate_t *state)
   do
   {
     zoombox_draw_tile(state, zoombox_tile_VT, addr);
-    delta = state->width; // move to next character row
-    if (((addr - screen_base) & 0xFF) >= 224) // was: if (L >= 224) // if adding 32 would overflow
-      delta += 0x0700; // was D=7
+    delta = NEXT_CHAR_ROW(addr);
     addr += delta;
   }
   while (--iters);
@@ -265,9 +303,7 @@ static void zoombox_draw_border(tgestate_t *state)
 
   /* Bottom left */
   zoombox_draw_tile(state, zoombox_tile_BL, addr);
-  delta = -state->width; // move to next character row
-  if (((addr - screen_base) & 0xFF) < 32) // was: if (L < 32) // if subtracting 32 would underflow
-    delta -= 0x0700;
+  delta = PREV_CHAR_ROW(addr);
   addr += delta;
 
   /* Vertical, moving up */
@@ -275,12 +311,13 @@ static void zoombox_draw_border(tgestate_t *state)
   do
   {
     zoombox_draw_tile(state, zoombox_tile_VT, addr);
-    delta = -state->width; // move to next character row
-    if (((addr - screen_base) & 0xFF) < 32) // was: if (L < 32) // if subtracting 32 would underflow
-      delta -= 0x0700;
+    delta = PREV_CHAR_ROW(addr);
     addr += delta;
   }
   while (--iters);
+
+#undef PREV_CHAR_ROW
+#undef NEXT_CHAR_ROW
 }
 
 /**
@@ -317,22 +354,27 @@ static void zoombox_draw_tile(tgestate_t     *state,
   assert(tile < NELEMS(zoombox_tiles));
   ASSERT_SCREEN_PTR_VALID(addr_in);
 
+  COST(COST_ZOOMBOX_TILE);
+
   addr = addr_in; // was EX DE,HL
   row = &zoombox_tiles[tile].row[0];
   iters = 8;
   do
   {
     *addr = *row++;
-    addr += 256;
+    addr += ZXSCREEN_SCANLINE_STRIDE;
   }
   while (--iters);
 
   /* Conv: The original game can munge bytes directly here, assuming screen
    * addresses, but I can't... */
 
-  addr -= 256; /* Compensate for overshoot */
+  addr -= ZXSCREEN_SCANLINE_STRIDE; /* Compensate for overshoot */
   off = addr - &state->speccy->screen.pixels[0];
 
+#ifdef ZXSCREEN_LINEAR
+  attrs = &state->speccy->screen.attributes[ZXSCREEN_ATTRIBUTE_OFFSET(off)];
+#else
   attrs = &state->speccy->screen.attributes[off & 0xFF]; // to within a third
 
   // can i do ((off >> 11) << 8) ?
@@ -342,6 +384,7 @@ static void zoombox_draw_tile(tgestate_t     *state,
     if (off >= 0x1000)
       attrs += 256;
   }
+#endif
 
   *attrs = state->game_window_attribute;
 }
@@ -0,0 +1,127 @@
+/**
+ * MapCache.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Exterior map cache.
+ *
+ * When built with TGE_MAP_CACHE the whole exterior map is rendered once, on
+ * first use, into a flat bitmap alongside its tile indices. The outdoor tile
+ * plotters then copy rows out of it in place of resolving each tile through
+ * map[], supertiles[] and exterior_tiles[].
+ *
+ * The cache depends only on constant game data so a single copy is shared
+ * by every game instance (see Shared.c).
+ */
+
+#ifdef TGE_MAP_CACHE
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/ExteriorTiles.h"
+#include "TheGreatEscape/Map.h"
+#include "TheGreatEscape/MapCache.h"
+#include "TheGreatEscape/Shared.h"
+#include "TheGreatEscape/SuperTiles.h"
+
+/* ----------------------------------------------------------------------- */
+
+static sharedslot_t shared_cache;
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Render the whole exterior map.
+ *
+ * \param[out] cache Cache to render into.
+ */
+static void render(mapcache_t *cache)
+{
+  int                     y, x;
+  const supertileindex_t *maprow;
+  supertileindex_t        supertileindex;
+  tileindex_t             tile_index;
+  const tile_t           *tileset;
+  const tilerow_t        *src;
+  tilerow_t              *dst;
+  int                     i;
+
+  for (y = 0; y < MAPCACHE_HEIGHT; y++)
+  {
+    maprow = &map[(y >> 2) * MAPX];
+    for (x = 0; x < MAPCACHE_WIDTH; x++)
+    {
+      supertileindex = maprow[x >> 2];
+      assert(supertileindex < supertileindex__LIMIT);
+      tile_index = supertiles[supertileindex].tiles[(y & 3) * 4 + (x & 3)];
+
+      /* Select the tile set as plot_tile() does. */
+      if (supertileindex <= 44)
+        tileset = &exterior_tiles[0];
+      else if (supertileindex <= 138 || supertileindex >= 204)
+        tileset = &exterior_tiles[145];
+      else
+        tileset = &exterior_tiles[365];
+
+      cache->tiles[y][x] = tile_index;
+
+      src = &tileset[tile_index].row[0];
+      dst = &cache->pixels[y * 8][x];
+      for (i = 0; i < 8; i++)
+      {
+        *dst = *src++;
+        dst += MAPCACHE_WIDTH;
+      }
+    }
+  }
+}
+
+const mapcache_t *mapcache_get(void)
+{
+  mapcache_t *cache;
+
+  cache = shared_load(&shared_cache);
+  if (cache != NULL)
+    return cache;
+
+  cache = malloc(sizeof(*cache));
+  if (cache == NULL)
+    return NULL;
+
+  render(cache);
+
+  if (!shared_publish(&shared_cache, cache))
+  {
+    /* Another thread published one first. */
+    free(cache);
+    cache = shared_load(&shared_cache);
+  }
+
+  return cache;
+}
+
+TGE_API size_t tge_mapcache_size(void)
+{
+  return shared_load(&shared_cache) != NULL ? sizeof(mapcache_t) : 0;
+}
+
+#endif /* TGE_MAP_CACHE */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,104 @@
+/**
+ * MaskIndex.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Exterior mask index.
+ *
+ * For every sprite plotted outdoors render_mask_buffer() would test the
+ * bounds of all 58 exterior masks. When built with TGE_MASK_INDEX it looks
+ * up the masks which overlap the sprite here instead, then runs its depth
+ * tests on only those.
+ *
+ * Interior rooms have at most MAX_INTERIOR_MASK_REFS masks, copied out by
+ * setup_room(), so they're left alone.
+ *
+ * The index depends only on constant game data so a single copy is shared
+ * by every game instance (see Shared.c).
+ */
+
+#ifdef TGE_MASK_INDEX
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/MaskIndex.h"
+#include "TheGreatEscape/Masks.h"
+#include "TheGreatEscape/Shared.h"
+#include "TheGreatEscape/Utils.h"
+
+/* ----------------------------------------------------------------------- */
+
+static sharedslot_t shared_index;
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Add a mask to every position from 'first' to 'last' inclusive.
+ */
+static void add_span(maskset_t *positions, int first, int last, int mask)
+{
+  int i;
+
+  if (first < 0)
+    first = 0;
+  if (last > MASKINDEX_POSITIONS - 1)
+    last = MASKINDEX_POSITIONS - 1;
+
+  for (i = first; i <= last; i++)
+    positions[i] |= (maskset_t) 1 << mask;
+}
+
+const maskindex_t *maskindex_get(void)
+{
+  maskindex_t  *index;
+  int           i;
+  const mask_t *pmask;
+
+  assert(NELEMS(exterior_mask_data) <= (int) sizeof(maskset_t) * 8);
+
+  index = shared_load(&shared_index);
+  if (index != NULL)
+    return index;
+
+  index = calloc(1, sizeof(*index));
+  if (index == NULL)
+    return NULL;
+
+  /* These spans must match the culling tests in render_mask_buffer(). */
+  for (i = 0; i < NELEMS(exterior_mask_data); i++)
+  {
+    pmask = &exterior_mask_data[i];
+    add_span(&index->columns[0], pmask->bounds.x0 - 3, pmask->bounds.x1, i);
+    add_span(&index->rows[0],    pmask->bounds.y0 - 4, pmask->bounds.y1, i);
+  }
+
+  if (!shared_publish(&shared_index, index))
+  {
+    /* Another thread published one first. */
+    free(index);
+    index = shared_load(&shared_index);
+  }
+
+  return index;
+}
+
+#endif /* TGE_MASK_INDEX */
+
+// vim: ts=8 sts=2 sw=2 et
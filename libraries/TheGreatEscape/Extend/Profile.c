@@ -0,0 +1,255 @@
+/**
+ * Profile.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Main loop profiler.
+ *
+ * When built with TGE_PROFILE every phase of main_loop() is timed against a
+ * monotonic clock. Each game instance accumulates a count, total, minimum,
+ * maximum and log2 histogram of durations per phase. Phases which run more
+ * than once per frame, like ring_bell(), accumulate once per run.
+ *
+ * Reading the clock costs a few tens of nanoseconds per phase so the
+ * timings of the shortest phases are dominated by it.
+ */
+
+#ifdef TGE_PROFILE
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  ifndef _POSIX_C_SOURCE
+#    define _POSIX_C_SOURCE 199309L /* for clock_gettime */
+#  endif
+#  include <time.h>
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/State.h"
+
+#include "TheGreatEscape/Profile.h"
+
+/* ----------------------------------------------------------------------- */
+
+struct tgeprofile
+{
+  uint64_t          last;  /* clock at the previous mark */
+  tgeprofilephase_t phases[profile__LIMIT];
+};
+
+/* Indexed by profilephase_t. */
+static const char *phase_names[profile__LIMIT] =
+{
+  "check_morale",
+  "keyscan_break",
+  "message_display",
+  "process_player_input",
+  "in_permitted_area",
+  "restore_tiles",
+  "move_a_character",
+  "automatics",
+  "purge_invisible_characters",
+  "spawn_characters",
+  "mark_nearby_items",
+  "ring_bell",
+  "animate",
+  "move_map",
+  "plot_sprites",
+  "plot_game_window",
+  "nighttime",
+  "wave_morale_flag",
+  "dispatch_timed_event"
+};
+
+/* ----------------------------------------------------------------------- */
+
+/* Return a monotonic time in nanoseconds. */
+static uint64_t now_ns(void)
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER        counter;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000 +
+         (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000000 /
+                    frequency.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void clear(tgeprofile_t *profile)
+{
+  int i;
+
+  memset(profile->phases, 0, sizeof(profile->phases));
+  for (i = 0; i < profile__LIMIT; i++)
+  {
+    profile->phases[i].name   = phase_names[i];
+    profile->phases[i].min_ns = (uint64_t) -1;
+  }
+}
+
+/* ----------------------------------------------------------------------- */
+
+tgeprofile_t *profile_create(void)
+{
+  tgeprofile_t *profile;
+
+  profile = malloc(sizeof(*profile));
+  if (profile == NULL)
+    return NULL;
+
+  profile->last = now_ns();
+  clear(profile);
+
+  return profile;
+}
+
+void profile_destroy(tgeprofile_t *profile)
+{
+  free(profile);
+}
+
+void profile_start(tgestate_t *state)
+{
+  state->profile->last = now_ns();
+}
+
+void profile_lap(tgestate_t *state, profilephase_t phase)
+{
+  tgeprofile_t      *profile = state->profile;
+  tgeprofilephase_t *p;
+  uint64_t           now;
+  uint64_t           elapsed;
+  int                bucket;
+
+  assert(phase < profile__LIMIT);
+
+  now           = now_ns();
+  elapsed       = now - profile->last;
+  profile->last = now;
+
+  p = &profile->phases[phase];
+  p->count++;
+  p->total_ns += elapsed;
+  if (elapsed < p->min_ns)
+    p->min_ns = elapsed;
+  if (elapsed > p->max_ns)
+    p->max_ns = elapsed;
+
+  for (bucket = 0; bucket < TGE_PROFILE_BUCKETS - 1 && (elapsed >> 1) != 0; bucket++)
+    elapsed >>= 1;
+  p->histogram[bucket]++;
+}
+
+/* ----------------------------------------------------------------------- */
+
+TGE_API int tge_profile_phases(void)
+{
+  return profile__LIMIT;
+}
+
+TGE_API int tge_profile_get(const tgestate_t *state,
+                            int               index,
+                            tgeprofilephase_t *phase)
+{
+  assert(state != NULL);
+  assert(phase != NULL);
+
+  if (index < 0 || index >= profile__LIMIT)
+    return 1;
+
+  *phase = state->profile->phases[index];
+  if (phase->count == 0)
+    phase->min_ns = 0;
+
+  return 0;
+}
+
+TGE_API void tge_profile_reset(tgestate_t *state)
+{
+  assert(state != NULL);
+
+  clear(state->profile);
+}
+
+TGE_API int tge_profile_dump_json(const tgestate_t *state,
+                                  const char       *filename)
+{
+  FILE *f;
+  int   i;
+  int   j;
+
+  assert(state != NULL);
+  assert(filename != NULL);
+
+  f = fopen(filename, "w");
+  if (f == NULL)
+    return 1;
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"bucket_base_ns\": 1,\n");
+  fprintf(f, "  \"phases\": [\n");
+  for (i = 0; i < profile__LIMIT; i++)
+  {
+    tgeprofilephase_t phase;
+
+    tge_profile_get(state, i, &phase);
+
+    fprintf(f,
+            "    { \"name\": \"%s\", \"count\": %" PRIu64 ", "
+            "\"total_ns\": %" PRIu64 ", \"min_ns\": %" PRIu64 ", "
+            "\"max_ns\": %" PRIu64 ", \"mean_ns\": %.1f,\n"
+            "      \"histogram\": [",
+            phase.name,
+            phase.count,
+            phase.total_ns,
+            phase.min_ns,
+            phase.max_ns,
+            phase.count ? (double) phase.total_ns / phase.count : 0.0);
+    for (j = 0; j < TGE_PROFILE_BUCKETS; j++)
+      fprintf(f, "%s%" PRIu32, j ? ", " : "", phase.histogram[j]);
+    fprintf(f, "] }%s\n", i < profile__LIMIT - 1 ? "," : "");
+  }
+  fprintf(f, "  ]\n");
+  fprintf(f, "}\n");
+
+  return fclose(f) != 0;
+}
+
+#endif /* TGE_PROFILE */
+
+/* ----------------------------------------------------------------------- */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,414 @@
+/**
+ * Rewind.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Rewind history.
+ *
+ * Once enabled, every call to tge_main() appends the resulting game state to
+ * a ring of frames. Each frame is a snapshot image (see Snapshot.c) XORed
+ * against the most recent keyframe then run-length encoded. Consecutive
+ * frames differ only slightly from their keyframe so most of the XORed image
+ * is zero and encodes to a few hundred bytes. Keyframes are encoded the same
+ * way against an all-zero image.
+ *
+ * Each frame refers only to its keyframe so any frame can be reconstructed
+ * with at most two decodes. When the ring is full the oldest frame is
+ * dropped, along with any frames which depended upon it if it was a
+ * keyframe.
+ *
+ * Encoded form: a sequence of (skip, count, literal[count]) runs where skip
+ * and count are LEB128 varints. 'skip' bytes are unchanged from the
+ * reference then 'count' literal bytes are XORed into it.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/State.h"
+
+#include "TheGreatEscape/Rewind.h"
+#include "TheGreatEscape/Snapshot.h"
+
+/* ----------------------------------------------------------------------- */
+
+/* Maximum number of frames between keyframes. */
+#define KEYFRAME_INTERVAL (60)
+
+/* ----------------------------------------------------------------------- */
+
+typedef struct rewindframe
+{
+  uint8_t *data;      /* encoded frame */
+  size_t   length;    /* length of encoded frame */
+  size_t   allocated; /* allocated length of 'data' */
+  int      keyframe;  /* non-zero if encoded against zero */
+}
+rewindframe_t;
+
+struct tgerewind
+{
+  size_t         image_size;
+  uint8_t       *image;          /* scratch image for capture and restore */
+  uint8_t       *keyimage;       /* decoded image of the latest keyframe */
+  uint8_t       *encoded;        /* scratch buffer for encoding */
+  size_t         encoded_size;
+  int            interval;       /* frames between keyframes */
+  int            since_keyframe; /* frames recorded since the last keyframe */
+  rewindframe_t *frames;         /* ring of frames */
+  int            capacity;       /* length of 'frames' */
+  int            head;           /* index of the oldest frame */
+  int            count;          /* number of frames held */
+};
+
+/* ----------------------------------------------------------------------- */
+
+static uint8_t *put_varint(uint8_t *p, size_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (uint8_t) (v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t) v;
+
+  return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, size_t *v)
+{
+  size_t value = 0;
+  int    shift = 0;
+
+  do
+  {
+    value |= (size_t) (*p & 0x7F) << shift;
+    shift += 7;
+  }
+  while (*p++ & 0x80);
+
+  *v = value;
+
+  return p;
+}
+
+/**
+ * Encode 'image' XORed against 'reference', or against zero if 'reference'
+ * is NULL.
+ *
+ * 'out' must have room for at least worst_case(length) bytes.
+ *
+ * \return Length of encoded data.
+ */
+static size_t encode(uint8_t       *out,
+                     const uint8_t *image,
+                     const uint8_t *reference,
+                     size_t         length)
+{
+#define X(i) (image[i] ^ (reference ? reference[i] : 0))
+
+  uint8_t *p = out;
+  size_t   i = 0;
+
+  while (i < length)
+  {
+    size_t start, end;
+
+    start = i;
+    while (start < length && X(start) == 0)
+      start++;
+    if (start == length)
+      break; /* trailing unchanged bytes are implied */
+
+    /* Literals continue through isolated zero bytes since a run break
+     * costs more than the zero does. */
+    end = start;
+    while (end < length &&
+           (X(end) != 0 || (end + 1 < length && X(end + 1) != 0)))
+      end++;
+
+    p = put_varint(p, start - i);
+    p = put_varint(p, end - start);
+    for (i = start; i < end; i++)
+      *p++ = X(i);
+  }
+
+  return p - out;
+
+#undef X
+}
+
+/**
+ * Decode 'in' into 'image' which must already hold the reference.
+ */
+static void decode(uint8_t *image, const uint8_t *in, size_t inlength)
+{
+  const uint8_t *end = in + inlength;
+  uint8_t       *p   = image;
+
+  while (in < end)
+  {
+    size_t skip, count;
+
+    in = get_varint(in, &skip);
+    in = get_varint(in, &count);
+    p += skip;
+    while (count--)
+      *p++ ^= *in++;
+  }
+}
+
+/* Every run carries at least one literal and a literal run can only be
+ * broken by a pair of zero bytes, so the varints can't outweigh the input. */
+static size_t worst_case(size_t length)
+{
+  return length * 2 + 16;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void rewind_destroy(tgerewind_t *rewind)
+{
+  int i;
+
+  if (rewind == NULL)
+    return;
+
+  if (rewind->frames)
+    for (i = 0; i < rewind->capacity; i++)
+      free(rewind->frames[i].data);
+
+  free(rewind->frames);
+  free(rewind->encoded);
+  free(rewind->keyimage);
+  free(rewind->image);
+  free(rewind);
+}
+
+TGE_API int tge_rewind_enable(tgestate_t *state, int frames)
+{
+  tgerewind_t *rewind;
+
+  assert(state != NULL);
+
+  rewind_destroy(state->rewind);
+  state->rewind = NULL;
+
+  if (frames <= 0)
+    return 0;
+
+  rewind = calloc(1, sizeof(*rewind));
+  if (rewind == NULL)
+    return 1;
+
+  rewind->image_size   = snapshot_image_size(state);
+  rewind->encoded_size = worst_case(rewind->image_size);
+  rewind->image        = malloc(rewind->image_size);
+  rewind->keyimage     = malloc(rewind->image_size);
+  rewind->encoded      = malloc(rewind->encoded_size);
+  rewind->frames       = calloc(frames, sizeof(*rewind->frames));
+  if (rewind->image    == NULL ||
+      rewind->keyimage == NULL ||
+      rewind->encoded  == NULL ||
+      rewind->frames   == NULL)
+  {
+    rewind_destroy(rewind);
+    return 1;
+  }
+
+  /* Keep several keyframes in the ring so that dropping the oldest one
+   * never discards most of the history. */
+  rewind->interval = frames / 4;
+  if (rewind->interval < 1)
+    rewind->interval = 1;
+  else if (rewind->interval > KEYFRAME_INTERVAL)
+    rewind->interval = KEYFRAME_INTERVAL;
+
+  rewind->capacity = frames;
+
+  state->rewind = rewind;
+
+  return 0;
+}
+
+/**
+ * Drop the oldest frame, plus any frames which then lack a keyframe.
+ */
+static void drop_oldest(tgerewind_t *rewind)
+{
+  do
+  {
+    rewind->head = (rewind->head + 1) % rewind->capacity;
+    rewind->count--;
+  }
+  while (rewind->count > 0 && !rewind->frames[rewind->head].keyframe);
+}
+
+void rewind_record(tgestate_t *state)
+{
+  tgerewind_t   *rewind = state->rewind;
+  rewindframe_t *frame;
+  int            keyframe;
+  size_t         length;
+
+  assert(rewind != NULL);
+
+  snapshot_capture(state, rewind->image);
+
+  if (rewind->count == rewind->capacity)
+    drop_oldest(rewind);
+
+  keyframe = rewind->count == 0 ||
+             rewind->since_keyframe >= rewind->interval;
+  if (keyframe)
+  {
+    length = encode(rewind->encoded, rewind->image, NULL, rewind->image_size);
+    memcpy(rewind->keyimage, rewind->image, rewind->image_size);
+    rewind->since_keyframe = 0;
+  }
+  else
+  {
+    length = encode(rewind->encoded, rewind->image, rewind->keyimage, rewind->image_size);
+    rewind->since_keyframe++;
+  }
+  assert(length <= rewind->encoded_size);
+
+  frame = &rewind->frames[(rewind->head + rewind->count) % rewind->capacity];
+  if (frame->allocated < length)
+  {
+    uint8_t *data;
+
+    data = realloc(frame->data, length);
+    if (data == NULL)
+    {
+      /* Out of memory: forget the history rather than leave a hole in it. */
+      rewind->count = 0;
+      return;
+    }
+    frame->data      = data;
+    frame->allocated = length;
+  }
+  memcpy(frame->data, rewind->encoded, length);
+  frame->length   = length;
+  frame->keyframe = keyframe;
+
+  rewind->count++;
+}
+
+void rewind_reset(tgestate_t *state)
+{
+  tgerewind_t *rewind = state->rewind;
+
+  if (rewind == NULL)
+    return;
+
+  /* The frames' buffers are kept for reuse. */
+  rewind->head           = 0;
+  rewind->count          = 0;
+  rewind->since_keyframe = 0;
+}
+
+TGE_API int tge_rewind(tgestate_t *state, int frames)
+{
+  tgerewind_t         *rewind;
+  int                  target;
+  int                  key;
+  const rewindframe_t *frame;
+
+  assert(state != NULL);
+
+  rewind = state->rewind;
+  if (rewind == NULL || frames <= 0)
+    return 0;
+
+  /* The newest frame is the current state. */
+  if (frames > rewind->count - 1)
+    frames = rewind->count - 1;
+  if (frames <= 0)
+    return 0;
+
+  target = rewind->count - 1 - frames;
+
+  /* The oldest frame is always a keyframe so this terminates. */
+  key = target;
+  while (!rewind->frames[(rewind->head + key) % rewind->capacity].keyframe)
+    key--;
+
+  /* Decode into the scratch image. keyimage must keep the newest keyframe
+   * until the restore succeeds since later frames are encoded against it. */
+  frame = &rewind->frames[(rewind->head + key) % rewind->capacity];
+  memset(rewind->image, 0, rewind->image_size);
+  decode(rewind->image, frame->data, frame->length);
+
+  if (key != target)
+  {
+    frame = &rewind->frames[(rewind->head + target) % rewind->capacity];
+    decode(rewind->image, frame->data, frame->length);
+  }
+
+  if (snapshot_restore(state, rewind->image))
+    return 0;
+
+  /* Make the target's keyframe the one which recording continues against.
+   * Decoding XORs, so decoding the target frame again undoes it. */
+  memcpy(rewind->keyimage, rewind->image, rewind->image_size);
+  if (key != target)
+    decode(rewind->keyimage, frame->data, frame->length);
+
+  /* Discard the frames after the target so that recording continues from
+   * it. */
+  rewind->count          = target + 1;
+  rewind->since_keyframe = target - key;
+
+  return frames;
+}
+
+TGE_API void tge_rewind_stats(const tgestate_t *state, tgerewindstats_t *stats)
+{
+  const tgerewind_t *rewind;
+  int                i;
+
+  assert(state != NULL);
+  assert(stats != NULL);
+
+  memset(stats, 0, sizeof(*stats));
+
+  rewind = state->rewind;
+  if (rewind == NULL)
+    return;
+
+  stats->frames = rewind->count;
+  for (i = 0; i < rewind->count; i++)
+    if (rewind->frames[(rewind->head + i) % rewind->capacity].keyframe)
+      stats->keyframes++;
+
+  stats->bytes = sizeof(*rewind) +
+                 rewind->capacity * sizeof(*rewind->frames) +
+                 rewind->image_size * 2 +
+                 rewind->encoded_size;
+  for (i = 0; i < rewind->capacity; i++)
+    stats->bytes += rewind->frames[i].allocated;
+
+  stats->uncompressed = (size_t) rewind->count * rewind->image_size;
+}
+
+/* ----------------------------------------------------------------------- */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -23,6 +23,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "ZXSpectrum/Screen.h"
+
 #include "TheGreatEscape/State.h"
 #include "TheGreatEscape/Main.h" /* for animations[] */
 #include "TheGreatEscape/Messages.h" /* for messages_table[] */
@@ -428,6 +430,9 @@ static const ztstruct_t meta_keydefs =
 
 static const ztfield_t meta_tgestate_fields[] =
 {
+  ZTUCHAR(activity, tgestate_t),
+  ZTUCHAR(after_zoombox, tgestate_t),
+  ZTUCHAR(escape_itemflags, tgestate_t),
   ZTUCHARARRAY(roomdef_shadow_bytes, tgestate_t, 16),
   ZTUCHAR(room_index, tgestate_t),
   ZTUCHAR(current_door, tgestate_t),
@@ -502,11 +507,59 @@ static const ztstruct_t meta_tgestate =
 
 /* ----------------------------------------------------------------------- */
 
+/* Saved games hold the screen in the Spectrum's interleaved layout. When
+ * this build holds its screen linearly the pixels are saved from, and
+ * loaded into, an interleaved copy and the morale flag pointer is moved
+ * across to match. */
+
+#ifdef ZXSCREEN_LINEAR
+static uint8_t *linear_to_interleaved(const tgestate_t *state,
+                                      uint8_t          *interleaved,
+                                      uint8_t          *ptr)
+{
+  size_t index;
+
+  if (ptr == NULL)
+    return NULL;
+
+  index = ptr - state->speccy->screen.pixels;
+  return interleaved + ZXSCREEN_TO_INTERLEAVED(index);
+}
+
+static uint8_t *interleaved_to_linear(const tgestate_t *state,
+                                      uint8_t          *interleaved,
+                                      uint8_t          *ptr)
+{
+  size_t index;
+
+  if (ptr == NULL)
+    return NULL;
+
+  index = ptr - interleaved;
+  if (index >= SCREEN_BITMAP_LENGTH)
+    return NULL;
+
+  return state->speccy->screen.pixels + ZXSCREEN_FROM_INTERLEAVED(index);
+}
+#endif
+
+/* ----------------------------------------------------------------------- */
+
 TGE_API int tge_save(tgestate_t *state, const char *filename)
 {
   ztresult_t zt;
   ztregion_t regions[NREGIONS];
   ztsaver_t *savers[CUSTOM_ID__LIMIT];
+  uint8_t   *screen = state->speccy->screen.pixels;
+#ifdef ZXSCREEN_LINEAR
+  uint8_t    interleaved[SCREEN_BITMAP_LENGTH];
+  uint8_t   *moraleflag_screen_address = state->moraleflag_screen_address;
+
+  zxscreen_to_interleaved(screen, interleaved);
+  state->moraleflag_screen_address =
+    linear_to_interleaved(state, interleaved, moraleflag_screen_address);
+  screen = interleaved;
+#endif
 
   regions[0].id          = messages_queue_id;
   regions[0].spec.base   = &state->messages.queue[0];
@@ -519,7 +572,7 @@ TGE_API int tge_save(tgestate_t *state, const char *filename)
   regions[1].spec.nelems = state->window_buf_size;
 
   regions[2].id          = screen_id;
-  regions[2].spec.base   = state->speccy->screen.pixels;
+  regions[2].spec.base   = screen;
   regions[2].spec.length = SCREEN_BITMAP_LENGTH;
   regions[2].spec.nelems = SCREEN_BITMAP_LENGTH;
 
@@ -538,6 +591,9 @@ TGE_API int tge_save(tgestate_t *state, const char *filename)
                NREGIONS,
                savers,
                NELEMS(savers));
+#ifdef ZXSCREEN_LINEAR
+  state->moraleflag_screen_address = moraleflag_screen_address;
+#endif
   if (zt != ztresult_OK)
     return 1;
 
@@ -551,6 +607,16 @@ TGE_API int tge_load(tgestate_t *state,
   ztresult_t  zt;
   ztregion_t  regions[NREGIONS];
   ztloader_t *loaders[CUSTOM_ID__LIMIT];
+  uint8_t    *screen = state->speccy->screen.pixels;
+#ifdef ZXSCREEN_LINEAR
+  uint8_t     interleaved[SCREEN_BITMAP_LENGTH];
+
+  /* Pixels which aren't loaded are left as they were. */
+  zxscreen_to_interleaved(screen, interleaved);
+  state->moraleflag_screen_address =
+    linear_to_interleaved(state, interleaved, state->moraleflag_screen_address);
+  screen = interleaved;
+#endif
 
   regions[0].id          = messages_queue_id;
   regions[0].spec.base   = &state->messages.queue;
@@ -563,7 +629,7 @@ TGE_API int tge_load(tgestate_t *state,
   regions[1].spec.nelems = state->window_buf_size;
 
   regions[2].id          = screen_id;
-  regions[2].spec.base   = state->speccy->screen.pixels;
+  regions[2].spec.base   = screen;
   regions[2].spec.length = SCREEN_BITMAP_LENGTH;
   regions[2].spec.nelems = SCREEN_BITMAP_LENGTH;
 
@@ -583,6 +649,11 @@ TGE_API int tge_load(tgestate_t *state,
                loaders,
                NELEMS(loaders),
                error);
+#ifdef ZXSCREEN_LINEAR
+  zxscreen_from_interleaved(interleaved, state->speccy->screen.pixels);
+  state->moraleflag_screen_address =
+    interleaved_to_linear(state, interleaved, state->moraleflag_screen_address);
+#endif
   if (zt != ztresult_OK)
     return 1;
 
@@ -596,6 +667,44 @@ TGE_API void tge_disposeoferror(char *error)
 
 /* ----------------------------------------------------------------------- */
 
+TGE_API int tge_convert_save(const char *input,
+                             const char *output,
+                             char      **error)
+{
+  zxspectrum_t speccy;
+  tgestate_t  *state;
+  int          i;
+  int          rc;
+
+  if (error)
+    *error = NULL;
+
+  /* A scratch instance to convert through. It's never run so its virtual
+   * Spectrum needs no handlers. */
+  memset(&speccy, 0, sizeof(speccy));
+  speccy.screen.width  = SCREEN_WIDTH / 8;
+  speccy.screen.height = SCREEN_HEIGHT / 8;
+
+  state = tge_create(&speccy);
+  if (state == NULL)
+    return 1;
+
+  /* The text format doesn't record animbase since it never varies. */
+  for (i = 0; i < vischars_LENGTH; i++)
+    state->vischars[i].animbase = &animations[0];
+
+  if (tge_snapshot_detect(input))
+    rc = tge_snapshot_load(state, input) || tge_save(state, output);
+  else
+    rc = tge_load(state, input, error) || tge_snapshot_save(state, output);
+
+  tge_destroy(state);
+
+  return rc;
+}
+
+/* ----------------------------------------------------------------------- */
+
 #endif /* TGE_SAVES */
 
 // vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,84 @@
+/**
+ * Shared.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Shared data.
+ *
+ * Caches which depend only on constant game data are built once and shared
+ * by every game instance. Instances may be created from several threads at
+ * once: each builds the data if it finds none, then publishes it with a
+ * compare-and-swap. Losers of the race discard their copies.
+ */
+
+#include <stddef.h>
+
+#include "TheGreatEscape/Shared.h"
+
+/* ----------------------------------------------------------------------- */
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+void *shared_load(sharedslot_t *slot)
+{
+  return InterlockedCompareExchangePointer((PVOID volatile *) slot, NULL, NULL);
+}
+
+int shared_publish(sharedslot_t *slot, void *data)
+{
+  return InterlockedCompareExchangePointer((PVOID volatile *) slot, data, NULL) == NULL;
+}
+
+#elif defined(__GNUC__)
+
+void *shared_load(sharedslot_t *slot)
+{
+  return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+int shared_publish(sharedslot_t *slot, void *data)
+{
+  void *expected = NULL;
+
+  return __atomic_compare_exchange_n(slot, &expected, data, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#else
+
+//#warning Default threading used
+
+void *shared_load(sharedslot_t *slot)
+{
+  return *slot;
+}
+
+int shared_publish(sharedslot_t *slot, void *data)
+{
+  if (*slot != NULL)
+    return 0;
+  *slot = data;
+  return 1;
+}
+
+#endif
+
+/* ----------------------------------------------------------------------- */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,733 @@
+/**
+ * Snapshot.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Binary snapshots.
+ *
+ * A snapshot is a fixed header followed by a sequence of sections. All
+ * header and section framing fields are little-endian uint32s:
+ *
+ *   header:  magic[8] version layout byteorder nsections
+ *   section: id length data[length]
+ *
+ * The state section holds the game part of the tgestate_t structure
+ * (TGESTATE_GAME_SIZE bytes) as raw bytes with every pointer field cleared.
+ * Pointers are instead stored as indices in the pointers section. The host
+ * resources which follow the game part, and which vary with build options,
+ * are never saved. Since the raw section depends on the build's structure
+ * layout and byte order the header records both and mismatched snapshots are
+ * rejected. Use the text format (tge_save) to move games between builds.
+ *
+ * Snapshot files always hold the screen pixels, and the morale flag pointer
+ * into them, in the Spectrum's interleaved layout even when this build holds
+ * its screen linearly (ZXSCREEN_LINEAR). In-memory images use the build's
+ * own layout.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ZXSpectrum/Screen.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/Main.h" /* for animations[] */
+#include "TheGreatEscape/Messages.h" /* for messages_table[] */
+#include "TheGreatEscape/Sprites.h" /* for sprites[] */
+#include "TheGreatEscape/State.h"
+
+#include "TheGreatEscape/Snapshot.h"
+
+/* ----------------------------------------------------------------------- */
+
+#define SNAPSHOT_MAGIC      "TGESNAP\x1A"
+#define SNAPSHOT_MAGIC_LEN  (8)
+#define SNAPSHOT_VERSION    (1)
+#define SNAPSHOT_BYTEORDER  (0x01020304)
+
+#define SNAPSHOT_HEADER_LEN (SNAPSHOT_MAGIC_LEN + 4 * 4)
+#define SECTION_HEADER_LEN  (2 * 4)
+
+/* Identifiers of sections */
+enum
+{
+  section_STATE,
+  section_POINTERS,
+  section_TILE_BUF,
+  section_WINDOW_BUF,
+  section_MAP_BUF,
+  section_PIXELS,
+  section_ATTRIBUTES,
+  section__LIMIT
+};
+
+/* Pointer fields are stored in this order. Each is a uint32 index, or
+ * NO_INDEX for NULL. */
+enum
+{
+  pointer_IY,                           /* index into vischars[] */
+  pointer_WINDOW_BUF_POINTER,           /* offset into window_buf */
+  pointer_MESSAGES_QUEUE_POINTER,       /* offset into messages.queue */
+  pointer_MESSAGES_CURRENT_CHARACTER,   /* message << 16 | offset */
+  pointer_MORALEFLAG_SCREEN_ADDRESS,    /* offset into screen pixels */
+  pointer_PTR_TO_DOOR_BEING_LOCKPICKED, /* index into locked_doors[] */
+  pointer_MOVABLE_ITEMS,                /* sprite index for each movable item */
+  pointer_VISCHARS = pointer_MOVABLE_ITEMS + movable_item__LIMIT,
+                                        /* animbase, anim, sprite for each vischar */
+  pointer__LIMIT = pointer_VISCHARS + vischars_LENGTH * 3
+};
+
+#define NO_INDEX (0xFFFFFFFFu)
+
+/* ----------------------------------------------------------------------- */
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t) (v >>  0);
+  p[1] = (uint8_t) (v >>  8);
+  p[2] = (uint8_t) (v >> 16);
+  p[3] = (uint8_t) (v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return ((uint32_t) p[0] <<  0) |
+         ((uint32_t) p[1] <<  8) |
+         ((uint32_t) p[2] << 16) |
+         ((uint32_t) p[3] << 24);
+}
+
+static uint32_t native_byteorder(void)
+{
+  static const uint8_t bytes[4] = { 4, 3, 2, 1 };
+  uint32_t             v;
+
+  memcpy(&v, bytes, 4);
+  return v; /* == SNAPSHOT_BYTEORDER on little-endian hosts */
+}
+
+/* ----------------------------------------------------------------------- */
+
+/* Convert an offset into an array into an index, or NO_INDEX for NULL. */
+#define INDEX(ptr, base) \
+  ((ptr) == NULL ? NO_INDEX : (uint32_t) ((ptr) - (base)))
+
+static uint32_t anim_to_index(const anim_t *anim)
+{
+  uint32_t i;
+
+  if (anim == NULL)
+    return NO_INDEX;
+
+  for (i = 0; i < animations__LIMIT; i++)
+    if (animations[i] == anim)
+      return i;
+
+  assert("Unknown animation" == NULL);
+  return NO_INDEX;
+}
+
+/* The compiler may merge a message into the tail of a longer one, in which
+ * case the pointer lies within both. Which messages share storage varies
+ * between builds, so encode the pointer by the text remaining to be shown:
+ * pick the message which ends with that text at the smallest offset. That
+ * gives the same index in every build and decodes to the same text. */
+static uint32_t curchr_to_index(const char *p)
+{
+  uint32_t i;
+  size_t   remaining;
+  size_t   length;
+  uint32_t best;
+  size_t   best_offset;
+
+  if (p == NULL)
+    return NO_INDEX;
+
+  remaining   = strlen(p);
+  best        = NO_INDEX;
+  best_offset = 0;
+
+  for (i = 0; i < message__LIMIT; i++)
+  {
+    const char *start = messages_table[i];
+
+    length = strlen(start);
+    if (length >= remaining &&
+        strcmp(start + length - remaining, p) == 0 &&
+        (best == NO_INDEX || length - remaining < best_offset))
+    {
+      best        = i;
+      best_offset = length - remaining;
+    }
+  }
+
+  if (best == NO_INDEX)
+  {
+    assert("Unknown message pointer" == NULL);
+    return NO_INDEX;
+  }
+
+  return (best << 16) | (uint32_t) best_offset;
+}
+
+/**
+ * Encode the state's pointer fields as indices.
+ */
+static void encode_pointers(const tgestate_t *state, uint8_t *out)
+{
+  int i;
+
+  put_u32(out + pointer_IY * 4,
+          INDEX(state->IY, &state->vischars[0]));
+  put_u32(out + pointer_WINDOW_BUF_POINTER * 4,
+          INDEX(state->window_buf_pointer, state->window_buf));
+  put_u32(out + pointer_MESSAGES_QUEUE_POINTER * 4,
+          INDEX(state->messages.queue_pointer, &state->messages.queue[0]));
+  put_u32(out + pointer_MESSAGES_CURRENT_CHARACTER * 4,
+          curchr_to_index(state->messages.current_character));
+  put_u32(out + pointer_MORALEFLAG_SCREEN_ADDRESS * 4,
+          INDEX(state->moraleflag_screen_address, &state->speccy->screen.pixels[0]));
+  put_u32(out + pointer_PTR_TO_DOOR_BEING_LOCKPICKED * 4,
+          INDEX(state->ptr_to_door_being_lockpicked, &state->locked_doors[0]));
+
+  for (i = 0; i < movable_item__LIMIT; i++)
+    put_u32(out + (pointer_MOVABLE_ITEMS + i) * 4,
+            INDEX(state->movable_items[i].sprite, &sprites[0]));
+
+  for (i = 0; i < vischars_LENGTH; i++)
+  {
+    const vischar_t *vischar = &state->vischars[i];
+    uint8_t         *p       = out + (pointer_VISCHARS + i * 3) * 4;
+
+    put_u32(p + 0, INDEX(vischar->animbase, &animations[0]));
+    put_u32(p + 4, anim_to_index(vischar->anim));
+    put_u32(p + 8, INDEX(vischar->mi.sprite, &sprites[0]));
+  }
+}
+
+/* Convert an index back into a pointer, validating it against the highest
+ * permissible index. Sets 'bad' if out of range. */
+#define POINTER(T, index, base, limit)                               \
+  ((index) == NO_INDEX ? (T) NULL :                                  \
+   (index) <= (limit) ? (T) ((base) + (index)) : (bad = 1, (T) NULL))
+
+/**
+ * Decode the state's pointer fields from indices.
+ *
+ * \return Non-zero if any index was out of range.
+ */
+static int decode_pointers(tgestate_t *state, const uint8_t *in)
+{
+  int      bad = 0;
+  uint32_t index;
+  int      i;
+
+  index = get_u32(in + pointer_IY * 4);
+  /* Loops over the vischars may leave IY pointing one past the end. */
+  state->IY = POINTER(vischar_t *, index, &state->vischars[0], vischars_LENGTH);
+
+  index = get_u32(in + pointer_WINDOW_BUF_POINTER * 4);
+  state->window_buf_pointer = POINTER(uint8_t *, index, state->window_buf, state->window_buf_size);
+
+  index = get_u32(in + pointer_MESSAGES_QUEUE_POINTER * 4);
+  state->messages.queue_pointer = POINTER(uint8_t *, index, &state->messages.queue[0], message_queue_LENGTH);
+
+  index = get_u32(in + pointer_MESSAGES_CURRENT_CHARACTER * 4);
+  if (index == NO_INDEX)
+    state->messages.current_character = NULL;
+  else if ((index >> 16) < message__LIMIT &&
+           (index & 0xFFFF) <= strlen(messages_table[index >> 16]))
+    state->messages.current_character = messages_table[index >> 16] + (index & 0xFFFF);
+  else
+    bad = 1;
+
+  index = get_u32(in + pointer_MORALEFLAG_SCREEN_ADDRESS * 4);
+  state->moraleflag_screen_address = POINTER(uint8_t *, index, &state->speccy->screen.pixels[0], SCREEN_BITMAP_LENGTH - 1);
+
+  index = get_u32(in + pointer_PTR_TO_DOOR_BEING_LOCKPICKED * 4);
+  state->ptr_to_door_being_lockpicked = POINTER(doorindex_t *, index, &state->locked_doors[0], LOCKED_DOORS_LENGTH - 1);
+
+  for (i = 0; i < movable_item__LIMIT; i++)
+  {
+    index = get_u32(in + (pointer_MOVABLE_ITEMS + i) * 4);
+    state->movable_items[i].sprite = POINTER(const spritedef_t *, index, &sprites[0], sprite__LIMIT - 1);
+  }
+
+  for (i = 0; i < vischars_LENGTH; i++)
+  {
+    vischar_t     *vischar = &state->vischars[i];
+    const uint8_t *p       = in + (pointer_VISCHARS + i * 3) * 4;
+
+    index = get_u32(p + 0);
+    vischar->animbase = POINTER(const anim_t **, index, &animations[0], animations__LIMIT - 1);
+    index = get_u32(p + 4);
+    vischar->anim = (index == NO_INDEX) ? NULL :
+                    (index < animations__LIMIT) ? animations[index] : (bad = 1, NULL);
+    index = get_u32(p + 8);
+    vischar->mi.sprite = POINTER(const spritedef_t *, index, &sprites[0], sprite__LIMIT - 1);
+  }
+
+  return bad;
+}
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Clear the pointer fields of a copy of the game state so that the raw
+ * section carries no addresses.
+ */
+static void clear_pointers(tgestate_t *copy)
+{
+  int i;
+
+  copy->IY                           = NULL;
+  copy->window_buf_pointer           = NULL;
+  copy->bitmap_pointer               = NULL;
+  copy->mask_pointer                 = NULL;
+  copy->foreground_mask_pointer      = NULL;
+  copy->messages.queue_pointer       = NULL;
+  copy->messages.current_character   = NULL;
+  copy->moraleflag_screen_address    = NULL;
+  copy->ptr_to_door_being_lockpicked = NULL;
+  copy->tile_buf                     = NULL;
+  copy->window_buf                   = NULL;
+  copy->tile_buf_alloc               = NULL;
+  copy->window_buf_alloc             = NULL;
+  copy->map_buf                      = NULL;
+  for (i = 0; i < movable_item__LIMIT; i++)
+    copy->movable_items[i].sprite = NULL;
+  for (i = 0; i < vischars_LENGTH; i++)
+  {
+    copy->vischars[i].animbase  = NULL;
+    copy->vischars[i].anim      = NULL;
+    copy->vischars[i].mi.sprite = NULL;
+  }
+  for (i = 0; i < 3; i++)
+    copy->searchlight.states[i].ptr = NULL;
+}
+
+/**
+ * Zero the padding bytes within the vischars.
+ *
+ * tge_initialise() copies the vischars from a template on the stack, so
+ * their padding bytes are indeterminate. Rebuild them member by member over
+ * zeroes so that identical game states produce identical images.
+ */
+static void clear_padding(tgestate_t *copy)
+{
+  int i;
+
+  for (i = 0; i < vischars_LENGTH; i++)
+  {
+    vischar_t *vischar = &copy->vischars[i];
+    vischar_t  v       = *vischar;
+
+    memset(vischar, 0, sizeof(*vischar));
+    vischar->character          = v.character;
+    vischar->flags              = v.flags;
+    vischar->route              = v.route;
+    vischar->target             = v.target;
+    vischar->counter_and_flags  = v.counter_and_flags;
+    vischar->animbase           = v.animbase;
+    vischar->anim               = v.anim;
+    vischar->animindex          = v.animindex;
+    vischar->input              = v.input;
+    vischar->direction          = v.direction;
+    vischar->mi.mappos          = v.mi.mappos;
+    vischar->mi.sprite          = v.mi.sprite;
+    vischar->mi.sprite_index    = v.mi.sprite_index;
+    vischar->isopos             = v.isopos;
+    vischar->room               = v.room;
+    vischar->unused             = v.unused;
+    vischar->width_bytes        = v.width_bytes;
+    vischar->height             = v.height;
+  }
+}
+
+/* ----------------------------------------------------------------------- */
+
+/* An image is the concatenation of every section's data in section order. */
+
+static void section_lengths(const tgestate_t *state,
+                            size_t            lengths[section__LIMIT])
+{
+  lengths[section_STATE]      = TGESTATE_GAME_SIZE;
+  lengths[section_POINTERS]   = pointer__LIMIT * 4;
+  lengths[section_TILE_BUF]   = state->tile_buf_size;
+  lengths[section_WINDOW_BUF] = state->window_buf_size;
+  lengths[section_MAP_BUF]    = state->map_buf_size;
+  lengths[section_PIXELS]     = SCREEN_BITMAP_LENGTH;
+  lengths[section_ATTRIBUTES] = SCREEN_ATTRIBUTES_LENGTH;
+}
+
+size_t snapshot_image_size(const tgestate_t *state)
+{
+  size_t lengths[section__LIMIT];
+  size_t total;
+  int    i;
+
+  section_lengths(state, lengths);
+  total = 0;
+  for (i = 0; i < section__LIMIT; i++)
+    total += lengths[i];
+
+  return total;
+}
+
+void snapshot_capture(const tgestate_t *state, uint8_t *image)
+{
+  uint8_t *p = image;
+
+  assert(state != NULL);
+  assert(image != NULL);
+
+  memcpy(p, state, TGESTATE_GAME_SIZE);
+  clear_pointers((tgestate_t *) p);
+  clear_padding((tgestate_t *) p);
+  p += TGESTATE_GAME_SIZE;
+
+  encode_pointers(state, p);
+  p += pointer__LIMIT * 4;
+
+  memcpy(p, state->tile_buf, state->tile_buf_size);
+  p += state->tile_buf_size;
+  memcpy(p, state->window_buf, state->window_buf_size);
+  p += state->window_buf_size;
+  memcpy(p, state->map_buf, state->map_buf_size);
+  p += state->map_buf_size;
+  memcpy(p, state->speccy->screen.pixels, SCREEN_BITMAP_LENGTH);
+  p += SCREEN_BITMAP_LENGTH;
+  memcpy(p, state->speccy->screen.attributes, SCREEN_ATTRIBUTES_LENGTH);
+}
+
+int snapshot_restore(tgestate_t *state, const uint8_t *image)
+{
+  const uint8_t *p = image;
+  tgestate_t    *saved;
+  int            i;
+
+  assert(state != NULL);
+  assert(image != NULL);
+
+  /* Copy the game over, retaining the fields which belong to this instance:
+   * its allocations and its constant pointers. The host resources aren't in
+   * the image so are left alone. */
+
+  saved = malloc(sizeof(*saved));
+  if (saved == NULL)
+    return 1;
+  memcpy(saved, state, sizeof(*saved));
+
+  memcpy(state, p, TGESTATE_GAME_SIZE);
+  p += TGESTATE_GAME_SIZE;
+
+  state->tile_buf                = saved->tile_buf;
+  state->window_buf              = saved->window_buf;
+  state->tile_buf_alloc          = saved->tile_buf_alloc;
+  state->window_buf_alloc        = saved->window_buf_alloc;
+  state->map_buf                 = saved->map_buf;
+  state->tile_buf_size           = saved->tile_buf_size;
+  state->window_buf_stride       = saved->window_buf_stride;
+  state->window_buf_size         = saved->window_buf_size;
+  state->map_buf_size            = saved->map_buf_size;
+  state->bitmap_pointer          = saved->bitmap_pointer;
+  state->mask_pointer            = saved->mask_pointer;
+  state->foreground_mask_pointer = saved->foreground_mask_pointer;
+  for (i = 0; i < 3; i++)
+    state->searchlight.states[i].ptr = saved->searchlight.states[i].ptr;
+
+  if (decode_pointers(state, p))
+  {
+    /* Restore the original state. */
+    memcpy(state, saved, sizeof(*state));
+    free(saved);
+    return 1;
+  }
+  p += pointer__LIMIT * 4;
+
+  free(saved);
+
+  memcpy(state->tile_buf, p, state->tile_buf_size);
+  p += state->tile_buf_size;
+  memcpy(state->window_buf, p, state->window_buf_size);
+  p += state->window_buf_size;
+  memcpy(state->map_buf, p, state->map_buf_size);
+  p += state->map_buf_size;
+  memcpy(state->speccy->screen.pixels, p, SCREEN_BITMAP_LENGTH);
+  p += SCREEN_BITMAP_LENGTH;
+  memcpy(state->speccy->screen.attributes, p, SCREEN_ATTRIBUTES_LENGTH);
+
+  /* The screen was replaced wholesale so redraw all of it. */
+  state->speccy->draw(state->speccy, NULL);
+
+  return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static int write_section(FILE *f, uint32_t id, const void *data, size_t length)
+{
+  uint8_t header[SECTION_HEADER_LEN];
+
+  put_u32(header + 0, id);
+  put_u32(header + 4, (uint32_t) length);
+  if (fwrite(header, 1, SECTION_HEADER_LEN, f) != SECTION_HEADER_LEN ||
+      fwrite(data, 1, length, f) != length)
+    return 1;
+
+  return 0;
+}
+
+#ifdef ZXSCREEN_LINEAR
+/**
+ * Convert the screen pixels held in 'image' between this build's layout and
+ * the Spectrum's interleaved layout.
+ */
+static void image_convert_screen(const tgestate_t *state,
+                                 uint8_t          *image,
+                                 int               to_interleaved)
+{
+  size_t   lengths[section__LIMIT];
+  uint8_t *pointers;
+  uint8_t *pixels;
+  uint8_t  converted[SCREEN_BITMAP_LENGTH];
+  uint32_t index;
+  int      i;
+
+  section_lengths(state, lengths);
+  pointers = image;
+  for (i = 0; i < section_POINTERS; i++)
+    pointers += lengths[i];
+  pixels = image;
+  for (i = 0; i < section_PIXELS; i++)
+    pixels += lengths[i];
+
+  if (to_interleaved)
+    zxscreen_to_interleaved(pixels, converted);
+  else
+    zxscreen_from_interleaved(pixels, converted);
+  memcpy(pixels, converted, SCREEN_BITMAP_LENGTH);
+
+  /* Out of range indices are left for decode_pointers() to reject. */
+  index = get_u32(pointers + pointer_MORALEFLAG_SCREEN_ADDRESS * 4);
+  if (index < SCREEN_BITMAP_LENGTH)
+    put_u32(pointers + pointer_MORALEFLAG_SCREEN_ADDRESS * 4,
+            to_interleaved ? ZXSCREEN_TO_INTERLEAVED(index)
+                           : ZXSCREEN_FROM_INTERLEAVED(index));
+}
+#endif
+
+TGE_API int tge_snapshot_save(tgestate_t *state, const char *filename)
+{
+  uint8_t  header[SNAPSHOT_HEADER_LEN];
+  size_t   lengths[section__LIMIT];
+  uint8_t *image = NULL;
+  uint8_t *p;
+  FILE    *f     = NULL;
+  int      i;
+  int      rc    = 1;
+
+  assert(state    != NULL);
+  assert(filename != NULL);
+
+  image = malloc(snapshot_image_size(state));
+  if (image == NULL)
+    goto exit;
+
+  snapshot_capture(state, image);
+#ifdef ZXSCREEN_LINEAR
+  image_convert_screen(state, image, 1);
+#endif
+
+  memcpy(header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+  put_u32(header + SNAPSHOT_MAGIC_LEN +  0, SNAPSHOT_VERSION);
+  put_u32(header + SNAPSHOT_MAGIC_LEN +  4, (uint32_t) TGESTATE_GAME_SIZE);
+  put_u32(header + SNAPSHOT_MAGIC_LEN +  8, native_byteorder());
+  put_u32(header + SNAPSHOT_MAGIC_LEN + 12, section__LIMIT);
+
+  f = fopen(filename, "wb");
+  if (f == NULL)
+    goto exit;
+
+  if (fwrite(header, 1, SNAPSHOT_HEADER_LEN, f) != SNAPSHOT_HEADER_LEN)
+    goto exit;
+
+  section_lengths(state, lengths);
+  p = image;
+  for (i = 0; i < section__LIMIT; i++)
+  {
+    if (write_section(f, i, p, lengths[i]))
+      goto exit;
+    p += lengths[i];
+  }
+
+  rc = 0;
+
+exit:
+  if (f && fclose(f) != 0)
+    rc = 1;
+  free(image);
+
+  return rc;
+}
+
+TGE_API int tge_snapshot_load(tgestate_t *state, const char *filename)
+{
+  size_t         lengths[section__LIMIT];
+  size_t         offsets[section__LIMIT];
+  uint8_t        present[section__LIMIT];
+  size_t         image_size;
+  uint8_t       *image = NULL;
+  uint8_t       *buf   = NULL;
+  FILE          *f     = NULL;
+  long           length;
+  const uint8_t *p;
+  const uint8_t *end;
+  uint32_t       nsections;
+  uint32_t       i;
+  int            rc    = 1;
+
+  assert(state    != NULL);
+  assert(filename != NULL);
+
+  section_lengths(state, lengths);
+  image_size = 0;
+  for (i = 0; i < section__LIMIT; i++)
+  {
+    offsets[i]  = image_size;
+    image_size += lengths[i];
+  }
+
+  /* Read the whole snapshot then validate it before touching the state. */
+
+  f = fopen(filename, "rb");
+  if (f == NULL)
+    goto exit;
+  if (fseek(f, 0, SEEK_END) != 0 || (length = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0)
+    goto exit;
+  if ((unsigned long) length < SNAPSHOT_HEADER_LEN ||
+      (unsigned long) length > SNAPSHOT_HEADER_LEN + section__LIMIT * SECTION_HEADER_LEN + image_size)
+    goto exit;
+
+  buf   = malloc(length);
+  image = malloc(image_size);
+  if (buf == NULL || image == NULL || fread(buf, 1, length, f) != (size_t) length)
+    goto exit;
+
+  if (memcmp(buf, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0 ||
+      get_u32(buf + SNAPSHOT_MAGIC_LEN + 0) != SNAPSHOT_VERSION ||
+      get_u32(buf + SNAPSHOT_MAGIC_LEN + 4) != TGESTATE_GAME_SIZE ||
+      get_u32(buf + SNAPSHOT_MAGIC_LEN + 8) != native_byteorder())
+    goto exit;
+
+  nsections = get_u32(buf + SNAPSHOT_MAGIC_LEN + 12);
+  if (nsections != section__LIMIT)
+    goto exit;
+
+  /* Locate and size-check every section, gathering them into an image. */
+
+  memset(present, 0, sizeof(present));
+  p   = buf + SNAPSHOT_HEADER_LEN;
+  end = buf + length;
+  for (i = 0; i < nsections; i++)
+  {
+    uint32_t id;
+    uint32_t seclen;
+
+    if (end - p < SECTION_HEADER_LEN)
+      goto exit;
+    id     = get_u32(p + 0);
+    seclen = get_u32(p + 4);
+    p += SECTION_HEADER_LEN;
+    if (id >= section__LIMIT || present[id] ||
+        seclen != lengths[id] || (size_t) (end - p) < seclen)
+      goto exit;
+    memcpy(image + offsets[id], p, seclen);
+    present[id] = 1;
+    p += seclen;
+  }
+
+#ifdef ZXSCREEN_LINEAR
+  image_convert_screen(state, image, 0);
+#endif
+  if (snapshot_restore(state, image))
+    goto exit;
+
+  rc = 0;
+
+exit:
+  free(image);
+  free(buf);
+  if (f)
+    fclose(f);
+
+  return rc;
+}
+
+TGE_API int tge_snapshot_detect(const char *filename)
+{
+  char  magic[SNAPSHOT_MAGIC_LEN];
+  FILE *f;
+  int   is_snapshot;
+
+  f = fopen(filename, "rb");
+  if (f == NULL)
+    return 0;
+  is_snapshot = fread(magic, 1, SNAPSHOT_MAGIC_LEN, f) == SNAPSHOT_MAGIC_LEN &&
+                memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) == 0;
+  fclose(f);
+
+  return is_snapshot;
+}
+
+TGE_API uint32_t tge_hash(const tgestate_t *state)
+{
+  uint8_t *image;
+  size_t   size;
+  size_t   i;
+  uint32_t hash;
+
+  assert(state != NULL);
+
+  size  = snapshot_image_size(state);
+  image = malloc(size);
+  if (image == NULL)
+    return 0;
+
+  snapshot_capture(state, image);
+#ifdef ZXSCREEN_LINEAR
+  /* Hash the screen as the Spectrum lays it out so that linear builds agree
+   * with interleaved ones. */
+  image_convert_screen(state, image, 1);
+#endif
+
+  /* FNV-1a */
+  hash = 2166136261u;
+  for (i = 0; i < size; i++)
+    hash = (hash ^ image[i]) * 16777619u;
+
+  free(image);
+
+  return hash;
+}
+
+/* ----------------------------------------------------------------------- */
+
+// vim: ts=8 sts=2 sw=2 et
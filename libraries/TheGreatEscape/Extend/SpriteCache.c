@@ -0,0 +1,198 @@
+/**
+ * SpriteCache.c
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+/* ----------------------------------------------------------------------- */
+
+/* Sprite cache.
+ *
+ * When built with TGE_SPRITE_CACHE every sprite in sprites[] is rendered
+ * once, on first use, at each of the eight pixel offsets within a byte and
+ * in both orientations. The 16 and 24 pixel wide sprite plotters then mask
+ * whole bytes onto the screen in place of rotating the bitmap and mask of
+ * every row into position and, for flipped sprites, reversing them first.
+ *
+ * sprites[] holds the characters and the movable items: the stoves and the
+ * crate. Those are plotted as visible characters so are cached with the
+ * rest, taking 5,184 of the 92,192 bytes of rows. The items which can be
+ * picked up are held apart in item_definitions[] and are plotted unshifted
+ * and unflipped so they aren't cached.
+ *
+ * The cache depends only on constant game data so a single copy is shared
+ * by every game instance (see Shared.c).
+ */
+
+#ifdef TGE_SPRITE_CACHE
+
+#include <stdlib.h>
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/Shared.h"
+#include "TheGreatEscape/SpriteCache.h"
+#include "TheGreatEscape/Sprites.h"
+
+/* ----------------------------------------------------------------------- */
+
+static sharedslot_t shared_cache;
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Reverse the bits of a byte.
+ */
+static uint8_t reverse(uint8_t byte)
+{
+  uint8_t reversed;
+  int     i;
+
+  reversed = 0;
+  for (i = 0; i < 8; i++)
+  {
+    reversed = (reversed << 1) | (byte & 1);
+    byte >>= 1;
+  }
+
+  return reversed;
+}
+
+/**
+ * Load a source row of a sprite into the top of a 32-bit word.
+ *
+ * \param[in] src    Source row.
+ * \param[in] nbytes Bytes in the source row (2 or 3).
+ * \param[in] flip   Non-zero to reverse the row, as flip_16_masked_pixels()
+ *                   and flip_24_masked_pixels() would.
+ *
+ * \return Source row, left aligned, with the remaining bits clear.
+ */
+static uint32_t load_row(const uint8_t *src, int nbytes, int flip)
+{
+  uint32_t row;
+  int      i;
+
+  row = 0;
+  for (i = 0; i < nbytes; i++)
+  {
+    uint8_t byte = flip ? reverse(src[nbytes - 1 - i]) : src[i];
+    row |= (uint32_t) byte << (24 - 8 * i);
+  }
+
+  return row;
+}
+
+/**
+ * Render one sprite at a given flip and shift.
+ *
+ * The sprite plotters shift rows right by 'shift' pixels or, for shifts of
+ * four or more, left by the remainder into the following byte. Either way
+ * the result is the same: bitmap rows are shifted right with zeroes coming
+ * in and mask rows with ones coming in.
+ *
+ * \param[in]  sprite Sprite.
+ * \param[in]  flip   Non-zero to render the sprite flipped.
+ * \param[in]  shift  Pixel offset (0..7).
+ * \param[out] dst    Buffer to render into.
+ *
+ * \return Bytes written.
+ */
+static size_t render(const spritedef_t *sprite,
+                     int                flip,
+                     int                shift,
+                     uint8_t           *dst)
+{
+  int            nbytes;
+  const uint8_t *bitmap;
+  const uint8_t *mask;
+  int            y;
+  uint32_t       bm, mk;
+  int            i;
+
+  nbytes = sprite->width - 1;
+  bitmap = sprite->bitmap;
+  mask   = sprite->mask;
+
+  for (y = 0; y < sprite->height; y++)
+  {
+    bm = load_row(bitmap, nbytes, flip) >> shift;
+    mk = load_row(mask,   nbytes, flip) | (0xFFFFFFFFu >> (8 * nbytes));
+    mk = (mk >> shift) | ~(0xFFFFFFFFu >> shift);
+    bitmap += nbytes;
+    mask   += nbytes;
+
+    for (i = 0; i < sprite->width; i++)
+    {
+      *dst++ = (uint8_t) (bm >> (24 - 8 * i));
+      *dst++ = (uint8_t) (mk >> (24 - 8 * i));
+    }
+  }
+
+  return (size_t) sprite->height * sprite->width * 2;
+}
+
+const spritecache_t *spritecache_get(void)
+{
+  spritecache_t *cache;
+  size_t         size;
+  int            s, flip, shift;
+  uint8_t       *rows;
+
+  cache = shared_load(&shared_cache);
+  if (cache != NULL)
+    return cache;
+
+  size = 0;
+  for (s = 0; s < sprite__LIMIT; s++)
+    size += (size_t) sprites[s].height * sprites[s].width * 2;
+  size = sizeof(*cache) + size * 2 * SPRITECACHE_SHIFTS;
+
+  cache = malloc(size);
+  if (cache == NULL)
+    return NULL;
+
+  cache->size = size;
+
+  rows = (uint8_t *) (cache + 1);
+  for (s = 0; s < sprite__LIMIT; s++)
+    for (flip = 0; flip < 2; flip++)
+      for (shift = 0; shift < SPRITECACHE_SHIFTS; shift++)
+      {
+        cache->rows[s][flip][shift] = rows;
+        rows += render(&sprites[s], flip, shift, rows);
+      }
+
+  if (!shared_publish(&shared_cache, cache))
+  {
+    /* Another thread published one first. */
+    free(cache);
+    cache = shared_load(&shared_cache);
+  }
+
+  return cache;
+}
+
+TGE_API size_t tge_spritecache_size(void)
+{
+  const spritecache_t *cache;
+
+  cache = shared_load(&shared_cache);
+
+  return cache != NULL ? cache->size : 0;
+}
+
+#endif /* TGE_SPRITE_CACHE */
+
+// vim: ts=8 sts=2 sw=2 et
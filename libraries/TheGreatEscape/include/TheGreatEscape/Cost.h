@@ -0,0 +1,102 @@
+/**
+ * Cost.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef COST_H
+#define COST_H
+
+/* ----------------------------------------------------------------------- */
+
+/* T-state cost model.
+ *
+ * The original game runs flat out so its frame rate varies with the work
+ * done in each frame: it's slowest outdoors with the map scrolling and
+ * several characters on screen. To reproduce that, the expensive routines
+ * charge an estimate of what the original Z80 code would have taken to the
+ * current frame and the frame then sleeps for the total.
+ *
+ * The estimates are counted from the instruction timings of the original
+ * routines' inner loops. Work which isn't modelled separately is covered by
+ * a fixed charge per main loop iteration.
+ */
+
+/* Fixed charge per main loop iteration for all the unmodelled work:
+ * character AI, collision, messages, etc. */
+#define COST_MAIN_LOOP                    (235000)
+
+/* Menu: one iteration of the two-channel music loop, plus everything else
+ * the menu does per frame. */
+#define COST_MENU_MUSIC_ITER              (49)
+#define COST_MENU                         (485)
+
+/* Tiles: plot one exterior tile (supertile lookup plus eight rows). */
+#define COST_PLOT_TILE                    (440)
+/* Tiles: plot one interior tile. */
+#define COST_PLOT_INTERIOR_TILE           (380)
+
+/* Shunting the map: LDIR/LDDR cost per byte moved. */
+#define COST_SHUNT_BYTE                   (21)
+
+/* restore_tiles: per visible character, then per tile restored. */
+#define COST_RESTORE_TILES_VISCHAR        (600)
+#define COST_RESTORE_TILE                 (460)
+
+/* render_mask_buffer: clearing the buffer, culling each mask, each cell of
+ * an overlapping mask, and each mask tile ANDed in. */
+#define COST_MASK_CLEAR                   (3400)
+#define COST_MASK_CULL                    (120)
+#define COST_MASK_CELL                    (60)
+#define COST_MASK_TILE                    (330)
+
+/* Sprite plotters: per row, per bit shifted per row, and per row flipped. */
+#define COST_SPRITE_24_ROW                (300)
+#define COST_SPRITE_24_SHIFT              (64)
+#define COST_SPRITE_24_FLIP               (180)
+#define COST_SPRITE_16_ROW                (220)
+#define COST_SPRITE_16_SHIFT              (48)
+#define COST_SPRITE_16_FLIP               (120)
+
+/* plot_game_window: per scanline copied (unrolled LDIs) and per scanline
+ * copied with a nibble shift (RRDs). */
+#define COST_GAME_WINDOW_ROW              (400)
+#define COST_GAME_WINDOW_SHIFTED_ROW      (1000)
+
+/* searchlight_plot: setup then per row of the circle. */
+#define COST_SEARCHLIGHT                  (200)
+#define COST_SEARCHLIGHT_ROW              (500)
+
+/* Zoombox: per byte copied by the fill, and per border tile drawn. */
+#define COST_ZOOMBOX_BYTE                 (21)
+#define COST_ZOOMBOX_TILE                 (300)
+
+/**
+ * The COST macro charges 'n' T-states to the current frame.
+ */
+#define COST(n) (state->tstates += (n))
+
+/**
+ * The VIRTUAL_TSTATES macro gives the current time in T-states as the
+ * original game would see it: the T-states slept for so far plus those
+ * charged to the current frame. It's used to timestamp speaker events so
+ * wraps around every twenty minutes or so.
+ */
+#define VIRTUAL_TSTATES() ((uint32_t) (state->total_tstates + state->tstates))
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* COST_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -149,7 +149,8 @@ void set_game_window_attributes(tgestate_t *state, attribute_t attrs);
 
 /* event routines would be placed here but are now in Events.[ch]. */
 
-void screen_reset(tgestate_t *state);
+void screen_reset(tgestate_t *state, activity_t then);
+void screen_reset_complete(tgestate_t *state);
 
 void escaped(tgestate_t *state);
 
@@ -267,7 +268,10 @@ void searchlight_mask_test(tgestate_t *state, vischar_t *vischar);
 
 void plot_sprites(tgestate_t *state);
 
+void collect_drawables(tgestate_t *state, drawables_t *drawables);
+
 int get_next_drawable(tgestate_t    *state,
+                      drawables_t   *drawables,
                       uint8_t       *pindex,
                       vischar_t    **pvischar,
                       itemstruct_t **pitemstruct);
@@ -387,6 +391,7 @@ extern const anim_t *animations[animations__LIMIT];
 void mark_nearby_items(tgestate_t *state);
 
 uint8_t get_next_drawable_itemstruct(tgestate_t    *state,
+                                     drawables_t   *drawables,
                                      item_t         item_and_flag,
                                      uint16_t       x,
                                      uint16_t       y,
@@ -440,6 +445,8 @@ timedevent_handler_t event_roll_call;
 void action_papers(tgestate_t *state);
 
 int user_confirm(tgestate_t *state);
+void user_confirm_prompt(tgestate_t *state);
+int user_confirm_keyscan(tgestate_t *state);
 
 /* $F000 onwards */
 
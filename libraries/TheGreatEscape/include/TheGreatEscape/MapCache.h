@@ -0,0 +1,74 @@
+/**
+ * MapCache.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef MAP_CACHE_H
+#define MAP_CACHE_H
+
+/* ----------------------------------------------------------------------- */
+
+#include "TheGreatEscape/Map.h"
+#include "TheGreatEscape/Tiles.h"
+
+/* ----------------------------------------------------------------------- */
+
+#ifdef TGE_MAP_CACHE
+
+/** Dimensions of the map cache, in tiles. */
+#define MAPCACHE_WIDTH  (MAPX * 4)
+#define MAPCACHE_HEIGHT (MAPY * 4)
+
+/**
+ * The row of tiles, in map_position coordinates, held in the first row of
+ * the cache. get_supertiles() skips the first row of supertiles.
+ */
+#define MAPCACHE_TOP    (4)
+
+/**
+ * The exterior map, pre-rendered.
+ *
+ * This holds what plot_tile() would produce for every tile of the map, so
+ * that tiles can be plotted by copying rows rather than by looking up
+ * supertiles, tiles and tile sets one tile at a time.
+ */
+typedef struct mapcache
+{
+  /** Tile indices, as plot_tile() would store them in tile_buf. */
+  tileindex_t tiles[MAPCACHE_HEIGHT][MAPCACHE_WIDTH];
+
+  /** Pixels, as plot_tile() would store them in window_buf. */
+  tilerow_t   pixels[MAPCACHE_HEIGHT * 8][MAPCACHE_WIDTH];
+}
+mapcache_t;
+
+/**
+ * Return the map cache, rendering it if this is the first call.
+ *
+ * The cache is shared, read-only, by every game instance in the process and
+ * lasts until the process exits. It's safe to call this from multiple
+ * threads.
+ *
+ * \return Map cache, or NULL if out of memory.
+ */
+const mapcache_t *mapcache_get(void);
+
+#endif /* TGE_MAP_CACHE */
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* MAP_CACHE_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,72 @@
+/**
+ * MaskIndex.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef MASK_INDEX_H
+#define MASK_INDEX_H
+
+/* ----------------------------------------------------------------------- */
+
+#include "C99/Types.h"
+
+/* ----------------------------------------------------------------------- */
+
+#ifdef TGE_MASK_INDEX
+
+/** Number of isometric positions indexed along each axis. */
+#define MASKINDEX_POSITIONS (256)
+
+/**
+ * A set of exterior masks. Bit 'n' stands for exterior_mask_data[n].
+ */
+typedef uint64_t maskset_t;
+
+/**
+ * Exterior masks indexed by the isometric position of the sprite they're
+ * applied to.
+ *
+ * render_mask_buffer() keeps a mask when its bounds overlap the sprite's
+ * columns and its rows. The two tests are independent so the masks which
+ * overlap a sprite at (x,y) are columns[x] & rows[y].
+ */
+typedef struct maskindex
+{
+  /** Masks whose bounds overlap a sprite at isopos.x == index. */
+  maskset_t columns[MASKINDEX_POSITIONS];
+
+  /** Masks whose bounds overlap a sprite at isopos.y == index. */
+  maskset_t rows[MASKINDEX_POSITIONS];
+}
+maskindex_t;
+
+/**
+ * Return the exterior mask index, building it if this is the first call.
+ *
+ * The index is shared, read-only, by every game instance in the process and
+ * lasts until the process exits. It's safe to call this from multiple
+ * threads.
+ *
+ * \return Mask index, or NULL if out of memory.
+ */
+const maskindex_t *maskindex_get(void);
+
+#endif /* TGE_MASK_INDEX */
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* MASK_INDEX_H */
+
+// vim: ts=8 sts=2 sw=2 et
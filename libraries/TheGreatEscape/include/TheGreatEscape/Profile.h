@@ -0,0 +1,91 @@
+/**
+ * Profile.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* ----------------------------------------------------------------------- */
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Phases of main_loop() which are timed when profiling.
+ *
+ * Keep in step with the names in Profile.c.
+ */
+typedef enum profilephase
+{
+  profile_CHECK_MORALE,
+  profile_KEYSCAN_BREAK,
+  profile_MESSAGE_DISPLAY,
+  profile_PROCESS_PLAYER_INPUT,
+  profile_IN_PERMITTED_AREA,
+  profile_RESTORE_TILES,
+  profile_MOVE_A_CHARACTER,
+  profile_AUTOMATICS,
+  profile_PURGE_INVISIBLE_CHARACTERS,
+  profile_SPAWN_CHARACTERS,
+  profile_MARK_NEARBY_ITEMS,
+  profile_RING_BELL,
+  profile_ANIMATE,
+  profile_MOVE_MAP,
+  profile_PLOT_SPRITES,
+  profile_PLOT_GAME_WINDOW,
+  profile_NIGHTTIME,
+  profile_WAVE_MORALE_FLAG,
+  profile_DISPATCH_TIMED_EVENT,
+  profile__LIMIT
+}
+profilephase_t;
+
+#ifdef TGE_PROFILE
+
+typedef struct tgeprofile tgeprofile_t;
+
+/* Create and destroy the profile held by a game instance. */
+tgeprofile_t *profile_create(void);
+void profile_destroy(tgeprofile_t *profile);
+
+/* Start timing from now. */
+void profile_start(tgestate_t *state);
+
+/* Attribute the time since the last call to 'phase'. */
+void profile_lap(tgestate_t *state, profilephase_t phase);
+
+/**
+ * The PROFILE_START macro marks the start of a run of timed phases. Each
+ * following PROFILE_LAP(phase) attributes the time elapsed since the
+ * previous mark to 'phase'. Both expand to nothing unless TGE_PROFILE is
+ * defined.
+ */
+#define PROFILE_START      profile_start(state)
+#define PROFILE_LAP(phase) profile_lap(state, profile_##phase)
+
+#else
+
+#define PROFILE_START      do { } while (0)
+#define PROFILE_LAP(phase) do { } while (0)
+
+#endif /* TGE_PROFILE */
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* PROFILE_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,39 @@
+/**
+ * Rewind.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+/* ----------------------------------------------------------------------- */
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+/* ----------------------------------------------------------------------- */
+
+typedef struct tgerewind tgerewind_t;
+
+/* Record the current state into the rewind history. */
+void rewind_record(tgestate_t *state);
+
+/* Discard the rewind history, if any, keeping its settings. */
+void rewind_reset(tgestate_t *state);
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* REWIND_H */
+
+// vim: ts=8 sts=2 sw=2 et
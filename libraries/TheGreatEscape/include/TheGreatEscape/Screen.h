@@ -62,6 +62,53 @@ void invalidate_attrs(tgestate_t *state,
                       int         width,
                       int         height);
 
+/**
+ * Mark scanlines of the window buffer as written so that plot_game_window()
+ * will copy them to the screen.
+ *
+ * Conv: This helper function was added over the original game.
+ *
+ * \param[in] state  Pointer to game state.
+ * \param[in] addr   Pointer into the window buffer. May lie outside of it.
+ * \param[in] height Number of scanlines written.
+ */
+void invalidate_window_buf(tgestate_t    *state,
+                           const uint8_t *addr,
+                           int            height);
+
+/**
+ * Mark the whole window buffer as written.
+ *
+ * This must be called whenever the window buffer is moved wholesale or the
+ * game window on screen is drawn over by anything but plot_game_window().
+ *
+ * Conv: This helper function was added over the original game.
+ *
+ * \param[in] state Pointer to game state.
+ */
+void invalidate_game_window(tgestate_t *state);
+
+/**
+ * Copy a row of the game window to the screen.
+ *
+ * Conv: This helper function was added over the original game.
+ *
+ * \param[out] dst Pointer to 23 bytes of screen pixels.
+ * \param[in]  src Pointer to 23 bytes of window buffer.
+ */
+void plot_game_window_row(uint8_t *dst, const uint8_t *src);
+
+/**
+ * Copy a row of the game window to the screen, shifting it left by four
+ * pixels.
+ *
+ * Conv: This helper function was added over the original game.
+ *
+ * \param[out] dst Pointer to 23 bytes of screen pixels.
+ * \param[in]  src Pointer to 24 bytes of window buffer.
+ */
+void plot_game_window_row_shifted(uint8_t *dst, const uint8_t *src);
+
 /* ----------------------------------------------------------------------- */
 
 #endif /* SCREEN_H */
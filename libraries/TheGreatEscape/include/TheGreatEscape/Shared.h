@@ -0,0 +1,54 @@
+/**
+ * Shared.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef SHARED_H
+#define SHARED_H
+
+/* ----------------------------------------------------------------------- */
+
+/**
+ * A slot holding a pointer to data which is built once then shared,
+ * read-only, by every game instance in the process. Slots start out NULL.
+ */
+typedef void *volatile sharedslot_t;
+
+/**
+ * Return the data in a shared slot.
+ *
+ * \param[in] slot Shared slot.
+ *
+ * \return Shared data, or NULL if none has been published.
+ */
+void *shared_load(sharedslot_t *slot);
+
+/**
+ * Publish data into a shared slot, unless another thread published some
+ * first.
+ *
+ * \param[in] slot Shared slot.
+ * \param[in] data Data to publish.
+ *
+ * \return Non-zero if 'data' was published. Zero if the slot was already
+ * taken, in which case the caller still owns 'data'.
+ */
+int shared_publish(sharedslot_t *slot, void *data);
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* SHARED_H */
+
+// vim: ts=8 sts=2 sw=2 et
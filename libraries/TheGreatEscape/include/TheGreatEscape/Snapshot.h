@@ -0,0 +1,48 @@
+/**
+ * Snapshot.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/* ----------------------------------------------------------------------- */
+
+#include <stddef.h>
+
+#include "C99/Types.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+/* ----------------------------------------------------------------------- */
+
+/* A snapshot image is the complete game state flattened into a block of
+ * bytes which holds no addresses. Images from the same instance are all the
+ * same size and lay out the state identically, so they can be compared
+ * byte-for-byte. */
+
+size_t snapshot_image_size(const tgestate_t *state);
+
+/* 'image' must be suitably aligned for a tgestate_t, e.g. from malloc(). */
+void snapshot_capture(const tgestate_t *state, uint8_t *image);
+
+/* Returns non-zero, leaving the state untouched, if the image is invalid. */
+int snapshot_restore(tgestate_t *state, const uint8_t *image);
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* SNAPSHOT_H */
+
+// vim: ts=8 sts=2 sw=2 et
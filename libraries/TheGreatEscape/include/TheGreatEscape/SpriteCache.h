@@ -0,0 +1,71 @@
+/**
+ * SpriteCache.h
+ *
+ * This file is part of "The Great Escape in C".
+ *
+ * This project recreates the 48K ZX Spectrum version of the prison escape
+ * game "The Great Escape" in portable C code. It is free software provided
+ * without warranty in the interests of education and software preservation.
+ *
+ * "The Great Escape" was created by Denton Designs and published in 1986 by
+ * Ocean Software Limited.
+ *
+ * The original game is copyright (c) 1986 Ocean Software Ltd.
+ * The original game design is copyright (c) 1986 Denton Designs Ltd.
+ * The recreated version is copyright (c) 2012-2020 David Thomas
+ */
+
+#ifndef SPRITE_CACHE_H
+#define SPRITE_CACHE_H
+
+/* ----------------------------------------------------------------------- */
+
+#include <stddef.h>
+
+#include "C99/Types.h"
+
+#include "TheGreatEscape/Sprites.h"
+
+/* ----------------------------------------------------------------------- */
+
+#ifdef TGE_SPRITE_CACHE
+
+/** Number of pixel offsets, within a byte, at which sprites are plotted. */
+#define SPRITECACHE_SHIFTS (8)
+
+/**
+ * The sprites[] array, pre-shifted and pre-flipped.
+ *
+ * Each sprite is held once for every combination of flip and shift. A row of
+ * a sprite which is 'width' bytes wide in its spritedef_t (that's one more
+ * byte than its source rows) holds 'width' pairs of bitmap and mask bytes,
+ * ready to be combined with the screen exactly as the sprite plotters would.
+ */
+typedef struct spritecache
+{
+  /** Rows of sprites, indexed by [sprite][flipped][shift]. */
+  const uint8_t *rows[sprite__LIMIT][2][SPRITECACHE_SHIFTS];
+
+  /** Size of the cache, in bytes. */
+  size_t         size;
+}
+spritecache_t;
+
+/**
+ * Return the sprite cache, building it if this is the first call.
+ *
+ * The cache is shared, read-only, by every game instance in the process and
+ * lasts until the process exits. It's safe to call this from multiple
+ * threads.
+ *
+ * \return Sprite cache, or NULL if out of memory.
+ */
+const spritecache_t *spritecache_get(void);
+
+#endif /* TGE_SPRITE_CACHE */
+
+/* ----------------------------------------------------------------------- */
+
+#endif /* SPRITE_CACHE_H */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -20,7 +20,6 @@
 
 /* ----------------------------------------------------------------------- */
 
-#include <setjmp.h>
 #include <stddef.h>
 
 #include "C99/Types.h"
@@ -46,6 +45,12 @@
 #define WINDOW_BUF_HEIGHT         (17)
 #define WINDOW_BUF_LENGTH         (WINDOW_BUF_WIDTH * WINDOW_BUF_HEIGHT)
 
+/* Conv: Rows of slack allocated either side of tile_buf and window_buf. The
+ * map scrolls by moving the buffers within their allocations rather than by
+ * shunting their contents. They're only moved back to the centre, with a
+ * single copy, once they run out of slack. */
+#define SCROLL_SLACK_ROWS         (2 * WINDOW_BUF_HEIGHT)
+
 #define MAP_BUF_WIDTH             (7)
 #define MAP_BUF_HEIGHT            (5)
 #define MAP_BUF_LENGTH            (MAP_BUF_WIDTH * MAP_BUF_HEIGHT)
@@ -90,16 +95,43 @@ struct tgestate
   int             st_columns, st_rows;
 
   /**
-   * Virtual ZX Spectrum hardware we're driving.
+   * The activity which the next call to tge_main() will advance.
    */
-  zxspectrum_t   *speccy;
+  activity_t      activity;
 
   /**
-   * Non-local jump buffer initialised by tge_main() then jumped to when
-   * squash_stack_goto_main() is called. This happens when transition() or
-   * enter_room() is called.
+   * The activity to continue with once the zoombox has completed.
    */
-  jmp_buf         jmpbuf_main;
+  activity_t      after_zoombox;
+
+  /**
+   * Set by squash_stack_goto_main() to make every routine return up to
+   * tge_main(). This happens when transition() or enter_room() is called.
+   */
+  uint8_t         squashed;
+
+  /**
+   * The escape items bitfield computed by escaped() and used once the
+   * player has pressed a key.
+   */
+  uint8_t         escape_itemflags;
+
+  /**
+   * Estimated T-states charged to the current frame by the cost model (see
+   * Cost.h).
+   */
+  uint32_t        tstates;
+
+  /**
+   * Total T-states slept for since the game instance was created.
+   */
+  uint64_t        total_tstates;
+
+  /**
+   * Scanlines of window_buf written since plot_game_window() last copied
+   * them to the screen. One bit per scanline.
+   */
+  uint32_t        window_buf_dirty[(WINDOW_BUF_HEIGHT * 8 + 31) / 32];
 
   /**
    * tile_buf's length in bytes.
@@ -116,6 +148,14 @@ struct tgestate
    */
   size_t          window_buf_size;
 
+  /**
+   * Conv: The allocations which tile_buf and window_buf move around within
+   * as the map scrolls. Each has SCROLL_SLACK_ROWS rows of slack either side
+   * of the buffer.
+   */
+  tileindex_t    *tile_buf_alloc;
+  uint8_t        *window_buf_alloc;
+
   /**
    * map_buf's length in bytes.
    */
@@ -567,6 +607,8 @@ struct tgestate
    * Its dimensions are 24x17 = 408 total tiles in the buffer.
    *
    * Written by plot_*_tiles and expand_object.
+   *
+   * Conv: Moves within tile_buf_alloc as the map scrolls.
    */
   tileindex_t    *tile_buf;
 
@@ -594,6 +636,8 @@ struct tgestate
    * a possible 4-bit shift.
    *
    * Its dimensions are 24x17x8 bytes = 3,264 total bytes in the buffer.
+   *
+   * Conv: Moves within window_buf_alloc as the map scrolls.
    */
   uint8_t        *window_buf; // should this be a tilerow_t?
 
@@ -607,8 +651,64 @@ struct tgestate
    * Its dimensions are 7x5 = 35 total supertiles in the buffer.
    */
   supertileindex_t *map_buf;
+
+  /* ------------------------------------------------------------------------
+   * Host resources.
+   *
+   * Everything from here on belongs to the host rather than to the game and
+   * some of it depends on build options. Snapshots, tge_hash() and
+   * tge_clone() cover only the structure before this point (see
+   * TGESTATE_GAME_SIZE) so that builds with different options agree.
+   * --------------------------------------------------------------------- */
+
+  /**
+   * Virtual ZX Spectrum hardware we're driving.
+   */
+  zxspectrum_t   *speccy;
+
+  /**
+   * Rewind history, or NULL if rewind is disabled.
+   */
+  struct tgerewind *rewind;
+
+#ifdef TGE_PROFILE
+  /**
+   * Main loop phase timings.
+   */
+  struct tgeprofile *profile;
+#endif
+
+#ifdef TGE_MAP_CACHE
+  /**
+   * Pre-rendered exterior map, shared with other instances, or NULL if it
+   * couldn't be created.
+   */
+  const struct mapcache *mapcache;
+#endif
+
+#ifdef TGE_SPRITE_CACHE
+  /**
+   * Pre-shifted and pre-flipped sprites, shared with other instances, or NULL
+   * if they couldn't be created.
+   */
+  const struct spritecache *spritecache;
+#endif
+
+#ifdef TGE_MASK_INDEX
+  /**
+   * Exterior masks indexed by position, shared with other instances, or NULL
+   * if the index couldn't be created.
+   */
+  const struct maskindex *maskindex;
+#endif
 };
 
+/**
+ * Size of the part of tgestate_t which holds the game: everything before the
+ * host resources.
+ */
+#define TGESTATE_GAME_SIZE (offsetof(tgestate_t, speccy))
+
 /* ----------------------------------------------------------------------- */
 
 #endif /* STATE_H */
@@ -151,6 +151,31 @@ enum direction
  */
 typedef uint8_t direction_t;
 
+/**
+ * Identifiers of engine activities.
+ *
+ * Conv: The original game blocks in nested loops while zooming the game
+ * window or waiting for keypresses. Here each of those is an activity which
+ * tge_main() advances by one step per call.
+ */
+enum activity
+{
+  activity_MAIN_LOOP,           /**< Run main_loop() from the top. */
+  activity_MAIN_LOOP_RESUME,    /**< Run main_loop() from after keyscan_break(). */
+  activity_ZOOMBOX,             /**< Step the zoombox then continue with after_zoombox. */
+  activity_ENTERED_ROOM,        /**< Finish off enter_room(). */
+  activity_BREAK_PROMPT,        /**< Finish screen_reset() then ask to confirm the break. */
+  activity_BREAK_CONFIRM,       /**< Poll for a Y/N answer to the break prompt. */
+  activity_ESCAPED_MESSAGES,    /**< Finish screen_reset() then show the escape messages. */
+  activity_ESCAPED_RELEASE,     /**< Wait for all keys to be released. */
+  activity_ESCAPED_PRESS        /**< Wait for any key to be pressed. */
+};
+
+/**
+ * Holds an activity.
+ */
+typedef uint8_t activity_t;
+
 /* ----------------------------------------------------------------------- */
 
 /* FLAGS
@@ -408,8 +433,8 @@ enum escapeitem_flags
  */
 
 /* These are offsets from the start of the screen bank. */
-#define score_address                 ((uint16_t) 0x1094)
-#define screen_text_start_address     ((uint16_t) 0x10E0)
+#define score_address                 ((uint16_t) ZXSCREEN_FROM_INTERLEAVED(0x1094))
+#define screen_text_start_address     ((uint16_t) ZXSCREEN_FROM_INTERLEAVED(0x10E0))
 
 /* These are offsets from the start of the attributes bank. */
 #define morale_flag_attributes_offset ((uint16_t) 0x0042)
@@ -738,6 +763,19 @@ typedef struct itemstruct
 }
 itemstruct_t;
 
+/**
+ * Conv: Holds the vischars and itemstructs which plot_sprites() has yet to
+ * draw, in index order.
+ */
+typedef struct drawables
+{
+  vischar_t    *vischars[vischars_LENGTH];
+  int           nvischars;
+  itemstruct_t *itemstructs[item__LIMIT];
+  int           nitemstructs;
+}
+drawables_t;
+
 /**
  * Holds the variables related to on-screen messages.
  */
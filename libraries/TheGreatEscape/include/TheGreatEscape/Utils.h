@@ -48,8 +48,18 @@
 /**
  * The NEVER_RETURNS macro is placed after calls which are not expected to
  * return (calls which ultimately invoke squash_stack_goto_main()).
+ *
+ * Conv: squash_stack_goto_main() sets a flag rather than jumping out so these
+ * calls do return, but only once the stack is being unwound.
  */
-#define NEVER_RETURNS assert("Unexpected return." == NULL); return
+#define NEVER_RETURNS assert(state->squashed); return
+
+/**
+ * The RETURN_IF_SQUASHED macro is placed after calls which _may_ invoke
+ * squash_stack_goto_main(). It returns from the calling routine if the stack
+ * is being unwound.
+ */
+#define RETURN_IF_SQUASHED if (state->squashed) return
 
 /* ----------------------------------------------------------------------- */
 
@@ -135,11 +145,21 @@ int menudelay(tgestate_t *state, int duration);
  * Use this in the body of the game code when you don't care about accuracy
  * (e.g. when waiting inbetween key presses).
  *
- * If the sleep() callback returns 'terminate game thread', this handles it by
- * exiting from tge_main().
+ * Callers end their tge_main() slice straight after the delay, so if the
+ * sleep() callback returns 'terminate game thread' the host regains control
+ * without further action here.
  */
 void gamedelay(tgestate_t *state, int duration);
 
+/**
+ * Ends a frame by sleeping for the T-states charged to it by the cost model
+ * (see Cost.h), plus 'overhead'.
+ *
+ * If the sleep() callback returns 'terminate game thread', this returns that
+ * value.
+ */
+int framedelay(tgestate_t *state, int overhead);
+
 /* ----------------------------------------------------------------------- */
 
 #endif /* UTILS_H */
@@ -21,10 +21,12 @@
 /* ----------------------------------------------------------------------- */
 
 #include "TheGreatEscape/TheGreatEscape.h"
+#include "TheGreatEscape/Types.h"
 
 /* ----------------------------------------------------------------------- */
 
-void zoombox(tgestate_t *state);
+void zoombox(tgestate_t *state, activity_t then);
+void zoombox_step(tgestate_t *state);
 
 /* ----------------------------------------------------------------------- */
 
@@ -0,0 +1,335 @@
+/* Beeper.c
+ *
+ * ZX Spectrum beeper synthesis.
+ *
+ * Copyright (c) David Thomas, 2020. <dave@davespace.co.uk>
+ */
+
+/* Each change of the speaker's level is a step. Sampling a step directly
+ * aliases, so instead we add the step's derivative - a band-limited impulse
+ * - into a buffer of deltas at the step's fractional sample position, then
+ * integrate the deltas to make the output. This is the "BLEP" technique.
+ *
+ * The impulses are windowed sincs with a cutoff of 0.45 times the sample
+ * rate, tabulated at 32 sub-sample phases. They're held in 1.15 fixed point
+ * and normalised so that each phase sums to exactly one, so every step
+ * settles at exactly its height and the output is bit exact everywhere.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "C99/Types.h"
+
+#include "ZXSpectrum/Spectrum.h"
+
+#include "ZXSpectrum/Beeper.h"
+
+/* Vector kernels for add_impulse(). */
+#if defined(__x86_64__) || defined(_M_X64)
+#define ZXBEEPER_X86
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ZXBEEPER_NEON
+#include <arm_neon.h>
+#endif
+
+/* ----------------------------------------------------------------------- */
+
+#define PHASES     (32)    /* sub-sample positions of the impulses */
+#define TAPS       (16)    /* length of each impulse, in samples */
+
+#define VOLUME     (16384) /* step height for a change of level */
+#define HIGHPASS   (512)   /* time constant of the DC filter, in samples */
+
+/* Samples by which events may be ahead of the output. */
+#define LOOKAHEAD(rate) (rate) /* one second */
+
+/* Band-limited impulses, indexed by phase. */
+static const int16_t impulses[PHASES][TAPS] =
+{
+  {     18,   -110,    359,   -843,   1561,  -2371,   3025,  29490,
+      3025,  -2371,   1561,   -843,    359,   -110,     18,      0 },
+  {     17,   -108,    347,   -795,   1421,  -2025,   2117,  29452,
+      3974,  -2714,   1693,   -887,    369,   -111,     18,      0 },
+  {     17,   -105,    332,   -742,   1276,  -1679,   1252,  29332,
+      4960,  -3051,   1818,   -925,    376,   -110,     17,      0 },
+  {     16,   -102,    315,   -686,   1128,  -1335,    434,  29131,
+      5981,  -3378,   1932,   -956,    380,   -109,     17,      0 },
+  {     16,    -98,    297,   -627,    977,   -997,   -336,  28853,
+      7031,  -3693,   2036,   -982,    381,   -106,     16,      0 },
+  {     15,    -93,    277,   -566,    824,   -665,  -1055,  28499,
+      8106,  -3992,   2127,   -999,    378,   -103,     15,      0 },
+  {     14,    -87,    256,   -503,    672,   -343,  -1721,  28067,
+      9203,  -4273,   2204,  -1009,    372,    -97,     13,      0 },
+  {     13,    -82,    234,   -439,    522,    -34,  -2334,  27565,
+     10317,  -4531,   2266,  -1011,    362,    -91,     11,      0 },
+  {     12,    -76,    211,   -375,    374,    262,  -2891,  26992,
+     11444,  -4765,   2311,  -1004,    348,    -83,      8,      0 },
+  {     10,    -69,    188,   -311,    229,    543,  -3394,  26350,
+     12577,  -4970,   2339,   -987,    330,    -73,      6,      0 },
+  {      9,    -63,    165,   -248,     90,    807,  -3840,  25646,
+     13712,  -5144,   2348,   -962,    308,    -62,      2,      0 },
+  {      8,    -56,    142,   -186,    -44,   1052,  -4231,  24877,
+     14845,  -5283,   2338,   -926,    282,    -50,     -1,      1 },
+  {      7,    -50,    119,   -126,   -171,   1277,  -4566,  24057,
+     15970,  -5386,   2307,   -881,    251,    -36,     -5,      1 },
+  {      6,    -44,     96,    -68,   -291,   1482,  -4846,  23182,
+     17081,  -5448,   2255,   -825,    217,    -21,    -10,      2 },
+  {      5,    -37,     74,    -12,   -403,   1666,  -5072,  22257,
+     18174,  -5467,   2182,   -760,    178,     -4,    -15,      2 },
+  {      4,    -31,     53,     41,   -506,   1828,  -5246,  21289,
+     19243,  -5441,   2086,   -685,    136,     14,    -20,      3 },
+  {      3,    -25,     33,     90,   -600,   1968,  -5368,  20283,
+     20283,  -5368,   1968,   -600,     90,     33,    -25,      3 },
+  {      3,    -20,     14,    136,   -685,   2086,  -5441,  19243,
+     21289,  -5246,   1828,   -506,     41,     53,    -31,      4 },
+  {      2,    -15,     -4,    178,   -760,   2182,  -5467,  18174,
+     22257,  -5072,   1666,   -403,    -12,     74,    -37,      5 },
+  {      2,    -10,    -21,    217,   -825,   2255,  -5448,  17081,
+     23182,  -4846,   1482,   -291,    -68,     96,    -44,      6 },
+  {      1,     -5,    -36,    251,   -881,   2307,  -5386,  15970,
+     24057,  -4566,   1277,   -171,   -126,    119,    -50,      7 },
+  {      1,     -1,    -50,    282,   -926,   2338,  -5283,  14845,
+     24877,  -4231,   1052,    -44,   -186,    142,    -56,      8 },
+  {      0,      2,    -62,    308,   -962,   2348,  -5144,  13712,
+     25646,  -3840,    807,     90,   -248,    165,    -63,      9 },
+  {      0,      6,    -73,    330,   -987,   2339,  -4970,  12577,
+     26350,  -3394,    543,    229,   -311,    188,    -69,     10 },
+  {      0,      8,    -83,    348,  -1004,   2311,  -4765,  11444,
+     26992,  -2891,    262,    374,   -375,    211,    -76,     12 },
+  {      0,     11,    -91,    362,  -1011,   2266,  -4531,  10317,
+     27565,  -2334,    -34,    522,   -439,    234,    -82,     13 },
+  {      0,     13,    -97,    372,  -1009,   2204,  -4273,   9203,
+     28067,  -1721,   -343,    672,   -503,    256,    -87,     14 },
+  {      0,     15,   -103,    378,   -999,   2127,  -3992,   8106,
+     28499,  -1055,   -665,    824,   -566,    277,    -93,     15 },
+  {      0,     16,   -106,    381,   -982,   2036,  -3693,   7031,
+     28853,   -336,   -997,    977,   -627,    297,    -98,     16 },
+  {      0,     17,   -109,    380,   -956,   1932,  -3378,   5981,
+     29131,    434,  -1335,   1128,   -686,    315,   -102,     16 },
+  {      0,     17,   -110,    376,   -925,   1818,  -3051,   4960,
+     29332,   1252,  -1679,   1276,   -742,    332,   -105,     17 },
+  {      0,     18,   -111,    369,   -887,   1693,  -2714,   3974,
+     29452,   2117,  -2025,   1421,   -795,    347,   -108,     17 }
+};
+
+/* ----------------------------------------------------------------------- */
+
+struct zxbeeper
+{
+  int       rate;     /* sample rate */
+  uint64_t  clock;    /* T-states rendered so far */
+  uint64_t  rendered; /* samples rendered so far */
+  uint32_t  now;      /* event time corresponding to 'clock' */
+  uint32_t  level;    /* speaker level after the last event added */
+
+  int32_t   filtered; /* leaky integral of the deltas */
+
+  int       size;     /* samples of deltas which may be addressed */
+  int       used;     /* deltas beyond this are zero */
+  int32_t  *deltas;   /* 'size' + TAPS entries */
+};
+
+/* ----------------------------------------------------------------------- */
+
+/* Add 'impulse' scaled by 'delta' into 'out'. */
+
+#if defined(ZXBEEPER_X86)
+
+static void add_impulse(int32_t *out, const int16_t *impulse, int delta)
+{
+  __m128i d;
+  __m128i k, lo, hi;
+  __m128i *o;
+  int     i;
+
+  d = _mm_set1_epi16((short) delta);
+  for (i = 0; i < TAPS; i += 8)
+  {
+    /* Widen the 16x16-bit products to 32 bits. */
+    k  = _mm_loadu_si128((const __m128i *) &impulse[i]);
+    lo = _mm_mullo_epi16(k, d);
+    hi = _mm_mulhi_epi16(k, d);
+    o  = (__m128i *) &out[i];
+    _mm_storeu_si128(o + 0, _mm_add_epi32(_mm_loadu_si128(o + 0),
+                                          _mm_unpacklo_epi16(lo, hi)));
+    _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1),
+                                          _mm_unpackhi_epi16(lo, hi)));
+  }
+}
+
+#elif defined(ZXBEEPER_NEON)
+
+static void add_impulse(int32_t *out, const int16_t *impulse, int delta)
+{
+  int16x4_t d;
+  int       i;
+
+  d = vdup_n_s16((int16_t) delta);
+  for (i = 0; i < TAPS; i += 4)
+    vst1q_s32(&out[i], vmlal_s16(vld1q_s32(&out[i]), vld1_s16(&impulse[i]), d));
+}
+
+#else
+
+static void add_impulse(int32_t *out, const int16_t *impulse, int delta)
+{
+  int i;
+
+  for (i = 0; i < TAPS; i++)
+    out[i] += impulse[i] * delta;
+}
+
+#endif
+
+/* ----------------------------------------------------------------------- */
+
+zxbeeper_t *zxbeeper_create(int sample_rate)
+{
+  zxbeeper_t *beeper;
+
+  if (sample_rate < 8000 || sample_rate > 192000)
+    return NULL;
+
+  beeper = malloc(sizeof(*beeper));
+  if (beeper == NULL)
+    return NULL;
+
+  beeper->size   = LOOKAHEAD(sample_rate);
+  beeper->deltas = calloc(beeper->size + TAPS, sizeof(*beeper->deltas));
+  if (beeper->deltas == NULL)
+  {
+    free(beeper);
+    return NULL;
+  }
+
+  beeper->rate     = sample_rate;
+  beeper->clock    = 0;
+  beeper->rendered = 0;
+  beeper->now      = 0;
+  beeper->level    = 0;
+  beeper->filtered = 0;
+  beeper->used     = 0;
+
+  return beeper;
+}
+
+void zxbeeper_destroy(zxbeeper_t *doomed)
+{
+  if (doomed == NULL)
+    return;
+
+  free(doomed->deltas);
+  free(doomed);
+}
+
+void zxbeeper_add(zxbeeper_t             *beeper,
+                  const zxspeakerevent_t *events,
+                  int                     nevents)
+{
+  int      i;
+  int32_t  ahead;
+  uint64_t phasepos;
+  int      index;
+
+  assert(beeper != NULL);
+  assert(events != NULL || nevents == 0);
+
+  for (i = 0; i < nevents; i++)
+  {
+    if (events[i].level == beeper->level)
+      continue;
+
+    ahead = (int32_t) (events[i].tstate - beeper->now);
+    if (ahead < 0)
+    {
+      ahead = 0; /* late */
+    }
+    else if (ahead > ZXBEEPER_TSTATES_PER_SEC)
+    {
+      beeper->now = events[i].tstate; /* the game's clock was reset */
+      ahead = 0;
+    }
+
+    /* Position of the event relative to the next sample to be rendered, in
+     * phases. */
+    phasepos = (beeper->clock + ahead) * beeper->rate * PHASES /
+               ZXBEEPER_TSTATES_PER_SEC - beeper->rendered * PHASES;
+    if (phasepos > (uint64_t) (beeper->size - 1) * PHASES)
+      phasepos = (uint64_t) (beeper->size - 1) * PHASES;
+
+    index = (int) (phasepos / PHASES);
+    add_impulse(&beeper->deltas[index],
+                impulses[phasepos % PHASES],
+                events[i].level ? VOLUME : -VOLUME);
+    if (beeper->used < index + TAPS)
+      beeper->used = index + TAPS;
+
+    beeper->level = events[i].level;
+  }
+}
+
+int zxbeeper_max_samples(const zxbeeper_t *beeper, int duration)
+{
+  assert(beeper != NULL);
+  assert(duration >= 0);
+
+  return (int) ((uint64_t) duration * beeper->rate /
+                ZXBEEPER_TSTATES_PER_SEC) + 1;
+}
+
+int zxbeeper_render(zxbeeper_t *beeper, int duration, int16_t *samples)
+{
+  int      nsamples;
+  int      i;
+  int32_t  delta;
+  int32_t  sample;
+
+  assert(beeper != NULL);
+  assert(duration >= 0);
+  assert(samples != NULL);
+
+  beeper->clock += duration;
+  beeper->now   += duration;
+  nsamples = (int) (beeper->clock * beeper->rate / ZXBEEPER_TSTATES_PER_SEC -
+                    beeper->rendered);
+  beeper->rendered += nsamples;
+
+  /* Integrate the deltas. The integrator leaks, which removes the DC
+   * offset. */
+  for (i = 0; i < nsamples; i++)
+  {
+    delta = (i < beeper->used) ? beeper->deltas[i] : 0;
+    beeper->filtered += delta - beeper->filtered / HIGHPASS;
+
+    sample = beeper->filtered / 32768;
+    if (sample > 32767)
+      sample = 32767;
+    else if (sample < -32768)
+      sample = -32768;
+    samples[i] = (int16_t) sample;
+  }
+
+  /* Discard the deltas consumed. */
+  if (nsamples < beeper->used)
+  {
+    memmove(&beeper->deltas[0],
+            &beeper->deltas[nsamples],
+            (beeper->used - nsamples) * sizeof(*beeper->deltas));
+    memset(&beeper->deltas[beeper->used - nsamples],
+           0,
+           nsamples * sizeof(*beeper->deltas));
+    beeper->used -= nsamples;
+  }
+  else
+  {
+    memset(&beeper->deltas[0], 0, beeper->used * sizeof(*beeper->deltas));
+    beeper->used = 0;
+  }
+
+  return nsamples;
+}
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,412 @@
+/* InputLog.c
+ *
+ * Recording and replay of ZX Spectrum input.
+ *
+ * Copyright (c) David Thomas, 2020. <dave@davespace.co.uk>
+ */
+
+/* File format:
+ *
+ *   header: magic[8] version nports hash_interval
+ *   record: RUN   count mask values[popcount(mask)]
+ *         | HASH  frame hash[4]
+ *         | END   frames
+ *
+ * 'version' and 'nports' are bytes. 'hash_interval', 'count', 'frame' and
+ * 'frames' are LEB128 varints. 'mask' is a little-endian uint16 with a bit
+ * set for every port whose value differs from the previous RUN record (ports
+ * start out as zero) and 'values' are the new values of those ports in port
+ * order. 'hash' is a little-endian uint32 of the game state once 'frame'
+ * frames have completed.
+ *
+ * Runs of frames with identical port values collapse into a single RUN
+ * record so an idle game costs nothing and a typical frame a few bytes.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "C99/Types.h"
+
+#include "ZXSpectrum/Spectrum.h"
+
+#include "ZXSpectrum/InputLog.h"
+
+/* ----------------------------------------------------------------------- */
+
+#define INPUTLOG_MAGIC     "ZXINPUT\x1A"
+#define INPUTLOG_MAGIC_LEN (8)
+#define INPUTLOG_VERSION   (1)
+
+enum
+{
+  record_END,
+  record_RUN,
+  record_HASH
+};
+
+/* The ports which are logged, in log order. */
+static const uint16_t ports[] =
+{
+  port_KEMPSTON_JOYSTICK,
+  port_KEYBOARD_SHIFTZXCV,
+  port_KEYBOARD_ASDFG,
+  port_KEYBOARD_QWERT,
+  port_KEYBOARD_12345,
+  port_KEYBOARD_09876,
+  port_KEYBOARD_POIUY,
+  port_KEYBOARD_ENTERLKJH,
+  port_KEYBOARD_SPACESYMSHFTMNB
+};
+
+#define NPORTS ((int) (sizeof(ports) / sizeof(ports[0])))
+
+/* ----------------------------------------------------------------------- */
+
+struct zxinputlog
+{
+  FILE          *f;
+  int            recording;     /* bool */
+  int            hash_interval; /* frames per hash, or zero */
+  int            error;         /* bool */
+  unsigned long  frames;        /* frames completed */
+  uint8_t        values[NPORTS];
+
+  /* Recording */
+  unsigned int   latched;       /* bitmask of ports read this frame */
+  uint8_t        run_values[NPORTS];
+  unsigned long  run_length;
+  uint8_t        written[NPORTS]; /* port values as of the last RUN record */
+
+  /* Replaying */
+  unsigned long  remaining;     /* frames left in the current run */
+  int            ended;         /* bool */
+};
+
+/* ----------------------------------------------------------------------- */
+
+static int port_index(uint16_t port)
+{
+  int i;
+
+  for (i = 0; i < NPORTS; i++)
+    if (ports[i] == port)
+      return i;
+
+  return -1;
+}
+
+static void put_varint(zxinputlog_t *log, unsigned long v)
+{
+  while (v >= 0x80)
+  {
+    putc((int) ((v & 0x7F) | 0x80), log->f);
+    v >>= 7;
+  }
+  putc((int) v, log->f);
+}
+
+static int get_varint(zxinputlog_t *log, unsigned long *v)
+{
+  unsigned long value = 0;
+  int           shift = 0;
+  int           c;
+
+  do
+  {
+    c = getc(log->f);
+    /* Reject values too wide for an unsigned long, whatever its size. */
+    if (c == EOF || shift >= (int) (sizeof(unsigned long) * CHAR_BIT))
+      return 1;
+    value |= (unsigned long) (c & 0x7F) << shift;
+    shift += 7;
+  }
+  while (c & 0x80);
+
+  *v = value;
+
+  return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void flush_run(zxinputlog_t *log)
+{
+  unsigned int mask;
+  int          i;
+
+  if (log->run_length == 0)
+    return;
+
+  mask = 0;
+  for (i = 0; i < NPORTS; i++)
+    if (log->run_values[i] != log->written[i])
+      mask |= 1u << i;
+
+  putc(record_RUN, log->f);
+  put_varint(log, log->run_length);
+  putc((int) (mask & 0xFF), log->f);
+  putc((int) (mask >> 8), log->f);
+  for (i = 0; i < NPORTS; i++)
+    if (mask & (1u << i))
+      putc(log->run_values[i], log->f);
+
+  memcpy(log->written, log->run_values, NPORTS);
+  log->run_length = 0;
+}
+
+static void put_hash(zxinputlog_t *log, uint32_t hash)
+{
+  putc(record_HASH, log->f);
+  put_varint(log, log->frames);
+  putc((int) ((hash >>  0) & 0xFF), log->f);
+  putc((int) ((hash >>  8) & 0xFF), log->f);
+  putc((int) ((hash >> 16) & 0xFF), log->f);
+  putc((int) ((hash >> 24) & 0xFF), log->f);
+}
+
+/* Read records up to and including the next RUN, checking any hashes on the
+ * way. */
+static zxinputlogresult_t next_run(zxinputlog_t        *log,
+                                   zxinputlog_hasher_t *hasher,
+                                   void                *opaque)
+{
+  for (;;)
+  {
+    int           tag;
+    unsigned long v;
+    unsigned int  mask;
+    uint8_t       bytes[4];
+    uint32_t      hash;
+    int           i;
+
+    tag = getc(log->f);
+    switch (tag)
+    {
+    case record_RUN:
+      if (get_varint(log, &v) || v == 0 ||
+          fread(bytes, 1, 2, log->f) != 2)
+        goto malformed;
+      mask = bytes[0] | (bytes[1] << 8);
+      for (i = 0; i < NPORTS; i++)
+      {
+        if (mask & (1u << i))
+        {
+          int c = getc(log->f);
+          if (c == EOF)
+            goto malformed;
+          log->values[i] = (uint8_t) c;
+        }
+      }
+      log->remaining = v;
+      return zxinputlog_OK;
+
+    case record_HASH:
+      if (get_varint(log, &v) || v != log->frames ||
+          fread(bytes, 1, 4, log->f) != 4)
+        goto malformed;
+      hash = ((uint32_t) bytes[0] <<  0) |
+             ((uint32_t) bytes[1] <<  8) |
+             ((uint32_t) bytes[2] << 16) |
+             ((uint32_t) bytes[3] << 24);
+      if (hasher && hasher(opaque) != hash)
+        return zxinputlog_DESYNC;
+      break;
+
+    case record_END:
+      if (get_varint(log, &v) || v != log->frames)
+        goto malformed;
+      log->ended = 1;
+      return zxinputlog_END;
+
+    default:
+      goto malformed;
+    }
+  }
+
+malformed:
+  log->error = 1;
+  log->ended = 1;
+  return zxinputlog_ERROR;
+}
+
+/* ----------------------------------------------------------------------- */
+
+zxinputlog_t *zxinputlog_record(const char *filename, int hash_interval)
+{
+  zxinputlog_t *log;
+
+  assert(filename != NULL);
+  assert(hash_interval >= 0);
+
+  log = calloc(1, sizeof(*log));
+  if (log == NULL)
+    return NULL;
+
+  log->f = fopen(filename, "wb");
+  if (log->f == NULL)
+  {
+    free(log);
+    return NULL;
+  }
+
+  log->recording     = 1;
+  log->hash_interval = hash_interval;
+
+  fwrite(INPUTLOG_MAGIC, 1, INPUTLOG_MAGIC_LEN, log->f);
+  putc(INPUTLOG_VERSION, log->f);
+  putc(NPORTS, log->f);
+  put_varint(log, (unsigned long) hash_interval);
+
+  return log;
+}
+
+zxinputlog_t *zxinputlog_replay(const char *filename)
+{
+  zxinputlog_t *log;
+  char          magic[INPUTLOG_MAGIC_LEN];
+  unsigned long hash_interval;
+
+  assert(filename != NULL);
+
+  log = calloc(1, sizeof(*log));
+  if (log == NULL)
+    return NULL;
+
+  log->f = fopen(filename, "rb");
+  if (log->f == NULL)
+    goto failure;
+
+  if (fread(magic, 1, INPUTLOG_MAGIC_LEN, log->f) != INPUTLOG_MAGIC_LEN ||
+      memcmp(magic, INPUTLOG_MAGIC, INPUTLOG_MAGIC_LEN) != 0 ||
+      getc(log->f) != INPUTLOG_VERSION ||
+      getc(log->f) != NPORTS ||
+      get_varint(log, &hash_interval))
+    goto failure;
+
+  log->hash_interval = (int) hash_interval;
+
+  /* Load the first frame's values. */
+  if (next_run(log, NULL, NULL) == zxinputlog_ERROR)
+    goto failure;
+
+  return log;
+
+
+failure:
+
+  if (log->f)
+    fclose(log->f);
+  free(log);
+
+  return NULL;
+}
+
+int zxinputlog_key(zxinputlog_t *log, uint16_t port, int value)
+{
+  int index;
+
+  assert(log != NULL);
+
+  index = port_index(port);
+  if (index < 0)
+    return value;
+
+  if (log->recording && (log->latched & (1u << index)) == 0)
+  {
+    log->values[index] = (uint8_t) value;
+    log->latched |= 1u << index;
+  }
+
+  return log->values[index];
+}
+
+zxinputlogresult_t zxinputlog_end_frame(zxinputlog_t        *log,
+                                        zxinputlog_hasher_t *hasher,
+                                        void                *opaque)
+{
+  assert(log != NULL);
+
+  if (log->recording)
+  {
+    if (log->run_length > 0 &&
+        memcmp(log->values, log->run_values, NPORTS) == 0)
+    {
+      log->run_length++;
+    }
+    else
+    {
+      flush_run(log);
+      memcpy(log->run_values, log->values, NPORTS);
+      log->run_length = 1;
+    }
+    log->latched = 0;
+    log->frames++;
+
+    if (log->hash_interval > 0 &&
+        (log->frames % log->hash_interval) == 0 &&
+        hasher)
+    {
+      /* Hashes follow the run they were taken at the end of. */
+      flush_run(log);
+      put_hash(log, hasher(opaque));
+    }
+
+    if (ferror(log->f))
+    {
+      log->error = 1;
+      return zxinputlog_ERROR;
+    }
+
+    return zxinputlog_OK;
+  }
+  else
+  {
+    if (log->ended)
+      return log->error ? zxinputlog_ERROR : zxinputlog_END;
+
+    log->frames++;
+    if (--log->remaining > 0)
+      return zxinputlog_OK;
+
+    return next_run(log, hasher, opaque);
+  }
+}
+
+unsigned long zxinputlog_frames(const zxinputlog_t *log)
+{
+  assert(log != NULL);
+
+  return log->frames;
+}
+
+zxinputlogresult_t zxinputlog_close(zxinputlog_t *log)
+{
+  int error;
+
+  if (log == NULL)
+    return zxinputlog_OK;
+
+  error = log->error;
+
+  if (log->recording)
+  {
+    flush_run(log);
+    putc(record_END, log->f);
+    put_varint(log, log->frames);
+    if (ferror(log->f))
+      error = 1;
+  }
+
+  if (fclose(log->f) != 0 && log->recording)
+    error = 1;
+
+  free(log);
+
+  return error ? zxinputlog_ERROR : zxinputlog_OK;
+}
+
+// vim: ts=8 sts=2 sw=2 et
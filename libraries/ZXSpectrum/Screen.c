@@ -7,6 +7,11 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "ZXSpectrum/Macros.h"
 
@@ -20,111 +25,24 @@
 #define RGB
 #endif
 
-#ifdef RGB
-/* 0x00RRGGBB */
-#define BK_ 0x00000000
-#define RD_ 0x00010000
-#define GR_ 0x00000100
-#define YL_ 0x00010100
-#define BL_ 0x00000001
-#define MG_ 0x00010001
-#define CY_ 0x00000101
-#define WH_ 0x00010101
+/* Vector kernels for zxscreen_converter_convert(). */
+#if defined(__x86_64__) || defined(_M_X64)
+#define ZXSCREEN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define TARGET_AVX2
 #else
-/* 0x00BBGGRR */
-#define BK_ 0x00000000
-#define RD_ 0x00000001
-#define GR_ 0x00000100
-#define YL_ 0x00000101
-#define BL_ 0x00010000
-#define MG_ 0x00010001
-#define CY_ 0x00010100
-#define WH_ 0x00010101
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ZXSCREEN_NEON
+#include <arm_neon.h>
 #endif
-
-#define NORMAL(C) (C * 0xCD)
-#define BRIGHT(C) (C * 0xFF)
-
-/* BRIGHT 0 */
-#define BKd NORMAL(BK_)
-#define RDd NORMAL(RD_)
-#define GRd NORMAL(GR_)
-#define YLd NORMAL(YL_)
-#define BLd NORMAL(BL_)
-#define MGd NORMAL(MG_)
-#define CYd NORMAL(CY_)
-#define WHd NORMAL(WH_)
-/* BRIGHT 1 */
-#define BKb BRIGHT(BK_)
-#define RDb BRIGHT(RD_)
-#define GRb BRIGHT(GR_)
-#define YLb BRIGHT(YL_)
-#define BLb BRIGHT(BL_)
-#define MGb BRIGHT(MG_)
-#define CYb BRIGHT(CY_)
-#define WHb BRIGHT(WH_)
-
-/* Given a set of tokens: A, B, C, which have permutations:
- *   (AA, AB, AC, BA, BB, BC, CA, CB, CC)
- * They can be written out contiguously as:
- *   AAABACBABBBCCACBCC
- * We can remove and index the redundant overlaps:
- *   AABACBBCACC
- * (Note that 'AC' occurs twice in the sequence).
- * Producing a mapping:
- *   (0, 1, 3, 2, 5, 6, 7, 4, 9)
- * This is a De Bruijn sequence.
- *
- * The following palette is laid out in a De Bruijn sequence in a vain attempt
- * to improve performance.
- */
-static const unsigned int palette[66 + 65] =
-{
-  BKd, BKd, BLd, BKd, RDd, BKd, MGd, BKd,
-  GRd, BKd, CYd, BKd, YLd, BKd, WHd, BLd,
-  BLd, RDd, BLd, MGd, BLd, GRd, BLd, CYd,
-  BLd, YLd, BLd, WHd, RDd, RDd, MGd, RDd,
-  GRd, RDd, CYd, RDd, YLd, RDd, WHd, MGd,
-  MGd, GRd, MGd, CYd, MGd, YLd, MGd, WHd,
-  GRd, GRd, CYd, GRd, YLd, GRd, WHd, CYd,
-  CYd, YLd, CYd, WHd, YLd, YLd, WHd, BKd,
-  WHd, WHd,
-
-  /* The zeroth bright entry is shared. */
-       BKb, BLb, BKb, RDb, BKb, MGb, BKb,
-  GRb, BKb, CYb, BKb, YLb, BKb, WHb, BLb,
-  BLb, RDb, BLb, MGb, BLb, GRb, BLb, CYb,
-  BLb, YLb, BLb, WHb, RDb, RDb, MGb, RDb,
-  GRb, RDb, CYb, RDb, YLb, RDb, WHb, MGb,
-  MGb, GRb, MGb, CYb, MGb, YLb, MGb, WHb,
-  GRb, GRb, CYb, GRb, YLb, GRb, WHb, CYb,
-  CYb, YLb, CYb, WHb, YLb, YLb, WHb, BKb,
-  WHb, WHb,
-};
-
-static const unsigned char offsets[66 + 65] =
-{
-    0,   1,   3,   5,   7,   9,  11,  13,
-    2,  15,  16,  18,  20,  22,  24,  26,
-    4,  17,  28,  29,  31,  33,  35,  37,
-    6,  19,  30,  39,  40,  42,  44,  46,
-    8,  21,  32,  41,  48,  49,  51,  53,
-   10,  23,  34,  43,  50,  55,  56,  58,
-   12,  25,  36,  45,  52,  57,  60,  61,
-   62,  14,  27,  38,  47,  54,  59,  64,
-    0,  66,  68,  70,  72,  74,  76,  78,
-   67,  80,  81,  83,  85,  87,  89,  91,
-   69,  82,  93,  94,  96,  98, 100, 102,
-   71,  84,  95, 104, 105, 107, 109, 111,
-   73,  86,  97, 106, 113, 114, 116, 118,
-   75,  88,  99, 108, 115, 120, 121, 123,
-   77,  90, 101, 110, 117, 122, 125, 126,
-  127,  79,  92, 103, 112, 119, 124, 129,
-};
 
 #define WRITE8PIX(shift)                            \
 do {                                                \
-  pal = &palette[offsets[(attrs >> shift) & 0x7F]]; \
+  pal = &colours[indices[(attrs >> shift) & 0x7F]]; \
   *poutput++ = pal[(input >> (shift + 7)) & 1];     \
   *poutput++ = pal[(input >> (shift + 6)) & 1];     \
   *poutput++ = pal[(input >> (shift + 5)) & 1];     \
@@ -144,121 +62,633 @@ do {                                                \
  * 0bLRBBBFFF (L = flash, R = bright, B = paper (background), F = ink (foreground))
  */
 
-void zxscreen_convert(const void    *vscr,
-                      unsigned int  *poutput,
-                      const zxbox_t *dirty)
+/* A row kernel converts 'nbytes' bytes of a scanline of pixels, with their
+ * attributes, into 32-bit output pixels. Every attribute byte is XORed with
+ * 'attrxor' first. 'nbytes' is always a multiple of four and the input
+ * pointers are always word aligned. Each attribute's paper and ink colours
+ * are found at 'colours[indices[attribute]]'. */
+typedef void (rowkernel_t)(const unsigned char *pixels,
+                           const unsigned char *attributes,
+                           unsigned int        *poutput,
+                           int                  nbytes,
+                           unsigned int         attrxor,
+                           const unsigned int  *colours,
+                           const unsigned char *indices);
+
+/* The scalar kernel is the reference for the others. */
+static void convert_row_scalar(const unsigned char *pixels,
+                               const unsigned char *attributes,
+                               unsigned int        *poutput,
+                               int                  nbytes,
+                               unsigned int         attrxor,
+                               const unsigned int  *colours,
+                               const unsigned char *indices)
 {
-  zxbox_t              box;
-  int                  height;
-  const unsigned int  *pattrs;
-  int                  width;
-  int                  x,linear_y;
-  const unsigned int  *pinput;
-  unsigned int         input;
-  unsigned int         attrs;
-  const unsigned int  *pal;
+  const unsigned int *pinput = (const unsigned int *) pixels;
+  const unsigned int *pattrs = (const unsigned int *) attributes;
+  unsigned int        input;
+  unsigned int        attrs;
+  const unsigned int *pal;
+  int                 x;
 
-  assert(dirty);
+  attrxor *= 0x01010101;
 
-#ifdef SHOW_DIRTY_RECTS
-  static int dirtybits;
-  dirtybits = 0x20202020 - dirtybits;
+  for (x = nbytes / 4; x > 0; x--)
+  {
+    input = *pinput++;
+    attrs = *pattrs++ ^ attrxor;
+
+    WRITE8PIX(0);
+    WRITE8PIX(8);
+    WRITE8PIX(16);
+    WRITE8PIX(24);
+  }
+}
+
+/* The vector kernels process one byte at a time in memory order. That
+ * matches the scalar kernel's word at a time order only on little endian
+ * machines, which all of the targets are. Each broadcasts the pixel byte
+ * across the lanes, tests each lane's bit to form a mask then selects
+ * between the paper and ink colours with it. */
+
+#ifdef ZXSCREEN_X86
+
+static void convert_row_sse2(const unsigned char *pixels,
+                             const unsigned char *attributes,
+                             unsigned int        *poutput,
+                             int                  nbytes,
+                             unsigned int         attrxor,
+                             const unsigned int  *colours,
+                             const unsigned char *indices)
+{
+  const __m128i bits_lo = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+  const __m128i bits_hi = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+  int           i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    const unsigned int *pal   = &colours[indices[(attributes[i] ^ attrxor) & 0x7F]];
+    __m128i             paper = _mm_set1_epi32((int) pal[0]);
+    __m128i             ink   = _mm_set1_epi32((int) pal[1]);
+    __m128i             input = _mm_set1_epi32(pixels[i]);
+    __m128i             mask_lo, mask_hi;
+
+    mask_lo = _mm_cmpeq_epi32(_mm_and_si128(input, bits_lo), bits_lo);
+    mask_hi = _mm_cmpeq_epi32(_mm_and_si128(input, bits_hi), bits_hi);
+
+    _mm_storeu_si128((__m128i *) poutput + 0,
+                     _mm_or_si128(_mm_and_si128(mask_lo, ink),
+                                  _mm_andnot_si128(mask_lo, paper)));
+    _mm_storeu_si128((__m128i *) poutput + 1,
+                     _mm_or_si128(_mm_and_si128(mask_hi, ink),
+                                  _mm_andnot_si128(mask_hi, paper)));
+    poutput += 8;
+  }
+}
+
+static TARGET_AVX2 void convert_row_avx2(const unsigned char *pixels,
+                                         const unsigned char *attributes,
+                                         unsigned int        *poutput,
+                                         int                  nbytes,
+                                         unsigned int         attrxor,
+                                         const unsigned int  *colours,
+                                         const unsigned char *indices)
+{
+  const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10,
+                                         0x08, 0x04, 0x02, 0x01);
+  int           i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    const unsigned int *pal   = &colours[indices[(attributes[i] ^ attrxor) & 0x7F]];
+    __m256i             paper = _mm256_set1_epi32((int) pal[0]);
+    __m256i             ink   = _mm256_set1_epi32((int) pal[1]);
+    __m256i             input = _mm256_set1_epi32(pixels[i]);
+    __m256i             mask;
+
+    mask = _mm256_cmpeq_epi32(_mm256_and_si256(input, bits), bits);
+    _mm256_storeu_si256((__m256i *) poutput,
+                        _mm256_blendv_epi8(paper, ink, mask));
+    poutput += 8;
+  }
+}
+
+/* Return non-zero if the CPU and OS support AVX2. */
+static int have_avx2(void)
+{
+#if defined(_MSC_VER)
+  int info[4];
+
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return 0;
+
+  /* The OS must save the YMM registers (OSXSAVE and XCR0 bits 1,2). */
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+    return 0;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
 #endif
+}
 
-  /* Clamp the dirty rectangle to the screen dimensions. */
-  box.x0 = CLAMP(dirty->x0, 0, 255);
-  box.y0 = CLAMP(dirty->y0, 0, 191);
-  box.x1 = CLAMP(dirty->x1, 1, 256);
-  box.y1 = CLAMP(dirty->y1, 1, 192);
+#endif /* ZXSCREEN_X86 */
 
-  /* The inner loop processes 32 pixels at a time, so we need to convert x
-   * coordinates into chunks four attributes wide while rounding up and down as
-   * required. */
-  box.x0 = (box.x0     ) / 32; /* divide to 0..7 rounding down */
-  box.x1 = (box.x1 + 31) / 32; /* divide to 0..7 rounding up */
+#ifdef ZXSCREEN_NEON
 
-  /* Convert y coordinates into screen space - (0,0) is top left. */
-  height = box.y1 - box.y0;
-  box.y0 = 192 - box.y1;
-  box.y1 = box.y0 + height;
+static void convert_row_neon(const unsigned char *pixels,
+                             const unsigned char *attributes,
+                             unsigned int        *poutput,
+                             int                  nbytes,
+                             unsigned int         attrxor,
+                             const unsigned int  *colours,
+                             const unsigned char *indices)
+{
+  static const uint32_t bits[8] = { 0x80, 0x40, 0x20, 0x10,
+                                    0x08, 0x04, 0x02, 0x01 };
+  const uint32x4_t      bits_lo = vld1q_u32(&bits[0]);
+  const uint32x4_t      bits_hi = vld1q_u32(&bits[4]);
+  int                   i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    const unsigned int *pal   = &colours[indices[(attributes[i] ^ attrxor) & 0x7F]];
+    uint32x4_t          paper = vdupq_n_u32(pal[0]);
+    uint32x4_t          ink   = vdupq_n_u32(pal[1]);
+    uint32x4_t          input = vdupq_n_u32(pixels[i]);
+
+    vst1q_u32(poutput + 0, vbslq_u32(vtstq_u32(input, bits_lo), ink, paper));
+    vst1q_u32(poutput + 4, vbslq_u32(vtstq_u32(input, bits_hi), ink, paper));
+    poutput += 8;
+  }
+}
 
-  pattrs = (const unsigned int *) vscr
-         + (SCREEN_BITMAP_LENGTH
-         + box.y0 / 8 * 32  /* 8 scanlines/row, 32 attrs/row */
-         + box.x0 * 4) / 4; /* 4 bytes/chunk, 4 bytes/word */
+#endif /* ZXSCREEN_NEON */
 
-  poutput += box.y0 * 256 /* 256 pixels/row (256 words) for output */
-           + box.x0 * 32; /* 32 pixels/chunk (32 words) */
+/* ----------------------------------------------------------------------- */
 
-  width = box.x1 - box.x0; /* hoisted out of loop */
+/* The kernel used by zxscreen_converter_convert(), or AUTO until one has been
+ * chosen. Conversions may run on several threads at once, so it's a single
+ * word accessed atomically. Threads racing to make the automatic choice all
+ * store the same kernel. */
 
-  for (linear_y = box.y0; linear_y < box.y1; linear_y++)
+#if defined(__GNUC__)
+
+static int selected_kernel = zxscreen_kernel_AUTO;
+
+static zxscreen_kernel_t load_kernel(void)
+{
+  return (zxscreen_kernel_t) __atomic_load_n(&selected_kernel,
+                                             __ATOMIC_RELAXED);
+}
+
+static void store_kernel(zxscreen_kernel_t kernel)
+{
+  __atomic_store_n(&selected_kernel, (int) kernel, __ATOMIC_RELAXED);
+}
+
+#elif defined(_MSC_VER)
+
+static volatile long selected_kernel = zxscreen_kernel_AUTO;
+
+static zxscreen_kernel_t load_kernel(void)
+{
+  return (zxscreen_kernel_t) _InterlockedCompareExchange(&selected_kernel,
+                                                         0, 0);
+}
+
+static void store_kernel(zxscreen_kernel_t kernel)
+{
+  _InterlockedExchange(&selected_kernel, (long) kernel);
+}
+
+#else
+
+static volatile int selected_kernel = zxscreen_kernel_AUTO;
+
+static zxscreen_kernel_t load_kernel(void)
+{
+  return (zxscreen_kernel_t) selected_kernel;
+}
+
+static void store_kernel(zxscreen_kernel_t kernel)
+{
+  selected_kernel = (int) kernel;
+}
+
+#endif
+
+static int kernel_available(zxscreen_kernel_t kernel)
+{
+  switch (kernel)
   {
-    /* Transpose fields using XOR */
-    unsigned int tmp = (linear_y ^ (linear_y >> 3)) & 7;
-    int          y   = linear_y ^ (tmp | (tmp << 3));
-
-    pinput = (const unsigned int *) vscr
-           + (y     * 32           /* 32 bytes/row */
-           + box.x0 * 32 / 8) / 4; /* 32 bytes/row, 8 pixels/byte, 4 bytes/word */
-    for (x = width; x > 0; x--) /* x is unused in the loop body */
-    {
-      input = *pinput++;
-      attrs = *pattrs++;
-#ifdef SHOW_DIRTY_RECTS
-      attrs ^= dirtybits; /* force colour attrs to show redrawn areas */
+  case zxscreen_kernel_SCALAR:
+    return 1;
+#ifdef ZXSCREEN_X86
+  case zxscreen_kernel_SSE2:
+    return 1; /* baseline on x86-64 */
+  case zxscreen_kernel_AVX2:
+    return have_avx2();
+#endif
+#ifdef ZXSCREEN_NEON
+  case zxscreen_kernel_NEON:
+    return 1; /* baseline on AArch64 */
 #endif
+  default:
+    return 0;
+  }
+}
 
-      WRITE8PIX(0);
-      WRITE8PIX(8);
-      WRITE8PIX(16);
-      WRITE8PIX(24);
-    }
+int zxscreen_set_kernel(zxscreen_kernel_t kernel)
+{
+  static const zxscreen_kernel_t preferred[] =
+  {
+    zxscreen_kernel_AVX2,
+    zxscreen_kernel_SSE2,
+    zxscreen_kernel_NEON,
+    zxscreen_kernel_SCALAR
+  };
+
+  int i;
 
-    /* Skip to the start of the next row. */
-    pattrs  += 8   - width;
-    poutput += 256 - width * 32;
+  if (kernel == zxscreen_kernel_AUTO)
+  {
+    for (i = 0; !kernel_available(preferred[i]); i++)
+      ;
+    kernel = preferred[i];
+  }
+  else if (!kernel_available(kernel))
+  {
+    return 1;
+  }
+
+  store_kernel(kernel);
+
+  return 0;
+}
+
+zxscreen_kernel_t zxscreen_get_kernel(void)
+{
+  zxscreen_kernel_t kernel;
 
-    /* Rewind pattrs except at the end of an attribute row. */
-    if ((linear_y & 7) != 7)
-      pattrs -= 8;
+  kernel = load_kernel();
+  if (kernel == zxscreen_kernel_AUTO)
+  {
+    zxscreen_set_kernel(zxscreen_kernel_AUTO);
+    kernel = load_kernel();
   }
+
+  return kernel;
+}
+
+void zxscreen_to_interleaved(const uint8_t *pixels, uint8_t *interleaved)
+{
+#ifdef ZXSCREEN_LINEAR
+  int y;
+
+  for (y = 0; y < SCREEN_HEIGHT; y++)
+    memcpy(interleaved + ZXSCREEN_INTERLEAVED_OFFSET(0, y),
+           pixels + ZXSCREEN_OFFSET(0, y),
+           SCREEN_WIDTH / 8);
+#else
+  memcpy(interleaved, pixels, SCREEN_BITMAP_LENGTH);
+#endif
 }
 
+void zxscreen_from_interleaved(const uint8_t *interleaved, uint8_t *pixels)
+{
+#ifdef ZXSCREEN_LINEAR
+  int y;
 
+  for (y = 0; y < SCREEN_HEIGHT; y++)
+    memcpy(pixels + ZXSCREEN_OFFSET(0, y),
+           interleaved + ZXSCREEN_INTERLEAVED_OFFSET(0, y),
+           SCREEN_WIDTH / 8);
+#else
+  memcpy(pixels, interleaved, SCREEN_BITMAP_LENGTH);
+#endif
+}
 
-// flash  = (attr & (1 << 7)) != 0;
-// bright = (attr & (1 << 6)) != 0;
-// paper  = (attr & (7 << 3)) >> 3;
-// ink    = (attr & (7 << 0)) >> 0;
-//
-// for (attr = 0..127)
-//   tab[i] = ((bright * 8 + ink)   << 0) |
-//            ((bright * 8 + paper) << 4);
+/* ----------------------------------------------------------------------- */
 
-// Extract attribute colour and fold in bright flag
-#define ATTR(v,s) ((((v) & (1 << 6)) >> 3) + (((v) >> s) & 7))
+/* Converters for output formats chosen at runtime.
+ *
+ * Each format has its own row loop. The 32-bit formats reuse the row kernels
+ * with a palette built for the converter. The others look up the paper and
+ * ink values of each attribute in a table built for the converter then
+ * select between them with masks formed from the pixels. */
 
-// Form 8x foreground pixels
-#define FG(v) (ATTR(v,0) * 0x11111111U)
+#if defined(__riscos)
+#define FORMAT_NATIVE zxscreen_format_PACKED4
+#elif defined(RGB)
+#define FORMAT_NATIVE zxscreen_format_ARGB8888
+#else
+#define FORMAT_NATIVE zxscreen_format_ABGR8888
+#endif
 
-// Form 8x background pixels
-#define BG(v) (ATTR(v,3) * 0x11111111U)
+/* Form a 0x00RRGGBB colour from a Spectrum colour number and intensity. */
+#define COLOUR(C, I) ((((C) & 2) ? (I) << 16 : 0) | \
+                      (((C) & 4) ? (I) <<  8 : 0) | \
+                      (((C) & 1) ? (I) <<  0 : 0))
 
-// A pixel entry
-#define E(v) BG(v), FG(v),
+static const uint32_t default_palette[16] =
+{
+  COLOUR(0, 0xCD), COLOUR(1, 0xCD), COLOUR(2, 0xCD), COLOUR(3, 0xCD),
+  COLOUR(4, 0xCD), COLOUR(5, 0xCD), COLOUR(6, 0xCD), COLOUR(7, 0xCD),
+  COLOUR(0, 0xFF), COLOUR(1, 0xFF), COLOUR(2, 0xFF), COLOUR(3, 0xFF),
+  COLOUR(4, 0xFF), COLOUR(5, 0xFF), COLOUR(6, 0xFF), COLOUR(7, 0xFF)
+};
 
-// Macros to form 64 pixel entries at a time
-#define E4(b) E(b+0) E(b+1) E(b+2) E(b+3)
-#define E16(b) E4(b+0) E4(b+4) E4(b+8) E4(b+12)
-#define E64(b) E16(b+0) E16(b+16) E16(b+32) E16(b+48)
+typedef void (formatrow_t)(const zxscreen_converter_t *converter,
+                           const unsigned char        *pixels,
+                           const unsigned char        *attributes,
+                           void                       *output,
+                           int                         nbytes,
+                           unsigned int                attrxor);
 
-// Note: This table could be De Brujin'd down
-static const unsigned int pixels8tab[128 * 2] =
+struct zxscreen_converter
 {
-  E64(0) E64(64)
+  zxscreen_format_t format;
+  int               log2bpp;
+
+  /* Paper and ink values for each attribute in the output format. The
+   * formats narrower than 32 bits have them replicated across the word. */
+  unsigned int      pairs[128][2];
+
+  /* Indices of each attribute's pair, for the 32-bit row kernels. */
+  unsigned char     indices[128];
+
+  /* Masks of 0x00 or 0xFF bytes in memory order, for INDEXED8. */
+  unsigned int      expand[16];
+
+  /* Masks of 0x0000 or 0xFFFF halfwords in memory order, for RGB565. */
+  unsigned int      expand16[4];
 };
 
+const uint32_t *zxscreen_get_default_palette(void)
+{
+  return default_palette;
+}
+
+static int format_log2bpp(zxscreen_format_t format)
+{
+  switch (format)
+  {
+  case zxscreen_format_ARGB8888:
+  case zxscreen_format_ABGR8888:
+    return 5;
+  case zxscreen_format_RGB565:
+    return 4;
+  case zxscreen_format_INDEXED8:
+    return 3;
+  case zxscreen_format_PACKED4:
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+int zxscreen_format_stride(zxscreen_format_t format)
+{
+  int log2bpp;
+
+  if (format == zxscreen_format_NATIVE)
+    format = FORMAT_NATIVE;
+
+  log2bpp = format_log2bpp(format);
+  if (log2bpp < 0)
+    return 0;
+
+  return (SCREEN_WIDTH << log2bpp) / 8;
+}
+
+/* Return colour 'index' of 'palette' in 'format'. */
+static unsigned int format_colour(zxscreen_format_t  format,
+                                  const uint32_t    *palette,
+                                  int                index)
+{
+  uint32_t c = palette[index];
+
+  switch (format)
+  {
+  default:
+  case zxscreen_format_ARGB8888:
+    return c;
+  case zxscreen_format_ABGR8888:
+    return (c & 0xFF00FF00) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+  case zxscreen_format_RGB565:
+    return (((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F))
+           * 0x00010001;
+  case zxscreen_format_INDEXED8:
+    return index * 0x01010101;
+  case zxscreen_format_PACKED4:
+    return index * 0x11111111;
+  }
+}
+
+zxscreen_converter_t *zxscreen_converter_create(zxscreen_format_t format,
+                                                const uint32_t   *palette)
+{
+  zxscreen_converter_t *converter;
+  int                   attr;
+  int                   bright;
+  int                   n;
+  int                   k;
+  unsigned char         bytes[4];
+  uint16_t              halves[2];
+
+  if (format == zxscreen_format_NATIVE)
+    format = FORMAT_NATIVE;
+  if (format_log2bpp(format) < 0)
+    return NULL;
+
+  if (palette == NULL)
+    palette = default_palette;
+
+  converter = malloc(sizeof(*converter));
+  if (converter == NULL)
+    return NULL;
+
+  converter->format  = format;
+  converter->log2bpp = format_log2bpp(format);
+
+  for (attr = 0; attr < 128; attr++)
+  {
+    bright = (attr >> 6) * 8;
+    converter->pairs[attr][0] = format_colour(format, palette,
+                                              bright + ((attr >> 3) & 7));
+    converter->pairs[attr][1] = format_colour(format, palette,
+                                              bright + (attr & 7));
+
+    converter->indices[attr] = (unsigned char) (attr * 2);
+  }
+
+  for (n = 0; n < 16; n++)
+  {
+    for (k = 0; k < 4; k++)
+      bytes[k] = ((n << k) & 8) ? 0xFF : 0x00;
+    memcpy(&converter->expand[n], bytes, 4);
+  }
+
+  for (n = 0; n < 4; n++)
+  {
+    halves[0] = (n & 2) ? 0xFFFF : 0x0000;
+    halves[1] = (n & 1) ? 0xFFFF : 0x0000;
+    memcpy(&converter->expand16[n], halves, 4);
+  }
+
+  return converter;
+}
+
+void zxscreen_converter_destroy(zxscreen_converter_t *doomed)
+{
+  free(doomed);
+}
+
+/* The 32-bit formats run a row kernel over the converter's pairs. */
+#define FORMAT_ROW_32(NAME, KERNEL)                                  \
+static void NAME(const zxscreen_converter_t *converter,              \
+                 const unsigned char        *pixels,                 \
+                 const unsigned char        *attributes,             \
+                 void                       *output,                 \
+                 int                         nbytes,                 \
+                 unsigned int                attrxor)                \
+{                                                                    \
+  KERNEL(pixels, attributes, output, nbytes, attrxor,                \
+         &converter->pairs[0][0], converter->indices);               \
+}
+
+FORMAT_ROW_32(format_row_32_scalar, convert_row_scalar)
+#ifdef ZXSCREEN_X86
+FORMAT_ROW_32(format_row_32_sse2, convert_row_sse2)
+FORMAT_ROW_32(format_row_32_avx2, convert_row_avx2)
+#endif
+#ifdef ZXSCREEN_NEON
+FORMAT_ROW_32(format_row_32_neon, convert_row_neon)
+#endif
+
+static void format_row_16_scalar(const zxscreen_converter_t *converter,
+                                 const unsigned char        *pixels,
+                                 const unsigned char        *attributes,
+                                 void                       *output,
+                                 int                         nbytes,
+                                 unsigned int                attrxor)
+{
+  unsigned int       *poutput = output;
+  const unsigned int *pal;
+  unsigned int        input;
+  unsigned int        mask;
+  int                 i;
+
+  /* Two pixels per word. */
+  for (i = 0; i < nbytes; i++)
+  {
+    pal   = converter->pairs[(attributes[i] ^ attrxor) & 0x7F];
+    input = pixels[i];
+
+    mask = converter->expand16[(input >> 6) & 3];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+    mask = converter->expand16[(input >> 4) & 3];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+    mask = converter->expand16[(input >> 2) & 3];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+    mask = converter->expand16[(input >> 0) & 3];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+  }
+}
+
+/* As the 32-bit vector kernels but with eight 16-bit lanes, so a byte of
+ * pixels makes exactly one vector. */
+
+#ifdef ZXSCREEN_X86
+
+static void format_row_16_sse2(const zxscreen_converter_t *converter,
+                               const unsigned char        *pixels,
+                               const unsigned char        *attributes,
+                               void                       *output,
+                               int                         nbytes,
+                               unsigned int                attrxor)
+{
+  const __m128i bits = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10,
+                                      0x08, 0x04, 0x02, 0x01);
+  __m128i      *poutput = output;
+  int           i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    const unsigned int *pal   = converter->pairs[(attributes[i] ^ attrxor) & 0x7F];
+    __m128i             paper = _mm_set1_epi16((short) pal[0]);
+    __m128i             ink   = _mm_set1_epi16((short) pal[1]);
+    __m128i             input = _mm_set1_epi16(pixels[i]);
+    __m128i             mask;
+
+    mask = _mm_cmpeq_epi16(_mm_and_si128(input, bits), bits);
+    _mm_storeu_si128(poutput++,
+                     _mm_or_si128(_mm_and_si128(mask, ink),
+                                  _mm_andnot_si128(mask, paper)));
+  }
+}
+
+#endif /* ZXSCREEN_X86 */
+
+#ifdef ZXSCREEN_NEON
+
+static void format_row_16_neon(const zxscreen_converter_t *converter,
+                               const unsigned char        *pixels,
+                               const unsigned char        *attributes,
+                               void                       *output,
+                               int                         nbytes,
+                               unsigned int                attrxor)
+{
+  static const uint16_t bits[8] = { 0x80, 0x40, 0x20, 0x10,
+                                    0x08, 0x04, 0x02, 0x01 };
+  const uint16x8_t      vbits   = vld1q_u16(bits);
+  uint16_t             *poutput = output;
+  int                   i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    const unsigned int *pal   = converter->pairs[(attributes[i] ^ attrxor) & 0x7F];
+    uint16x8_t          paper = vdupq_n_u16((uint16_t) pal[0]);
+    uint16x8_t          ink   = vdupq_n_u16((uint16_t) pal[1]);
+    uint16x8_t          input = vdupq_n_u16(pixels[i]);
+
+    vst1q_u16(poutput, vbslq_u16(vtstq_u16(input, vbits), ink, paper));
+    poutput += 8;
+  }
+}
+
+#endif /* ZXSCREEN_NEON */
+
+static void format_row_8(const zxscreen_converter_t *converter,
+                         const unsigned char        *pixels,
+                         const unsigned char        *attributes,
+                         void                       *output,
+                         int                         nbytes,
+                         unsigned int                attrxor)
+{
+  unsigned int       *poutput = output;
+  const unsigned int *pal;
+  unsigned int        input;
+  unsigned int        mask;
+  int                 i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    pal   = converter->pairs[(attributes[i] ^ attrxor) & 0x7F];
+    input = pixels[i];
+
+    mask = converter->expand[input >> 4];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+    mask = converter->expand[input & 15];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+  }
+}
+
 // Convert an 8-bit pixel into a 32-bit mask with a 0x0 or 0xF nibble for
 // each input bit (also includes a byte flip).
 static const unsigned int mask8tab[256] =
@@ -521,96 +951,222 @@ static const unsigned int mask8tab[256] =
   0xFFFFFFFF
 };
 
-// Form 8 4bpp pixels at a time
-#define WRITE8PIX_16(shift) \
-do { \
-  bg = pixels8tab[((attrs >> shift) & 0x7F) * 2 + 0]; \
-  fg = pixels8tab[((attrs >> shift) & 0x7F) * 2 + 1]; \
-  mask = mask8tab[input]; \
-  *poutput++ = (bg & ~mask) | (fg & mask); \
-} while (0)
+static void format_row_4(const zxscreen_converter_t *converter,
+                         const unsigned char        *pixels,
+                         const unsigned char        *attributes,
+                         void                       *output,
+                         int                         nbytes,
+                         unsigned int                attrxor)
+{
+  unsigned int       *poutput = output;
+  const unsigned int *pal;
+  unsigned int        mask;
+  int                 i;
+
+  for (i = 0; i < nbytes; i++)
+  {
+    pal  = converter->pairs[(attributes[i] ^ attrxor) & 0x7F];
+    mask = mask8tab[pixels[i]];
+    *poutput++ = (pal[0] & ~mask) | (pal[1] & mask);
+  }
+}
+
+static formatrow_t *choose_format_row(zxscreen_format_t format,
+                                      zxscreen_kernel_t kernel)
+{
+  switch (format)
+  {
+  default:
+  case zxscreen_format_ARGB8888:
+  case zxscreen_format_ABGR8888:
+    switch (kernel)
+    {
+#ifdef ZXSCREEN_X86
+    case zxscreen_kernel_SSE2:
+      return format_row_32_sse2;
+    case zxscreen_kernel_AVX2:
+      return format_row_32_avx2;
+#endif
+#ifdef ZXSCREEN_NEON
+    case zxscreen_kernel_NEON:
+      return format_row_32_neon;
+#endif
+    default:
+      return format_row_32_scalar;
+    }
+
+  case zxscreen_format_RGB565:
+    /* Follow the choice of 32-bit kernel. */
+    switch (kernel)
+    {
+#ifdef ZXSCREEN_X86
+    case zxscreen_kernel_SSE2:
+    case zxscreen_kernel_AVX2:
+      return format_row_16_sse2;
+#endif
+#ifdef ZXSCREEN_NEON
+    case zxscreen_kernel_NEON:
+      return format_row_16_neon;
+#endif
+    default:
+      return format_row_16_scalar;
+    }
+
+  case zxscreen_format_INDEXED8:
+    return format_row_8;
 
-void zxscreen_convert16(const void    *vscr,
-                        unsigned int  *poutput,
-                        const zxbox_t *dirty)
+  case zxscreen_format_PACKED4:
+    return format_row_4;
+  }
+}
+
+void zxscreen_converter_convert(const zxscreen_converter_t *converter,
+                                const void                 *vscr,
+                                void                       *output,
+                                int                         stride,
+                                const zxbox_t              *dirty)
 {
   zxbox_t              box;
   int                  height;
-  const unsigned char *pattrs;
-  int                  width;
+  int                  nbytes;
   int                  linear_y;
   const unsigned char *pinput;
-  int                  x;
-  unsigned int         input;
-  unsigned int         attrs;
-  unsigned int         bg;
-  unsigned int         fg;
-  unsigned int         mask;
+  const unsigned char *pattrs;
+  unsigned char       *poutput;
+  unsigned int         attrxor;
+  formatrow_t         *row;
 
+  assert(converter);
   assert(dirty);
+  assert(stride >= (SCREEN_WIDTH << converter->log2bpp) / 8);
+  assert((stride & 3) == 0);
 
 #ifdef SHOW_DIRTY_RECTS
-  static int foo;
-  foo = 0x20202020 - foo;
+  attrxor = ((dirty->x0 ^ dirty->y0) & 8) ? 0x20 : 0;
+#else
+  attrxor = 0;
 #endif
 
+  /* Choose the kernel once so that the whole conversion uses it. */
+  row = choose_format_row(converter->format, zxscreen_get_kernel());
+
   /* Clamp the dirty rectangle to the screen dimensions. */
   box.x0 = CLAMP(dirty->x0, 0, 255);
   box.y0 = CLAMP(dirty->y0, 0, 191);
   box.x1 = CLAMP(dirty->x1, 1, 256);
   box.y1 = CLAMP(dirty->y1, 1, 192);
 
-  /* The inner loop processes 8 pixels at a time so we convert x coordinates
-   * into chunks one attribute wide while rounding up and down as required.
-   */
-#define CHUNK 8
-  box.x0 = (box.x0            ) / CHUNK; /* divide to 0..31 rounding down */
-  box.x1 = (box.x1 + CHUNK - 1) / CHUNK; /* divide to 0..31 rounding up */
+  /* The row loops process 32 pixels at a time, so we need to convert x
+   * coordinates into chunks four attributes wide while rounding up and down
+   * as required. */
+  box.x0 = (box.x0     ) / 32; /* divide to 0..7 rounding down */
+  box.x1 = (box.x1 + 31) / 32; /* divide to 0..7 rounding up */
 
   /* Convert y coordinates into screen space - (0,0) is top left. */
   height = box.y1 - box.y0;
   box.y0 = 192 - box.y1;
   box.y1 = box.y0 + height;
 
-  pattrs = (const unsigned char *) vscr
-         + SCREEN_BITMAP_LENGTH
-         + box.y0 / 8 * 32
-         + box.x0; /* 8 scanlines/row, 32 attrs/row */
-
-  poutput += box.y0 * 32 /* 256 pixels/row (128 bytes / 32 words) for output */
-           + box.x0; /* 8 pixels/chunk (1 word) */
+  poutput = (unsigned char *) output
+          + box.y0 * stride
+          + (box.x0 * 32 << converter->log2bpp) / 8; /* 32 pixels/chunk */
 
-  width = box.x1 - box.x0; /* hoisted out of loop */
+  nbytes = (box.x1 - box.x0) * 4; /* hoisted out of loop */
 
   for (linear_y = box.y0; linear_y < box.y1; linear_y++)
   {
-    /* Transpose fields using XOR */
-    unsigned int tmp = (linear_y ^ (linear_y >> 3)) & 7;
-    int          y   = linear_y ^ (tmp | (tmp << 3));
-
     pinput = (const unsigned char *) vscr
-           + y * 32 /* 32 bytes/row */
-           + box.x0;
-    for (x = width; x > 0; x--) /* x is unused in the loop body */
-    {
+           + ZXSCREEN_OFFSET(box.x0 * 4, linear_y); /* 4 bytes/chunk */
+    pattrs = (const unsigned char *) vscr
+           + SCREEN_BITMAP_LENGTH
+           + linear_y / 8 * 32 /* 8 scanlines/row, 32 attrs/row */
+           + box.x0 * 4;       /* 4 bytes/chunk */
+
+    row(converter, pinput, pattrs, poutput, nbytes, attrxor);
+
+    poutput += stride;
+  }
+}
+
+int zxscreen_converter_recolour(const zxscreen_converter_t *converter,
+                                void                       *output,
+                                int                         stride,
+                                int                         column,
+                                int                         row,
+                                int                         from,
+                                int                         to)
+{
+  const unsigned int *oldpal;
+  const unsigned int *newpal;
+  unsigned int        oldink;
+  unsigned char      *poutput;
+  int                 x, y;
+
+  assert(converter);
+  assert(column >= 0 && column < 32);
+  assert(row >= 0 && row < 24);
+
 #ifdef SHOW_DIRTY_RECTS
-      attrs ^= foo; /* force colour attrs to show redrawn areas */
+  /* Highlighted cells can't be recognised. */
+  return 1;
 #endif
 
-      input = *pinput++;
-      attrs = *pattrs++;
+  oldpal = converter->pairs[from & 0x7F];
+  newpal = converter->pairs[to   & 0x7F];
 
-      WRITE8PIX_16(0);
-    }
+  /* Ink can't be told from paper if they're the same colour. */
+  oldink = oldpal[1];
+  if (oldink == oldpal[0])
+    return 1;
+
+  poutput = (unsigned char *) output
+          + row * 8 * stride
+          + (column * 8 << converter->log2bpp) / 8;
+
+  for (y = 0; y < 8; y++)
+  {
+    switch (converter->log2bpp)
+    {
+    case 5:
+      {
+        unsigned int *p = (unsigned int *) poutput;
+
+        for (x = 0; x < 8; x++)
+          p[x] = newpal[p[x] == oldink];
+      }
+      break;
+
+    case 4:
+      {
+        uint16_t *p = (uint16_t *) poutput;
+
+        for (x = 0; x < 8; x++)
+          p[x] = (uint16_t) newpal[p[x] == (uint16_t) oldink];
+      }
+      break;
 
-    /* Skip to the start of the next row. */
-    pattrs  += 32 - width;
-    poutput += (256 - width * CHUNK) / 8; // == 32 - width
+    case 3:
+      for (x = 0; x < 8; x++)
+        poutput[x] = (unsigned char) newpal[poutput[x] == (oldink & 0xFF)];
+      break;
 
-    /* Rewind pattrs except at the end of an attribute row. */
-    if ((linear_y & 7) != 7)
-      pattrs -= 32;
+    case 2:
+      /* Each byte holds two pixels. */
+      for (x = 0; x < 4; x++)
+      {
+        unsigned int lo = poutput[x] & 0x0F;
+        unsigned int hi = poutput[x] >> 4;
+
+        poutput[x] = (unsigned char) ((newpal[lo == (oldink & 0x0F)] & 0x0F) |
+                                      (newpal[hi == (oldink & 0x0F)] & 0xF0));
+      }
+      break;
+    }
+
+    poutput += stride;
   }
+
+  return 0;
 }
 
 // vim: ts=8 sts=2 sw=2 et
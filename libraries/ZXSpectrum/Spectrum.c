@@ -20,103 +20,233 @@
 
 /* ----------------------------------------------------------------------- */
 
+/* Atomic integers for the frame handoff between the game and presenter
+ * threads. Operations are sequentially consistent. */
+
 #if defined(_WIN32)
 
 #include <windows.h>
 
-#define mutex_t          CRITICAL_SECTION
-#define mutex_init(M)    InitializeCriticalSection(&M)
-#define mutex_destroy(M) DeleteCriticalSection(&M)
-#define mutex_lock(M)    EnterCriticalSection(&M)
-#define mutex_unlock(M)  LeaveCriticalSection(&M)
+#define atom_t               volatile LONG
+#define atom_init(A, V)      ((A) = (V))
+#define atom_load(A)         InterlockedCompareExchange(&A, 0, 0)
+#define atom_exchange(A, V)  InterlockedExchange(&A, V)
+#define atom_increment(A)    InterlockedIncrement(&A)
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+      !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
 
-#elif defined(_POSIX_THREADS) || \
-      defined(_POSIX_VERSION) || \
-      defined(__unix__)       || \
-      defined(__unix)         || \
-     (defined(__APPLE__) && defined(__MACH__))
+#define atom_t               atomic_int
+#define atom_init(A, V)      atomic_init(&A, V)
+#define atom_load(A)         atomic_load(&A)
+#define atom_exchange(A, V)  atomic_exchange(&A, V)
+#define atom_increment(A)    atomic_fetch_add(&A, 1)
 
-#include <pthread.h>
+#elif defined(__GNUC__)
 
-#define mutex_t          pthread_mutex_t
-#define mutex_init(M)    pthread_mutex_init(&M, NULL)
-#define mutex_lock(M)    pthread_mutex_lock(&M)
-#define mutex_unlock(M)  pthread_mutex_unlock(&M)
-#define mutex_destroy(M) pthread_mutex_destroy(&M)
+#define atom_t               int
+#define atom_init(A, V)      ((A) = (V))
+#define atom_load(A)         __atomic_load_n(&A, __ATOMIC_SEQ_CST)
+#define atom_exchange(A, V)  __atomic_exchange_n(&A, V, __ATOMIC_SEQ_CST)
+#define atom_increment(A)    __atomic_fetch_add(&A, 1, __ATOMIC_SEQ_CST)
 
 #else
 
 //#warning Default threading used
 
-#define mutex_t          int
-#define mutex_init(M)
-#define mutex_lock(M)
-#define mutex_unlock(M)
-#define mutex_destroy(M)
+#define atom_t               int
+#define atom_init(A, V)      ((A) = (V))
+#define atom_load(A)         (A)
+#define atom_exchange(A, V)  zxatom_exchange(&A, V)
+#define atom_increment(A)    ((A)++)
 
-#endif
+static int zxatom_exchange(int *a, int v)
+{
+  int old = *a;
+  *a = v;
+  return old;
+}
 
-#ifdef __riscos
-typedef uint32_t outputpixel_t;
-#define OUTPUT_SCREEN_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT / 8) // 4bpp
-#else
-typedef uint32_t outputpixel_t;
-#define OUTPUT_SCREEN_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT)
 #endif
 
+
+/* ----------------------------------------------------------------------- */
+
+/* Clamp the cartesian box 'b' to the screen. Return a mask of the 8-pixel
+ * columns it covers and its scanlines in screen space - (0,0) is top left. */
+static uint32_t zxbox_columns(const zxbox_t *b, int *top, int *bottom)
+{
+  int x0, y0, x1, y1;
+
+  x0 = CLAMP(b->x0, 0, SCREEN_WIDTH);
+  x1 = CLAMP(b->x1, 0, SCREEN_WIDTH);
+  y0 = CLAMP(b->y0, 0, SCREEN_HEIGHT);
+  y1 = CLAMP(b->y1, 0, SCREEN_HEIGHT);
+
+  /* Divide down the x coordinates to get columns. */
+  x0 = (x0    ) >> 3; /* divide to 0..32 rounding down */
+  x1 = (x1 + 7) >> 3; /* divide to 0..32 rounding up */
+  if (x0 >= x1 || y0 >= y1)
+    return 0;
+
+  *top    = SCREEN_HEIGHT - y1;
+  *bottom = SCREEN_HEIGHT - y0;
+
+  return (x1 - x0 == 32) ? ~0u : ((1u << (x1 - x0)) - 1) << x0;
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void zxdirtymap_clear(zxdirtymap_t *map)
+{
+  memset(map->rows, 0, sizeof(map->rows));
+}
+
+static void zxdirtymap_fill(zxdirtymap_t *map)
+{
+  memset(map->rows, 0xFF, sizeof(map->rows));
+}
+
+/* Mark the cartesian box 'b' as dirty. */
+static void zxdirtymap_add_box(zxdirtymap_t *map, const zxbox_t *b)
+{
+  uint32_t mask;
+  int      top, bottom;
+  int      y;
+
+  mask = zxbox_columns(b, &top, &bottom);
+  if (mask == 0)
+    return;
+
+  for (y = top; y < bottom; y++)
+    map->rows[y] |= mask;
+}
+
+/* Compute 'a' |= 'b'. */
+static void zxdirtymap_union(zxdirtymap_t *a, const zxdirtymap_t *b)
+{
+  int y;
+
+  for (y = 0; y < SCREEN_HEIGHT; y++)
+    a->rows[y] |= b->rows[y];
+}
+
 /* ----------------------------------------------------------------------- */
 
-/* Set minimums smaller than maximums to invalidate. */
-static void zxbox_invalidate(zxbox_t *b)
+/* Map of attribute cells: a row of 32 bits per character row, laid out as
+ * for zxdirtymap_t. */
+typedef struct zxcellmap
 {
-  b->x0 = INT_MAX;
-  b->y0 = INT_MAX;
-  b->x1 = INT_MIN;
-  b->y1 = INT_MIN;
+  uint32_t rows[SCREEN_HEIGHT / 8];
 }
+zxcellmap_t;
 
-/* Return true if box is valid. */
-static int zxbox_is_valid(zxbox_t *b)
+static void zxcellmap_clear(zxcellmap_t *map)
 {
-  return (b->x0 < b->x1) && (b->y0 < b->y1);
+  memset(map->rows, 0, sizeof(map->rows));
 }
 
-/* Set largest possible valid box. */
-static void zxbox_maximise(zxbox_t *b)
+static void zxcellmap_fill(zxcellmap_t *map)
 {
-  b->x0 = INT_MIN;
-  b->y0 = INT_MIN;
-  b->x1 = INT_MAX;
-  b->y1 = INT_MAX;
+  memset(map->rows, 0xFF, sizeof(map->rows));
 }
 
-/* Return true if box is largest possible. */
-static int zxbox_is_maximised(const zxbox_t *b)
+/* Mark the cells touched by the cartesian box 'b'. */
+static void zxcellmap_add_box(zxcellmap_t *map, const zxbox_t *b)
 {
-  return b->x0 == INT_MIN &&
-         b->y0 == INT_MIN &&
-         b->x1 == INT_MAX &&
-         b->y1 == INT_MAX;
+  uint32_t mask;
+  int      top, bottom;
+  int      y;
+
+  mask = zxbox_columns(b, &top, &bottom);
+  if (mask == 0)
+    return;
+
+  for (y = top / 8; y < (bottom + 7) / 8; y++)
+    map->rows[y] |= mask;
 }
 
-/* Return true if box can hold (width,height) at (0,0). */
-static int zxbox_exceeds(const zxbox_t *b, int width, int height)
+/* Compute 'a' |= 'b'. */
+static void zxcellmap_union(zxcellmap_t *a, const zxcellmap_t *b)
 {
-  return (b->x0 <= 0)     && (b->y0 <= 0)      &&
-         (b->x1 >= width) && (b->y1 >= height);
+  int y;
+
+  for (y = 0; y < SCREEN_HEIGHT / 8; y++)
+    a->rows[y] |= b->rows[y];
 }
 
-/* Return the union in 'c' of boxes 'a' and 'b'. */
-static void zxbox_union(const zxbox_t *a, const zxbox_t *b, zxbox_t *c)
+/* ----------------------------------------------------------------------- */
+
+int zxdirtymap_next_box(const zxdirtymap_t *map, int *cursor, zxbox_t *box)
 {
-  c->x0 = MIN(a->x0, b->x0);
-  c->y0 = MIN(a->y0, b->y0);
-  c->x1 = MAX(a->x1, b->x1);
-  c->y1 = MAX(a->y1, b->y1);
+  int      y, x;
+  uint32_t row;
+  int      x1, y1;
+
+  /* The cursor is the (row, column) from which to resume the search. */
+  y = *cursor >> 5;
+  x = *cursor & 31;
+
+  for (; y < SCREEN_HEIGHT; y++, x = 0)
+  {
+    row = map->rows[y] >> x;
+    if (row == 0)
+      continue;
+
+    /* Find the run of set columns. */
+    while ((row & 1) == 0)
+    {
+      row >>= 1;
+      x++;
+    }
+    for (x1 = x; x1 < 32 && (row & 1); x1++)
+      row >>= 1;
+
+    /* Extend the run down over identical rows. Those rows will be skipped
+     * once this row is exhausted. */
+    for (y1 = y + 1; y1 < SCREEN_HEIGHT && map->rows[y1] == map->rows[y]; y1++)
+      ;
+
+    box->x0 = x  * 8;
+    box->x1 = x1 * 8;
+    box->y0 = SCREEN_HEIGHT - y1;
+    box->y1 = SCREEN_HEIGHT - y;
+
+    if (x1 < 32 && (map->rows[y] >> x1) != 0)
+      *cursor = (y << 5) | x1; /* more runs in this row */
+    else
+      *cursor = y1 << 5;
+
+    return 1;
+  }
+
+  *cursor = SCREEN_HEIGHT << 5;
+
+  return 0;
 }
 
 /* ----------------------------------------------------------------------- */
 
+/* Completed screens are handed from the game thread to the presenter thread
+ * through three frames: the game owns the 'back' frame, the presenter owns
+ * the 'front' frame and the remaining 'middle' frame is exchanged between
+ * them atomically. Neither side ever waits for the other.
+ *
+ * The middle index is tagged with FRAME_FRESH when it holds a frame the
+ * presenter has yet to see. */
+#define FRAME_FRESH (4)
+#define FRAME_INDEX (3)
+
+typedef struct zxframe
+{
+  zxscreen_t      screen;
+  zxdirtymap_t    dirty;    // area to convert
+  zxcellmap_t     recolour; // cells whose attributes alone have changed
+}
+zxframe_t;
+
 typedef struct zxspectrum_private
 {
   zxspectrum_t    pub;
@@ -124,10 +254,35 @@ typedef struct zxspectrum_private
 
   unsigned int    prev_border;
 
-  mutex_t         lock;
-  zxbox_t         dirty;
-  zxscreen_t      screen_copy; // most recent 'complete' screen
-  outputpixel_t   converted[OUTPUT_SCREEN_SIZE];
+  /* Speaker */
+  uint32_t        speaker_offset; // added to event times to keep them in order
+  uint32_t        speaker_time;   // time of the last event passed on
+  uint32_t        speaker_level;  // level of the last event passed on
+
+  zxframe_t       frames[3];
+  atom_t          middle;    // index of middle frame | FRAME_FRESH
+
+  /* Game thread */
+  int             back;      // index of back frame
+  zxdirtymap_t    stale[3];  // pixels changed since each frame was written
+  zxcellmap_t     stale_attrs[3]; // likewise for attributes
+  zxdirtymap_t    carried;   // maps of the last published frame
+  zxcellmap_t     carried_recolour;
+  atom_t          published;
+  atom_t          dropped;   // published but never presented
+
+  /* Presenter thread */
+  int             front;     // index of front frame
+  const zxdirtymap_t *claimed; // area changed by the last claim
+  zxdirtymap_t    changed;
+  zxdirtymap_t    unchanged; // empty map
+  attribute_t     converted_attrs[SCREEN_ATTRIBUTES_LENGTH]; // attributes the converted screen has
+  zxcellmap_t     mixed;     // cells converted with more than one attribute
+  atom_t          presented;
+  atom_t          duplicated; // claims which found no new frame
+  zxscreen_converter_t *converter;
+  int             stride;    // bytes per row of converted
+  void           *converted;
 }
 zxspectrum_private_t;
 
@@ -167,10 +322,11 @@ static void zx_out(zxspectrum_t *state, uint16_t address, uint8_t byte)
   case port_BORDER_EAR_MIC:
     {
       unsigned int border;
-      unsigned int ear;
+      uint32_t     ear;
+      uint32_t     level;
 
       border = byte & port_MASK_BORDER;
-      ear    = byte & port_MASK_EAR;
+      ear    = (byte & port_MASK_EAR) != 0;
 
       if (border != prv->prev_border)
       {
@@ -179,8 +335,14 @@ static void zx_out(zxspectrum_t *state, uint16_t address, uint8_t byte)
         prv->prev_border = border;
       }
 
-      if (prv->config.speaker)
-        prv->config.speaker(ear != 0, prv->config.opaque);
+      /* The game sounds the speaker through ZXSPECTRUM_SPEAKER() so only
+       * changes of level here need recording. */
+      if (state->nspeakerevents > 0)
+        level = state->speakerevents[state->nspeakerevents - 1].level;
+      else
+        level = prv->speaker_level;
+      if (ear != level)
+        ZXSPECTRUM_SPEAKER(state, state->speakertime, ear);
     }
     break;
 
@@ -190,96 +352,200 @@ static void zx_out(zxspectrum_t *state, uint16_t address, uint8_t byte)
   }
 }
 
+/* Publish the back frame, whose dirty maps have been set up, as the middle
+ * frame. 'attrs' are the cells whose attributes have changed. */
+static void zx_publish(zxspectrum_private_t *prv, const zxcellmap_t *attrs)
+{
+  zxframe_t    *back;
+  zxdirtymap_t *stale;
+  zxcellmap_t  *stale_attrs;
+  int           i;
+  int           y;
+  uint32_t      row;
+  int           x0, x1;
+  int           old;
+
+  back = &prv->frames[prv->back];
+
+  for (i = 0; i < 3; i++)
+  {
+    zxdirtymap_union(&prv->stale[i], &back->dirty);
+    zxcellmap_union(&prv->stale_attrs[i], attrs);
+  }
+
+  /* Copy the stale spans of pub.screen into the back frame. */
+  stale = &prv->stale[prv->back];
+  for (y = 0; y < SCREEN_HEIGHT; y++)
+  {
+    int addr;
+
+    row = stale->rows[y];
+    if (row == 0)
+      continue;
+
+    addr = ZXSCREEN_OFFSET(0, y);
+
+    for (x0 = 0; row != 0; x0 = x1)
+    {
+      for (; (row & 1) == 0; row >>= 1)
+        x0++;
+      for (x1 = x0; row & 1; row >>= 1)
+        x1++;
+
+      memcpy(&back->screen.pixels[addr + x0],
+             &prv->pub.screen.pixels[addr + x0],
+             x1 - x0);
+    }
+  }
+  zxdirtymap_clear(stale);
+
+  stale_attrs = &prv->stale_attrs[prv->back];
+  for (y = 0; y < SCREEN_HEIGHT / 8; y++)
+  {
+    for (row = stale_attrs->rows[y], x0 = 0; row != 0; x0 = x1)
+    {
+      for (; (row & 1) == 0; row >>= 1)
+        x0++;
+      for (x1 = x0; row & 1; row >>= 1)
+        x1++;
+
+      memcpy(&back->screen.attributes[y * 32 + x0],
+             &prv->pub.screen.attributes[y * 32 + x0],
+             x1 - x0);
+    }
+  }
+  zxcellmap_clear(stale_attrs);
+
+  /* If the presenter might not have seen the previous frame then this frame
+   * must also cover the area that frame changed. This errs on the side of
+   * converting too much if the presenter claims it in the meantime. */
+  if (atom_load(prv->middle) & FRAME_FRESH)
+  {
+    zxdirtymap_union(&back->dirty, &prv->carried);
+    zxcellmap_union(&back->recolour, &prv->carried_recolour);
+  }
+  prv->carried          = back->dirty;
+  prv->carried_recolour = back->recolour;
+
+  /* Publish the back frame and take the old middle frame as the new back. */
+  old = atom_exchange(prv->middle, prv->back | FRAME_FRESH);
+  prv->back = old & FRAME_INDEX;
+
+  atom_increment(prv->published);
+  if (old & FRAME_FRESH)
+    atom_increment(prv->dropped);
+}
+
 /* The game is telling us that the screen it draws to has been modified.
  *
  * Only the game (thread) writes to pub.screen. This entry point is called
  * when the game modifies it and wants us to know that. We're not obligated
- * to cause a screen/window refresh immediately, so may maintain an overall
- * dirty rectangle coalesced from multiple updates, but doing it in a timely
+ * to cause a screen/window refresh immediately, but doing it in a timely
  * manner will improve the game's latency.
  *
- * We try to avoid copying the whole screen buffer on every update, where
- * practical, for speed. We do a partial copy then update our dirty rectangle
- * ready for zxspectrum_claim_screen.
+ * The duration of this call is the only window we have for legal access to
+ * pub.screen, so we copy it into the back frame then publish that as the
+ * middle frame from where zxspectrum_claim_screen can pick it up.
  *
- * It's tempting to not copy the pub.screen here but instead wait for a
- * redraw message from the OS and do it then. However, the duration of this
- * call is the only window we have for legal access to pub.screen, so we have
- * to quickly copy out into our own buffer from where zxspectrum_claim_screen
- * can have unimpeded access.
+ * Dirty areas are tracked per scanline in 8-pixel columns so that separate
+ * updates don't coalesce into one large box. Each frame keeps a map of the
+ * areas changed since it was last written so only those are copied.
  */
 static void zx_draw(zxspectrum_t *state, const zxbox_t *dirty)
 {
+  static const zxbox_t  full = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+
   zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
+  zxframe_t            *back;
+  zxcellmap_t           attrs;
 
-  mutex_lock(prv->lock);
+  back = &prv->frames[prv->back];
 
   /* If no dirty rectangle was specified then assume the full screen. */
-  if (dirty == NULL || zxbox_exceeds(dirty, SCREEN_WIDTH, SCREEN_HEIGHT))
-  {
-    /* Entire screen has been modified - copy it all. */
-    memcpy(&prv->screen_copy, &prv->pub.screen, sizeof(prv->screen_copy));
+  if (dirty == NULL)
+    dirty = &full;
 
-    /* Maximise the overall dirty box that zxspectrum_claim_screen() will
-     * use. */
-    zxbox_maximise(&prv->dirty);
-  }
-  else
-  {
-    /* Copy pub.screen's dirty region into the screen copy. */
+  zxdirtymap_clear(&back->dirty);
+  zxdirtymap_add_box(&back->dirty, dirty);
+  zxcellmap_clear(&back->recolour);
+
+  /* The attributes in the area may have changed too. */
+  zxcellmap_clear(&attrs);
+  zxcellmap_add_box(&attrs, dirty);
+
+  zx_publish(prv, &attrs);
 
-    zxbox_t box;
-    int     width;
-    int     height;
-    int     linear_y;
+  prv->config.draw(dirty, prv->config.opaque);
+}
 
-    /* Clamp the dirty rectangle to the screen dimensions. */
-    box.x0 = CLAMP(dirty->x0, 0, 255);
-    box.y0 = CLAMP(dirty->y0, 0, 191);
-    box.x1 = CLAMP(dirty->x1, 1, 256);
-    box.y1 = CLAMP(dirty->y1, 1, 192);
+/* The game is telling us that only screen attributes have changed.
+ *
+ * Cells whose pixels are unchanged can be recoloured in the converted
+ * screen rather than converted afresh. */
+static void zx_draw_attrs(zxspectrum_t *state, const zxbox_t *dirty)
+{
+  zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
+  zxframe_t            *back;
 
-    /* Divide down the x coordinates to get byte-sized quantities. */
-    box.x0 = (box.x0    ) >> 3; /* divide to 0..31 rounding down */
-    box.x1 = (box.x1 + 7) >> 3; /* divide to 0..31 rounding up */
+  back = &prv->frames[prv->back];
 
-    width = box.x1 - box.x0;
+  zxdirtymap_clear(&back->dirty);
+  zxcellmap_clear(&back->recolour);
+  zxcellmap_add_box(&back->recolour, dirty);
 
-    /* Convert y coordinates into screen space - (0,0) is top left. */
-    height = box.y1 - box.y0;
-    box.y0 = 192 - box.y1;
-    box.y1 = box.y0 + height;
+  zx_publish(prv, &back->recolour);
 
-    for (linear_y = box.y0; linear_y < box.y1; linear_y++)
-    {
-      /* Transpose fields using XOR */
-      unsigned int tmp = (linear_y ^ (linear_y >> 3)) & 7;
-      int          y   = linear_y ^ (tmp | (tmp << 3));
+  prv->config.draw(dirty, prv->config.opaque);
+}
 
-      memcpy(&prv->screen_copy.pixels[y * 32 + box.x0],
-             &prv->pub.screen.pixels[y * 32 + box.x0],
-             width);
-    }
+/* Pass the buffered speaker events to the host.
+ *
+ * Times are adjusted so that they never decrease. If the speaker callback is
+ * in use the events are turned into a bitstream for it. */
+static void zx_flush_speaker(zxspectrum_t *state)
+{
+  zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
+  int                   nevents;
+  zxspeakerevent_t     *ev;
+  int32_t               behind;
+  uint32_t              bits;
 
-    /* Divide down the y coordinates to get attribute-sized quantities. */
-    box.y0 = (box.y0    ) >> 3;
-    box.y1 = (box.y1 + 7) >> 3;
+  nevents = state->nspeakerevents;
+  if (nevents == 0)
+    return;
+  state->nspeakerevents = 0;
+
+  for (ev = &state->speakerevents[0]; ev < &state->speakerevents[nevents]; ev++)
+  {
+    ev->tstate += prv->speaker_offset;
 
-    for (linear_y = box.y0; linear_y < box.y1; linear_y++)
+    behind = (int32_t) (prv->speaker_time - ev->tstate);
+    if (behind > 0)
     {
-      memcpy(&prv->screen_copy.attributes[linear_y * 32 + box.x0],
-             &prv->pub.screen.attributes[linear_y * 32 + box.x0],
-             width);
+      if (behind > ZXSPEAKER_REBASE)
+        prv->speaker_offset += behind; /* the clock was reset */
+      ev->tstate = prv->speaker_time;
     }
 
-    /* Union the overall dirty box that zxspectrum_claim_screen() will use
-     * with the outstanding one. */
-    zxbox_union(&prv->dirty, dirty, &prv->dirty);
-  }
+    if (prv->config.speaker_batch == NULL && prv->config.speaker)
+    {
+      /* Hold the previous level up until this event. */
+      bits = ev->tstate       / ZXSPEAKER_TSTATES_PER_BIT -
+             prv->speaker_time / ZXSPEAKER_TSTATES_PER_BIT;
+      if (bits > ZXSPEAKER_MAX_HOLD)
+        bits = ZXSPEAKER_MAX_HOLD;
+      while (bits--)
+        prv->config.speaker(prv->speaker_level, prv->config.opaque);
+    }
 
-  mutex_unlock(prv->lock);
+    prv->speaker_time  = ev->tstate;
+    prv->speaker_level = ev->level;
+  }
 
-  prv->config.draw(dirty, prv->config.opaque);
+  if (prv->config.speaker_batch)
+    prv->config.speaker_batch(state->speakerevents,
+                              nevents,
+                              prv->config.opaque);
 }
 
 static void zx_stamp(zxspectrum_t *state)
@@ -293,6 +559,8 @@ static int zx_sleep(zxspectrum_t *state, int duration)
 {
   zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
 
+  zx_flush_speaker(state);
+
   return prv->config.sleep(duration, prv->config.opaque);
 }
 
@@ -301,27 +569,76 @@ static int zx_sleep(zxspectrum_t *state, int duration)
 zxspectrum_t *zxspectrum_create(const zxconfig_t *config)
 {
   zxspectrum_private_t *prv;
+  int                   min_stride;
+  int                   i;
+
+  min_stride = zxscreen_format_stride(config->format);
+  if (min_stride == 0 ||
+      (config->stride != 0 &&
+       (config->stride < min_stride || (config->stride & 3) != 0)))
+    return NULL;
 
   prv = malloc(sizeof(*prv));
   if (prv == NULL)
     return NULL;
 
-  prv->pub.in            = zx_in;
-  prv->pub.out           = zx_out;
-  prv->pub.draw          = zx_draw;
-  prv->pub.stamp         = zx_stamp;
-  prv->pub.sleep         = zx_sleep;
-  prv->pub.screen.width  = config->width;
-  prv->pub.screen.height = config->height;
+  prv->stride = config->stride ? config->stride : min_stride;
+
+  prv->converter = zxscreen_converter_create(config->format, config->palette);
+  prv->converted = calloc(SCREEN_HEIGHT, prv->stride);
+  if (prv->converter == NULL || prv->converted == NULL)
+  {
+    zxscreen_converter_destroy(prv->converter);
+    free(prv->converted);
+    free(prv);
+    return NULL;
+  }
+
+  prv->pub.in             = zx_in;
+  prv->pub.out            = zx_out;
+  prv->pub.draw           = zx_draw;
+  prv->pub.draw_attrs     = zx_draw_attrs;
+  prv->pub.stamp          = zx_stamp;
+  prv->pub.sleep          = zx_sleep;
+  prv->pub.flush_speaker  = zx_flush_speaker;
+  prv->pub.nspeakerevents = 0;
+  prv->pub.speakertime    = 0;
+  prv->pub.screen.width   = config->width;
+  prv->pub.screen.height  = config->height;
 
   prv->config = *config;
 
-  mutex_init(prv->lock);
+  prv->back  = 0;
+  prv->front = 1;
+  atom_init(prv->middle, 2);
+
+  /* The frames start out empty so must be written in full. */
+  for (i = 0; i < 3; i++)
+  {
+    zxdirtymap_fill(&prv->stale[i]);
+    zxcellmap_fill(&prv->stale_attrs[i]);
+  }
+  zxdirtymap_clear(&prv->carried);
+  zxcellmap_clear(&prv->carried_recolour);
+
+  zxdirtymap_clear(&prv->unchanged);
+  prv->claimed = &prv->unchanged;
+  /* Every cell starts out mixed so the attributes converted so far are never
+   * trusted, but give them a value all the same. */
+  memset(prv->converted_attrs, 0, sizeof(prv->converted_attrs));
+  zxcellmap_fill(&prv->mixed);
 
-  zxbox_invalidate(&prv->dirty);
+  atom_init(prv->published,  0);
+  atom_init(prv->dropped,    0);
+  atom_init(prv->presented,  0);
+  atom_init(prv->duplicated, 0);
 
   prv->prev_border = ~0;
 
+  prv->speaker_offset = 0;
+  prv->speaker_time   = 0;
+  prv->speaker_level  = 0;
+
   return &prv->pub;
 }
 
@@ -332,39 +649,175 @@ void zxspectrum_destroy(zxspectrum_t *doomed)
   if (doomed == NULL)
     return;
 
-  mutex_destroy(prv->lock);
-
+  zxscreen_converter_destroy(prv->converter);
+  free(prv->converted);
   free(prv);
 }
 
+/* Convert the cartesian box 'box' of 'front' then note the attributes that
+ * the converted cells now have. */
+static void convert_box(zxspectrum_private_t *prv,
+                        const zxframe_t      *front,
+                        const zxbox_t        *box)
+{
+  int                c0, c1;
+  int                top, bottom;
+  int                row, column;
+  uint32_t           mask;
+  const attribute_t *attrs;
+  attribute_t       *converted;
+
+  zxscreen_converter_convert(prv->converter,
+                             front->screen.pixels,
+                             prv->converted,
+                             prv->stride,
+                             box);
+
+  /* zxscreen_converter_convert works in 32-pixel chunks so may convert cells either
+   * side of the box. */
+  if (zxbox_columns(box, &top, &bottom) == 0)
+    return;
+  c0 = CLAMP(box->x0, 0, SCREEN_WIDTH) / 32 * 4;
+  c1 = (CLAMP(box->x1, 0, SCREEN_WIDTH) + 31) / 32 * 4;
+  mask = (c1 - c0 == 32) ? ~0u : ((1u << (c1 - c0)) - 1) << c0;
+
+  for (row = top / 8; row < (bottom + 7) / 8; row++)
+  {
+    attrs     = &front->screen.attributes[row * 32];
+    converted = &prv->converted_attrs[row * 32];
+
+    if (top <= row * 8 && bottom >= row * 8 + 8)
+    {
+      /* Whole cells now have a single attribute. */
+      memcpy(&converted[c0], &attrs[c0], c1 - c0);
+      prv->mixed.rows[row] &= ~mask;
+    }
+    else
+    {
+      /* Cells converted in part have a single attribute only if it hasn't
+       * changed. */
+      for (column = c0; column < c1; column++)
+        if (converted[column] != attrs[column])
+          prv->mixed.rows[row] |= 1u << column;
+    }
+  }
+}
+
 uint32_t *zxspectrum_claim_screen(zxspectrum_t *state)
 {
   zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
+  zxframe_t            *front;
+  int                   row;
+  int                   column;
+  int                   y;
+  uint32_t              whole;
+  uint32_t              mask;
+  int                   cursor;
+  zxbox_t               box;
+
+  /* Check for a new frame */
+  if ((atom_load(prv->middle) & FRAME_FRESH) == 0)
+  {
+    atom_increment(prv->duplicated);
+    prv->claimed = &prv->unchanged;
+    return (uint32_t *) prv->converted;
+  }
+
+  /* Take the middle frame and return the old front frame in its place. Only
+   * the presenter clears FRAME_FRESH so the frame is still there. */
+  prv->front = atom_exchange(prv->middle, prv->front) & FRAME_INDEX;
+  atom_increment(prv->presented);
+
+  front = &prv->frames[prv->front];
 
-  mutex_lock(prv->lock);
+  prv->claimed = &front->dirty;
 
-  /* Check for any changes */
-  if (zxbox_is_valid(&prv->dirty))
+  /* Recolour cells whose attributes alone have changed. Cells which are
+   * about to be converted in whole are skipped. */
+  for (row = 0; row < SCREEN_HEIGHT / 8; row++)
   {
-    // Convert the screen only when it's asked for
-#ifdef __riscos
-    zxscreen_convert16(prv->screen_copy.pixels, prv->converted, &prv->dirty);
-#else
-    zxscreen_convert(prv->screen_copy.pixels, prv->converted, &prv->dirty);
-#endif
+    mask = front->recolour.rows[row];
+    if (mask == 0)
+      continue;
 
-    /* Invalidate the dirty region once complete */
-    zxbox_invalidate(&prv->dirty);
+    whole = ~0u;
+    for (y = row * 8; y < row * 8 + 8; y++)
+      whole &= front->dirty.rows[y];
+    mask &= ~whole;
+
+    for (column = 0; mask != 0; column++, mask >>= 1)
+    {
+      int         index;
+      attribute_t from, to;
+      int         mixed;
+
+      if ((mask & 1) == 0)
+        continue;
+
+      index = row * 32 + column;
+      from  = prv->converted_attrs[index];
+      to    = front->screen.attributes[index];
+      mixed = (prv->mixed.rows[row] >> column) & 1;
+      if (from == to && !mixed)
+        continue;
+
+      if (mixed ||
+          zxscreen_converter_recolour(prv->converter,
+                                      prv->converted,
+                                      prv->stride,
+                                      column, row,
+                                      from, to))
+      {
+        box.x0 = column * 8;
+        box.x1 = column * 8 + 8;
+        box.y0 = SCREEN_HEIGHT - row * 8 - 8;
+        box.y1 = SCREEN_HEIGHT - row * 8;
+        convert_box(prv, front, &box);
+      }
+      else
+      {
+        prv->converted_attrs[index] = to;
+      }
+
+      /* Report the cell as changed. */
+      if (prv->claimed != &prv->changed)
+      {
+        prv->changed = front->dirty;
+        prv->claimed = &prv->changed;
+      }
+      for (y = row * 8; y < row * 8 + 8; y++)
+        prv->changed.rows[y] |= 1u << column;
+    }
   }
 
-  return prv->converted;
+  // Convert the screen only when it's asked for
+  cursor = 0;
+  while (zxdirtymap_next_box(&front->dirty, &cursor, &box))
+    convert_box(prv, front, &box);
+
+  return (uint32_t *) prv->converted;
+}
+
+const zxdirtymap_t *zxspectrum_get_dirty_map(zxspectrum_t *state)
+{
+  zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
+
+  return prv->claimed;
 }
 
 void zxspectrum_release_screen(zxspectrum_t *state)
+{
+  /* Nothing to do: the converted screen belongs to the presenter. */
+}
+
+void zxspectrum_get_frame_stats(zxspectrum_t *state, zxframestats_t *stats)
 {
   zxspectrum_private_t *prv = (zxspectrum_private_t *) state;
 
-  mutex_unlock(prv->lock);
+  stats->published  = (unsigned long) atom_load(prv->published);
+  stats->presented  = (unsigned long) atom_load(prv->presented);
+  stats->dropped    = (unsigned long) atom_load(prv->dropped);
+  stats->duplicated = (unsigned long) atom_load(prv->duplicated);
 }
 
 // vim: ts=8 sts=2 sw=2 et
@@ -20,7 +20,7 @@
 #
 PROJECT=TheGreatEscape
 LIBS=-lSDL2
-DONTCOMPILE=main.c
+DONTCOMPILE=main.c batch.c replay.c bench.c audio.c
 
 # Paths
 #
@@ -115,7 +115,7 @@ else
   LDFLAGS+=-g
 endif
 
-SRC=$(shell find $(LIBRARIES) $(PLATFORM_DIR) -type f \( -name '*.c' ! -name '$(DONTCOMPILE)' \) -print)
+SRC=$(filter-out $(addprefix %/,$(DONTCOMPILE)),$(shell find $(LIBRARIES) $(PLATFORM_DIR) -type f -name '*.c' -print))
 OBJ=$(SRC:.c=.o)
 DEP=$(SRC:.c=.d)
 
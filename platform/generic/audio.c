@@ -0,0 +1,352 @@
+/* audio.c
+ *
+ * Offline audio renderer for The Great Escape.
+ *
+ * This runs a headless game as fast as possible, synthesising its beeper
+ * audio and writing it to a WAV file. It reports how long the synthesis took
+ * so that the cost of the audio can be tracked, and the WAV files from
+ * separate runs may be compared to check the output.
+ *
+ * Without an input log it renders the menu music. With one it replays the
+ * logged session (see replay.c).
+ *
+ * (c) David Thomas, 2020.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/Beeper.h"
+#include "ZXSpectrum/InputLog.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+// -----------------------------------------------------------------------------
+
+// Configuration
+//
+#define GAMEWIDTH       256
+#define GAMEHEIGHT      192
+
+#define DEFAULT_RATE    44100
+#define DEFAULT_FRAMES  1000
+
+// -----------------------------------------------------------------------------
+
+typedef struct audio
+{
+  zxinputlog_t *log;            // or NULL to render the menu music
+  zxbeeper_t   *beeper;
+  FILE         *wav;
+  int16_t      *samples;
+  int           maxduration;    // longest sleep 'samples' has room for
+  unsigned long nsamples;       // samples written
+  long long     synth_us;       // time spent synthesising
+  int           error;          // bool
+}
+audio_t;
+
+// -----------------------------------------------------------------------------
+
+static long long get_us(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void put_le(FILE *f, unsigned long v, int nbytes)
+{
+  while (nbytes--)
+  {
+    putc((int) (v & 0xFF), f);
+    v >>= 8;
+  }
+}
+
+// Write a header for 16-bit mono PCM. Call again once the samples have been
+// written to fill in the sizes.
+static void write_wav_header(FILE *f, int rate, unsigned long nsamples)
+{
+  unsigned long databytes = nsamples * 2;
+
+  fputs("RIFF", f);
+  put_le(f, 36 + databytes, 4);
+  fputs("WAVE", f);
+  fputs("fmt ", f);
+  put_le(f, 16, 4);       // chunk size
+  put_le(f, 1, 2);        // PCM
+  put_le(f, 1, 2);        // channels
+  put_le(f, rate, 4);
+  put_le(f, rate * 2, 4); // bytes per second
+  put_le(f, 2, 2);        // bytes per frame
+  put_le(f, 16, 2);       // bits per sample
+  fputs("data", f);
+  put_le(f, databytes, 4);
+}
+
+// -----------------------------------------------------------------------------
+
+static void draw_handler(const zxbox_t *dirty,
+                         void          *opaque)
+{
+}
+
+static void stamp_handler(void *opaque)
+{
+}
+
+static int sleep_handler(int durationTStates, void *opaque)
+{
+  audio_t  *audio = opaque;
+  long long start;
+  int       n;
+  int       i;
+
+  // grow the sample buffer if this sleep is the longest yet
+  if (durationTStates > audio->maxduration)
+  {
+    int16_t *samples;
+
+    samples = realloc(audio->samples,
+                      zxbeeper_max_samples(audio->beeper, durationTStates) *
+                      sizeof(*samples));
+    if (samples == NULL)
+    {
+      audio->error = 1;
+      return 1; // terminate
+    }
+    audio->samples     = samples;
+    audio->maxduration = durationTStates;
+  }
+
+  start = get_us();
+  n = zxbeeper_render(audio->beeper, durationTStates, audio->samples);
+  audio->synth_us += get_us() - start;
+
+  for (i = 0; i < n; i++)
+    put_le(audio->wav, (uint16_t) audio->samples[i], 2);
+  audio->nsamples += n;
+
+  // return immediately: run the game as fast as possible
+  return 0;
+}
+
+static int key_handler(uint16_t port, void *opaque)
+{
+  audio_t *audio = opaque;
+
+  if (audio->log == NULL)
+    return port == port_KEMPSTON_JOYSTICK ? 0x00 : 0x1F; // no keys
+
+  return zxinputlog_key(audio->log, port, 0x1F);
+}
+
+static void border_handler(int colour, void *opaque)
+{
+}
+
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
+{
+  audio_t  *audio = opaque;
+  long long start;
+
+  start = get_us();
+  zxbeeper_add(audio->beeper, events, nevents);
+  audio->synth_us += get_us() - start;
+}
+
+// -----------------------------------------------------------------------------
+
+// End a frame. Returns non-zero when it's time to stop.
+static int end_frame(audio_t *audio, unsigned long *frames, int maxframes)
+{
+  ++*frames;
+
+  if (audio->error)
+    return 1;
+
+  if (audio->log &&
+      zxinputlog_end_frame(audio->log, NULL, NULL) != zxinputlog_OK)
+    return 1;
+
+  return maxframes > 0 && *frames >= (unsigned long) maxframes;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-r <rate>] [-f <frames>] [-l <input log>] <wav>\n"
+          "\n"
+          "Renders %d frames of the menu music, or the whole of the input log,\n"
+          "unless -f is given.\n",
+          argv0, DEFAULT_FRAMES);
+}
+
+int main(int argc, char *argv[])
+{
+  zxconfig_t     zxconfig =
+  {
+    GAMEWIDTH / 8, GAMEHEIGHT / 8,
+    NULL, /* opaque */
+    &draw_handler,
+    &stamp_handler,
+    &sleep_handler,
+    &key_handler,
+    &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
+    &speaker_handler
+  };
+  audio_t        audio = { NULL };
+  const char    *logname = NULL;
+  const char    *filename;
+  int            rate = DEFAULT_RATE;
+  int            frames = 0;
+  int            opt;
+  zxspectrum_t  *zx;
+  tgestate_t    *game;
+  long long      start, end;
+  unsigned long  done;
+  double         seconds;
+
+  while ((opt = getopt(argc, argv, "r:f:l:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 'l':
+      logname = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1 || frames < 0)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  filename = argv[optind];
+
+  if (logname == NULL && frames == 0)
+    frames = DEFAULT_FRAMES;
+
+  printf("THE GREAT ESCAPE\n");
+  printf("================\n");
+
+  audio.beeper = zxbeeper_create(rate);
+  if (audio.beeper == NULL)
+  {
+    fprintf(stderr, "Error: Couldn't create a beeper at %d Hz\n", rate);
+    goto failure;
+  }
+
+  if (logname)
+  {
+    audio.log = zxinputlog_replay(logname);
+    if (audio.log == NULL)
+    {
+      fprintf(stderr, "Error: Couldn't open '%s'\n", logname);
+      goto failure;
+    }
+  }
+
+  audio.wav = fopen(filename, "wb");
+  if (audio.wav == NULL)
+  {
+    fprintf(stderr, "Error: Couldn't create '%s'\n", filename);
+    goto failure;
+  }
+  write_wav_header(audio.wav, rate, 0);
+
+  zxconfig.opaque = &audio;
+
+  zx = zxspectrum_create(&zxconfig);
+  if (zx == NULL)
+    goto failure;
+
+  game = tge_create(zx);
+  if (game == NULL)
+    goto failure;
+
+  printf("Rendering %s to '%s'...\n",
+         logname ? logname : "the menu music", filename);
+
+  start = get_us();
+
+  tge_setup(game);
+
+  done = 0;
+  for (;;)
+  {
+    int done_menu = tge_menu(game) > 0;
+
+    if (end_frame(&audio, &done, frames))
+      break;
+    if (done_menu)
+    {
+      tge_setup2(game);
+      do
+        tge_main(game);
+      while (!end_frame(&audio, &done, frames));
+      break;
+    }
+  }
+
+  end = get_us();
+
+  tge_destroy(game);
+  zxspectrum_destroy(zx);
+  zxinputlog_close(audio.log);
+
+  // fill in the sizes
+  rewind(audio.wav);
+  write_wav_header(audio.wav, rate, audio.nsamples);
+  if (ferror(audio.wav))
+    audio.error = 1;
+  if (fclose(audio.wav) != 0 || audio.error)
+  {
+    fprintf(stderr, "Error: Couldn't write '%s'\n", filename);
+    goto failure;
+  }
+
+  seconds = (double) audio.nsamples / rate;
+  printf("%lu frames, %.2fs of audio in %.2fms = %.1fx real time\n",
+         done,
+         seconds,
+         (end - start) / 1000.0,
+         end > start ? seconds / ((end - start) / 1e6) : 0.0);
+  printf("synthesis took %.2fms = %.2fus per second of audio\n",
+         audio.synth_us / 1000.0,
+         seconds > 0.0 ? audio.synth_us / seconds : 0.0);
+
+  zxbeeper_destroy(audio.beeper);
+  free(audio.samples);
+
+  printf("(quit)\n");
+
+  exit(EXIT_SUCCESS);
+
+
+failure:
+
+  exit(EXIT_FAILURE);
+}
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,470 @@
+/* batch.c
+ *
+ * Headless batch runner for The Great Escape.
+ *
+ * This runs many independent game instances as fast as possible across a pool
+ * of worker threads, then reports frames per second per worker and overall.
+ * It's intended for soak testing and gathering statistics.
+ *
+ * Each game instance is advanced a fixed quantum of frames at a time. Workers
+ * take quanta from their own queue and, when that runs dry, steal them from
+ * the other workers' queues so that the load stays balanced even though some
+ * games cost more per frame than others.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/Keyboard.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+// -----------------------------------------------------------------------------
+
+// Configuration
+//
+#define GAMEWIDTH     256
+#define GAMEHEIGHT    192
+
+#define DEFAULT_GAMES   64
+#define DEFAULT_FRAMES  10000
+
+// Number of tge_main() calls a worker makes before returning an instance to
+// its queue. Small enough to balance well, large enough to amortise locking.
+#define QUANTUM         250
+
+// Number of frames between changes of joystick input.
+#define INPUT_PERIOD    16
+
+// -----------------------------------------------------------------------------
+
+typedef struct game
+{
+  int           index;
+  zxspectrum_t *zx;
+  tgestate_t   *tge;
+  int           keystroke_time;
+  unsigned int  seed;
+  int           input;       // current Kempston input
+  int           frames;      // tge_main calls made so far
+  int           transitions; // tge_main calls which returned TRANSITION
+}
+game_t;
+
+typedef struct batch batch_t;
+
+typedef struct worker
+{
+  batch_t        *batch;
+  int             id;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  int            *queue;   // circular queue of game indices
+  int             head;    // next index to steal (oldest)
+  int             count;   // number of queued games
+  int             frames;  // frames run by this worker
+  int             steals;  // quanta taken from other workers
+  long long       busy_us; // time spent running games
+}
+worker_t;
+
+struct batch
+{
+  game_t         *games;
+  int             ngames;
+  int             frames_per_game;
+  worker_t       *workers;
+  int             nworkers;
+  pthread_mutex_t lock;
+  int             remaining; // games not yet complete
+  int             failed;    // set if any game failed to start
+};
+
+// -----------------------------------------------------------------------------
+
+static void draw_handler(const zxbox_t *dirty,
+                         void          *opaque)
+{
+}
+
+static void stamp_handler(void *opaque)
+{
+}
+
+static int sleep_handler(int durationTStates, void *opaque)
+{
+  game_t *game = opaque;
+
+  // The game has reached the end of a slice. Vary the joystick input every
+  // so often so that each instance explores the game differently.
+  if ((game->frames % INPUT_PERIOD) == 0)
+  {
+    game->seed  = game->seed * 1103515245 + 12345;
+    game->input = (game->seed >> 16) & 0x1F;
+  }
+
+  // return immediately: run the game as fast as possible
+  return 0;
+}
+
+static int key_handler(uint16_t port, void *opaque)
+{
+  game_t *game = opaque;
+
+  if (port == port_KEMPSTON_JOYSTICK)
+    return game->input; // active high
+
+  game->keystroke_time++;
+
+  // first send a '2' to select Kempston joystick mode
+  if (game->keystroke_time < 3 && port == port_KEYBOARD_12345)
+    return 0x1F ^ 2;
+
+  // then send a '0' to start the game
+  if (game->keystroke_time < 6 && port == port_KEYBOARD_09876)
+    return 0x1F ^ 1;
+
+  return 0x1F;
+}
+
+static void border_handler(int colour, void *opaque)
+{
+}
+
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+static long long get_us(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// -----------------------------------------------------------------------------
+
+static int game_start(game_t *game)
+{
+  zxconfig_t zxconfig =
+  {
+    GAMEWIDTH / 8, GAMEHEIGHT / 8,
+    NULL, /* opaque */
+    &draw_handler,
+    &stamp_handler,
+    &sleep_handler,
+    &key_handler,
+    &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
+    &speaker_handler
+  };
+
+  zxconfig.opaque = game;
+
+  game->zx = zxspectrum_create(&zxconfig);
+  if (game->zx == NULL)
+    return -1;
+
+  game->tge = tge_create(game->zx);
+  if (game->tge == NULL)
+  {
+    zxspectrum_destroy(game->zx);
+    game->zx = NULL;
+    return -1;
+  }
+
+  tge_setup(game->tge);
+  while (tge_menu(game->tge) <= 0)
+    ;
+  tge_setup2(game->tge);
+
+  return 0;
+}
+
+static void game_stop(game_t *game)
+{
+  tge_destroy(game->tge);
+  zxspectrum_destroy(game->zx);
+}
+
+// -----------------------------------------------------------------------------
+
+static void worker_push(worker_t *worker, int index, int capacity)
+{
+  pthread_mutex_lock(&worker->lock);
+  worker->queue[(worker->head + worker->count++) % capacity] = index;
+  pthread_mutex_unlock(&worker->lock);
+}
+
+// Take from the back of our own queue (most recently run, so likely cached).
+static int worker_pop(worker_t *worker, int capacity)
+{
+  int index = -1;
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->count > 0)
+    index = worker->queue[(worker->head + --worker->count) % capacity];
+  pthread_mutex_unlock(&worker->lock);
+
+  return index;
+}
+
+// Take from the front of another worker's queue.
+static int worker_steal(worker_t *victim, int capacity)
+{
+  int index = -1;
+
+  pthread_mutex_lock(&victim->lock);
+  if (victim->count > 0)
+  {
+    index = victim->queue[victim->head];
+    victim->head = (victim->head + 1) % capacity;
+    victim->count--;
+  }
+  pthread_mutex_unlock(&victim->lock);
+
+  return index;
+}
+
+static void *worker_main(void *opaque)
+{
+  worker_t *worker = opaque;
+  batch_t  *batch  = worker->batch;
+  int       capacity = batch->ngames;
+  long long start;
+  int       index;
+  int       i;
+
+  for (;;)
+  {
+    game_t *game;
+    int     frames;
+
+    index = worker_pop(worker, capacity);
+    for (i = 1; index < 0 && i < batch->nworkers; i++)
+    {
+      index = worker_steal(&batch->workers[(worker->id + i) % batch->nworkers],
+                           capacity);
+      if (index >= 0)
+        worker->steals++;
+    }
+
+    if (index < 0)
+    {
+      int remaining;
+
+      // Nothing to run. Games still in progress on other workers may be
+      // requeued, so only finish once every game is complete.
+      pthread_mutex_lock(&batch->lock);
+      remaining = batch->remaining;
+      pthread_mutex_unlock(&batch->lock);
+      if (remaining == 0)
+        break;
+      sched_yield();
+      continue;
+    }
+
+    game  = &batch->games[index];
+    start = get_us();
+
+    if (game->tge == NULL && game_start(game) < 0)
+    {
+      pthread_mutex_lock(&batch->lock);
+      batch->failed = 1;
+      batch->remaining--;
+      pthread_mutex_unlock(&batch->lock);
+      continue;
+    }
+
+    frames = batch->frames_per_game - game->frames;
+    if (frames > QUANTUM)
+      frames = QUANTUM;
+    for (i = 0; i < frames; i++)
+    {
+      game->frames++;
+      if (tge_main(game->tge) == tgestatus_TRANSITION)
+        game->transitions++;
+    }
+    worker->frames += frames;
+
+    worker->busy_us += get_us() - start;
+
+    if (game->frames < batch->frames_per_game)
+    {
+      worker_push(worker, index, capacity);
+    }
+    else
+    {
+      game_stop(game);
+      pthread_mutex_lock(&batch->lock);
+      batch->remaining--;
+      pthread_mutex_unlock(&batch->lock);
+    }
+  }
+
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-j <workers>] [-n <games>] [-f <frames per game>]\n",
+          argv0);
+}
+
+int main(int argc, char *argv[])
+{
+  batch_t   batch;
+  int       nworkers;
+  int       ngames = DEFAULT_GAMES;
+  int       frames = DEFAULT_FRAMES;
+  int       opt;
+  int       i;
+  long long start, end;
+  long long total_frames;
+  long long total_transitions;
+  double    seconds;
+
+  nworkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nworkers < 1)
+    nworkers = 1;
+
+  while ((opt = getopt(argc, argv, "j:n:f:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      nworkers = atoi(optarg);
+      break;
+    case 'n':
+      ngames = atoi(optarg);
+      break;
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (nworkers < 1 || ngames < 1 || frames < 1)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("THE GREAT ESCAPE\n");
+  printf("================\n");
+
+  printf("Running %d games of %d frames on %d workers...\n",
+         ngames, frames, nworkers);
+
+  memset(&batch, 0, sizeof(batch));
+  batch.ngames          = ngames;
+  batch.frames_per_game = frames;
+  batch.nworkers        = nworkers;
+  batch.remaining       = ngames;
+  batch.games           = calloc(ngames, sizeof(*batch.games));
+  batch.workers         = calloc(nworkers, sizeof(*batch.workers));
+  if (batch.games == NULL || batch.workers == NULL)
+    goto failure;
+  pthread_mutex_init(&batch.lock, NULL);
+
+  for (i = 0; i < nworkers; i++)
+  {
+    worker_t *worker = &batch.workers[i];
+
+    worker->batch = &batch;
+    worker->id    = i;
+    worker->queue = malloc(ngames * sizeof(*worker->queue));
+    if (worker->queue == NULL)
+      goto failure;
+    pthread_mutex_init(&worker->lock, NULL);
+  }
+
+  // Deal the games out to the workers round robin.
+  for (i = 0; i < ngames; i++)
+  {
+    batch.games[i].index = i;
+    batch.games[i].seed  = i + 1;
+    worker_push(&batch.workers[i % nworkers], i, ngames);
+  }
+
+  start = get_us();
+  for (i = 0; i < nworkers; i++)
+    if (pthread_create(&batch.workers[i].thread,
+                       NULL,
+                       worker_main,
+                       &batch.workers[i]) != 0)
+      goto failure;
+  for (i = 0; i < nworkers; i++)
+    pthread_join(batch.workers[i].thread, NULL);
+  end = get_us();
+
+  if (batch.failed)
+    goto failure;
+
+  total_frames = 0;
+  for (i = 0; i < nworkers; i++)
+  {
+    worker_t *worker = &batch.workers[i];
+
+    printf("worker %2d: %9d frames in %8.2fms = %10.2f frames/sec (%d steals)\n",
+           i,
+           worker->frames,
+           worker->busy_us / 1000.0,
+           worker->busy_us ? worker->frames / (worker->busy_us / 1e6) : 0.0,
+           worker->steals);
+    total_frames += worker->frames;
+  }
+
+  total_transitions = 0;
+  for (i = 0; i < ngames; i++)
+    total_transitions += batch.games[i].transitions;
+
+  seconds = (end - start) / 1e6;
+  printf("%lld frames in %.2fms = %.2f frames/sec (%lld in transitions)\n",
+         total_frames,
+         (end - start) / 1000.0,
+         seconds > 0.0 ? total_frames / seconds : 0.0,
+         total_transitions);
+
+  for (i = 0; i < nworkers; i++)
+  {
+    pthread_mutex_destroy(&batch.workers[i].lock);
+    free(batch.workers[i].queue);
+  }
+  pthread_mutex_destroy(&batch.lock);
+  free(batch.workers);
+  free(batch.games);
+
+  printf("(quit)\n");
+
+  exit(EXIT_SUCCESS);
+
+
+failure:
+
+  exit(EXIT_FAILURE);
+}
+
+// vim: ts=8 sts=2 sw=2 et
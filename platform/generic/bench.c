@@ -0,0 +1,634 @@
+/* bench.c
+ *
+ * Scenario benchmarks for The Great Escape.
+ *
+ * Each scenario constructs a game state which exercises a particular part of
+ * the engine - the menu, an idle interior, outdoor scrolling, searchlights,
+ * crowds, room transitions - then repeatedly copies that state into a
+ * working instance and times each frame run from it. Results are printed as
+ * a table and optionally written out as JSON so that runs can be compared
+ * between commits. Alongside the host timings each scenario reports the
+ * T-states the original game is estimated to take per frame, which measures
+ * the work done independently of the host.
+ *
+ * Scenarios are constructed by letting the game run unattended, which is
+ * deterministic, until the state of interest arises. This peeks at the game
+ * state so is built against the library's private headers. Saved snapshots
+ * can be benchmarked too.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/Keyboard.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/Main.h"
+#include "TheGreatEscape/Rooms.h"
+#include "TheGreatEscape/Screen.h"
+#include "TheGreatEscape/State.h"
+
+// -----------------------------------------------------------------------------
+
+// Configuration
+//
+#define GAMEWIDTH       256
+#define GAMEHEIGHT      192
+
+#define DEFAULT_RUNS    20
+#define DEFAULT_FRAMES  200
+
+// Give up constructing a scenario after this many frames.
+#define SETUP_LIMIT     50000
+
+#define MAXSNAPSHOTS    8
+
+// -----------------------------------------------------------------------------
+
+typedef struct bench
+{
+  int keystroke_time;
+  int started;        // bool: the game has been started, stop sending keys
+}
+bench_t;
+
+typedef struct scenario
+{
+  const char *name;
+  const char *description;
+
+  // Run one frame of the scenario.
+  void      (*frame)(tgestate_t *state);
+
+  // Construct the scenario's initial state in 'state', which has been set up
+  // but not started. 'arg' is the scenario's argument.
+  int       (*setup)(bench_t *bench, tgestate_t *state, const char *arg);
+  const char *arg;
+}
+scenario_t;
+
+typedef struct result
+{
+  const char *name;
+  int         frames;
+  double      min_us, median_us, p99_us, mean_us;
+  double      iters_per_sec;
+  double      tstates_per_frame;
+}
+result_t;
+
+// -----------------------------------------------------------------------------
+
+static void draw_handler(const zxbox_t *dirty,
+                         void          *opaque)
+{
+}
+
+static void stamp_handler(void *opaque)
+{
+}
+
+static int sleep_handler(int durationTStates, void *opaque)
+{
+  // return immediately: run the game as fast as possible
+  return 0;
+}
+
+static int key_handler(uint16_t port, void *opaque)
+{
+  bench_t *bench = opaque;
+
+  if (port == port_KEMPSTON_JOYSTICK)
+    return 0; // active high (zeroes by default)
+
+  if (bench->started)
+    return 0x1F;
+
+  bench->keystroke_time++;
+
+  // first send a '2' to select Kempston joystick mode
+  if (bench->keystroke_time < 3 && port == port_KEYBOARD_12345)
+    return 0x1F ^ 2;
+
+  // then send a '0' to start the game
+  if (bench->keystroke_time < 6 && port == port_KEYBOARD_09876)
+    return 0x1F ^ 1;
+
+  return 0x1F;
+}
+
+static void border_handler(int colour, void *opaque)
+{
+}
+
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+static long long get_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+
+static void start_game(bench_t *bench, tgestate_t *state)
+{
+  bench->keystroke_time = 0;
+  bench->started        = 0;
+  while (tge_menu(state) <= 0)
+    ;
+  tge_setup2(state);
+  bench->started = 1;
+}
+
+static int visible_characters(const tgestate_t *state)
+{
+  int count;
+  int i;
+
+  count = 0;
+  for (i = 0; i < vischars_LENGTH; i++)
+    if (state->vischars[i].flags != vischar_FLAGS_EMPTY_SLOT)
+      count++;
+
+  return count;
+}
+
+typedef int (predicate_t)(const tgestate_t *state, tgestatus_t status);
+
+// Run the game unattended until 'predicate' holds.
+static int run_until(tgestate_t *state, predicate_t *predicate)
+{
+  int frames;
+
+  for (frames = 0; frames < SETUP_LIMIT; frames++)
+    if (predicate(state, tge_main(state)))
+      return 0;
+
+  return -1;
+}
+
+static int is_hut_at_night(const tgestate_t *state, tgestatus_t status)
+{
+  return state->room_index == room_2_HUT2LEFT && state->day_or_night != 0;
+}
+
+static int is_outdoors(const tgestate_t *state, tgestatus_t status)
+{
+  return state->room_index == room_0_OUTDOORS &&
+         status == tgestatus_FRAME_DONE;
+}
+
+static int is_roll_call(const tgestate_t *state, tgestatus_t status)
+{
+  return state->room_index == room_0_OUTDOORS &&
+         visible_characters(state) == vischars_LENGTH;
+}
+
+static int is_transition(const tgestate_t *state, tgestatus_t status)
+{
+  return status == tgestatus_TRANSITION;
+}
+
+// -----------------------------------------------------------------------------
+
+static int setup_menu(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // tge_setup() has already readied the menu. Stop key_handler from
+  // selecting a control method and starting the game.
+  bench->started = 1;
+  return 0;
+}
+
+static int setup_hut_idle(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // Once night falls the hero lies in bed until morning.
+  start_game(bench, state);
+  return run_until(state, is_hut_at_night);
+}
+
+static int setup_outdoors(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // The hero walks out of the hut to breakfast, scrolling the map.
+  start_game(bench, state);
+  return run_until(state, is_outdoors);
+}
+
+static int setup_night(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // The hero is in bed at night so make it night while he's outdoors.
+  start_game(bench, state);
+  if (run_until(state, is_outdoors))
+    return -1;
+  state->day_or_night = 255;
+  set_game_window_attributes(state, choose_game_window_attributes(state));
+  return 0;
+}
+
+static int setup_roll_call(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // Every character is on screen for the first roll call.
+  start_game(bench, state);
+  return run_until(state, is_roll_call);
+}
+
+static int setup_transition(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  // Step back a few frames from the first zoombox so that the run covers
+  // the approach to the door, the zoombox and the room being entered.
+  start_game(bench, state);
+  if (tge_rewind_enable(state, 16))
+    return -1;
+  if (run_until(state, is_transition))
+    return -1;
+  tge_rewind(state, 4);
+  return tge_rewind_enable(state, 0);
+}
+
+// Place the outdoor game window at an aligned or a nibble-shifted offset so
+// that the two paths through plot_game_window() can be compared.
+static int setup_window(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  start_game(bench, state);
+  if (run_until(state, is_outdoors))
+    return -1;
+  state->game_window_offset.x = 2 * 24;
+  state->game_window_offset.y = strcmp(arg, "shifted") == 0 ? 255 : 0;
+  return 0;
+}
+
+static int setup_snapshot(bench_t *bench, tgestate_t *state, const char *arg)
+{
+  bench->started = 1;
+  return tge_snapshot_load(state, arg);
+}
+
+static void frame_menu(tgestate_t *state)
+{
+  tge_menu(state);
+}
+
+static void frame_main(tgestate_t *state)
+{
+  tge_main(state);
+}
+
+// Copy the whole game window to the screen.
+static void frame_window(tgestate_t *state)
+{
+  invalidate_game_window(state);
+  plot_game_window(state);
+}
+
+// Build the mask buffer for every visible character, as plot_sprites() would.
+static void frame_masks(tgestate_t *state)
+{
+  int i;
+
+  for (i = 0; i < vischars_LENGTH; i++)
+    if (state->vischars[i].flags != vischar_FLAGS_EMPTY_SLOT &&
+        setup_vischar_plotting(state, &state->vischars[i]))
+      render_mask_buffer(state);
+}
+
+static const scenario_t builtin_scenarios[] =
+{
+  { "menu",         "Menu with music",              frame_menu,   setup_menu,       NULL },
+  { "hut_idle",     "Idle in the hut interior",     frame_main,   setup_hut_idle,   NULL },
+  { "outdoors",     "Outdoor map scrolling",        frame_main,   setup_outdoors,   NULL },
+  { "night",        "Night-time with searchlights", frame_main,   setup_night,      NULL },
+  { "roll_call",    "Crowded yard at roll call",    frame_main,   setup_roll_call,  NULL },
+  { "transition",   "Room transition with zoombox", frame_main,   setup_transition, NULL },
+  { "window",       "Game window blit, aligned",    frame_window, setup_window,     "aligned" },
+  { "window_shift", "Game window blit, shifted",    frame_window, setup_window,     "shifted" },
+  { "masks",        "Mask buffers at roll call",    frame_masks,  setup_roll_call,  NULL },
+};
+
+#define NBUILTINS ((int) (sizeof(builtin_scenarios) / sizeof(builtin_scenarios[0])))
+
+// -----------------------------------------------------------------------------
+
+static int compare_ns(const void *a, const void *b)
+{
+  long long x = *(const long long *) a;
+  long long y = *(const long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+static int run_scenario(const scenario_t *scenario,
+                        int               runs,
+                        int               frames,
+                        result_t         *result)
+{
+  zxconfig_t    zxconfig =
+  {
+    GAMEWIDTH / 8, GAMEHEIGHT / 8,
+    NULL, /* opaque */
+    &draw_handler,
+    &stamp_handler,
+    &sleep_handler,
+    &key_handler,
+    &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
+    &speaker_handler
+  };
+  bench_t       bench = { 0, 0 };
+  zxspectrum_t *template_zx = NULL;
+  zxspectrum_t *zx          = NULL;
+  tgestate_t   *template    = NULL;
+  tgestate_t   *game        = NULL;
+  long long    *times       = NULL;
+  long long     total;
+  uint64_t      tstates;
+  int           n;
+  int           run;
+  int           i;
+  int           rc = -1;
+
+  zxconfig.opaque = &bench;
+
+  template_zx = zxspectrum_create(&zxconfig);
+  zx          = zxspectrum_create(&zxconfig);
+  if (template_zx == NULL || zx == NULL)
+    goto exit;
+
+  template = tge_create(template_zx);
+  game     = tge_create(zx);
+  if (template == NULL || game == NULL)
+    goto exit;
+
+  times = malloc((size_t) runs * frames * sizeof(*times));
+  if (times == NULL)
+    goto exit;
+
+  tge_setup(template);
+  if (scenario->setup(&bench, template, scenario->arg))
+  {
+    fprintf(stderr, "Error: Couldn't set up scenario '%s'\n", scenario->name);
+    goto exit;
+  }
+
+  n       = 0;
+  total   = 0;
+  tstates = 0;
+  for (run = 0; run < runs; run++)
+  {
+    if (tge_clone(game, template))
+      goto exit;
+
+    tstates -= tge_tstates(game);
+
+    for (i = 0; i < frames; i++)
+    {
+      long long start, end;
+
+      start = get_ns();
+      scenario->frame(game);
+      end = get_ns();
+
+      times[n++] = end - start;
+      total += end - start;
+    }
+
+    tstates += tge_tstates(game);
+  }
+
+  qsort(times, n, sizeof(*times), compare_ns);
+
+  result->name              = scenario->name;
+  result->frames            = n;
+  result->min_us            = times[0] / 1e3;
+  result->median_us         = times[n / 2] / 1e3;
+  result->p99_us            = times[(n - 1) * 99 / 100] / 1e3;
+  result->mean_us           = total / 1e3 / n;
+  result->iters_per_sec     = total > 0 ? n / (total / 1e9) : 0.0;
+  result->tstates_per_frame = (double) tstates / n;
+
+  rc = 0;
+
+exit:
+  free(times);
+  tge_destroy(game);
+  tge_destroy(template);
+  zxspectrum_destroy(zx);
+  zxspectrum_destroy(template_zx);
+
+  return rc;
+}
+
+// Write a string as a quoted JSON string. Snapshot paths may hold quotes
+// or backslashes.
+static void write_json_string(FILE *f, const char *s)
+{
+  const unsigned char *p;
+
+  fputc('"', f);
+  for (p = (const unsigned char *) s; *p; p++)
+  {
+    if (*p == '"' || *p == '\\')
+      fprintf(f, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf(f, "\\u%04x", *p);
+    else
+      fputc(*p, f);
+  }
+  fputc('"', f);
+}
+
+static int write_json(const char     *filename,
+                      const result_t *results,
+                      int             nresults,
+                      int             runs,
+                      int             frames)
+{
+  FILE *f;
+  int   i;
+
+  f = fopen(filename, "w");
+  if (f == NULL)
+    return -1;
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"runs\": %d,\n", runs);
+  fprintf(f, "  \"frames_per_run\": %d,\n", frames);
+  fprintf(f, "  \"scenarios\": [\n");
+  for (i = 0; i < nresults; i++)
+  {
+    const result_t *r = &results[i];
+
+    fprintf(f, "    { \"name\": ");
+    write_json_string(f, r->name);
+    fprintf(f,
+            ", \"frames\": %d, "
+            "\"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f, "
+            "\"mean_us\": %.3f, \"iters_per_sec\": %.2f, "
+            "\"tstates_per_frame\": %.0f }%s\n",
+            r->frames,
+            r->min_us,
+            r->median_us,
+            r->p99_us,
+            r->mean_us,
+            r->iters_per_sec,
+            r->tstates_per_frame,
+            i < nresults - 1 ? "," : "");
+  }
+  fprintf(f, "  ]\n");
+  fprintf(f, "}\n");
+
+  return fclose(f) != 0 ? -1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+
+static void usage(const char *argv0)
+{
+  int i;
+
+  fprintf(stderr,
+          "Usage: %s [-r <runs>] [-f <frames per run>] [-s <scenario>]...\n"
+          "          [-l <snapshot>]... [-o <json output>]\n"
+          "\n"
+          "Scenarios:\n",
+          argv0);
+  for (i = 0; i < NBUILTINS; i++)
+    fprintf(stderr, "  %-12s %s\n",
+            builtin_scenarios[i].name,
+            builtin_scenarios[i].description);
+}
+
+int main(int argc, char *argv[])
+{
+  scenario_t  scenarios[NBUILTINS + MAXSNAPSHOTS];
+  result_t    results[NBUILTINS + MAXSNAPSHOTS];
+  int         nscenarios = 0;
+  int         nresults   = 0;
+  int         runs       = DEFAULT_RUNS;
+  int         frames     = DEFAULT_FRAMES;
+  const char *json       = NULL;
+  int         failed     = 0;
+  int         opt;
+  int         i;
+
+  while ((opt = getopt(argc, argv, "r:f:s:l:o:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 's':
+      for (i = 0; i < NBUILTINS; i++)
+        if (strcmp(builtin_scenarios[i].name, optarg) == 0)
+          break;
+      if (i == NBUILTINS || nscenarios == NBUILTINS + MAXSNAPSHOTS)
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      scenarios[nscenarios++] = builtin_scenarios[i];
+      break;
+    case 'l':
+      if (nscenarios == NBUILTINS + MAXSNAPSHOTS)
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      scenarios[nscenarios].name        = optarg;
+      scenarios[nscenarios].description = "Saved snapshot";
+      scenarios[nscenarios].frame       = frame_main;
+      scenarios[nscenarios].setup       = setup_snapshot;
+      scenarios[nscenarios].arg         = optarg;
+      nscenarios++;
+      break;
+    case 'o':
+      json = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc || runs < 1 || frames < 1)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // run every built-in scenario by default
+  if (nscenarios == 0)
+    for (nscenarios = 0; nscenarios < NBUILTINS; nscenarios++)
+      scenarios[nscenarios] = builtin_scenarios[nscenarios];
+
+  printf("THE GREAT ESCAPE\n");
+  printf("================\n");
+
+  printf("%d runs of %d frames per scenario\n\n", runs, frames);
+  printf("%-12s %10s %10s %10s %10s %12s %10s\n",
+         "scenario", "min us", "median us", "p99 us", "mean us", "iters/sec",
+         "kT/frame");
+
+  for (i = 0; i < nscenarios; i++)
+  {
+    result_t *r = &results[nresults];
+
+    if (run_scenario(&scenarios[i], runs, frames, r))
+    {
+      failed = 1;
+      continue;
+    }
+    nresults++;
+
+    printf("%-12s %10.2f %10.2f %10.2f %10.2f %12.2f %10.1f\n",
+           r->name,
+           r->min_us,
+           r->median_us,
+           r->p99_us,
+           r->mean_us,
+           r->iters_per_sec,
+           r->tstates_per_frame / 1e3);
+  }
+
+  // the caches are shared by all games so are reported once
+#if defined(TGE_MAP_CACHE) || defined(TGE_SPRITE_CACHE)
+  printf("\n");
+#endif
+#ifdef TGE_MAP_CACHE
+  printf("map cache: %lu bytes\n", (unsigned long) tge_mapcache_size());
+#endif
+#ifdef TGE_SPRITE_CACHE
+  printf("sprite cache: %lu bytes\n", (unsigned long) tge_spritecache_size());
+#endif
+
+  if (json && write_json(json, results, nresults, runs, frames))
+  {
+    fprintf(stderr, "Error: Couldn't write '%s'\n", json);
+    failed = 1;
+  }
+
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// vim: ts=8 sts=2 sw=2 et
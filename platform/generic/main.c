@@ -69,10 +69,14 @@ static void border_handler(int colour, void *opaque)
 {
 }
 
-static void speaker_handler(int on_off, void *opaque)
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
 {
-  // dump the speaker pulses in binary
-  // putc('0' + on_off, stderr);
+  // dump the speaker edges
+  // int i;
+  // for (i = 0; i < nevents; i++)
+  //   fprintf(stderr, "%u %u\n", events[i].tstate, events[i].level);
 }
 
 // -----------------------------------------------------------------------------
@@ -97,6 +101,10 @@ int main(void)
     &sleep_handler,
     &key_handler,
     &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
     &speaker_handler
   };
   zxspectrum_t *zx;
@@ -0,0 +1,297 @@
+/* replay.c
+ *
+ * Input log replay driver for The Great Escape.
+ *
+ * This replays a recorded input log through a headless game as fast as
+ * possible, checking the game state hashes stored in the log to detect
+ * desyncs. It can also record a log of a synthetic session, driven by
+ * pseudo-random joystick input, to produce reproducible workloads.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/InputLog.h"
+#include "ZXSpectrum/Keyboard.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+// -----------------------------------------------------------------------------
+
+// Configuration
+//
+#define GAMEWIDTH       256
+#define GAMEHEIGHT      192
+
+#define DEFAULT_FRAMES  10000
+#define DEFAULT_HASH    100
+
+// Number of frames between changes of joystick input when recording.
+#define INPUT_PERIOD    16
+
+// -----------------------------------------------------------------------------
+
+typedef struct replay
+{
+  zxinputlog_t *log;
+  tgestate_t   *game;
+  int           recording;      // bool
+  int           keystroke_time;
+  unsigned int  seed;
+  int           input;          // current Kempston input when recording
+}
+replay_t;
+
+// -----------------------------------------------------------------------------
+
+static void draw_handler(const zxbox_t *dirty,
+                         void          *opaque)
+{
+}
+
+static void stamp_handler(void *opaque)
+{
+}
+
+static int sleep_handler(int durationTStates, void *opaque)
+{
+  // return immediately: run the game as fast as possible
+  return 0;
+}
+
+// Generate the live input for a synthetic recording.
+static int synthetic_key(replay_t *replay, uint16_t port)
+{
+  if (port == port_KEMPSTON_JOYSTICK)
+    return replay->input; // active high
+
+  replay->keystroke_time++;
+
+  // first send a '2' to select Kempston joystick mode
+  if (replay->keystroke_time < 3 && port == port_KEYBOARD_12345)
+    return 0x1F ^ 2;
+
+  // then send a '0' to start the game
+  if (replay->keystroke_time < 6 && port == port_KEYBOARD_09876)
+    return 0x1F ^ 1;
+
+  return 0x1F;
+}
+
+static int key_handler(uint16_t port, void *opaque)
+{
+  replay_t *replay = opaque;
+  int       live;
+
+  // when replaying the live value is ignored
+  live = replay->recording ? synthetic_key(replay, port) : 0x1F;
+
+  return zxinputlog_key(replay->log, port, live);
+}
+
+static void border_handler(int colour, void *opaque)
+{
+}
+
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+static uint32_t hasher(void *opaque)
+{
+  replay_t *replay = opaque;
+
+  return tge_hash(replay->game);
+}
+
+// End a frame, varying the synthetic input every so often when recording.
+static zxinputlogresult_t end_frame(replay_t *replay)
+{
+  if (replay->recording &&
+      (zxinputlog_frames(replay->log) % INPUT_PERIOD) == 0)
+  {
+    replay->seed  = replay->seed * 1103515245 + 12345;
+    replay->input = (replay->seed >> 16) & 0x1F;
+  }
+
+  return zxinputlog_end_frame(replay->log, hasher, replay);
+}
+
+// -----------------------------------------------------------------------------
+
+static long long get_us(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s <log>\n"
+          "       %s -r <log> [-f <frames>] [-s <seed>] [-h <hash interval>]\n",
+          argv0, argv0);
+}
+
+int main(int argc, char *argv[])
+{
+  zxconfig_t         zxconfig =
+  {
+    GAMEWIDTH / 8, GAMEHEIGHT / 8,
+    NULL, /* opaque */
+    &draw_handler,
+    &stamp_handler,
+    &sleep_handler,
+    &key_handler,
+    &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
+    &speaker_handler
+  };
+  replay_t           replay = { NULL };
+  const char        *filename;
+  int                frames = DEFAULT_FRAMES;
+  int                hash_interval = DEFAULT_HASH;
+  int                opt;
+  zxspectrum_t      *zx;
+  zxinputlogresult_t result;
+  long long          start, end;
+  unsigned long      done;
+
+  replay.seed = 1;
+
+  while ((opt = getopt(argc, argv, "rf:s:h:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      replay.recording = 1;
+      break;
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 's':
+      replay.seed = (unsigned int) atoi(optarg);
+      break;
+    case 'h':
+      hash_interval = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1 || frames < 1 || hash_interval < 0)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  filename = argv[optind];
+
+  printf("THE GREAT ESCAPE\n");
+  printf("================\n");
+
+  if (replay.recording)
+    replay.log = zxinputlog_record(filename, hash_interval);
+  else
+    replay.log = zxinputlog_replay(filename);
+  if (replay.log == NULL)
+  {
+    fprintf(stderr, "Error: Couldn't open '%s'\n", filename);
+    goto failure;
+  }
+
+  zxconfig.opaque = &replay;
+
+  zx = zxspectrum_create(&zxconfig);
+  if (zx == NULL)
+    goto failure;
+
+  replay.game = tge_create(zx);
+  if (replay.game == NULL)
+    goto failure;
+
+  printf("%s '%s'...\n", replay.recording ? "Recording" : "Replaying", filename);
+
+  start = get_us();
+
+  tge_setup(replay.game);
+
+  result = zxinputlog_OK;
+  for (;;)
+  {
+    int done_menu = tge_menu(replay.game) > 0;
+
+    result = end_frame(&replay);
+    if (result != zxinputlog_OK || done_menu)
+      break;
+  }
+
+  if (result == zxinputlog_OK)
+  {
+    tge_setup2(replay.game);
+
+    do
+    {
+      tge_main(replay.game);
+      result = end_frame(&replay);
+    }
+    while (result == zxinputlog_OK &&
+           !(replay.recording && zxinputlog_frames(replay.log) >= (unsigned long) frames));
+  }
+
+  end = get_us();
+
+  done = zxinputlog_frames(replay.log);
+
+  if (zxinputlog_close(replay.log) != zxinputlog_OK)
+    result = zxinputlog_ERROR;
+
+  printf("%lu frames in %.2fms = %.2f frames/sec\n",
+         done,
+         (end - start) / 1000.0,
+         end > start ? done / ((end - start) / 1e6) : 0.0);
+
+  tge_destroy(replay.game);
+  zxspectrum_destroy(zx);
+
+  switch (result)
+  {
+  case zxinputlog_OK:
+  case zxinputlog_END:
+    break;
+
+  case zxinputlog_DESYNC:
+    fprintf(stderr, "Error: Desync detected after frame %lu\n", done);
+    goto failure;
+
+  default:
+    fprintf(stderr, "Error: Input log '%s' is unreadable\n", filename);
+    goto failure;
+  }
+
+  printf("(quit)\n");
+
+  exit(EXIT_SUCCESS);
+
+
+failure:
+
+  exit(EXIT_FAILURE);
+}
+
+// vim: ts=8 sts=2 sw=2 et
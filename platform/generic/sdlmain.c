@@ -2,12 +2,19 @@
  *
  * SDL front-end for The Great Escape.
  *
+ * The game runs on its own thread, paced by the durations it passes to the
+ * sleep handler. The main thread handles events and presents frames as they
+ * arrive, uploading only the areas which changed. Emscripten has no threads
+ * so there the browser calls a main loop which runs the game and presents
+ * in turn.
+ *
  * (c) David Thomas, 2017-2019.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
 
@@ -16,6 +23,8 @@
 #endif
 
 #include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/Beeper.h"
+#include "ZXSpectrum/InputLog.h"
 #include "ZXSpectrum/Keyboard.h"
 #include "ZXSpectrum/Kempston.h"
 
@@ -25,13 +34,41 @@
 
 // Configuration
 //
-#define FPS           10
+#define FPS           10    // Emscripten main loop rate
 #define GAMEWIDTH     256
 #define GAMEHEIGHT    192
 #define BORDER        32
 #define WINDOWWIDTH   (GAMEWIDTH  + 2 * BORDER)
 #define WINDOWHEIGHT  (GAMEHEIGHT + 2 * BORDER)
 
+// Number of frames between state hashes when recording input.
+#define RECORD_HASH_INTERVAL 100
+
+// A Spectrum 48K's Z80 runs at 3.5MHz.
+#define TSTATES_PER_SEC 3500000
+
+// If the game falls further behind than this (in ms) then give up on
+// catching up, rather than running flat out until it has.
+#define MAX_LAG         250
+
+// Max depth of the timestamps stack.
+#define MAXSTAMPS       4
+
+// Frame rate to present at when vsync is unavailable.
+#define NOVSYNC_FPS     60
+
+// Interval between stats overlay updates, in ms.
+#define STATS_INTERVAL  1000
+
+// Audio sample rate.
+#define AUDIO_RATE      44100
+
+// The game delivers a frame's worth of audio at a time, so keep this much
+// (in ms) queued to play while the next frame is computed. If more than
+// AUDIO_MAX_QUEUED builds up then discard it to bound the latency.
+#define AUDIO_LEAD      120
+#define AUDIO_MAX_QUEUED 400
+
 // -----------------------------------------------------------------------------
 
 typedef struct
@@ -39,67 +76,179 @@ typedef struct
   zxspectrum_t *zx;
   tgestate_t   *game;
 
+  SDL_mutex    *input_lock; // guards keys and kempston
   zxkeyset_t    keys;
   zxkempston_t  kempston;
 
   int           paused; // bool
 
-  int           quit; // bool
+  SDL_atomic_t  quit; // bool
 
   SDL_Renderer *renderer;
   SDL_Texture  *texture;
-  int           menu; // bool
+  int           vsync; // bool
+  SDL_atomic_t  fresh; // bool: the game has drawn since the last upload
 
-  int           sleep_us; // us to sleep for on the next loop
+  /* Game thread */
+  SDL_Thread   *thread;
+  int           menu; // bool
+  Uint64        stamps[MAXSTAMPS];
+  int           nstamps;
+  Uint64        deadline; // when the current slice should end
+
+  zxinputlog_t *record; // input log, or NULL if not recording
+
+  /* Audio, synthesised on the game thread */
+  SDL_AudioDeviceID audio; // or zero if there's no sound
+  zxbeeper_t   *beeper;
+  int16_t      *samples;
+  int           maxduration; // longest sleep 'samples' has room for
+
+  /* Stats, accumulated since the last overlay update */
+  SDL_mutex    *stats_lock; // guards game_*
+  Uint64        game_ticks; // time spent running the game
+  int           game_slices;
+  Uint64        upload_ticks; // time spent converting and uploading
+  int           uploads;
+  Uint64        stats_start;
+  unsigned long stats_presented;
+  int           overlay; // bool
+  char          overlay_text[64];
 }
 state_t;
 
 // -----------------------------------------------------------------------------
 
+// Game thread callbacks
+
 static void draw_handler(const zxbox_t *dirty,
                          void          *opaque)
 {
-  state_t  *state = opaque;
-  uint32_t *pixels;
+  state_t *state = opaque;
 
-  pixels = zxspectrum_claim_screen(state->zx);
-  SDL_UpdateTexture(state->texture, NULL, pixels, GAMEWIDTH * 4);
-  zxspectrum_release_screen(state->zx);
+  // The frame is handed over without locking: just note that there's one.
+  SDL_AtomicSet(&state->fresh, 1);
 }
 
 static void stamp_handler(void *opaque)
 {
   state_t *state = opaque;
 
-  // TODO: Save timestamps.
+  // Stack timestamps as they arrive
+  if (state->nstamps >= MAXSTAMPS)
+    return;
+  state->stamps[state->nstamps++] = SDL_GetPerformanceCounter();
+}
+
+// Synthesise and queue the audio for the slice just run.
+static void queue_audio(state_t *state, int durationTStates)
+{
+  Uint32 queued;
+  int    n;
+
+  if (state->audio == 0)
+    return;
+
+  if (durationTStates > state->maxduration)
+  {
+    int16_t *samples;
+
+    samples = realloc(state->samples,
+                      zxbeeper_max_samples(state->beeper, durationTStates) *
+                      sizeof(*samples));
+    if (samples == NULL)
+      return;
+    state->samples     = samples;
+    state->maxduration = durationTStates;
+  }
+
+  n = zxbeeper_render(state->beeper, durationTStates, state->samples);
+
+  queued = SDL_GetQueuedAudioSize(state->audio);
+  if (queued > AUDIO_MAX_QUEUED * AUDIO_RATE / 1000 * sizeof(int16_t))
+  {
+    SDL_ClearQueuedAudio(state->audio);
+    queued = 0;
+  }
+  if (queued == 0)
+  {
+    // Starting, or we've underrun: lead in with silence
+    static const int16_t silence[AUDIO_LEAD * AUDIO_RATE / 1000];
+
+    SDL_QueueAudio(state->audio, silence, sizeof(silence));
+  }
+  SDL_QueueAudio(state->audio, state->samples, n * sizeof(*state->samples));
 }
 
 static int sleep_handler(int durationTStates, void *opaque)
 {
   state_t *state = opaque;
+  Uint64   now;
+#ifndef __EMSCRIPTEN__
+  Uint64   freq;
+#endif
+
+  queue_audio(state, durationTStates);
 
-  // TODO: Sleep.
-  //
-  //usleep(durationTStates * 1000000 / 3500000);
-  //emscripten_sleep(durationTStates * 1000000 / 3500000);
-  //
-  // Note that we can't sleep here: in this single-threaded model it would
-  // stall the UI.  Instead we could store the timing details here and apply
-  // them in the main_loop. Though that would still create lumpy effects due
-  // to the way the game does not currently yield to its caller during
-  // periods when it wants to sleep.
+  now = SDL_GetPerformanceCounter();
 
+  // Unstack the timestamp to find how long the game took
+  if (state->nstamps > 0)
+  {
+    state->nstamps--;
+    SDL_LockMutex(state->stats_lock);
+    state->game_ticks += now - state->stamps[state->nstamps];
+    state->game_slices++;
+    SDL_UnlockMutex(state->stats_lock);
+  }
+
+#ifdef __EMSCRIPTEN__
+  // We can't sleep here without stalling the browser. It calls main_loop at
+  // FPS instead.
   return 0;
+#else
+  freq = SDL_GetPerformanceFrequency();
+
+  // Each slice should end 'durationTStates' after the previous one was due
+  // to end. Advancing a deadline, rather than sleeping for whatever remains
+  // of each duration, stops timer granularity and oversleeping accumulating
+  // into drift: a late slice is followed by a short one.
+  state->deadline += (Uint64) durationTStates * freq / TSTATES_PER_SEC;
+
+  if (state->deadline + MAX_LAG * freq / 1000 < now)
+  {
+    // Too far behind (or the first slice): start afresh from now
+    state->deadline = now;
+  }
+  else if (state->deadline > now)
+  {
+    Uint32 ms;
+
+    ms = (Uint32) ((state->deadline - now) * 1000 / freq);
+    if (ms > 0)
+      SDL_Delay(ms);
+  }
+
+  return SDL_AtomicGet(&state->quit);
+#endif
 }
 
 static int key_handler(uint16_t port, void *opaque)
 {
   state_t *state = opaque;
+  int      value;
 
+  SDL_LockMutex(state->input_lock);
   if (port == port_KEMPSTON_JOYSTICK)
-    return state->kempston;
+    value = state->kempston;
   else
-    return zxkeyset_for_port(port, &state->keys);
+    value = zxkeyset_for_port(port, &state->keys);
+  SDL_UnlockMutex(state->input_lock);
+
+  if (state->record)
+    value = zxinputlog_key(state->record, port, value);
+
+  return value;
 }
 
 static void border_handler(int colour, void *opaque)
@@ -109,11 +258,14 @@ static void border_handler(int colour, void *opaque)
   // TODO: Set border colour.
 }
 
-static void speaker_handler(int on_off, void *opaque)
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
 {
   state_t *state = opaque;
 
-  // TODO: All sound.
+  if (state->audio)
+    zxbeeper_add(state->beeper, events, nevents);
 }
 
 // -----------------------------------------------------------------------------
@@ -208,6 +360,14 @@ static void sdl_key_pressed(state_t *state, const SDL_KeyboardEvent *k)
 
   down = (k->type == SDL_KEYDOWN);
 
+  if (sym == SDLK_F1)
+  {
+    if (down && !k->repeat)
+      state->overlay = !state->overlay;
+    return;
+  }
+
+  SDL_LockMutex(state->input_lock);
   if (j != zxjoystick_UNKNOWN)
   {
     zxkempston_assign(&state->kempston, j, down);
@@ -222,87 +382,305 @@ static void sdl_key_pressed(state_t *state, const SDL_KeyboardEvent *k)
     else
       zxkeyset_clearchar(keys, k->keysym.sym);
   }
+  SDL_UnlockMutex(state->input_lock);
 }
 
-// type: em_arg_callback_func
-static void main_loop(void *opaque)
+static uint32_t record_hasher(void *opaque)
 {
-  static const SDL_Rect dstrect = { BORDER, BORDER, GAMEWIDTH, GAMEHEIGHT };
+  state_t *state = opaque;
+
+  return tge_hash(state->game);
+}
+
+// Run one slice of the game.
+static void game_slice(state_t *state)
+{
+  if (state->menu)
+  {
+    if (tge_menu(state->game) > 0)
+    {
+      tge_setup2(state->game);
+      state->menu = 0;
+    }
+  }
+  else
+  {
+    tge_main(state->game);
+  }
 
+  if (state->record &&
+      zxinputlog_end_frame(state->record, record_hasher, state) != zxinputlog_OK)
+  {
+    fprintf(stderr, "Error: Input recording failed\n");
+    zxinputlog_close(state->record);
+    state->record = NULL;
+  }
+}
+
+#ifndef __EMSCRIPTEN__
+// type: SDL_ThreadFunction
+static int game_thread(void *opaque)
+{
   state_t *state = opaque;
 
+  while (!SDL_AtomicGet(&state->quit))
+    game_slice(state);
+
+  return 0;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+// Stats overlay
+
+// A 3x5 pixel font. Each octal digit is a row of a glyph with the leftmost
+// pixel in its top bit.
+static const struct
+{
+  char     c;
+  unsigned int rows;
+}
+font[] =
+{
+  { '0', 075557 }, { '1', 026227 }, { '2', 071747 }, { '3', 071717 },
+  { '4', 055711 }, { '5', 074717 }, { '6', 074757 }, { '7', 071111 },
+  { '8', 075757 }, { '9', 075717 }, { '.', 000002 }, { 'A', 025755 },
+  { 'D', 065556 }, { 'E', 074647 }, { 'F', 074644 }, { 'G', 074557 },
+  { 'L', 044447 }, { 'M', 057755 }, { 'O', 075557 }, { 'P', 075744 },
+  { 'S', 074717 }, { 'U', 055557 }
+};
+
+#define NGLYPHS     ((int) (sizeof(font) / sizeof(font[0])))
+#define FONTSCALE   2
+#define OVERLAYX    (BORDER / 2)
+#define OVERLAYY    ((BORDER - 5 * FONTSCALE) / 2)
+
+// Draw 'text' in the top border. Unknown characters are drawn as spaces.
+static void draw_text(SDL_Renderer *renderer, const char *text)
+{
+  SDL_Rect rects[64 * 15];
+  int      nrects;
+  int      x;
+  int      i;
+  int      bit;
+
+  nrects = 0;
+  for (x = OVERLAYX; *text && nrects + 15 <= 64 * 15; text++, x += 4 * FONTSCALE)
   {
-    SDL_Event event;
+    for (i = 0; i < NGLYPHS; i++)
+      if (font[i].c == *text)
+        break;
+    if (i == NGLYPHS)
+      continue;
 
-    // Consume all pending events
-    while (SDL_PollEvent(&event))
+    for (bit = 0; bit < 15; bit++)
     {
-      switch (event.type)
-      {
-        case SDL_QUIT:
-          state->quit = 1;
-          SDL_Log("Quitting after %i ticks", event.quit.timestamp);
-          break;
-
-        case SDL_WINDOWEVENT:
-          PrintEvent(&event);
-          break;
-
-        case SDL_KEYDOWN:
-        case SDL_KEYUP:
-          sdl_key_pressed(state, &event.key);
-          break;
-
-        case SDL_TEXTEDITING:
-        case SDL_TEXTINPUT:
-          break;
-
-        case SDL_MOUSEMOTION:
-        case SDL_MOUSEBUTTONDOWN:
-        case SDL_MOUSEBUTTONUP:
-        case SDL_MOUSEWHEEL:
-          break;
-
-        default:
-          printf("Unhandled event code {%d}\n", event.type);
-          break;
-      }
+      if ((font[i].rows & (1u << (14 - bit))) == 0)
+        continue;
+
+      rects[nrects].x = x + (bit % 3) * FONTSCALE;
+      rects[nrects].y = OVERLAYY + (bit / 3) * FONTSCALE;
+      rects[nrects].w = FONTSCALE;
+      rects[nrects].h = FONTSCALE;
+      nrects++;
     }
+  }
 
-    if (state->quit)
-      return;
+  SDL_SetRenderDrawColor(renderer, 0xCD, 0xCD, 0xCD, 0xFF);
+  SDL_RenderFillRects(renderer, rects, nrects);
+}
+
+// Turn the accumulated stats into overlay text every STATS_INTERVAL.
+static void update_stats(state_t *state)
+{
+  Uint64         now;
+  Uint64         freq;
+  double         elapsed; // seconds
+  zxframestats_t frames;
+  Uint64         game_ticks;
+  int            game_slices;
+
+  now  = SDL_GetPerformanceCounter();
+  freq = SDL_GetPerformanceFrequency();
+
+  elapsed = (double) (now - state->stats_start) / freq;
+  if (elapsed < STATS_INTERVAL / 1000.0)
+    return;
+
+  zxspectrum_get_frame_stats(state->zx, &frames);
+
+  SDL_LockMutex(state->stats_lock);
+  game_ticks  = state->game_ticks;
+  game_slices = state->game_slices;
+  state->game_ticks  = 0;
+  state->game_slices = 0;
+  SDL_UnlockMutex(state->stats_lock);
+
+  sprintf(state->overlay_text,
+          "GAME %.2fMS  UPLOAD %.2fMS  FPS %.1f",
+          game_slices ? game_ticks * 1000.0 / freq / game_slices : 0.0,
+          state->uploads ? state->upload_ticks * 1000.0 / freq / state->uploads : 0.0,
+          (frames.presented - state->stats_presented) / elapsed);
+
+  state->upload_ticks    = 0;
+  state->uploads         = 0;
+  state->stats_start     = now;
+  state->stats_presented = frames.presented;
+}
+
+// -----------------------------------------------------------------------------
+
+// Upload the newest frame, if there is one, then render.
+static void present(state_t *state)
+{
+  static const SDL_Rect dstrect = { BORDER, BORDER, GAMEWIDTH, GAMEHEIGHT };
 
-    if (state->menu)
+  if (SDL_AtomicSet(&state->fresh, 0))
+  {
+    Uint64              start;
+    const uint16_t     *pixels;
+    const zxdirtymap_t *map;
+    int                 cursor;
+    zxbox_t             box;
+
+    start = SDL_GetPerformanceCounter();
+
+    pixels = (const uint16_t *) zxspectrum_claim_screen(state->zx);
+
+    // Upload only the regions which changed
+    map    = zxspectrum_get_dirty_map(state->zx);
+    cursor = 0;
+    while (zxdirtymap_next_box(map, &cursor, &box))
     {
-      if (tge_menu(state->game) > 0)
-      {
-        tge_setup2(state->game);
-        state->menu = 0;
-      }
+      SDL_Rect rect;
+
+      rect.x = box.x0;
+      rect.y = GAMEHEIGHT - box.y1;
+      rect.w = box.x1 - box.x0;
+      rect.h = box.y1 - box.y0;
+      SDL_UpdateTexture(state->texture,
+                        &rect,
+                        pixels + rect.y * GAMEWIDTH + rect.x,
+                        GAMEWIDTH * 2);
     }
-    else
+
+    zxspectrum_release_screen(state->zx);
+
+    state->upload_ticks += SDL_GetPerformanceCounter() - start;
+    state->uploads++;
+  }
+
+  update_stats(state);
+
+  /* Clear screen */
+  // TODO: This ought to be the border colour, but TGE's is always black.
+  SDL_SetRenderDrawColor(state->renderer, 0x00, 0x00, 0x00, 0xFF);
+  SDL_RenderClear(state->renderer);
+
+  /* Offset the image */
+  // Note that this will inhibit image stretching.
+
+  SDL_RenderCopy(state->renderer, state->texture, NULL, &dstrect);
+
+  if (state->overlay)
+    draw_text(state->renderer, state->overlay_text);
+
+  SDL_RenderPresent(state->renderer);
+
+#ifndef __EMSCRIPTEN__
+  // Without vsync RenderPresent returns at once. Under Emscripten the
+  // browser calls main_loop at FPS instead and sleeping here would stall it.
+  if (!state->vsync)
+    SDL_Delay(1000 / NOVSYNC_FPS);
+#endif
+}
+
+// type: em_arg_callback_func
+static void main_loop(void *opaque)
+{
+  state_t  *state = opaque;
+  SDL_Event event;
+
+  // Consume all pending events
+  while (SDL_PollEvent(&event))
+  {
+    switch (event.type)
     {
-      tge_main(state->game);
+      case SDL_QUIT:
+        SDL_AtomicSet(&state->quit, 1);
+        SDL_Log("Quitting after %i ticks", event.quit.timestamp);
+        break;
+
+      case SDL_WINDOWEVENT:
+        PrintEvent(&event);
+        break;
+
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+        sdl_key_pressed(state, &event.key);
+        break;
+
+      case SDL_TEXTEDITING:
+      case SDL_TEXTINPUT:
+        break;
+
+      case SDL_MOUSEMOTION:
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP:
+      case SDL_MOUSEWHEEL:
+        break;
+
+      default:
+        printf("Unhandled event code {%d}\n", event.type);
+        break;
     }
+  }
 
-    /* Update the texture and render it */
+  if (SDL_AtomicGet(&state->quit))
+    return;
 
-    /* Clear screen */
-    // TODO: This ought to be the border colour, but TGE's is always black.
-    SDL_SetRenderDrawColor(state->renderer, 0x00, 0x00, 0x00, 0xFF);
-    SDL_RenderClear(state->renderer);
+#ifdef __EMSCRIPTEN__
+  game_slice(state);
+#endif
 
-    /* Offset the image */
-    // Note that this will inhibit image stretching.
+  present(state);
+}
 
-    SDL_RenderCopy(state->renderer, state->texture, NULL, &dstrect);
-    SDL_RenderPresent(state->renderer);
+// Open the audio device. The game runs silently if there isn't one.
+static void open_audio(state_t *state)
+{
+  SDL_AudioSpec want;
 
-    SDL_Delay(1000 / FPS);
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+  {
+    fprintf(stderr, "Warning: No sound: %s\n", SDL_GetError());
+    return;
   }
+
+  SDL_zero(want);
+  want.freq     = AUDIO_RATE;
+  want.format   = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples  = 1024;
+  want.callback = NULL; // we queue audio instead
+
+  state->beeper = zxbeeper_create(AUDIO_RATE);
+  if (state->beeper == NULL)
+    return;
+
+  // SDL converts to whatever the device wants
+  state->audio = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+  if (state->audio == 0)
+  {
+    fprintf(stderr, "Warning: No sound: %s\n", SDL_GetError());
+    return;
+  }
+
+  SDL_PauseAudioDevice(state->audio, 0);
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
   state_t         state;
   zxconfig_t      zxconfig =
@@ -314,9 +692,29 @@ int main(void)
     &sleep_handler,
     &key_handler,
     &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_RGB565, // half the upload of 32bpp
+    0, /* stride */
+    NULL, /* palette */
     &speaker_handler
   };
   SDL_Window     *window;
+  SDL_RendererInfo info;
+  const char     *record_filename = NULL;
+  int             opt;
+
+  while ((opt = getopt(argc, argv, "r:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      record_filename = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-r <input log>]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
 
   printf("THE GREAT ESCAPE\n");
   printf("================\n");
@@ -326,8 +724,37 @@ int main(void)
   zxkeyset_clear(&state.keys);
   state.kempston  = 0;
   state.paused    = 0;
-  state.quit      = 0;
+  SDL_AtomicSet(&state.quit, 0);
+  SDL_AtomicSet(&state.fresh, 0);
+  state.thread    = NULL;
   state.menu      = 1;
+  state.nstamps   = 0;
+  state.deadline  = 0;
+  state.record    = NULL;
+
+  state.audio       = 0;
+  state.beeper      = NULL;
+  state.samples     = NULL;
+  state.maxduration = 0;
+
+  state.game_ticks      = 0;
+  state.game_slices     = 0;
+  state.upload_ticks    = 0;
+  state.uploads         = 0;
+  state.stats_start     = 0;
+  state.stats_presented = 0;
+  state.overlay         = 0; // F1 toggles it
+  state.overlay_text[0] = '\0';
+
+  if (record_filename)
+  {
+    state.record = zxinputlog_record(record_filename, RECORD_HASH_INTERVAL);
+    if (state.record == NULL)
+    {
+      fprintf(stderr, "Error: Couldn't create '%s'\n", record_filename);
+      goto failure;
+    }
+  }
 
   state.zx = zxspectrum_create(&zxconfig);
   if (state.zx == NULL)
@@ -339,6 +766,16 @@ int main(void)
     goto failure;
   }
 
+  open_audio(&state);
+
+  state.input_lock = SDL_CreateMutex();
+  state.stats_lock = SDL_CreateMutex();
+  if (state.input_lock == NULL || state.stats_lock == NULL)
+  {
+    fprintf(stderr, "Error: SDL_CreateMutex: %s\n", SDL_GetError());
+    goto failure;
+  }
+
   window = SDL_CreateWindow("The Great Escape",
                             SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                             WINDOWWIDTH, WINDOWHEIGHT,
@@ -358,10 +795,13 @@ int main(void)
     goto failure;
   }
 
+  state.vsync = SDL_GetRendererInfo(state.renderer, &info) == 0 &&
+                (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+
   // native_format = SDL_GetWindowPixelFormat(window);
 
   state.texture = SDL_CreateTexture(state.renderer,
-                                    SDL_PIXELFORMAT_ARGB8888, // fastest?
+                                    SDL_PIXELFORMAT_RGB565,
                                     SDL_TEXTUREACCESS_STREAMING,
                                     GAMEWIDTH, GAMEHEIGHT);
   if (state.texture == NULL)
@@ -382,13 +822,27 @@ int main(void)
 
   tge_setup(state.game);
 
+  state.stats_start = SDL_GetPerformanceCounter();
+
 #ifdef __EMSCRIPTEN__
   emscripten_set_main_loop_arg(main_loop, &state, FPS, 1 /* infinite loop */);
 #else
-  while (!state.quit)
+  state.thread = SDL_CreateThread(game_thread, "game", &state);
+  if (state.thread == NULL)
+  {
+    fprintf(stderr, "Error: SDL_CreateThread: %s\n", SDL_GetError());
+    goto failure;
+  }
+
+  while (!SDL_AtomicGet(&state.quit))
     main_loop(&state);
+
+  SDL_WaitThread(state.thread, NULL);
 #endif
 
+  if (zxinputlog_close(state.record) != zxinputlog_OK)
+    fprintf(stderr, "Error: Input recording failed\n");
+
   tge_destroy(state.game);
   zxspectrum_destroy(state.zx);
 
@@ -396,6 +850,14 @@ int main(void)
   SDL_DestroyRenderer(state.renderer);
   SDL_DestroyWindow(window);
 
+  if (state.audio)
+    SDL_CloseAudioDevice(state.audio);
+  zxbeeper_destroy(state.beeper);
+  free(state.samples);
+
+  SDL_DestroyMutex(state.stats_lock);
+  SDL_DestroyMutex(state.input_lock);
+
   SDL_Quit();
 
   printf("(quit)\n");
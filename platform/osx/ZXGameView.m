@@ -107,6 +107,8 @@
     int           index;    // index into samples
     bitfifo_t    *fifo;
     int           lastvol;  // most recently output volume
+    uint32_t      speakertime;  // time of the last speaker event
+    unsigned int  speakerlevel; // level of the last speaker event
     AudioComponentInstance instance;
   }
   audio;
@@ -154,6 +156,10 @@
     &sleep_handler,
     &key_handler,
     &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
     &speaker_handler
   };
 
@@ -902,15 +908,44 @@ static void border_handler(int colour, void *opaque)
   });
 }
 
-static void speaker_handler(int on_off, void *opaque)
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
 {
-  ZXGameView  *view = (__bridge id) opaque;
-  unsigned int bit = on_off;
+  static const unsigned int levels[2][8] =
+  {
+    { 0 },
+    { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u }
+  };
+
+  ZXGameView *view = (__bridge id) opaque;
+  int         i;
+  uint32_t    bits;
+  uint32_t    chunk;
 
   @synchronized(view)
   {
-    // There's nothing we can do if the buffer is full, so ignore errors
-    (void) bitfifo_enqueue(view->audio.fifo, &bit, 0, 1);
+    // Hold each level up until the following event
+    for (i = 0; i < nevents; i++)
+    {
+      bits = events[i].tstate        / ZXSPEAKER_TSTATES_PER_BIT -
+             view->audio.speakertime / ZXSPEAKER_TSTATES_PER_BIT;
+      if (bits > ZXSPEAKER_MAX_HOLD)
+        bits = ZXSPEAKER_MAX_HOLD;
+      // There's nothing we can do if the buffer is full, so ignore errors
+      while (bits)
+      {
+        chunk = MIN(bits, sizeof(levels[0]) * 8);
+        (void) bitfifo_enqueue(view->audio.fifo,
+                               levels[view->audio.speakerlevel],
+                               0,
+                               chunk);
+        bits -= chunk;
+      }
+
+      view->audio.speakertime  = events[i].tstate;
+      view->audio.speakerlevel = events[i].level;
+    }
   }
 }
 
@@ -1067,11 +1102,13 @@ static OSStatus playbackCallback(void                       *inRefCon,
     goto failure;
 
   // Setup audio
-  audio.enabled  = YES;
-  audio.index    = 0;
-  audio.fifo     = NULL;
-  audio.lastvol  = 0;
-  audio.instance = instance;
+  audio.enabled      = YES;
+  audio.index        = 0;
+  audio.fifo         = NULL;
+  audio.lastvol      = 0;
+  audio.speakertime  = 0;
+  audio.speakerlevel = 0;
+  audio.instance     = instance;
 
   // Create a bit fifo
   audio.fifo = bitfifo_create(BITFIFO_LENGTH);
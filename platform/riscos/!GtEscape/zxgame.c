@@ -183,6 +183,8 @@ struct zxgame
     bitfifo_t          *fifo;
     ssndbuf_t           stream;
     unsigned int       *data;
+    uint32_t            speakertime;  /* time of the last speaker event */
+    unsigned int        speakerlevel; /* level of the last speaker event */
   }
   audio;
 };
@@ -749,13 +751,23 @@ static void emit_sound(zxgame_t *zxgame)
 }
 
 /* Game callback. */
-static void speaker_handler(int on_off, void *opaque)
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
 {
   const unsigned int SOUNDFLAGS = zxgame_FLAG_HAVE_SOUND | zxgame_FLAG_SOUND_ON;
 
+  static const unsigned int levels[2][8] =
+  {
+    { 0 },
+    { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u }
+  };
+
   result_t      err;
   zxgame_t     *zxgame = opaque;
-  unsigned int  bits;
+  int           i;
+  uint32_t      bits;
+  uint32_t      chunk;
 
   if ((zxgame->flags & SOUNDFLAGS) != SOUNDFLAGS)
     return;
@@ -764,8 +776,26 @@ static void speaker_handler(int on_off, void *opaque)
   if (err)
     return;
 
-  bits = on_off;
-  (void) bitfifo_enqueue(zxgame->audio.fifo, &bits, 0, 1);
+  /* Hold each level up until the following event. */
+  for (i = 0; i < nevents; i++)
+  {
+    bits = events[i].tstate          / ZXSPEAKER_TSTATES_PER_BIT -
+           zxgame->audio.speakertime / ZXSPEAKER_TSTATES_PER_BIT;
+    if (bits > ZXSPEAKER_MAX_HOLD)
+      bits = ZXSPEAKER_MAX_HOLD;
+    while (bits)
+    {
+      chunk = MIN(bits, sizeof(levels[0]) * 8);
+      (void) bitfifo_enqueue(zxgame->audio.fifo,
+                             levels[zxgame->audio.speakerlevel],
+                             0,
+                             chunk);
+      bits -= chunk;
+    }
+
+    zxgame->audio.speakertime  = events[i].tstate;
+    zxgame->audio.speakerlevel = events[i].level;
+  }
 }
 
 /* ----------------------------------------------------------------------- */
@@ -1710,6 +1740,10 @@ result_t zxgame_create(zxgame_t **new_zxgame, const char *startup_game)
     &sleep_handler,
     &key_handler,
     &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
     &speaker_handler
   };
 
@@ -171,7 +171,9 @@ static void border_handler(int colour, void *opaque)
   // does nothing presently
 }
 
-static void speaker_handler(int on_off, void *opaque)
+static void speaker_handler(const zxspeakerevent_t *events,
+                            int                     nevents,
+                            void                   *opaque)
 {
   // does nothing presently
 }
@@ -221,7 +223,11 @@ static int CreateGame(gamewin_t *gamewin)
   zxconfig.sleep  = sleep_handler;
   zxconfig.key    = key_handler;
   zxconfig.border = border_handler;
-  zxconfig.speaker = speaker_handler;
+  zxconfig.speaker = NULL;
+  zxconfig.format  = zxscreen_format_NATIVE;
+  zxconfig.stride  = 0;
+  zxconfig.palette = NULL;
+  zxconfig.speaker_batch = speaker_handler;
 
   zx = zxspectrum_create(&zxconfig);
   if (zx == NULL)
@@ -0,0 +1,227 @@
+/* screen.c
+ *
+ * Tests of the screen conversion kernels.
+ *
+ * Every vector kernel must produce exactly what the scalar kernel produces,
+ * in every output format, without writing outside the rows it's asked to
+ * convert.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ZXSpectrum/Spectrum.h"
+#include "ZXSpectrum/Screen.h"
+
+#include "tests.h"
+
+// -----------------------------------------------------------------------------
+
+#define TRIALS 300
+
+// Bytes around each output buffer to catch stray writes.
+#define GUARD  64
+
+// -----------------------------------------------------------------------------
+
+static const struct
+{
+  zxscreen_format_t format;
+  const char       *name;
+}
+formats[] =
+{
+  { zxscreen_format_ARGB8888, "ARGB8888" },
+  { zxscreen_format_ABGR8888, "ABGR8888" },
+  { zxscreen_format_RGB565,   "RGB565"   },
+  { zxscreen_format_INDEXED8, "INDEXED8" },
+  { zxscreen_format_PACKED4,  "PACKED4"  },
+};
+
+static const struct
+{
+  zxscreen_kernel_t kernel;
+  const char       *name;
+}
+kernels[] =
+{
+  { zxscreen_kernel_SSE2, "SSE2" },
+  { zxscreen_kernel_AVX2, "AVX2" },
+  { zxscreen_kernel_NEON, "NEON" },
+};
+
+#define NFORMATS ((int) (sizeof(formats) / sizeof(formats[0])))
+#define NKERNELS ((int) (sizeof(kernels) / sizeof(kernels[0])))
+
+// -----------------------------------------------------------------------------
+
+// Return a random coordinate in the range [lo,hi].
+static int random_between(int lo, int hi)
+{
+  return lo + (int) (test_random() % (unsigned int) (hi - lo + 1));
+}
+
+// Make a dirty box: on screen, empty, partly or wholly off screen, or the
+// whole screen.
+static void random_box(zxbox_t *box)
+{
+  switch (test_random() % 5)
+  {
+  case 0:
+    box->x0 = random_between(0, SCREEN_WIDTH);
+    box->x1 = random_between(box->x0, SCREEN_WIDTH);
+    box->y0 = random_between(0, SCREEN_HEIGHT);
+    box->y1 = random_between(box->y0, SCREEN_HEIGHT);
+    break;
+
+  case 1:
+    box->x0 = random_between(0, SCREEN_WIDTH);
+    box->y0 = random_between(0, SCREEN_HEIGHT);
+    if (test_random() & 1)
+    {
+      box->x1 = box->x0;
+      box->y1 = random_between(box->y0, SCREEN_HEIGHT);
+    }
+    else
+    {
+      box->x1 = random_between(box->x0, SCREEN_WIDTH);
+      box->y1 = box->y0;
+    }
+    break;
+
+  case 2:
+    box->x0 = random_between(-2 * SCREEN_WIDTH, 2 * SCREEN_WIDTH);
+    box->x1 = random_between(box->x0, 3 * SCREEN_WIDTH);
+    box->y0 = random_between(-2 * SCREEN_HEIGHT, 2 * SCREEN_HEIGHT);
+    box->y1 = random_between(box->y0, 3 * SCREEN_HEIGHT);
+    break;
+
+  case 3:
+    box->x0 = random_between(-2 * SCREEN_WIDTH, -1);
+    box->x1 = random_between(box->x0, -1);
+    box->y0 = random_between(SCREEN_HEIGHT, 2 * SCREEN_HEIGHT);
+    box->y1 = random_between(box->y0, 3 * SCREEN_HEIGHT);
+    break;
+
+  default:
+    box->x0 = 0;
+    box->y0 = 0;
+    box->x1 = SCREEN_WIDTH;
+    box->y1 = SCREEN_HEIGHT;
+    break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+int test_screen_kernels(void)
+{
+  unsigned int          screen[SCREEN_LENGTH / sizeof(unsigned int)];
+  uint32_t              palette[16];
+  zxbox_t               box;
+  int                   trial;
+  int                   f, k;
+  int                   stride;
+  size_t                size;
+  unsigned char        *background = NULL;
+  unsigned char        *expected   = NULL;
+  unsigned char        *actual     = NULL;
+  zxscreen_converter_t *converter;
+  int                   tested[NKERNELS] = { 0 };
+  int                   failures = 0;
+
+  // Room for the widest format with the widest padding used below.
+  size = GUARD + (zxscreen_format_stride(zxscreen_format_ARGB8888) + 12) *
+                 SCREEN_HEIGHT + GUARD;
+  background = malloc(size);
+  expected   = malloc(size);
+  actual     = malloc(size);
+  if (background == NULL || expected == NULL || actual == NULL)
+  {
+    fprintf(stderr, "Error: Out of memory\n");
+    failures++;
+    goto exit;
+  }
+
+  for (trial = 0; trial < TRIALS && failures == 0; trial++)
+  {
+    test_random_fill(screen, sizeof(screen));
+    test_random_fill(palette, sizeof(palette));
+    random_box(&box);
+
+    for (f = 0; f < NFORMATS; f++)
+    {
+      // Alternate between the default palette and a random one.
+      converter = zxscreen_converter_create(formats[f].format,
+                                            (trial & 1) ? palette : NULL);
+      if (converter == NULL)
+      {
+        fprintf(stderr, "Error: Couldn't create a %s converter\n",
+                formats[f].name);
+        failures++;
+        break;
+      }
+
+      stride = zxscreen_format_stride(formats[f].format) +
+               (int) (test_random() % 4) * 4;
+
+      test_random_fill(background, size);
+
+      memcpy(expected, background, size);
+      zxscreen_set_kernel(zxscreen_kernel_SCALAR);
+      zxscreen_converter_convert(converter, screen, expected + GUARD, stride,
+                                 &box);
+
+      if (memcmp(expected, background, GUARD) != 0 ||
+          memcmp(expected + GUARD + stride * SCREEN_HEIGHT,
+                 background + GUARD + stride * SCREEN_HEIGHT, GUARD) != 0)
+      {
+        fprintf(stderr, "scalar %s: wrote outside the screen for box "
+                        "(%d,%d)-(%d,%d)\n",
+                formats[f].name, box.x0, box.y0, box.x1, box.y1);
+        failures++;
+      }
+
+      for (k = 0; k < NKERNELS; k++)
+      {
+        if (zxscreen_set_kernel(kernels[k].kernel))
+          continue; // not supported by this build or CPU
+
+        tested[k] = 1;
+
+        memcpy(actual, background, size);
+        zxscreen_converter_convert(converter, screen, actual + GUARD, stride,
+                                   &box);
+
+        if (memcmp(actual, expected, size) != 0)
+        {
+          fprintf(stderr, "%s %s: differs from scalar for box "
+                          "(%d,%d)-(%d,%d), stride %d, %s palette\n",
+                  kernels[k].name, formats[f].name,
+                  box.x0, box.y0, box.x1, box.y1, stride,
+                  (trial & 1) ? "random" : "default");
+          failures++;
+        }
+      }
+
+      zxscreen_converter_destroy(converter);
+    }
+  }
+
+  for (k = 0; k < NKERNELS; k++)
+    printf("  %s: %s\n", kernels[k].name, tested[k] ? "tested" : "not available");
+
+exit:
+  zxscreen_set_kernel(zxscreen_kernel_AUTO);
+
+  free(actual);
+  free(expected);
+  free(background);
+
+  return failures;
+}
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,264 @@
+/* sprites.c
+ *
+ * Tests of the sprite cache.
+ *
+ * Every sprite in sprites[] is plotted at each flip and shift, with random
+ * clipping, enables, foreground masks and window contents, both by the
+ * original shifting plotters and from the sprite cache. The window buffer,
+ * the plotters' pointers and the T-states charged must all match.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ZXSpectrum/Spectrum.h"
+
+#include "TheGreatEscape/TheGreatEscape.h"
+
+#include "TheGreatEscape/Main.h"
+#include "TheGreatEscape/SpriteCache.h"
+#include "TheGreatEscape/Sprites.h"
+#include "TheGreatEscape/State.h"
+
+#include "tests.h"
+
+// -----------------------------------------------------------------------------
+
+#ifdef TGE_SPRITE_CACHE
+
+// Trials of each sprite, flip and shift.
+#define TRIALS 20
+
+// Enable or disable a column of the sprite plotters. The enables are patched
+// opcodes: 119 (LD (HL),A) or zero (NOP).
+#define RANDOM_ENABLE(F) \
+  state->spriteplotter.F = (test_random() & 3) ? 119 : 0
+
+// -----------------------------------------------------------------------------
+
+static void draw_handler(const zxbox_t *dirty, void *opaque)
+{
+}
+
+static void stamp_handler(void *opaque)
+{
+}
+
+static int sleep_handler(int durationTStates, void *opaque)
+{
+  return 0;
+}
+
+static int key_handler(uint16_t port, void *opaque)
+{
+  return 0x1F; // no keys pressed
+}
+
+static void border_handler(int colour, void *opaque)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+// The plotter's outputs.
+typedef struct result
+{
+  uint8_t       *window_buf;
+  uint8_t       *window_buf_pointer;
+  const uint8_t *foreground_mask_pointer;
+  uint32_t       tstates;
+}
+result_t;
+
+// Plot a sprite using the given cache, or none, from the given starting
+// state.
+static void plot(tgestate_t          *state,
+                 vischar_t           *vischar,
+                 const spritecache_t *cache,
+                 const uint8_t       *window_buf,
+                 ptrdiff_t            window_offset,
+                 ptrdiff_t            mask_offset,
+                 const uint8_t       *bitmap,
+                 const uint8_t       *mask,
+                 result_t            *result)
+{
+  uint32_t tstates;
+
+  memcpy(state->window_buf, window_buf, state->window_buf_size);
+
+  state->window_buf_pointer      = state->window_buf + window_offset;
+  state->foreground_mask_pointer = state->mask_buffer + mask_offset;
+  state->bitmap_pointer          = bitmap;
+  state->mask_pointer            = mask;
+  state->spritecache             = cache;
+
+  tstates = state->tstates;
+  if (vischar->width_bytes == 4)
+    plot_masked_sprite_24px(state, vischar);
+  else
+    plot_masked_sprite_16px(state, vischar);
+
+  memcpy(result->window_buf, state->window_buf, state->window_buf_size);
+  result->window_buf_pointer      = state->window_buf_pointer;
+  result->foreground_mask_pointer = state->foreground_mask_pointer;
+  result->tstates                 = state->tstates - tstates;
+}
+
+int test_sprite_cache(void)
+{
+  static const zxconfig_t zxconfig =
+  {
+    SCREEN_WIDTH / 8, SCREEN_HEIGHT / 8,
+    NULL, /* opaque */
+    &draw_handler,
+    &stamp_handler,
+    &sleep_handler,
+    &key_handler,
+    &border_handler,
+    NULL, /* speaker */
+    zxscreen_format_NATIVE,
+    0, /* stride */
+    NULL, /* palette */
+    NULL /* speaker_batch */
+  };
+
+  zxspectrum_t        *zx       = NULL;
+  tgestate_t          *state    = NULL;
+  const spritecache_t *cache;
+  vischar_t           *vischar;
+  uint8_t             *initial  = NULL;
+  result_t             expected = { NULL };
+  result_t             actual   = { NULL };
+  const spritedef_t   *sprite;
+  int                  s, flip, shift, trial;
+  int                  skip, height;
+  ptrdiff_t            window_offset, mask_offset;
+  int                  cases    = 0;
+  int                  failures = 0;
+
+  zx = zxspectrum_create(&zxconfig);
+  if (zx == NULL)
+    goto oom;
+
+  state = tge_create(zx);
+  if (state == NULL)
+    goto oom;
+
+  cache = state->spritecache;
+  if (cache == NULL)
+    goto oom;
+
+  tge_setup(state);
+  tge_setup2(state); // builds state->reversed[]
+
+  initial             = malloc(state->window_buf_size);
+  expected.window_buf = malloc(state->window_buf_size);
+  actual.window_buf   = malloc(state->window_buf_size);
+  if (initial == NULL || expected.window_buf == NULL || actual.window_buf == NULL)
+    goto oom;
+
+  vischar = &state->vischars[1];
+  vischar->mi.sprite = &sprites[0];
+
+  for (s = 0; s < sprite__LIMIT; s++)
+    for (flip = 0; flip < 2; flip++)
+      for (shift = 0; shift < SPRITECACHE_SHIFTS; shift++)
+        for (trial = 0; trial < TRIALS; trial++)
+        {
+          sprite = &sprites[s];
+
+          // Clip rows from the top and bottom as setup_vischar_plotting()
+          // would.
+          skip   = (int) (test_random() % 4);
+          height = sprite->height - skip - (int) (test_random() % 3);
+          if (height < 1)
+            height = 1;
+
+          test_random_fill(initial, state->window_buf_size);
+          test_random_fill(state->mask_buffer, sizeof(state->mask_buffer));
+
+          vischar->mi.sprite_index = (uint8_t) (s | (flip ? sprite_FLAG_FLIP : 0));
+          vischar->isopos.x        = (uint16_t) (shift + 8 * (test_random() % 10));
+          vischar->width_bytes     = sprite->width;
+          state->sprite_index      = vischar->mi.sprite_index;
+
+          state->spriteplotter.height_24_right = (uint8_t) height;
+          state->spriteplotter.height_24_left  = (uint8_t) height;
+          state->spriteplotter.height_16_right = (uint8_t) height;
+          state->spriteplotter.height_16_left  = (uint8_t) height;
+
+          RANDOM_ENABLE(enable_24_right_1);
+          RANDOM_ENABLE(enable_24_right_2);
+          RANDOM_ENABLE(enable_24_right_3);
+          RANDOM_ENABLE(enable_24_right_4);
+          RANDOM_ENABLE(enable_24_left_1);
+          RANDOM_ENABLE(enable_24_left_2);
+          RANDOM_ENABLE(enable_24_left_3);
+          RANDOM_ENABLE(enable_24_left_4);
+          RANDOM_ENABLE(enable_16_left_1);
+          RANDOM_ENABLE(enable_16_left_2);
+          RANDOM_ENABLE(enable_16_left_3);
+          RANDOM_ENABLE(enable_16_right_1);
+          RANDOM_ENABLE(enable_16_right_2);
+          RANDOM_ENABLE(enable_16_right_3);
+
+          window_offset = 4 * (test_random() % 2) + 24 * (test_random() % 3) + 1;
+          mask_offset   = 4 * (test_random() % 3);
+
+          plot(state, vischar, NULL, initial, window_offset, mask_offset,
+               sprite->bitmap + skip * (sprite->width - 1),
+               sprite->mask   + skip * (sprite->width - 1),
+               &expected);
+          plot(state, vischar, cache, initial, window_offset, mask_offset,
+               sprite->bitmap + skip * (sprite->width - 1),
+               sprite->mask   + skip * (sprite->width - 1),
+               &actual);
+
+          cases++;
+
+          if (memcmp(expected.window_buf, actual.window_buf,
+                     state->window_buf_size) != 0 ||
+              expected.window_buf_pointer      != actual.window_buf_pointer      ||
+              expected.foreground_mask_pointer != actual.foreground_mask_pointer ||
+              expected.tstates                 != actual.tstates)
+          {
+            if (failures < 10)
+              fprintf(stderr, "sprite %d, flip %d, shift %d: cached plot "
+                              "differs\n", s, flip, shift);
+            failures++;
+          }
+        }
+
+  printf("  %d cases, cache of %lu bytes\n",
+         cases, (unsigned long) tge_spritecache_size());
+
+exit:
+  free(actual.window_buf);
+  free(expected.window_buf);
+  free(initial);
+  tge_destroy(state);
+  zxspectrum_destroy(zx);
+
+  return failures;
+
+
+oom:
+  fprintf(stderr, "Error: Out of memory\n");
+  failures++;
+  goto exit;
+}
+
+#else /* TGE_SPRITE_CACHE */
+
+int test_sprite_cache(void)
+{
+  printf("  not built with TGE_SPRITE_CACHE\n");
+  return 0;
+}
+
+#endif /* TGE_SPRITE_CACHE */
+
+// vim: ts=8 sts=2 sw=2 et
@@ -0,0 +1,95 @@
+/* tests.c
+ *
+ * Unit tests for The Great Escape.
+ *
+ * Run with no arguments to run every test, or name the tests to run. CTest
+ * runs each one separately.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+
+// -----------------------------------------------------------------------------
+
+static const struct
+{
+  const char *name;
+  test_t     *test;
+}
+tests[] =
+{
+  { "screen_kernels", test_screen_kernels },
+  { "window_rows",    test_window_rows    },
+  { "sprite_cache",   test_sprite_cache   },
+};
+
+#define NTESTS ((int) (sizeof(tests) / sizeof(tests[0])))
+
+// -----------------------------------------------------------------------------
+
+static unsigned int seed = 1;
+
+unsigned int test_random(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7FFF;
+}
+
+void test_random_fill(void *buf, size_t length)
+{
+  unsigned char *p = buf;
+
+  while (length--)
+    *p++ = (unsigned char) test_random();
+}
+
+// -----------------------------------------------------------------------------
+
+static int run(int i)
+{
+  int failures;
+
+  printf("%s...\n", tests[i].name);
+  seed = 1;
+  failures = tests[i].test();
+  printf("%s: %s\n", tests[i].name, failures ? "FAILED" : "passed");
+
+  return failures;
+}
+
+int main(int argc, char *argv[])
+{
+  int failures = 0;
+  int i, j;
+
+  if (argc == 1)
+  {
+    for (i = 0; i < NTESTS; i++)
+      failures += run(i);
+  }
+  else
+  {
+    for (j = 1; j < argc; j++)
+    {
+      for (i = 0; i < NTESTS; i++)
+        if (strcmp(argv[j], tests[i].name) == 0)
+          break;
+      if (i == NTESTS)
+      {
+        fprintf(stderr, "Error: No test named '%s'\n", argv[j]);
+        exit(EXIT_FAILURE);
+      }
+      failures += run(i);
+    }
+  }
+
+  exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// vim: ts=8 sts=2 sw=2 et
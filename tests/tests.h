@@ -0,0 +1,39 @@
+/* tests.h
+ *
+ * Unit tests for The Great Escape.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <stddef.h>
+
+// -----------------------------------------------------------------------------
+
+// A test returns the number of failures it found.
+typedef int (test_t)(void);
+
+// Return the next number from a deterministic pseudo-random sequence.
+unsigned int test_random(void);
+
+// Fill a buffer with bytes from test_random().
+void test_random_fill(void *buf, size_t length);
+
+// -----------------------------------------------------------------------------
+
+// Screen conversion kernels against the scalar kernel.
+int test_screen_kernels(void);
+
+// Game window row blits against byte at a time versions.
+int test_window_rows(void);
+
+// Sprite cache against the shifting sprite plotters.
+int test_sprite_cache(void);
+
+// -----------------------------------------------------------------------------
+
+#endif /* TESTS_H */
+
+// vim: ts=8 sts=2 sw=2 et
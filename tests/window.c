@@ -0,0 +1,99 @@
+/* window.c
+ *
+ * Tests of the game window row blits.
+ *
+ * plot_game_window_row() and plot_game_window_row_shifted() have SSE2 and
+ * NEON versions which handle a row as two overlapping vectors. They must
+ * produce exactly what the byte at a time versions do, and must leave the
+ * bytes either side of the 23-byte row alone.
+ *
+ * (c) David Thomas, 2017-2020.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "C99/Types.h"
+
+#include "TheGreatEscape/State.h"
+
+#include "TheGreatEscape/Screen.h"
+
+#include "tests.h"
+
+// -----------------------------------------------------------------------------
+
+#define TRIALS 100000
+
+// Width of a game window row in bytes.
+#define ROW    23
+
+// Bytes either side of the destination row to catch stray writes.
+#define GUARD  32
+
+// -----------------------------------------------------------------------------
+
+static void reference_row(uint8_t *dst, const uint8_t *src)
+{
+  memcpy(dst, src, ROW);
+}
+
+static void reference_row_shifted(uint8_t *dst, const uint8_t *src)
+{
+  int i;
+
+  for (i = 0; i < ROW; i++)
+    dst[i] = (uint8_t) ((src[i] << 4) | (src[i + 1] >> 4));
+}
+
+// -----------------------------------------------------------------------------
+
+int test_window_rows(void)
+{
+  // Sources and destinations are placed at random offsets to vary their
+  // alignment.
+  uint8_t src[ROW + 1 + 16];
+  uint8_t background[GUARD + ROW + GUARD + 16];
+  uint8_t expected[sizeof(background)];
+  uint8_t actual[sizeof(background)];
+  int     trial;
+  int     shifted;
+  int     s, d;
+  int     failures = 0;
+
+  for (trial = 0; trial < TRIALS && failures < 10; trial++)
+  {
+    test_random_fill(src, sizeof(src));
+    test_random_fill(background, sizeof(background));
+
+    s       = (int) (test_random() % 16);
+    d       = GUARD + (int) (test_random() % 16);
+    shifted = trial & 1;
+
+    memcpy(expected, background, sizeof(background));
+    memcpy(actual,   background, sizeof(background));
+
+    if (shifted)
+    {
+      reference_row_shifted(expected + d, src + s);
+      plot_game_window_row_shifted(actual + d, src + s);
+    }
+    else
+    {
+      reference_row(expected + d, src + s);
+      plot_game_window_row(actual + d, src + s);
+    }
+
+    if (memcmp(actual, expected, sizeof(actual)) != 0)
+    {
+      fprintf(stderr, "plot_game_window_row%s: differs from reference "
+                      "(source offset %d, destination offset %d)\n",
+              shifted ? "_shifted" : "", s, d - GUARD);
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+// vim: ts=8 sts=2 sw=2 et